@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+
+#include "arena.hpp"
+
+// First block of a new arena. The following ones double, so a frame needing a lot more settles in a few frames.
+const size_t ArenaFirstBlockSize = 64 * 1024;
+
+Arena::Arena() : current(0), offset(0), blockSize(ArenaFirstBlockSize), used(0), peak(0), heapAllocations(0) {}
+
+Arena::~Arena(){
+	freeArena(*this);
+}
+
+static void addArenaBlock(Arena & arena, size_t size){
+	while (arena.blockSize < size)
+		arena.blockSize *= 2;
+	ArenaBlock block;
+	block.memory = new unsigned char[arena.blockSize];
+	block.size = arena.blockSize;
+	arena.blockSize *= 2;
+	arena.heapAllocations++;
+	arena.blocks.push_back(block);
+	arena.current = arena.blocks.size() - 1;
+	arena.offset = 0;
+}
+
+void * arenaAllocate(Arena & arena, size_t size, size_t alignment){
+	while (true){
+		// The blocks after the current one were kept by a rewind : they are tried before adding one
+		for (; arena.current < arena.blocks.size(); arena.current++, arena.offset = 0){
+			const ArenaBlock & block = arena.blocks[arena.current];
+			uintptr_t base = (uintptr_t)block.memory;
+			size_t start = (size_t)(((base + arena.offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+			if (start + size <= block.size){
+				arena.used += start + size - arena.offset;
+				if (arena.used > arena.peak)
+					arena.peak = arena.used;
+				arena.offset = start + size;
+				return block.memory + start;
+			}
+		}
+		addArenaBlock(arena, size + alignment);
+	}
+}
+
+ArenaMarker arenaMark(const Arena & arena){
+	ArenaMarker marker;
+	marker.block = arena.current;
+	marker.offset = arena.offset;
+	marker.used = arena.used;
+	return marker;
+}
+
+void arenaRewind(Arena & arena, const ArenaMarker & marker){
+	arena.current = marker.block;
+	arena.offset = marker.offset;
+	arena.used = marker.used;
+}
+
+void resetArena(Arena & arena){
+	if (arena.blocks.size() > 1){
+		size_t capacity = arenaCapacity(arena);
+		freeArena(arena);
+		arena.blockSize = capacity;
+		addArenaBlock(arena, capacity);
+	}
+	arena.current = 0;
+	arena.offset = 0;
+	arena.used = 0;
+}
+
+void freeArena(Arena & arena){
+	for (size_t i = 0; i < arena.blocks.size(); i++)
+		delete[] arena.blocks[i].memory;
+	arena.blocks.clear();
+	arena.current = 0;
+	arena.offset = 0;
+	arena.used = 0;
+}
+
+size_t arenaCapacity(const Arena & arena){
+	size_t capacity = 0;
+	for (size_t i = 0; i < arena.blocks.size(); i++)
+		capacity += arena.blocks[i].size;
+	return capacity;
+}
+
+Arena & threadArena(){
+	static thread_local Arena arena;
+	return arena;
+}
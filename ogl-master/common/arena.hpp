@@ -0,0 +1,85 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+// Linear allocators for short-lived data : a frame, a job, a function call.
+// Allocating bumps an offset in a block, and freeing does nothing : the whole arena is rewound
+// at once, to a marker or to its start. The blocks are kept when rewound, so once an arena has
+// grown to its peak use it doesn't touch the heap anymore.
+// An arena is not thread safe : each thread uses its own, see threadArena().
+
+struct ArenaBlock {
+	unsigned char * memory;
+	size_t size;
+};
+
+struct Arena {
+	std::vector<ArenaBlock> blocks;
+	size_t current;      // block being filled
+	size_t offset;       // in the current block
+	size_t blockSize;    // size of the next block, doubled every time one is added
+	size_t used;         // bytes handed out since the last reset, padding included
+	size_t peak;
+	unsigned long long heapAllocations; // blocks allocated since the arena was created
+	Arena();
+	~Arena();
+};
+
+// Where an arena was, to rewind it later
+struct ArenaMarker {
+	size_t block;
+	size_t offset;
+	size_t used;
+};
+
+// alignment is a power of two. Never returns NULL : a new block is added if needed.
+void * arenaAllocate(Arena & arena, size_t size, size_t alignment);
+ArenaMarker arenaMark(const Arena & arena);
+// Everything allocated after the marker is gone
+void arenaRewind(Arena & arena, const ArenaMarker & marker);
+// Back to the start. Several blocks are merged into one, so the next frame fits in a single block.
+void resetArena(Arena & arena);
+// Gives the blocks back to the heap
+void freeArena(Arena & arena);
+// Bytes reserved in the blocks
+size_t arenaCapacity(const Arena & arena);
+
+// The calling thread's own arena. The frame loops reset it at the start of each frame.
+Arena & threadArena();
+
+// Rewinds an arena when leaving the scope : for a job, or a function which needs temporary containers.
+// Declared before the containers, so that they are destroyed first.
+struct ArenaScope {
+	Arena & arena;
+	ArenaMarker marker;
+	explicit ArenaScope(Arena & scopeArena) : arena(scopeArena), marker(arenaMark(scopeArena)) {}
+	~ArenaScope(){ arenaRewind(arena, marker); }
+};
+
+// Allocator for the standard containers, taking their memory from an arena (the thread's one by default).
+// deallocate() does nothing : a vector which grows leaves its old storage in the arena until the
+// rewind, so reserve() what is known up front.
+template <typename T>
+struct ArenaAllocator {
+	typedef T value_type;
+	Arena * arena;
+	ArenaAllocator() : arena(&threadArena()) {}
+	explicit ArenaAllocator(Arena & from) : arena(&from) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U> & other) : arena(other.arena) {}
+	T * allocate(size_t n){
+		return (T *)arenaAllocate(*arena, n * sizeof(T), alignof(T));
+	}
+	void deallocate(T *, size_t){}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b){ return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b){ return a.arena != b.arena; }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+template <typename K, typename V>
+using ArenaMap = std::map<K, V, std::less<K>, ArenaAllocator<std::pair<const K, V> > >;
+
+#endif
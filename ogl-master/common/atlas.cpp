@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "glstate.hpp"
+#include "mipmap.hpp"
+#include "atlas.hpp"
+
+void initSkyline(SkylinePacker & packer, int width, int height){
+	packer.width = width;
+	packer.height = height;
+	SkylineSegment floor = { 0, 0, width };
+	packer.skyline.assign(1, floor);
+}
+
+// Where a rectangle with its left side at segment `first` rests, -1 if it goes out of the packer
+static int skylineFit(const SkylinePacker & packer, size_t first, int width, int height){
+	int x = packer.skyline[first].x;
+	if (x + width > packer.width)
+		return -1;
+	int y = 0;
+	for (size_t i = first; i < packer.skyline.size() && packer.skyline[i].x < x + width; i++){
+		y = std::max(y, packer.skyline[i].y);
+		if (y + height > packer.height)
+			return -1;
+	}
+	return y;
+}
+
+bool packSkyline(SkylinePacker & packer, int width, int height, int & out_x, int & out_y){
+	std::vector<SkylineSegment> & skyline = packer.skyline;
+	int best = -1, bestY = 0;
+	for (size_t i = 0; i < skyline.size(); i++){
+		int y = skylineFit(packer, i, width, height);
+		if (y < 0)
+			continue;
+		if (best < 0 || y < bestY || (y == bestY && skyline[i].width < skyline[best].width)){
+			best = i;
+			bestY = y;
+		}
+	}
+	if (best < 0)
+		return false;
+	out_x = skyline[best].x;
+	out_y = bestY;
+	// The rectangle's top replaces the segments under it, and cuts the one it ends on
+	SkylineSegment top = { out_x, bestY + height, width };
+	skyline.insert(skyline.begin() + best, top);
+	size_t i = best + 1;
+	while (i < skyline.size()){
+		int end = skyline[i - 1].x + skyline[i - 1].width;
+		if (skyline[i].x >= end)
+			break;
+		int cut = end - skyline[i].x;
+		skyline[i].x += cut;
+		skyline[i].width -= cut;
+		if (skyline[i].width > 0)
+			break;
+		skyline.erase(skyline.begin() + i);
+	}
+	// Neighbours at the same height are one segment
+	for (i = 0; i + 1 < skyline.size(); ){
+		if (skyline[i].y == skyline[i + 1].y){
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		else
+			i++;
+	}
+	return true;
+}
+
+// Tallest first, then widest : the skyline stays flat
+struct TallerImage {
+	const AtlasImage * images;
+	bool operator()(size_t a, size_t b) const {
+		if (images[a].height != images[b].height)
+			return images[a].height > images[b].height;
+		return images[a].width > images[b].width;
+	}
+};
+
+// Packs the images in cells of `cell` texels, into width x height. false if they don't all fit.
+static bool packImages(const AtlasImage * images, const std::vector<size_t> & order, int padding, int cell,
+	int width, int height, std::vector<int> & out_x, std::vector<int> & out_y){
+	SkylinePacker packer;
+	initSkyline(packer, width / cell, height / cell);
+	for (size_t i = 0; i < order.size(); i++){
+		const AtlasImage & image = images[order[i]];
+		int cellsWide = (image.width + 2 * padding + cell - 1) / cell;
+		int cellsHigh = (image.height + 2 * padding + cell - 1) / cell;
+		int x, y;
+		if (!packSkyline(packer, cellsWide, cellsHigh, x, y))
+			return false;
+		out_x[order[i]] = x * cell;
+		out_y[order[i]] = y * cell;
+	}
+	return true;
+}
+
+bool buildAtlas(const AtlasImage * images, size_t count, int maxSize, int padding, Atlas & out_atlas){
+	int cell = 1;
+	while (cell < padding)
+		cell *= 2;
+	padding = cell;
+	std::vector<size_t> order(count);
+	size_t area = 0;
+	int widest = 1, tallest = 1;
+	for (size_t i = 0; i < count; i++){
+		order[i] = i;
+		area += (size_t)(images[i].width + 2 * padding) * (images[i].height + 2 * padding);
+		widest = std::max(widest, images[i].width + 2 * padding);
+		tallest = std::max(tallest, images[i].height + 2 * padding);
+	}
+	TallerImage taller = { images };
+	std::sort(order.begin(), order.end(), taller);
+	// The smallest power of 2 sizes the images could fit in, growing until they do
+	int width = cell, height = cell;
+	while (width < widest)
+		width *= 2;
+	while (height < tallest)
+		height *= 2;
+	while ((size_t)width * height < area){
+		if (width <= height)
+			width *= 2;
+		else
+			height *= 2;
+	}
+	std::vector<int> x(count), y(count);
+	while (!packImages(images, order, padding, cell, width, height, x, y)){
+		if (width <= height)
+			width *= 2;
+		else
+			height *= 2;
+		if (width > maxSize || height > maxSize){
+			fprintf(stderr, "%u images don't fit in a %dx%d atlas\n", (unsigned int)count, maxSize, maxSize);
+			return false;
+		}
+	}
+	out_atlas.width = width;
+	out_atlas.height = height;
+	// Down to a gutter of one texel
+	out_atlas.levels = 1;
+	for (int gutter = padding; gutter > 1 && out_atlas.levels < mipLevelCount(width, height); gutter /= 2)
+		out_atlas.levels++;
+	size_t bytes = 0;
+	for (int level = 0; level < out_atlas.levels; level++){
+		int levelWidth, levelHeight;
+		mipLevelSize(width, height, level, levelWidth, levelHeight);
+		bytes += (size_t)levelWidth * levelHeight * 4;
+	}
+	out_atlas.pixels.assign(bytes, 0);
+	out_atlas.rects.resize(count);
+	size_t imageTexels = 0;
+	unsigned char * pixels = &out_atlas.pixels[0];
+	for (size_t i = 0; i < count; i++){
+		const AtlasImage & image = images[i];
+		// The whole cell, gutter and rounding included : the edge texels repeated outside the image
+		int cellsWidth = (image.width + 2 * padding + cell - 1) / cell * cell;
+		int cellsHeight = (image.height + 2 * padding + cell - 1) / cell * cell;
+		for (int row = 0; row < cellsHeight; row++){
+			int sourceRow = std::min(std::max(row - padding, 0), image.height - 1);
+			const unsigned char * source = image.pixels + (size_t)sourceRow * image.width * 4;
+			unsigned char * target = pixels + ((size_t)(y[i] + row) * width + x[i]) * 4;
+			for (int column = 0; column < cellsWidth; column++){
+				int sourceColumn = std::min(std::max(column - padding, 0), image.width - 1);
+				memcpy(target + column * 4, source + sourceColumn * 4, 4);
+			}
+		}
+		out_atlas.rects[i] = glm::vec4(float(x[i] + padding) / width, float(y[i] + padding) / height,
+			float(image.width) / width, float(image.height) / height);
+		imageTexels += (size_t)image.width * image.height;
+	}
+	out_atlas.used = float(imageTexels) / ((size_t)width * height);
+	// Box filtered, from aligned cells : each texel of a level only covers texels of one cell
+	MipSettings settings = { MIP_BOX, true, 0.0f };
+	for (int level = 1; level < out_atlas.levels; level++){
+		int sourceWidth, sourceHeight, levelWidth, levelHeight;
+		mipLevelSize(width, height, level - 1, sourceWidth, sourceHeight);
+		mipLevelSize(width, height, level, levelWidth, levelHeight);
+		unsigned char * target = pixels + (size_t)sourceWidth * sourceHeight * 4;
+		downsampleRows(pixels, sourceWidth, sourceHeight, 4, target, levelWidth, levelHeight, settings, 0, levelHeight);
+		pixels = target;
+	}
+	return true;
+}
+
+GLuint uploadAtlas(const Atlas & atlas, size_t * out_bytes){
+	if (atlas.pixels.empty())
+		return 0;
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glsBindTexture(GL_TEXTURE_2D, texture);
+	const unsigned char * pixels = &atlas.pixels[0];
+	for (int level = 0; level < atlas.levels; level++){
+		int levelWidth, levelHeight;
+		mipLevelSize(atlas.width, atlas.height, level, levelWidth, levelHeight);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, levelWidth, levelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		pixels += (size_t)levelWidth * levelHeight * 4;
+	}
+	// Past the last level the images would start mixing : sampling stops there
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, atlas.levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (out_bytes != NULL)
+		*out_bytes = atlas.pixels.size();
+	return texture;
+}
+
+glm::vec2 atlasUV(const glm::vec4 & rect, const glm::vec2 & uv){
+	return glm::vec2(rect.x + uv.x * rect.z, rect.y + uv.y * rect.w);
+}
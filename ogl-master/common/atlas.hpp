@@ -0,0 +1,51 @@
+#ifndef ATLAS_HPP
+#define ATLAS_HPP
+
+// Texture atlases : many small images packed into one texture, so that the objects drawn with them share
+// one binding, and can even be merged into one mesh and one draw. Each image takes the rectangle its
+// UVs are moved to (see atlasUV), or which a shader is given as an offset and a scale.
+// The images are packed with a skyline, bottom-left first. Each one gets a gutter of its edge texels
+// repeated, and starts on a multiple of the gutter's width : down to the level where the gutter is one
+// texel wide, box filtering never mixes two images, and bilinear filtering never reaches the next one.
+// The mip chain stops there.
+// An atlas can't repeat an image : UVs out of [0, 1] need the repeats baked into the image first.
+
+// Top edge of the packed area, from left to right
+struct SkylineSegment {
+	int x, y, width;
+};
+
+struct SkylinePacker {
+	int width, height;
+	std::vector<SkylineSegment> skyline;
+};
+
+void initSkyline(SkylinePacker & packer, int width, int height);
+// Where a rectangle goes : the place it rests lowest, then the narrowest segment. false if it fits nowhere.
+bool packSkyline(SkylinePacker & packer, int width, int height, int & out_x, int & out_y);
+
+// RGBA, 8 bits per channel, rows packed. sRGB colors : the mip levels are filtered in linear light.
+struct AtlasImage {
+	const unsigned char * pixels;
+	int width, height;
+};
+
+struct Atlas {
+	int width, height;                // powers of 2
+	int levels;
+	std::vector<unsigned char> pixels; // the levels one after the other
+	// Per image : where UV (0, 0) goes (xy) and how much UV (1, 1) is from there (zw)
+	std::vector<glm::vec4> rects;
+	float used;                       // fraction of level 0 covered by the images, gutters not counted
+};
+
+// padding : the gutter, in texels, rounded up to a power of 2. 8 keeps 4 levels.
+// false if the images don't fit in maxSize x maxSize.
+bool buildAtlas(const AtlasImage * images, size_t count, int maxSize, int padding, Atlas & out_atlas);
+// Clamped to the edges, trilinear over the levels of the atlas. 0 on failure.
+GLuint uploadAtlas(const Atlas & atlas, size_t * out_bytes);
+
+// An UV of an image, in [0, 1], moved into its rectangle
+glm::vec2 atlasUV(const glm::vec4 & rect, const glm::vec2 & uv);
+
+#endif
@@ -0,0 +1,562 @@
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BLOCKCOMPRESS_SSE
+#endif
+
+#include "blockcompress.hpp"
+
+// A block as one array per channel, so that 4 texels load at a time
+struct BlockTexels {
+	float channel[4][16];   // r, g, b, a in [0, 255]
+};
+
+// Interpolation weights of BC7's 4-bit indices, out of 64
+static const int BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+unsigned int blockBytes(BlockFormat format){
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+size_t compressedSize(BlockFormat format, int width, int height){
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+static void loadBlock(const unsigned char texels[64], BlockTexels & block){
+	for (int t = 0; t < 16; t++){
+		for (int c = 0; c < 4; c++)
+			block.channel[c][t] = texels[t * 4 + c];
+	}
+}
+
+// For each texel, the closest of `count` palette entries over channels [first, first + channels).
+// Returns the sum of the squared distances.
+static float chooseIndices(const BlockTexels & block, const float palette[][4], int count, int first, int channels,
+	unsigned char indices[16]){
+	float total = 0.0f;
+#ifdef BLOCKCOMPRESS_SSE
+	for (int t = 0; t < 16; t += 4){
+		__m128 best = _mm_set1_ps(1e30f);
+		__m128 bestIndex = _mm_setzero_ps();
+		for (int p = 0; p < count; p++){
+			__m128 distance = _mm_setzero_ps();
+			for (int c = first; c < first + channels; c++){
+				__m128 d = _mm_sub_ps(_mm_loadu_ps(&block.channel[c][t]), _mm_set1_ps(palette[p][c]));
+				distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+			}
+			// Ties keep the first entry
+			__m128 closer = _mm_cmplt_ps(distance, best);
+			best = _mm_min_ps(distance, best);
+			bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)p)), _mm_andnot_ps(closer, bestIndex));
+		}
+		float distances[4], found[4];
+		_mm_storeu_ps(distances, best);
+		_mm_storeu_ps(found, bestIndex);
+		for (int k = 0; k < 4; k++){
+			indices[t + k] = (unsigned char)found[k];
+			total += distances[k];
+		}
+	}
+#else
+	for (int t = 0; t < 16; t++){
+		float best = 1e30f;
+		int bestIndex = 0;
+		for (int p = 0; p < count; p++){
+			float distance = 0.0f;
+			for (int c = first; c < first + channels; c++){
+				float d = block.channel[c][t] - palette[p][c];
+				distance += d * d;
+			}
+			if (distance < best){
+				best = distance;
+				bestIndex = p;
+			}
+		}
+		indices[t] = (unsigned char)bestIndex;
+		total += best;
+	}
+#endif
+	return total;
+}
+
+// Mean and principal axis of the texels over their first `channels` channels, by power iteration
+// on the covariance matrix. The axis is 0 when all the texels are the same.
+static void principalAxis(const BlockTexels & block, int channels, float mean[4], float axis[4]){
+	for (int c = 0; c < 4; c++){
+		mean[c] = 0.0f;
+		axis[c] = 0.0f;
+	}
+	for (int c = 0; c < channels; c++){
+		for (int t = 0; t < 16; t++)
+			mean[c] += block.channel[c][t];
+		mean[c] /= 16.0f;
+	}
+	float covariance[4][4] = {};
+	for (int t = 0; t < 16; t++){
+		float d[4];
+		for (int c = 0; c < channels; c++)
+			d[c] = block.channel[c][t] - mean[c];
+		for (int i = 0; i < channels; i++){
+			for (int j = i; j < channels; j++)
+				covariance[i][j] += d[i] * d[j];
+		}
+	}
+	for (int i = 0; i < channels; i++){
+		for (int j = 0; j < i; j++)
+			covariance[i][j] = covariance[j][i];
+	}
+	// From the row of the channel which varies most : never orthogonal to the axis
+	int largest = 0;
+	for (int c = 1; c < channels; c++){
+		if (covariance[c][c] > covariance[largest][largest])
+			largest = c;
+	}
+	if (covariance[largest][largest] <= 0.0f)
+		return;
+	float v[4] = {};
+	for (int c = 0; c < channels; c++)
+		v[c] = covariance[largest][c];
+	for (int iteration = 0; iteration < 8; iteration++){
+		float next[4] = {};
+		float length = 0.0f;
+		for (int i = 0; i < channels; i++){
+			for (int j = 0; j < channels; j++)
+				next[i] += covariance[i][j] * v[j];
+			length += next[i] * next[i];
+		}
+		if (length <= 0.0f)
+			return;
+		length = 1.0f / sqrtf(length);
+		for (int c = 0; c < channels; c++)
+			v[c] = next[c] * length;
+	}
+	for (int c = 0; c < channels; c++)
+		axis[c] = v[c];
+}
+
+static float clampColor(float value){
+	return value < 0.0f ? 0.0f : value > 255.0f ? 255.0f : value;
+}
+
+// The two ends of the texels projected on the axis
+static void axisEndpoints(const BlockTexels & block, int channels, const float mean[4], const float axis[4], float out_e[2][4]){
+	float lowest = 0.0f, highest = 0.0f;
+	for (int t = 0; t < 16; t++){
+		float projection = 0.0f;
+		for (int c = 0; c < channels; c++)
+			projection += (block.channel[c][t] - mean[c]) * axis[c];
+		if (projection < lowest)
+			lowest = projection;
+		if (projection > highest)
+			highest = projection;
+	}
+	for (int c = 0; c < 4; c++){
+		out_e[0][c] = clampColor(mean[c] + axis[c] * lowest);
+		out_e[1][c] = clampColor(mean[c] + axis[c] * highest);
+	}
+}
+
+// The endpoints which minimise the squared error when texel t is (1 - weights[t]) e0 + weights[t] e1.
+// False when the weights don't tell them apart (all the same).
+static bool refitEndpoints(const BlockTexels & block, int channels, const float weights[16], float out_e[2][4]){
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (int t = 0; t < 16; t++){
+		float b = weights[t], a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < channels; c++){
+			ax[c] += a * block.channel[c][t];
+			bx[c] += b * block.channel[c][t];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+	for (int c = 0; c < channels; c++){
+		out_e[0][c] = clampColor((ax[c] * bb - bx[c] * ab) / determinant);
+		out_e[1][c] = clampColor((bx[c] * aa - ax[c] * ab) / determinant);
+	}
+	return true;
+}
+
+// Bits from the lowest of the first byte up
+static void writeBits(unsigned char * out, int & position, unsigned int value, int count){
+	for (int i = 0; i < count; i++, position++){
+		if ((value >> i) & 1)
+			out[position >> 3] |= (unsigned char)(1 << (position & 7));
+	}
+}
+
+static unsigned int readBits(const unsigned char * block, int & position, int count){
+	unsigned int value = 0;
+	for (int i = 0; i < count; i++, position++)
+		value |= (unsigned int)((block[position >> 3] >> (position & 7)) & 1) << i;
+	return value;
+}
+
+static unsigned short packColor565(const float color[4]){
+	int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor565(unsigned short packed, int out_color[3]){
+	int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+	out_color[0] = (r << 3) | (r >> 2);
+	out_color[1] = (g << 2) | (g >> 4);
+	out_color[2] = (b << 3) | (b >> 2);
+}
+
+// The 4 color palette of a BC1 block, as decoders interpolate it
+static void colorPalette(unsigned short c0, unsigned short c1, float out_palette[4][4]){
+	int p0[3], p1[3];
+	unpackColor565(c0, p0);
+	unpackColor565(c1, p1);
+	for (int c = 0; c < 3; c++){
+		out_palette[0][c] = (float)p0[c];
+		out_palette[1][c] = (float)p1[c];
+		out_palette[2][c] = (float)((2 * p0[c] + p1[c]) / 3);
+		out_palette[3][c] = (float)((p0[c] + 2 * p1[c]) / 3);
+	}
+}
+
+// Packs the endpoints with c0 > c1 (the 4 color mode), and picks the indices. Returns the error.
+// Endpoints which pack to the same color leave a single one : every index is 0.
+static float encodeColors(const BlockTexels & block, const float e[2][4], unsigned short & out_c0, unsigned short & out_c1,
+	unsigned char indices[16]){
+	unsigned short c0 = packColor565(e[0]), c1 = packColor565(e[1]);
+	if (c0 < c1){
+		unsigned short swap = c0;
+		c0 = c1;
+		c1 = swap;
+	}
+	out_c0 = c0;
+	out_c1 = c1;
+	float palette[4][4];
+	colorPalette(c0, c1, palette);
+	return chooseIndices(block, palette, c0 == c1 ? 1 : 4, 0, 3, indices);
+}
+
+// Where each index is between c0 and c1
+static const float ColorWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+static void compressColors(const BlockTexels & block, BlockQuality quality, unsigned char * out){
+	float mean[4], axis[4], e[2][4];
+	principalAxis(block, 3, mean, axis);
+	axisEndpoints(block, 3, mean, axis, e);
+	unsigned short c0, c1;
+	unsigned char indices[16];
+	float error = encodeColors(block, e, c0, c1, indices);
+	int refits = quality == BLOCK_FAST ? 0 : quality == BLOCK_NORMAL ? 1 : 4;
+	for (int refit = 0; refit < refits && c0 != c1 && error > 0.0f; refit++){
+		float weights[16], candidate[2][4];
+		for (int t = 0; t < 16; t++)
+			weights[t] = ColorWeights[indices[t]];
+		if (!refitEndpoints(block, 3, weights, candidate))
+			break;
+		unsigned short candidate0, candidate1;
+		unsigned char candidateIndices[16];
+		float candidateError = encodeColors(block, candidate, candidate0, candidate1, candidateIndices);
+		if (candidateError >= error)
+			break;
+		error = candidateError;
+		c0 = candidate0;
+		c1 = candidate1;
+		memcpy(indices, candidateIndices, 16);
+	}
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	unsigned int bits = 0;
+	for (int t = 0; t < 16; t++)
+		bits |= (unsigned int)indices[t] << (2 * t);
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+// The 8 alphas of a BC3 block : 6 interpolated ones when a0 > a1, else 4 and then 0 and 255
+static void alphaPalette(int a0, int a1, float out_palette[8][4]){
+	out_palette[0][3] = (float)a0;
+	out_palette[1][3] = (float)a1;
+	if (a0 > a1){
+		for (int i = 2; i < 8; i++)
+			out_palette[i][3] = (float)(((8 - i) * a0 + (i - 1) * a1) / 7);
+	}
+	else {
+		for (int i = 2; i < 6; i++)
+			out_palette[i][3] = (float)(((6 - i) * a0 + (i - 1) * a1) / 5);
+		out_palette[6][3] = 0.0f;
+		out_palette[7][3] = 255.0f;
+	}
+}
+
+static float encodeAlpha(const BlockTexels & block, int a0, int a1, unsigned char indices[16]){
+	float palette[8][4];
+	alphaPalette(a0, a1, palette);
+	return chooseIndices(block, palette, 8, 3, 1, indices);
+}
+
+static void compressAlpha(const BlockTexels & block, BlockQuality quality, unsigned char * out){
+	int lowest = 255, highest = 0;
+	// Without the 0 and 255 texels, which the 6 alpha mode has for free
+	int innerLowest = 255, innerHighest = 0;
+	bool extremes = false;
+	for (int t = 0; t < 16; t++){
+		int a = (int)block.channel[3][t];
+		lowest = a < lowest ? a : lowest;
+		highest = a > highest ? a : highest;
+		if (a == 0 || a == 255)
+			extremes = true;
+		else {
+			innerLowest = a < innerLowest ? a : innerLowest;
+			innerHighest = a > innerHighest ? a : innerHighest;
+		}
+	}
+	int a0 = highest, a1 = lowest;
+	unsigned char indices[16];
+	float error = encodeAlpha(block, a0, a1, indices);
+	if (quality == BLOCK_BEST && extremes && error > 0.0f){
+		if (innerLowest > innerHighest)
+			innerLowest = innerHighest = 0;
+		unsigned char candidateIndices[16];
+		float candidateError = encodeAlpha(block, innerLowest, innerHighest, candidateIndices);
+		if (candidateError < error){
+			a0 = innerLowest;
+			a1 = innerHighest;
+			memcpy(indices, candidateIndices, 16);
+		}
+	}
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	memset(out + 2, 0, 6);
+	int position = 0;
+	for (int t = 0; t < 16; t++)
+		writeBits(out + 2, position, indices[t], 3);
+}
+
+// BC7 mode 6 : endpoints of 7 bits per channel, and a low bit for each of them
+struct BC7Endpoints {
+	int color[2][4];
+	int pbit[2];
+};
+
+static void quantizeBC7(const float e[4], int pbit, int out_color[4]){
+	for (int c = 0; c < 4; c++){
+		int value = (int)floorf((e[c] - pbit) * 0.5f + 0.5f);
+		out_color[c] = value < 0 ? 0 : value > 127 ? 127 : value;
+	}
+}
+
+// The low bit which loses the least when quantizing this endpoint
+static int bestPbit(const float e[4]){
+	float errors[2];
+	for (int pbit = 0; pbit < 2; pbit++){
+		int color[4];
+		quantizeBC7(e, pbit, color);
+		errors[pbit] = 0.0f;
+		for (int c = 0; c < 4; c++){
+			float d = e[c] - (color[c] * 2 + pbit);
+			errors[pbit] += d * d;
+		}
+	}
+	return errors[1] < errors[0] ? 1 : 0;
+}
+
+static void bc7Palette(const BC7Endpoints & endpoints, float out_palette[16][4]){
+	for (int c = 0; c < 4; c++){
+		int v0 = endpoints.color[0][c] * 2 + endpoints.pbit[0];
+		int v1 = endpoints.color[1][c] * 2 + endpoints.pbit[1];
+		for (int i = 0; i < 16; i++)
+			out_palette[i][c] = (float)(((64 - BC7Weights[i]) * v0 + BC7Weights[i] * v1 + 32) >> 6);
+	}
+}
+
+// Quantizes e with the best low bits (every pair of them with BLOCK_BEST) and picks the indices. Returns the error.
+static float encodeBC7(const BlockTexels & block, const float e[2][4], BlockQuality quality, BC7Endpoints & out_endpoints,
+	unsigned char indices[16]){
+	float best = 1e30f;
+	int first = quality == BLOCK_BEST ? 0 : 3;
+	for (int pbits = first; pbits < 4; pbits++){
+		BC7Endpoints endpoints;
+		if (quality == BLOCK_BEST){
+			endpoints.pbit[0] = pbits & 1;
+			endpoints.pbit[1] = pbits >> 1;
+		}
+		else {
+			endpoints.pbit[0] = bestPbit(e[0]);
+			endpoints.pbit[1] = bestPbit(e[1]);
+		}
+		quantizeBC7(e[0], endpoints.pbit[0], endpoints.color[0]);
+		quantizeBC7(e[1], endpoints.pbit[1], endpoints.color[1]);
+		float palette[16][4];
+		bc7Palette(endpoints, palette);
+		unsigned char candidateIndices[16];
+		float error = chooseIndices(block, palette, 16, 0, 4, candidateIndices);
+		if (error < best){
+			best = error;
+			out_endpoints = endpoints;
+			memcpy(indices, candidateIndices, 16);
+		}
+	}
+	return best;
+}
+
+static void compressBC7(const BlockTexels & block, BlockQuality quality, unsigned char * out){
+	float mean[4], axis[4], e[2][4];
+	principalAxis(block, 4, mean, axis);
+	axisEndpoints(block, 4, mean, axis, e);
+	BC7Endpoints endpoints;
+	unsigned char indices[16];
+	float error = encodeBC7(block, e, quality, endpoints, indices);
+	int refits = quality == BLOCK_FAST ? 0 : quality == BLOCK_NORMAL ? 1 : 3;
+	for (int refit = 0; refit < refits && error > 0.0f; refit++){
+		float weights[16], candidate[2][4];
+		for (int t = 0; t < 16; t++)
+			weights[t] = BC7Weights[indices[t]] / 64.0f;
+		if (!refitEndpoints(block, 4, weights, candidate))
+			break;
+		BC7Endpoints candidateEndpoints;
+		unsigned char candidateIndices[16];
+		float candidateError = encodeBC7(block, candidate, quality, candidateEndpoints, candidateIndices);
+		if (candidateError >= error)
+			break;
+		error = candidateError;
+		endpoints = candidateEndpoints;
+		memcpy(indices, candidateIndices, 16);
+	}
+	// The high bit of the first index isn't stored : it must be 0
+	if (indices[0] >= 8){
+		for (int c = 0; c < 4; c++){
+			int swap = endpoints.color[0][c];
+			endpoints.color[0][c] = endpoints.color[1][c];
+			endpoints.color[1][c] = swap;
+		}
+		int swap = endpoints.pbit[0];
+		endpoints.pbit[0] = endpoints.pbit[1];
+		endpoints.pbit[1] = swap;
+		for (int t = 0; t < 16; t++)
+			indices[t] = 15 - indices[t];
+	}
+	memset(out, 0, 16);
+	int position = 0;
+	writeBits(out, position, 1 << 6, 7);
+	for (int c = 0; c < 4; c++){
+		writeBits(out, position, endpoints.color[0][c], 7);
+		writeBits(out, position, endpoints.color[1][c], 7);
+	}
+	writeBits(out, position, endpoints.pbit[0], 1);
+	writeBits(out, position, endpoints.pbit[1], 1);
+	writeBits(out, position, indices[0], 3);
+	for (int t = 1; t < 16; t++)
+		writeBits(out, position, indices[t], 4);
+}
+
+void compressBlock(BlockFormat format, BlockQuality quality, const unsigned char texels[64], unsigned char * out){
+	BlockTexels block;
+	loadBlock(texels, block);
+	if (format == BLOCK_BC1)
+		compressColors(block, quality, out);
+	else if (format == BLOCK_BC3){
+		compressAlpha(block, quality, out);
+		compressColors(block, quality, out + 8);
+	}
+	else
+		compressBC7(block, quality, out);
+}
+
+static void decompressColors(const unsigned char * block, bool threeColors, unsigned char texels[64]){
+	unsigned short c0 = (unsigned short)(block[0] | (block[1] << 8));
+	unsigned short c1 = (unsigned short)(block[2] | (block[3] << 8));
+	int p0[3], p1[3];
+	unpackColor565(c0, p0);
+	unpackColor565(c1, p1);
+	int palette[4][4];
+	for (int c = 0; c < 3; c++){
+		palette[0][c] = p0[c];
+		palette[1][c] = p1[c];
+		if (c0 > c1 || !threeColors){
+			palette[2][c] = (2 * p0[c] + p1[c]) / 3;
+			palette[3][c] = (p0[c] + 2 * p1[c]) / 3;
+		}
+		else {
+			palette[2][c] = (p0[c] + p1[c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = c0 > c1 || !threeColors ? 255 : 0;
+	unsigned int bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+	for (int t = 0; t < 16; t++){
+		int index = (bits >> (2 * t)) & 3;
+		for (int c = 0; c < 4; c++)
+			texels[t * 4 + c] = (unsigned char)palette[index][c];
+	}
+}
+
+void decompressBlock(BlockFormat format, const unsigned char * block, unsigned char texels[64]){
+	if (format == BLOCK_BC1){
+		decompressColors(block, true, texels);
+		return;
+	}
+	if (format == BLOCK_BC3){
+		// The colors of BC3 always have 4 entries
+		decompressColors(block + 8, false, texels);
+		float palette[8][4];
+		alphaPalette(block[0], block[1], palette);
+		int position = 0;
+		for (int t = 0; t < 16; t++)
+			texels[t * 4 + 3] = (unsigned char)palette[readBits(block + 2, position, 3)][3];
+		return;
+	}
+	// Mode 6 only, as compressBlock writes it. Anything else decodes to magenta.
+	int position = 0;
+	if (readBits(block, position, 7) != 1 << 6){
+		for (int t = 0; t < 16; t++){
+			texels[t * 4 + 0] = 255;
+			texels[t * 4 + 1] = 0;
+			texels[t * 4 + 2] = 255;
+			texels[t * 4 + 3] = 255;
+		}
+		return;
+	}
+	BC7Endpoints endpoints;
+	for (int c = 0; c < 4; c++){
+		endpoints.color[0][c] = readBits(block, position, 7);
+		endpoints.color[1][c] = readBits(block, position, 7);
+	}
+	endpoints.pbit[0] = readBits(block, position, 1);
+	endpoints.pbit[1] = readBits(block, position, 1);
+	float palette[16][4];
+	bc7Palette(endpoints, palette);
+	for (int t = 0; t < 16; t++){
+		int index = readBits(block, position, t == 0 ? 3 : 4);
+		for (int c = 0; c < 4; c++)
+			texels[t * 4 + c] = (unsigned char)palette[index][c];
+	}
+}
+
+void compressBlockRows(BlockFormat format, BlockQuality quality, const unsigned char * rgba, int width, int height,
+	int firstRow, int endRow, unsigned char * out){
+	int blocksWide = (width + 3) / 4;
+	unsigned int bytes = blockBytes(format);
+	unsigned char texels[64];
+	for (int row = firstRow; row < endRow; row++){
+		for (int column = 0; column < blocksWide; column++){
+			for (int y = 0; y < 4; y++){
+				int sourceY = row * 4 + y < height ? row * 4 + y : height - 1;
+				for (int x = 0; x < 4; x++){
+					int sourceX = column * 4 + x < width ? column * 4 + x : width - 1;
+					memcpy(texels + (y * 4 + x) * 4, rgba + ((size_t)sourceY * width + sourceX) * 4, 4);
+				}
+			}
+			compressBlock(format, quality, texels, out + ((size_t)row * blocksWide + column) * bytes);
+		}
+	}
+}
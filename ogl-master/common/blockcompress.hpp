@@ -0,0 +1,38 @@
+#ifndef BLOCKCOMPRESS_HPP
+#define BLOCKCOMPRESS_HPP
+
+// Block compression of RGBA8 images into the formats the GPU samples as they are, 4x4 texels per block :
+// BC1 (DXT1, RGB in 8 bytes), BC3 (DXT5, BC1 colors plus interpolated alpha in 16 bytes) and BC7
+// (RGBA in 16 bytes, here with mode 6 only : one pair of 7-bit endpoints with a bit each, 16 levels).
+// Endpoints come from the principal axis of the block's colors, then are refitted by least squares
+// against the indices they give. The indices are chosen 4 texels at a time with SSE.
+// Nothing is shared between blocks : rows of blocks can be compressed on several threads at once.
+
+enum BlockFormat {
+	BLOCK_BC1,
+	BLOCK_BC3,
+	BLOCK_BC7
+};
+
+enum BlockQuality {
+	BLOCK_FAST,     // endpoints from the axis only
+	BLOCK_NORMAL,   // one refit
+	BLOCK_BEST      // several refits, every choice of BC7 endpoint bits, the 6 value BC3 alpha mode
+};
+
+// 8 for BC1, 16 for the others
+unsigned int blockBytes(BlockFormat format);
+// Of a whole image, partial blocks included
+size_t compressedSize(BlockFormat format, int width, int height);
+
+// texels : 16 RGBA texels, row by row. BC1 ignores alpha.
+void compressBlock(BlockFormat format, BlockQuality quality, const unsigned char texels[64], unsigned char * out);
+// The other way, for measuring the error
+void decompressBlock(BlockFormat format, const unsigned char * block, unsigned char texels[64]);
+
+// Rows of blocks [firstRow, endRow) of an RGBA image, into out (the blocks of the whole image, row after row).
+// The blocks over the right and bottom edges repeat the last column and row.
+void compressBlockRows(BlockFormat format, BlockQuality quality, const unsigned char * rgba, int width, int height,
+	int firstRow, int endRow, unsigned char * out);
+
+#endif
@@ -0,0 +1,273 @@
+#include <vector>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+
+void computeBounds(const std::vector<glm::vec3> & positions, AABB & out_box, BoundingSphere & out_sphere){
+	out_box.min = glm::vec3(FLT_MAX);
+	out_box.max = glm::vec3(-FLT_MAX);
+	for (size_t i = 0; i < positions.size(); i++){
+		out_box.min = glm::min(out_box.min, positions[i]);
+		out_box.max = glm::max(out_box.max, positions[i]);
+	}
+	if (positions.empty()){
+		out_box.min = out_box.max = glm::vec3(0.0f);
+	}
+
+	out_sphere.center = (out_box.min + out_box.max) * 0.5f;
+	float radius2 = 0.0f;
+	for (size_t i = 0; i < positions.size(); i++){
+		glm::vec3 d = positions[i] - out_sphere.center;
+		radius2 = std::max(radius2, glm::dot(d, d));
+	}
+	out_sphere.radius = sqrtf(radius2);
+}
+
+AABB transformAABB(const AABB & box, const glm::mat4 & matrix){
+	// Arvo's method : the extent along each axis is the sum of the absolute contributions
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	glm::vec3 newCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+	glm::vec3 newExtent;
+	for (int i = 0; i < 3; i++){
+		newExtent[i] = fabsf(matrix[0][i]) * extent.x + fabsf(matrix[1][i]) * extent.y + fabsf(matrix[2][i]) * extent.z;
+	}
+	AABB result;
+	result.min = newCenter - newExtent;
+	result.max = newCenter + newExtent;
+	return result;
+}
+
+Frustum extractFrustum(const glm::mat4 & viewProjection){
+	// GLM matrices are column-major : row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	const glm::mat4 & m = viewProjection;
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0; // left
+	frustum.planes[1] = row3 - row0; // right
+	frustum.planes[2] = row3 + row1; // bottom
+	frustum.planes[3] = row3 - row1; // top
+	frustum.planes[4] = row3 + row2; // near
+	frustum.planes[5] = row3 - row2; // far
+	for (int i = 0; i < 6; i++){
+		float length = glm::length(glm::vec3(frustum.planes[i]));
+		frustum.planes[i] /= length;
+	}
+	return frustum;
+}
+
+CullResult cullAABB(const Frustum & frustum, const AABB & box){
+	CullResult result = CULL_INSIDE;
+	for (int i = 0; i < 6; i++){
+		const glm::vec4 & plane = frustum.planes[i];
+		// The corners of the box the furthest along the normal, and the furthest against it
+		glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x,
+		                   plane.y >= 0.0f ? box.max.y : box.min.y,
+		                   plane.z >= 0.0f ? box.max.z : box.min.z);
+		glm::vec3 negative(plane.x >= 0.0f ? box.min.x : box.max.x,
+		                   plane.y >= 0.0f ? box.min.y : box.max.y,
+		                   plane.z >= 0.0f ? box.min.z : box.max.z);
+		if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+			return CULL_OUTSIDE;
+		if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+			result = CULL_INTERSECTS;
+	}
+	return result;
+}
+
+CullResult cullSphere(const Frustum & frustum, const BoundingSphere & sphere){
+	CullResult result = CULL_INSIDE;
+	for (int i = 0; i < 6; i++){
+		const glm::vec4 & plane = frustum.planes[i];
+		float distance = glm::dot(glm::vec3(plane), sphere.center) + plane.w;
+		if (distance < -sphere.radius)
+			return CULL_OUTSIDE;
+		if (distance < sphere.radius)
+			result = CULL_INTERSECTS;
+	}
+	return result;
+}
+
+static const int MaxObjectsPerLeaf = 4;
+
+static AABB unionAABB(const AABB & a, const AABB & b){
+	AABB result;
+	result.min = glm::min(a.min, b.min);
+	result.max = glm::max(a.max, b.max);
+	return result;
+}
+
+static int largestAxis(const glm::vec3 & v){
+	if (v.x > v.y && v.x > v.z) return 0;
+	if (v.y > v.z) return 1;
+	return 2;
+}
+
+// Sorts an index range by centroid along an axis
+struct CentroidLess {
+	const std::vector<AABB> * bounds;
+	int axis;
+	bool operator()(int a, int b) const {
+		return ((*bounds)[a].min[axis] + (*bounds)[a].max[axis]) < ((*bounds)[b].min[axis] + (*bounds)[b].max[axis]);
+	}
+};
+
+// Builds the subtree of objects[first, first + count), returns the index of its root.
+// Every node keeps the range of all the objects below it, so that a fully visible
+// subtree can be accepted without visiting it.
+static int buildNode(SceneBVH & bvh, const std::vector<AABB> & objectBounds, int first, int count){
+	int nodeIndex = (int)bvh.nodes.size();
+	bvh.nodes.push_back(SceneBVHNode());
+
+	AABB bounds = objectBounds[bvh.objects[first]];
+	AABB centroids;
+	centroids.min = centroids.max = (bounds.min + bounds.max) * 0.5f;
+	for (int i = first + 1; i < first + count; i++){
+		const AABB & b = objectBounds[bvh.objects[i]];
+		bounds = unionAABB(bounds, b);
+		glm::vec3 c = (b.min + b.max) * 0.5f;
+		centroids.min = glm::min(centroids.min, c);
+		centroids.max = glm::max(centroids.max, c);
+	}
+
+	int left = -1, right = -1;
+	if (count > MaxObjectsPerLeaf){
+		// Median split along the axis where the centroids are the most spread out
+		CentroidLess less;
+		less.bounds = &objectBounds;
+		less.axis = largestAxis(centroids.max - centroids.min);
+		int half = count / 2;
+		std::nth_element(bvh.objects.begin() + first, bvh.objects.begin() + first + half,
+			bvh.objects.begin() + first + count, less);
+		left = buildNode(bvh, objectBounds, first, half);
+		right = buildNode(bvh, objectBounds, first + half, count - half);
+	}
+
+	SceneBVHNode & node = bvh.nodes[nodeIndex]; // after the recursion : nodes may have been reallocated
+	node.bounds = bounds;
+	node.left = left;
+	node.right = right;
+	node.first = first;
+	node.count = count;
+	return nodeIndex;
+}
+
+void buildSceneBVH(SceneBVH & bvh, const std::vector<AABB> & objectBounds){
+	bvh.nodes.clear();
+	bvh.objects.resize(objectBounds.size());
+	for (size_t i = 0; i < objectBounds.size(); i++)
+		bvh.objects[i] = (int)i;
+	if (objectBounds.empty())
+		return;
+	buildNode(bvh, objectBounds, 0, (int)objectBounds.size());
+}
+
+void cullSceneBVH(const SceneBVH & bvh, const std::vector<AABB> & objectBounds,
+	const Frustum & frustum, std::vector<int> & out_visible){
+	if (bvh.nodes.empty())
+		return;
+
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0){
+		const SceneBVHNode & node = bvh.nodes[stack[--stackSize]];
+		CullResult result = cullAABB(frustum, node.bounds);
+		if (result == CULL_OUTSIDE)
+			continue;
+		if (result == CULL_INSIDE){
+			out_visible.insert(out_visible.end(), bvh.objects.begin() + node.first,
+				bvh.objects.begin() + node.first + node.count);
+			continue;
+		}
+		if (node.left < 0){
+			// Partially visible leaf : test its objects one by one
+			for (int i = node.first; i < node.first + node.count; i++){
+				if (cullAABB(frustum, objectBounds[bvh.objects[i]]) != CULL_OUTSIDE)
+					out_visible.push_back(bvh.objects[i]);
+			}
+			continue;
+		}
+		stack[stackSize++] = node.left;
+		stack[stackSize++] = node.right;
+	}
+}
+
+// Sorts triangles by centroid along an axis
+struct TriangleLess {
+	const std::vector<glm::vec3> * centroids;
+	int axis;
+	bool operator()(unsigned int a, unsigned int b) const {
+		return (*centroids)[a][axis] < (*centroids)[b][axis];
+	}
+};
+
+static void splitTriangles(const std::vector<glm::vec3> & centroids, std::vector<unsigned int> & triangles,
+	size_t first, size_t count, unsigned int maxTriangles, std::vector<size_t> & out_chunkStarts){
+	if (count <= maxTriangles){
+		out_chunkStarts.push_back(first);
+		return;
+	}
+	glm::vec3 cmin = centroids[triangles[first]];
+	glm::vec3 cmax = cmin;
+	for (size_t i = first + 1; i < first + count; i++){
+		cmin = glm::min(cmin, centroids[triangles[i]]);
+		cmax = glm::max(cmax, centroids[triangles[i]]);
+	}
+	TriangleLess less;
+	less.centroids = &centroids;
+	less.axis = largestAxis(cmax - cmin);
+	size_t half = count / 2;
+	std::nth_element(triangles.begin() + first, triangles.begin() + first + half,
+		triangles.begin() + first + count, less);
+	splitTriangles(centroids, triangles, first, half, maxTriangles, out_chunkStarts);
+	splitTriangles(centroids, triangles, first + half, count - half, maxTriangles, out_chunkStarts);
+}
+
+void buildMeshChunks(const std::vector<glm::vec3> & positions, std::vector<unsigned short> & indices,
+	unsigned int maxTrianglesPerChunk, std::vector<MeshChunk> & out_chunks){
+	out_chunks.clear();
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	std::vector<glm::vec3> centroids(triangleCount);
+	std::vector<unsigned int> triangles(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++){
+		centroids[t] = (positions[indices[3*t+0]] + positions[indices[3*t+1]] + positions[indices[3*t+2]]) / 3.0f;
+		triangles[t] = (unsigned int)t;
+	}
+
+	std::vector<size_t> chunkStarts;
+	splitTriangles(centroids, triangles, 0, triangleCount, maxTrianglesPerChunk, chunkStarts);
+	chunkStarts.push_back(triangleCount);
+
+	// Rewrite the index buffer in chunk order
+	std::vector<unsigned short> reordered(indices.size());
+	for (size_t t = 0; t < triangleCount; t++){
+		reordered[3*t+0] = indices[3*triangles[t]+0];
+		reordered[3*t+1] = indices[3*triangles[t]+1];
+		reordered[3*t+2] = indices[3*triangles[t]+2];
+	}
+	indices.swap(reordered);
+
+	std::vector<glm::vec3> chunkPositions;
+	for (size_t c = 0; c + 1 < chunkStarts.size(); c++){
+		MeshChunk chunk;
+		chunk.firstIndex = (unsigned int)(3 * chunkStarts[c]);
+		chunk.indexCount = (unsigned int)(3 * (chunkStarts[c+1] - chunkStarts[c]));
+		chunkPositions.clear();
+		for (unsigned int i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; i++)
+			chunkPositions.push_back(positions[indices[i]]);
+		computeBounds(chunkPositions, chunk.bounds, chunk.sphere);
+		out_chunks.push_back(chunk);
+	}
+}
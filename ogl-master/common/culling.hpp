@@ -0,0 +1,72 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+// Axis-aligned bounding box
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+struct BoundingSphere {
+	glm::vec3 center;
+	float radius;
+};
+
+// The 6 planes of a view frustum, as (normal, distance), normals pointing inwards :
+// a point p is inside the plane when dot(normal, p) + distance >= 0
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+enum CullResult {
+	CULL_OUTSIDE,
+	CULL_INTERSECTS,
+	CULL_INSIDE
+};
+
+// Bounding box and bounding sphere of a set of points.
+// The sphere is centered on the box, which is a bit loose but cheap and stable.
+void computeBounds(const std::vector<glm::vec3> & positions, AABB & out_box, BoundingSphere & out_sphere);
+
+// Bounding box of a transformed box
+AABB transformAABB(const AABB & box, const glm::mat4 & matrix);
+
+// Extract the planes from a projection * view matrix (Gribb & Hartmann)
+Frustum extractFrustum(const glm::mat4 & viewProjection);
+
+CullResult cullAABB(const Frustum & frustum, const AABB & box);
+CullResult cullSphere(const Frustum & frustum, const BoundingSphere & sphere);
+
+// Bounding volume hierarchy over the bounding boxes of the scene objects
+struct SceneBVHNode {
+	AABB bounds;
+	int left, right;     // children, -1 for a leaf
+	int first, count;    // range in SceneBVH::objects, for a leaf
+};
+
+struct SceneBVH {
+	std::vector<SceneBVHNode> nodes; // nodes[0] is the root
+	std::vector<int> objects;        // indices in the objectBounds array given to buildSceneBVH
+};
+
+void buildSceneBVH(SceneBVH & bvh, const std::vector<AABB> & objectBounds);
+
+// Append to out_visible the index of each object whose box touches the frustum.
+// Whole subtrees are accepted or rejected at once when their bounds are fully inside or outside.
+void cullSceneBVH(const SceneBVH & bvh, const std::vector<AABB> & objectBounds,
+	const Frustum & frustum, std::vector<int> & out_visible);
+
+// A part of an indexed mesh, made of contiguous triangles in the index buffer
+struct MeshChunk {
+	AABB bounds;
+	BoundingSphere sphere;
+	unsigned int firstIndex;
+	unsigned int indexCount;
+};
+
+// Split a triangle mesh into spatially coherent chunks of at most maxTrianglesPerChunk triangles.
+// The triangles are reordered in indices so that each chunk is a contiguous range.
+void buildMeshChunks(const std::vector<glm::vec3> & positions, std::vector<unsigned short> & indices,
+	unsigned int maxTrianglesPerChunk, std::vector<MeshChunk> & out_chunks);
+
+#endif
@@ -0,0 +1,105 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "glstate.hpp"
+#include "renderqueue.hpp"
+#include "shadervariants.hpp"
+#include "drawlist.hpp"
+
+// sizeof(DrawConstants) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+unsigned int DrawConstantsStride = sizeof(DrawConstants);
+
+void initDrawLists(){
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	if (alignment < 1)
+		alignment = 1;
+	DrawConstantsStride = (sizeof(DrawConstants) + alignment - 1) / alignment * alignment;
+}
+
+unsigned int drawConstantsStride(){
+	return DrawConstantsStride;
+}
+
+void clearDrawList(DrawList & list){
+	list.packets.clear();
+	list.constants.clear();
+}
+
+void recordDraw(DrawList & list, const DrawPacket & packet, const DrawConstants * constants){
+	list.packets.push_back(packet);
+	if (constants == NULL){
+		list.packets.back().constants = NoDrawConstants;
+		return;
+	}
+	// Each list starts aligned, and the stride keeps every block aligned once the lists are concatenated
+	size_t offset = list.constants.size();
+	list.constants.resize(offset + DrawConstantsStride);
+	memcpy(&list.constants[offset], constants, sizeof(DrawConstants));
+	list.packets.back().constants = (unsigned int)offset;
+}
+
+DrawConstants makeDrawConstants(const glm::mat4 & ModelMatrix){
+	DrawConstants constants;
+	constants.ModelMatrix = ModelMatrix;
+	constants.NormalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(ModelMatrix))));
+	return constants;
+}
+
+void replayDrawLists(const DrawList * lists, size_t listCount, DrawConstantsBuffer & buffer,
+	RenderQueue & queue, ResolvePacketFunction resolve){
+	size_t total = 0;
+	for (size_t l = 0; l < listCount; l++)
+		total += lists[l].constants.size();
+	if (total > 0){
+		if (buffer.buffer == 0)
+			glGenBuffers(1, &buffer.buffer);
+		glsBindBuffer(GL_UNIFORM_BUFFER, buffer.buffer);
+		// Orphaned each frame, like the instance buffers : the draws in flight keep the old storage
+		if ((GLsizeiptr)total > buffer.size)
+			buffer.size = (GLsizeiptr)total * 2;
+		glBufferData(GL_UNIFORM_BUFFER, buffer.size, NULL, GL_STREAM_DRAW);
+	}
+	size_t base = 0;
+	for (size_t l = 0; l < listCount; l++){
+		const DrawList & list = lists[l];
+		if (!list.constants.empty())
+			glBufferSubData(GL_UNIFORM_BUFFER, base, list.constants.size(), &list.constants[0]);
+		for (size_t i = 0; i < list.packets.size(); i++){
+			const DrawPacket & packet = list.packets[i];
+			DrawItem item = {};
+			item.texture = packet.texture;
+			item.mode = packet.mode;
+			item.first = packet.first;
+			item.count = packet.count;
+			item.indexType = packet.indexType;
+			item.instanceCount = packet.instanceCount;
+			item.polygonMode = packet.polygonMode;
+			item.flags = packet.flags;
+			item.pickID = packet.pickID;
+			item.ModelMatrix = glm::mat4(1.0f);
+			item.constants = packet.constants == NoDrawConstants ? -1 : (GLintptr)(base + packet.constants);
+			resolve(packet, item);
+			item.key = makeRenderKey(packet.pass, item.program, item.texture, item.vao, packet.depth);
+			submitDraw(queue, item);
+		}
+		base += list.constants.size();
+	}
+}
+
+void bindDrawConstants(const DrawConstantsBuffer & buffer, GLintptr offset){
+	glsBindBufferRange(GL_UNIFORM_BUFFER, DrawConstantsBinding, buffer.buffer, offset, sizeof(DrawConstants));
+}
+
+void deleteDrawConstantsBuffer(DrawConstantsBuffer & buffer){
+	if (buffer.buffer != 0)
+		glsDeleteBuffer(buffer.buffer);
+	buffer.buffer = 0;
+	buffer.size = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef DRAWLIST_HPP
+#define DRAWLIST_HPP
+
+// Deferred draw lists, recorded on any thread and replayed on the GL thread.
+// A DrawList holds compact draw packets which name their mesh and material instead of GL
+// objects, and the per-draw constants packed into a CPU arena laid out like the uniform buffer.
+// Several threads each record their own lists for a part of the scene. The GL thread uploads all
+// the arenas into one uniform buffer, then turns the packets into DrawItems for the render queue,
+// list after list : the result doesn't depend on which thread recorded what.
+
+// Per-draw constants, read by the DRAW_CONSTANTS shaders from a uniform block (std140)
+struct DrawConstants {
+	glm::mat4 ModelMatrix;
+	glm::mat4 NormalMatrix;   // transpose(inverse(mat3(M))) in the upper 3x3
+};
+
+// Offset of a packet without constants
+const unsigned int NoDrawConstants = 0xFFFFFFFFu;
+
+struct DrawPacket {
+	unsigned int mesh;        // meaning left to the caller : resolved into a VAO at replay
+	unsigned int flags;       // DrawFlags
+	unsigned int pass;        // RenderPass
+	float depth;              // 0 (near) .. 1 (far), for the sort key
+	GLenum mode;
+	GLuint first;
+	GLsizei count;
+	GLenum indexType;
+	GLsizei instanceCount;
+	GLenum polygonMode;
+	GLuint texture;           // meaning left to the caller too, 0 : none
+	unsigned int constants;   // offset in the list's arena, or NoDrawConstants
+	unsigned int pickID;      // written by the picking pass (see idpicking.hpp), 0 : not pickable
+};
+
+struct DrawList {
+	std::vector<DrawPacket> packets;
+	std::vector<unsigned char> constants;
+};
+
+// Reads the uniform buffer alignment. On the GL thread, before any list is recorded.
+void initDrawLists();
+// Distance between two DrawConstants in an arena
+unsigned int drawConstantsStride();
+
+// Keeps the capacity : no allocation once a list has grown to its part of the scene
+void clearDrawList(DrawList & list);
+// Adds a draw, and packs its constants if there are any (packet.constants is set)
+void recordDraw(DrawList & list, const DrawPacket & packet, const DrawConstants * constants);
+// transpose(inverse(mat3(M))), with M
+DrawConstants makeDrawConstants(const glm::mat4 & ModelMatrix);
+
+// The uniform buffer the arenas are uploaded to, grown as needed
+struct DrawConstantsBuffer {
+	GLuint buffer;
+	GLsizeiptr size;
+};
+
+// Fills item.vao and item.program for a packet
+typedef void (*ResolvePacketFunction)(const DrawPacket & packet, DrawItem & item);
+
+// Uploads the constants of the lists, then submits their packets to the queue in order.
+// item.constants is the offset of the draw's constants in the buffer.
+void replayDrawLists(const DrawList * lists, size_t listCount, DrawConstantsBuffer & buffer,
+	RenderQueue & queue, ResolvePacketFunction resolve);
+
+// Binds the constants of a draw to the DrawConstantsBinding point
+void bindDrawConstants(const DrawConstantsBuffer & buffer, GLintptr offset);
+
+void deleteDrawConstantsBuffer(DrawConstantsBuffer & buffer);
+
+#endif
@@ -0,0 +1,247 @@
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+
+// Value of a cached binding that we know nothing about
+static const GLuint Unknown = 0xFFFFFFFF;
+
+static const GLenum BufferTargets[] = {
+	GL_ARRAY_BUFFER,
+	GL_ELEMENT_ARRAY_BUFFER,
+	GL_UNIFORM_BUFFER,
+	GL_PIXEL_PACK_BUFFER,
+	GL_PIXEL_UNPACK_BUFFER,
+	GL_COPY_READ_BUFFER,
+	GL_COPY_WRITE_BUFFER,
+	GL_TEXTURE_BUFFER
+};
+static const int NumBufferTargets = sizeof(BufferTargets) / sizeof(BufferTargets[0]);
+
+static const GLenum TextureTargets[] = {
+	GL_TEXTURE_2D,
+	GL_TEXTURE_2D_ARRAY,
+	GL_TEXTURE_CUBE_MAP,
+	GL_TEXTURE_3D,
+	GL_TEXTURE_BUFFER
+};
+static const int NumTextureTargets = sizeof(TextureTargets) / sizeof(TextureTargets[0]);
+static const int MaxTextureUnits = 32;
+
+static const GLenum Capabilities[] = {
+	GL_BLEND,
+	GL_DEPTH_TEST,
+	GL_CULL_FACE,
+	GL_SCISSOR_TEST,
+	GL_POLYGON_OFFSET_FILL,
+	GL_PROGRAM_POINT_SIZE,
+	GL_FRAMEBUFFER_SRGB,
+	GL_MULTISAMPLE
+};
+static const int NumCapabilities = sizeof(Capabilities) / sizeof(Capabilities[0]);
+
+struct GLStateCache {
+	GLuint program;
+	GLuint vao;
+	GLuint buffers[NumBufferTargets];
+	GLuint activeUnit; // 0-based, Unknown if unknown
+	GLuint textures[MaxTextureUnits][NumTextureTargets];
+	GLuint capabilities[NumCapabilities]; // GL_TRUE, GL_FALSE or Unknown
+	GLuint blendSrc, blendDst;
+	GLuint depthFunc;
+	GLuint depthMask;
+	GLuint polygonMode;
+};
+
+static GLStateCache cache;
+static GLStateCounters counters;
+static bool cacheInitialized = false;
+
+void glsInvalidate(){
+	// Every field is a GLuint : setting all the bytes to 0xFF makes them all Unknown
+	memset(&cache, 0xFF, sizeof(cache));
+	cacheInitialized = true;
+}
+
+static void initIfNeeded(){
+	if (!cacheInitialized)
+		glsInvalidate();
+}
+
+static int findIndex(const GLenum * table, int count, GLenum value){
+	for (int i = 0; i < count; i++){
+		if (table[i] == value)
+			return i;
+	}
+	return -1;
+}
+
+// Returns true if the call must reach the driver, and updates the cached value
+static bool changed(GLuint & cached, GLuint value){
+	if (cached == value){
+		counters.filtered++;
+		return false;
+	}
+	cached = value;
+	counters.issued++;
+	return true;
+}
+
+void glsUseProgram(GLuint program){
+	initIfNeeded();
+	if (changed(cache.program, program))
+		glUseProgram(program);
+}
+
+void glsBindVertexArray(GLuint vao){
+	initIfNeeded();
+	if (changed(cache.vao, vao)){
+		glBindVertexArray(vao);
+		// The element array buffer binding belongs to the VAO we just switched to
+		cache.buffers[findIndex(BufferTargets, NumBufferTargets, GL_ELEMENT_ARRAY_BUFFER)] = Unknown;
+	}
+}
+
+void glsBindBuffer(GLenum target, GLuint buffer){
+	initIfNeeded();
+	int t = findIndex(BufferTargets, NumBufferTargets, target);
+	if (t < 0){
+		// Not tracked : always forward
+		counters.issued++;
+		glBindBuffer(target, buffer);
+		return;
+	}
+	if (changed(cache.buffers[t], buffer))
+		glBindBuffer(target, buffer);
+}
+
+void glsBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size){
+	initIfNeeded();
+	// Never filtered : the ranges of the indexed binding points are not cached
+	counters.issued++;
+	glBindBufferRange(target, index, buffer, offset, size);
+	int t = findIndex(BufferTargets, NumBufferTargets, target);
+	if (t >= 0)
+		cache.buffers[t] = buffer;
+}
+
+void glsActiveTexture(GLenum unit){
+	initIfNeeded();
+	if (changed(cache.activeUnit, unit - GL_TEXTURE0))
+		glActiveTexture(unit);
+}
+
+void glsBindTexture(GLenum target, GLuint texture){
+	initIfNeeded();
+	int t = findIndex(TextureTargets, NumTextureTargets, target);
+	GLuint unit = cache.activeUnit;
+	if (t < 0 || unit >= (GLuint)MaxTextureUnits){
+		counters.issued++;
+		glBindTexture(target, texture);
+		if (t >= 0){
+			// We don't know which unit this went to
+			for (int u = 0; u < MaxTextureUnits; u++)
+				cache.textures[u][t] = Unknown;
+		}
+		return;
+	}
+	if (changed(cache.textures[unit][t], texture))
+		glBindTexture(target, texture);
+}
+
+static void setCapability(GLenum cap, GLboolean enabled){
+	initIfNeeded();
+	int c = findIndex(Capabilities, NumCapabilities, cap);
+	if (c < 0 || changed(cache.capabilities[c], enabled)){
+		if (c < 0)
+			counters.issued++;
+		if (enabled)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	}
+}
+
+void glsEnable(GLenum cap){
+	setCapability(cap, GL_TRUE);
+}
+
+void glsDisable(GLenum cap){
+	setCapability(cap, GL_FALSE);
+}
+
+void glsBlendFunc(GLenum sfactor, GLenum dfactor){
+	initIfNeeded();
+	if (cache.blendSrc == sfactor && cache.blendDst == dfactor){
+		counters.filtered++;
+		return;
+	}
+	cache.blendSrc = sfactor;
+	cache.blendDst = dfactor;
+	counters.issued++;
+	glBlendFunc(sfactor, dfactor);
+}
+
+void glsDepthFunc(GLenum func){
+	initIfNeeded();
+	if (changed(cache.depthFunc, func))
+		glDepthFunc(func);
+}
+
+void glsDepthMask(GLboolean flag){
+	initIfNeeded();
+	if (changed(cache.depthMask, flag))
+		glDepthMask(flag);
+}
+
+void glsPolygonMode(GLenum mode){
+	initIfNeeded();
+	if (changed(cache.polygonMode, mode))
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void glsDeleteProgram(GLuint program){
+	initIfNeeded();
+	if (cache.program == program)
+		cache.program = Unknown;
+	glDeleteProgram(program);
+}
+
+void glsDeleteVertexArray(GLuint vao){
+	initIfNeeded();
+	if (cache.vao == vao){
+		cache.vao = Unknown;
+		cache.buffers[findIndex(BufferTargets, NumBufferTargets, GL_ELEMENT_ARRAY_BUFFER)] = Unknown;
+	}
+	glDeleteVertexArrays(1, &vao);
+}
+
+void glsDeleteBuffer(GLuint buffer){
+	initIfNeeded();
+	for (int t = 0; t < NumBufferTargets; t++){
+		if (cache.buffers[t] == buffer)
+			cache.buffers[t] = Unknown;
+	}
+	glDeleteBuffers(1, &buffer);
+}
+
+void glsDeleteTexture(GLuint texture){
+	initIfNeeded();
+	for (int u = 0; u < MaxTextureUnits; u++){
+		for (int t = 0; t < NumTextureTargets; t++){
+			if (cache.textures[u][t] == texture)
+				cache.textures[u][t] = Unknown;
+		}
+	}
+	glDeleteTextures(1, &texture);
+}
+
+GLStateCounters glsGetCounters(){
+	return counters;
+}
+
+void glsResetCounters(){
+	counters.issued = 0;
+	counters.filtered = 0;
+}
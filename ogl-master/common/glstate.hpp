@@ -0,0 +1,43 @@
+#ifndef GLSTATE_HPP
+#define GLSTATE_HPP
+
+// Thin cache in front of the OpenGL state setters.
+// Each function remembers the last value it sent, and drops the call when the same
+// value is set again. This only works if all the code that changes this state goes
+// through these functions : call glsInvalidate() after anything that bypassed them.
+
+void glsUseProgram(GLuint program);
+void glsBindVertexArray(GLuint vao);
+// The GL_ELEMENT_ARRAY_BUFFER binding is part of the VAO : it is forgotten each time the VAO changes
+void glsBindBuffer(GLenum target, GLuint buffer);
+// Binds a range to an indexed binding point. Like glBindBufferRange, it also binds buffer to target.
+void glsBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void glsActiveTexture(GLenum unit);
+// Binds to the active texture unit
+void glsBindTexture(GLenum target, GLuint texture);
+void glsEnable(GLenum cap);
+void glsDisable(GLenum cap);
+void glsBlendFunc(GLenum sfactor, GLenum dfactor);
+void glsDepthFunc(GLenum func);
+void glsDepthMask(GLboolean flag);
+// Always GL_FRONT_AND_BACK, the only face allowed in a core profile
+void glsPolygonMode(GLenum mode);
+
+// Delete an object and forget it if it's currently bound, since its name can be reused
+void glsDeleteProgram(GLuint program);
+void glsDeleteVertexArray(GLuint vao);
+void glsDeleteBuffer(GLuint buffer);
+void glsDeleteTexture(GLuint texture);
+
+// Forget everything : the next call of each setter will reach the driver
+void glsInvalidate();
+
+// How many calls reached the driver, and how many were dropped because they changed nothing
+struct GLStateCounters {
+	unsigned int issued;
+	unsigned int filtered;
+};
+GLStateCounters glsGetCounters();
+void glsResetCounters();
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <GL/glew.h>
+
+#if defined(HAVE_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#elif defined(HAVE_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+#include "headless.hpp"
+
+GLuint HeadlessFramebuffer = 0;
+GLuint HeadlessColorBuffer = 0;
+GLuint HeadlessDepthBuffer = 0;
+
+#if defined(HAVE_EGL)
+
+EGLDisplay HeadlessDisplay = EGL_NO_DISPLAY;
+EGLContext HeadlessContext = EGL_NO_CONTEXT;
+
+static bool createContext(int, int){
+	// The surfaceless platform needs neither a display server nor a GPU
+	PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (eglGetPlatformDisplayEXT != NULL)
+		HeadlessDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (HeadlessDisplay == EGL_NO_DISPLAY)
+		HeadlessDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (HeadlessDisplay == EGL_NO_DISPLAY || !eglInitialize(HeadlessDisplay, &major, &minor)){
+		fprintf(stderr, "Failed to initialize EGL\n");
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)){
+		fprintf(stderr, "EGL can't create OpenGL contexts\n");
+		return false;
+	}
+	EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config = NULL;
+	EGLint configCount = 0;
+	eglChooseConfig(HeadlessDisplay, configAttributes, &config, 1, &configCount);
+	EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	// Surfaceless contexts don't need a config (EGL_KHR_no_config_context)
+	HeadlessContext = eglCreateContext(HeadlessDisplay, configCount > 0 ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttributes);
+	if (HeadlessContext == EGL_NO_CONTEXT){
+		fprintf(stderr, "Failed to create an OpenGL 3.3 core context with EGL\n");
+		return false;
+	}
+	if (!eglMakeCurrent(HeadlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, HeadlessContext)){
+		fprintf(stderr, "EGL can't make a context current without a surface\n");
+		return false;
+	}
+	return true;
+}
+
+void * getHeadlessProcAddress(const char * name){
+	return (void *)eglGetProcAddress(name);
+}
+
+static void destroyContext(){
+	if (HeadlessDisplay == EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(HeadlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (HeadlessContext != EGL_NO_CONTEXT)
+		eglDestroyContext(HeadlessDisplay, HeadlessContext);
+	eglTerminate(HeadlessDisplay);
+	HeadlessContext = EGL_NO_CONTEXT;
+	HeadlessDisplay = EGL_NO_DISPLAY;
+}
+
+#elif defined(HAVE_OSMESA)
+
+OSMesaContext HeadlessContext = NULL;
+// OSMesa needs somewhere to draw, even if we only draw into the framebuffer object
+unsigned char * HeadlessBackBuffer = NULL;
+
+static bool createContext(int width, int height){
+	const int attributes[] = {
+		OSMESA_FORMAT, OSMESA_RGBA,
+		OSMESA_DEPTH_BITS, 24,
+		OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION, 3,
+		OSMESA_CONTEXT_MINOR_VERSION, 3,
+		0
+	};
+	HeadlessContext = OSMesaCreateContextAttribs(attributes, NULL);
+	if (HeadlessContext == NULL){
+		fprintf(stderr, "Failed to create an OpenGL 3.3 core context with OSMesa\n");
+		return false;
+	}
+	HeadlessBackBuffer = (unsigned char *)malloc(width * height * 4);
+	if (!OSMesaMakeCurrent(HeadlessContext, HeadlessBackBuffer, GL_UNSIGNED_BYTE, width, height)){
+		fprintf(stderr, "OSMesa can't make the context current\n");
+		return false;
+	}
+	return true;
+}
+
+void * getHeadlessProcAddress(const char * name){
+	return (void *)OSMesaGetProcAddress(name);
+}
+
+static void destroyContext(){
+	if (HeadlessContext != NULL)
+		OSMesaDestroyContext(HeadlessContext);
+	free(HeadlessBackBuffer);
+	HeadlessContext = NULL;
+	HeadlessBackBuffer = NULL;
+}
+
+#else
+
+static bool createContext(int, int){
+	fprintf(stderr, "Built without EGL or OSMesa : no headless mode\n");
+	return false;
+}
+
+void * getHeadlessProcAddress(const char *){
+	return NULL;
+}
+
+static void destroyContext(){
+}
+
+#endif
+
+bool createHeadlessContext(int width, int height){
+	if (!createContext(width, height)){
+		destroyContext();
+		return false;
+	}
+	// GLEW isn't initialized yet : get the few functions needed here by hand
+	PFNGLGENFRAMEBUFFERSPROC genFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)getHeadlessProcAddress("glGenFramebuffers");
+	PFNGLBINDFRAMEBUFFERPROC bindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)getHeadlessProcAddress("glBindFramebuffer");
+	PFNGLGENRENDERBUFFERSPROC genRenderbuffers = (PFNGLGENRENDERBUFFERSPROC)getHeadlessProcAddress("glGenRenderbuffers");
+	PFNGLBINDRENDERBUFFERPROC bindRenderbuffer = (PFNGLBINDRENDERBUFFERPROC)getHeadlessProcAddress("glBindRenderbuffer");
+	PFNGLRENDERBUFFERSTORAGEPROC renderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)getHeadlessProcAddress("glRenderbufferStorage");
+	PFNGLFRAMEBUFFERRENDERBUFFERPROC framebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)getHeadlessProcAddress("glFramebufferRenderbuffer");
+	PFNGLCHECKFRAMEBUFFERSTATUSPROC checkFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)getHeadlessProcAddress("glCheckFramebufferStatus");
+	if (genFramebuffers == NULL || bindFramebuffer == NULL || genRenderbuffers == NULL || bindRenderbuffer == NULL ||
+		renderbufferStorage == NULL || framebufferRenderbuffer == NULL || checkFramebufferStatus == NULL){
+		fprintf(stderr, "No framebuffer objects\n");
+		destroyContext();
+		return false;
+	}
+
+	// Single sampled, so that the images are the same from one run to the next
+	genRenderbuffers(1, &HeadlessColorBuffer);
+	bindRenderbuffer(GL_RENDERBUFFER, HeadlessColorBuffer);
+	renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	genRenderbuffers(1, &HeadlessDepthBuffer);
+	bindRenderbuffer(GL_RENDERBUFFER, HeadlessDepthBuffer);
+	renderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	genFramebuffers(1, &HeadlessFramebuffer);
+	bindFramebuffer(GL_FRAMEBUFFER, HeadlessFramebuffer);
+	framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, HeadlessColorBuffer);
+	framebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, HeadlessDepthBuffer);
+	if (checkFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+		fprintf(stderr, "Incomplete headless framebuffer\n");
+		destroyContext();
+		return false;
+	}
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+void destroyHeadlessContext(){
+	if (HeadlessFramebuffer != 0){
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &HeadlessFramebuffer);
+		glDeleteRenderbuffers(1, &HeadlessColorBuffer);
+		glDeleteRenderbuffers(1, &HeadlessDepthBuffer);
+		HeadlessFramebuffer = 0;
+	}
+	destroyContext();
+}
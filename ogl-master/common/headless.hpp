@@ -0,0 +1,17 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+// OpenGL 3.3 core context without a window, for benchmarks and tests on machines without
+// a display (or without a GPU : Mesa's llvmpipe works).
+// Uses EGL with a surfaceless context when built with HAVE_EGL, else OSMesa with HAVE_OSMESA.
+// Everything is drawn into a framebuffer object of the given size, which stays bound.
+
+// Creates the context, makes it current and binds the framebuffer. Call glewInit after it.
+bool createHeadlessContext(int width, int height);
+
+// For the functions GLEW doesn't know about
+void * getHeadlessProcAddress(const char * name);
+
+void destroyHeadlessContext();
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+#include "idpicking.hpp"
+
+bool createIDPickBuffer(IDPickBuffer & buffer, int width, int height){
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.width = width;
+	buffer.height = height;
+	GLint previous = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+
+	glGenTextures(1, &buffer.idTexture);
+	glsBindTexture(GL_TEXTURE_2D, buffer.idTexture);
+	// Integer textures can't be filtered
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, width, height, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+
+	glGenRenderbuffers(1, &buffer.depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, buffer.depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	glGenFramebuffers(1, &buffer.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, buffer.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer.idTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, buffer.depthBuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	if (status != GL_FRAMEBUFFER_COMPLETE){
+		fprintf(stderr, "ID picking framebuffer incomplete (0x%x)\n", status);
+		deleteIDPickBuffer(buffer);
+		return false;
+	}
+	return true;
+}
+
+void deleteIDPickBuffer(IDPickBuffer & buffer){
+	if (buffer.framebuffer != 0)
+		glDeleteFramebuffers(1, &buffer.framebuffer);
+	if (buffer.depthBuffer != 0)
+		glDeleteRenderbuffers(1, &buffer.depthBuffer);
+	if (buffer.idTexture != 0)
+		glsDeleteTexture(buffer.idTexture);
+	buffer.framebuffer = 0;
+	buffer.depthBuffer = 0;
+	buffer.idTexture = 0;
+}
+
+void beginIDPickPass(IDPickBuffer & buffer){
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &buffer.previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, buffer.previousViewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, buffer.framebuffer);
+	glViewport(0, 0, buffer.width, buffer.height);
+	const GLuint background[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, background);
+	glsDepthMask(GL_TRUE);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void endIDPickPass(IDPickBuffer & buffer){
+	glBindFramebuffer(GL_FRAMEBUFFER, buffer.previousFramebuffer);
+	glViewport(buffer.previousViewport[0], buffer.previousViewport[1], buffer.previousViewport[2], buffer.previousViewport[3]);
+}
+
+void beginIDReadback(IDReadbackQueue & queue, const IDPickBuffer & buffer, int x, int y, int width, int height,
+	unsigned int request){
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = std::min(x + width, buffer.width), y1 = std::min(y + height, buffer.height);
+	IDReadback read;
+	read.request = request;
+	read.x = x0;
+	read.y = y0;
+	read.width = std::max(x1 - x0, 0);
+	read.height = std::max(y1 - y0, 0);
+	GLsizeiptr size = (GLsizeiptr)read.width * read.height * sizeof(PickID);
+	if (size > queue.bufferSize){
+		// Too small for this region : all the buffers are replaced as they come back
+		for (size_t i = 0; i < queue.freeBuffers.size(); i++)
+			glsDeleteBuffer(queue.freeBuffers[i]);
+		queue.freeBuffers.clear();
+		queue.bufferSize = size;
+	}
+	if (queue.freeBuffers.empty()){
+		GLuint pixelBuffer;
+		glGenBuffers(1, &pixelBuffer);
+		glsBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, queue.bufferSize, NULL, GL_STREAM_READ);
+		queue.freeBuffers.push_back(pixelBuffer);
+	}
+	read.pixelBuffer = queue.freeBuffers.back();
+	read.bufferSize = queue.bufferSize;
+	queue.freeBuffers.pop_back();
+
+	GLint previousRead = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, buffer.framebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glsBindBuffer(GL_PIXEL_PACK_BUFFER, read.pixelBuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	// With a pack buffer bound, the last argument is an offset in it : this returns at once
+	if (size > 0)
+		glReadPixels(read.x, read.y, read.width, read.height, GL_RG_INTEGER, GL_UNSIGNED_INT, (void *)0);
+	// Left unbound : the other glReadPixels of the program read to client memory
+	glsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+	read.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	queue.reads.push_back(read);
+}
+
+bool finishIDReadback(IDReadbackQueue & queue, IDReadbackResult & out_result){
+	if (queue.reads.empty())
+		return false;
+	IDReadback & read = queue.reads.front();
+	// Timeout 0 : only asks. The flush makes sure the fence gets to the GPU at some point.
+	GLenum status = glClientWaitSync(read.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+	glDeleteSync(read.fence);
+
+	out_result.request = read.request;
+	out_result.x = read.x;
+	out_result.y = read.y;
+	out_result.width = read.width;
+	out_result.height = read.height;
+	out_result.ids.resize(read.width * read.height);
+	if (!out_result.ids.empty()){
+		glsBindBuffer(GL_PIXEL_PACK_BUFFER, read.pixelBuffer);
+		const void * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, out_result.ids.size() * sizeof(PickID), GL_MAP_READ_BIT);
+		if (pixels != NULL){
+			memcpy(&out_result.ids[0], pixels, out_result.ids.size() * sizeof(PickID));
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		else {
+			memset(&out_result.ids[0], 0, out_result.ids.size() * sizeof(PickID));
+		}
+		glsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	if (read.bufferSize < queue.bufferSize)
+		glsDeleteBuffer(read.pixelBuffer);
+	else
+		queue.freeBuffers.push_back(read.pixelBuffer);
+	queue.reads.erase(queue.reads.begin());
+	return true;
+}
+
+bool idReadbacksPending(const IDReadbackQueue & queue){
+	return !queue.reads.empty();
+}
+
+void deleteIDReadbacks(IDReadbackQueue & queue){
+	for (size_t i = 0; i < queue.reads.size(); i++){
+		glDeleteSync(queue.reads[i].fence);
+		glsDeleteBuffer(queue.reads[i].pixelBuffer);
+	}
+	for (size_t i = 0; i < queue.freeBuffers.size(); i++)
+		glsDeleteBuffer(queue.freeBuffers[i]);
+	queue.reads.clear();
+	queue.freeBuffers.clear();
+	queue.bufferSize = 0;
+}
+
+const PickID * closestPickID(const IDReadbackResult & result, int x, int y){
+	const PickID * closest = NULL;
+	int closestDistance = 0;
+	for (int row = 0; row < result.height; row++){
+		for (int column = 0; column < result.width; column++){
+			const PickID & id = result.ids[row * result.width + column];
+			if (id.object == 0)
+				continue;
+			int dx = result.x + column - x;
+			int dy = result.y + row - y;
+			int distance = dx * dx + dy * dy;
+			if (closest == NULL || distance < closestDistance){
+				closest = &id;
+				closestDistance = distance;
+			}
+		}
+	}
+	return closest;
+}
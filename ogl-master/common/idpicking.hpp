@@ -0,0 +1,66 @@
+#ifndef IDPICKING_HPP
+#define IDPICKING_HPP
+
+// Picking on the GPU without stalling : the scene is drawn into an integer ID buffer, the pixels
+// under the cursor are copied into a pixel buffer object, and a fence tells when the copy is done.
+// The result is read one or two frames later, once the GPU got there, instead of waiting with glFinish.
+
+// What was drawn in a pixel of the ID buffer
+struct PickID {
+	GLuint object;      // identifier given by the draw, 0 : background
+	GLuint primitive;   // triangle (or line) in the draw
+};
+
+// RG32UI color (object, primitive) and a depth buffer
+struct IDPickBuffer {
+	GLuint framebuffer;
+	GLuint idTexture;
+	GLuint depthBuffer;
+	int width, height;
+	// Restored by endIDPickPass
+	GLint previousFramebuffer;
+	GLint previousViewport[4];
+};
+
+bool createIDPickBuffer(IDPickBuffer & buffer, int width, int height);
+void deleteIDPickBuffer(IDPickBuffer & buffer);
+
+// Binds the ID buffer and clears it to the background. The draws of the pass go in between.
+void beginIDPickPass(IDPickBuffer & buffer);
+// Back to the framebuffer and viewport bound before
+void endIDPickPass(IDPickBuffer & buffer);
+
+// A region of the ID buffer being copied
+struct IDReadback {
+	GLuint pixelBuffer;
+	GLsizeiptr bufferSize;
+	GLsync fence;
+	unsigned int request;    // given by the caller, to match the result with what asked for it
+	int x, y, width, height;
+};
+
+struct IDReadbackQueue {
+	std::vector<IDReadback> reads;     // oldest first
+	std::vector<GLuint> freeBuffers;   // pixel buffers of finished reads, reused
+	GLsizeiptr bufferSize;             // of every pixel buffer
+};
+
+struct IDReadbackResult {
+	unsigned int request;
+	int x, y, width, height;
+	std::vector<PickID> ids;           // width * height, rows from the bottom
+};
+
+// Starts copying a region of the ID buffer ((x, y) is its bottom left corner, clipped to the buffer),
+// after the draws issued so far. Doesn't wait.
+void beginIDReadback(IDReadbackQueue & queue, const IDPickBuffer & buffer, int x, int y, int width, int height,
+	unsigned int request);
+// The oldest read, if the GPU is done with it. Never waits : false when nothing is ready.
+bool finishIDReadback(IDReadbackQueue & queue, IDReadbackResult & out_result);
+bool idReadbacksPending(const IDReadbackQueue & queue);
+void deleteIDReadbacks(IDReadbackQueue & queue);
+
+// The pixel the closest to (x, y) which isn't background, or NULL
+const PickID * closestPickID(const IDReadbackResult & result, int x, int y);
+
+#endif
@@ -0,0 +1,73 @@
+#include <vector>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "glstate.hpp"
+#include "instancing.hpp"
+
+GLuint createInstanceBuffer(GLsizei maxInstances){
+	GLuint instanceBuffer;
+	glGenBuffers(1, &instanceBuffer);
+	glsBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, maxInstances * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+	return instanceBuffer;
+}
+
+void setupInstanceAttributes(GLuint instanceBuffer, GLuint firstLocation){
+	glsBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+	// A mat4 attribute takes 4 consecutive locations, one per column
+	for (GLuint column = 0; column < 4; column++){
+		GLuint location = firstLocation + column;
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(sizeof(glm::vec4) * column));
+		glEnableVertexAttribArray(location);
+		// Advance once per instance instead of once per vertex
+		glVertexAttribDivisor(location, 1);
+	}
+
+	GLuint tintLocation = firstLocation + 4;
+	glVertexAttribPointer(tintLocation, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+		(void*)sizeof(InstanceData::ModelMatrix));
+	glEnableVertexAttribArray(tintLocation);
+	glVertexAttribDivisor(tintLocation, 1);
+}
+
+void uploadInstances(GLuint instanceBuffer, GLsizei maxInstances, const std::vector<InstanceData> & instances){
+	if (instances.empty())
+		return;
+
+	GLsizei count = (GLsizei)instances.size();
+	if (count > maxInstances)
+		count = maxInstances;
+
+	glsBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	// Buffer orphaning : same size, NULL data. The draws still in flight keep the old storage.
+	glBufferData(GL_ARRAY_BUFFER, maxInstances * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceData), &instances[0]);
+}
+
+void buildInstanceGrid(std::vector<InstanceData> & out_instances, int count, float spacing){
+	out_instances.clear();
+	out_instances.reserve(count);
+
+	int side = (int)ceil(sqrt((float)count));
+	float offset = (side - 1) * spacing * 0.5f;
+
+	for (int i = 0; i < count; i++){
+		int row = i / side;
+		int col = i % side;
+
+		InstanceData instance;
+		instance.ModelMatrix = glm::translate(glm::mat4(1.0f),
+			glm::vec3(col * spacing - offset, 0.0f, row * spacing - offset));
+		// Cheap hash of the grid cell, so that neighbours get different tints
+		float h = (float)((i * 2654435761u) >> 24) / 255.0f;
+		instance.Tint = glm::vec4(0.7f + 0.3f * h, 0.7f + 0.3f * (1.0f - h), 0.85f, 1.0f);
+		out_instances.push_back(instance);
+	}
+}
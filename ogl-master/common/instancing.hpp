@@ -0,0 +1,29 @@
+#ifndef INSTANCING_HPP
+#define INSTANCING_HPP
+
+// What each copy of an instanced mesh gets. One of these per instance is stored
+// in the instance buffer and fetched with glVertexAttribDivisor(location, 1).
+struct InstanceData {
+	glm::mat4 ModelMatrix;
+	glm::vec4 Tint;
+};
+
+// Number of attribute locations used by InstanceData (4 for the matrix columns, 1 for the tint)
+const GLuint InstanceAttributeCount = 5;
+
+// Create a buffer able to hold maxInstances InstanceData
+GLuint createInstanceBuffer(GLsizei maxInstances);
+
+// Point the attributes [firstLocation, firstLocation + InstanceAttributeCount) of the
+// currently bound VAO to instanceBuffer, advancing once per instance
+void setupInstanceAttributes(GLuint instanceBuffer, GLuint firstLocation);
+
+// Replace the content of the instance buffer. The old storage is orphaned first,
+// so the driver doesn't have to wait for the previous frame's draws.
+void uploadInstances(GLuint instanceBuffer, GLsizei maxInstances, const std::vector<InstanceData> & instances);
+
+// Lay out count instances on a square grid in the XZ plane, centered on the origin,
+// each one with a slightly different tint so that they can be told apart
+void buildInstanceGrid(std::vector<InstanceData> & out_instances, int count, float spacing);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <vector>
+#include <map>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "profiler.hpp"
+#include "arena.hpp"
+#include "jobs.hpp"
+
+std::vector<std::thread> JobWorkers;
+
+// The loop being run. Set by parallelFor under JobMutex before the workers are woken up.
+std::mutex JobMutex;
+std::condition_variable JobStartCondition;
+std::condition_variable JobDoneCondition;
+const JobFunction * JobCurrent = NULL;
+unsigned int JobCount = 0;
+unsigned int JobBatchSize = 1;
+unsigned int JobBatches = 0;
+unsigned long long JobGeneration = 0; // one per loop, so that a worker never runs a loop twice
+bool JobQuit = false;
+unsigned int JobActive = 0;           // workers inside runBatches : the counters can't be reset under them
+std::atomic<unsigned int> JobNextBatch(0);
+std::atomic<unsigned int> JobBatchesDone(0);
+
+// Takes batches until there are none left
+static void runBatches(const JobFunction & job, unsigned int thread){
+	while (true){
+		unsigned int batch = JobNextBatch.fetch_add(1);
+		if (batch >= JobBatches)
+			return;
+		unsigned int begin = batch * JobBatchSize;
+		unsigned int end = begin + JobBatchSize < JobCount ? begin + JobBatchSize : JobCount;
+		{
+			// What a batch takes from its thread's arena is given back when it ends
+			ArenaScope scope(threadArena());
+			job(begin, end, thread);
+		}
+		if (JobBatchesDone.fetch_add(1) + 1 == JobBatches){
+			// The last one : the caller may be waiting
+			std::lock_guard<std::mutex> lock(JobMutex);
+			JobDoneCondition.notify_all();
+		}
+	}
+}
+
+static void workerMain(unsigned int thread){
+	char name[32];
+	sprintf(name, "Worker %u", thread);
+	setProfilerThreadName(name);
+	unsigned long long seen = 0;
+	while (true){
+		const JobFunction * job;
+		{
+			std::unique_lock<std::mutex> lock(JobMutex);
+			while (!JobQuit && JobGeneration == seen)
+				JobStartCondition.wait(lock);
+			if (JobQuit)
+				return;
+			seen = JobGeneration;
+			job = JobCurrent;
+			JobActive++;
+		}
+		runBatches(*job, thread);
+		std::lock_guard<std::mutex> lock(JobMutex);
+		if (--JobActive == 0)
+			JobDoneCondition.notify_all();
+	}
+}
+
+void initJobs(unsigned int workerCount){
+	JobQuit = false;
+	for (unsigned int i = 0; i < workerCount; i++)
+		JobWorkers.push_back(std::thread(workerMain, i + 1));
+}
+
+unsigned int jobThreadCount(){
+	return (unsigned int)JobWorkers.size() + 1;
+}
+
+void parallelFor(unsigned int count, unsigned int batchSize, const JobFunction & job){
+	if (count == 0)
+		return;
+	if (batchSize == 0)
+		batchSize = 1;
+	unsigned int batches = (count + batchSize - 1) / batchSize;
+	// Not worth waking anybody up
+	if (JobWorkers.empty() || batches == 1){
+		for (unsigned int begin = 0; begin < count; begin += batchSize){
+			ArenaScope scope(threadArena());
+			job(begin, begin + batchSize < count ? begin + batchSize : count, 0);
+		}
+		return;
+	}
+	{
+		// Workers late for the previous loop only find that it has no batches left
+		std::unique_lock<std::mutex> lock(JobMutex);
+		while (JobActive > 0)
+			JobDoneCondition.wait(lock);
+		JobCurrent = &job;
+		JobCount = count;
+		JobBatchSize = batchSize;
+		JobBatches = batches;
+		JobNextBatch = 0;
+		JobBatchesDone = 0;
+		JobGeneration++;
+	}
+	JobStartCondition.notify_all();
+	runBatches(job, 0);
+	// A worker may still be in its last batch
+	std::unique_lock<std::mutex> lock(JobMutex);
+	while (JobBatchesDone < batches)
+		JobDoneCondition.wait(lock);
+}
+
+void cleanupJobs(){
+	{
+		std::lock_guard<std::mutex> lock(JobMutex);
+		JobQuit = true;
+	}
+	JobStartCondition.notify_all();
+	for (size_t i = 0; i < JobWorkers.size(); i++)
+		JobWorkers[i].join();
+	JobWorkers.clear();
+}
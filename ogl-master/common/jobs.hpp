@@ -0,0 +1,21 @@
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+// A pool of worker threads for data-parallel loops over the scene.
+// The thread calling parallelFor works too, so 0 workers means everything runs on it.
+// Only one thread (the main thread) starts loops, one at a time.
+
+// Range [begin, end) of the loop, and the thread running it, in [0, jobThreadCount())
+typedef std::function<void(unsigned int begin, unsigned int end, unsigned int thread)> JobFunction;
+
+void initJobs(unsigned int workerCount);
+// Workers, plus the calling thread
+unsigned int jobThreadCount();
+
+// Calls job over [0, count) in batches of batchSize, on all the threads, and returns once all the
+// batches are done. The batches are taken in any order : a job must only write what its range owns.
+void parallelFor(unsigned int count, unsigned int batchSize, const JobFunction & job);
+
+void cleanupJobs();
+
+#endif
@@ -0,0 +1,75 @@
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mappedfile.hpp"
+
+bool mapFile(const char * path, MappedFile & out_file){
+	out_file.data = NULL;
+	out_file.size = 0;
+	out_file.handle = NULL;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0){
+		CloseHandle(file);
+		return false;
+	}
+	// The mapping keeps the file open
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL)
+		return false;
+	void * data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL){
+		CloseHandle(mapping);
+		return false;
+	}
+	out_file.data = (const unsigned char *)data;
+	out_file.size = (size_t)size.QuadPart;
+	out_file.handle = mapping;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size <= 0){
+		close(file);
+		return false;
+	}
+	void * data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps the file open
+	close(file);
+	if (data == MAP_FAILED)
+		return false;
+	// Read far ahead : the whole file is about to be read, front to back
+	madvise(data, (size_t)status.st_size, MADV_SEQUENTIAL);
+	madvise(data, (size_t)status.st_size, MADV_WILLNEED);
+	out_file.data = (const unsigned char *)data;
+	out_file.size = (size_t)status.st_size;
+#endif
+	return true;
+}
+
+void unmapFile(MappedFile & file){
+	if (file.data == NULL)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle((HANDLE)file.handle);
+#else
+	munmap((void *)file.data, file.size);
+#endif
+	file.data = NULL;
+	file.size = 0;
+	file.handle = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+// A whole file mapped read only into memory : its pages are read from the disk (or the OS cache) as
+// they are touched, without being copied into a buffer of ours first.
+// Any thread : a file mapped on one can be read and unmapped on another.
+
+struct MappedFile {
+	const unsigned char * data;   // NULL when not mapped
+	size_t size;
+	void * handle;                // the file mapping object on Windows
+};
+
+// false if the file can't be opened, or is empty. The pages are read ahead, in order.
+bool mapFile(const char * path, MappedFile & out_file);
+// Nothing if it isn't mapped
+void unmapFile(MappedFile & file);
+
+#endif
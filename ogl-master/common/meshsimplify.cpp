@@ -0,0 +1,503 @@
+#include <vector>
+#include <map>
+#include <queue>
+#include <algorithm>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#include "meshsimplify.hpp"
+
+// Symmetric 4x4 matrix, upper triangle : a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+struct Quadric {
+	double a[10];
+};
+
+static void clearQuadric(Quadric & q){
+	for (int i = 0; i < 10; i++) q.a[i] = 0.0;
+}
+
+// Adds weight * (squared distance to the plane n.p + d = 0)
+static void addPlane(Quadric & q, const glm::dvec3 & n, double d, double weight){
+	q.a[0] += weight * n.x * n.x; q.a[1] += weight * n.x * n.y; q.a[2] += weight * n.x * n.z; q.a[3] += weight * n.x * d;
+	q.a[4] += weight * n.y * n.y; q.a[5] += weight * n.y * n.z; q.a[6] += weight * n.y * d;
+	q.a[7] += weight * n.z * n.z; q.a[8] += weight * n.z * d;
+	q.a[9] += weight * d * d;
+}
+
+static void addQuadric(Quadric & q, const Quadric & other){
+	for (int i = 0; i < 10; i++) q.a[i] += other.a[i];
+}
+
+static double evaluate(const Quadric & q, const glm::vec3 & p){
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a[0]*x*x + 2*q.a[1]*x*y + 2*q.a[2]*x*z + 2*q.a[3]*x
+	         + q.a[4]*y*y + 2*q.a[5]*y*z + 2*q.a[6]*y
+	         + q.a[7]*z*z + 2*q.a[8]*z
+	         + q.a[9];
+	return e > 0.0 ? e : 0.0;
+}
+
+// What a vertex (a position, with all the vertices sharing it) is allowed to do
+enum VertexKind {
+	KIND_MANIFOLD, // interior vertex, collapses anywhere
+	KIND_BORDER,   // on the border of the mesh, collapses along the border
+	KIND_SEAM,     // on a UV seam, collapses along the seam
+	KIND_LOCKED    // corner, non-manifold, several seams... : never moves
+};
+
+// Weight of the planes which keep borders and seams in place
+static const double BorderWeight = 10.0;
+
+struct Collapse {
+	double cost;
+	unsigned int from, to;          // positions
+	unsigned int fromVersion, toVersion;
+	bool operator<(const Collapse & other) const { return cost > other.cost; } // min-heap
+};
+
+struct Simplifier {
+	const std::vector<glm::vec3> * positions;
+	const std::vector<glm::vec2> * uvs;
+	std::vector<unsigned int> triangles;          // attribute vertex indices, 3 per triangle
+	std::vector<bool> triangleAlive;
+	unsigned int aliveTriangles;
+
+	std::vector<unsigned int> positionOf;         // attribute vertex -> position id
+	std::vector<std::vector<unsigned int> > trianglesOf; // position id -> triangles (may contain dead ones)
+	std::vector<unsigned int> representative;     // position id -> one attribute vertex, for the coordinates
+	std::vector<VertexKind> kind;
+	std::vector<Quadric> quadrics;
+	std::vector<unsigned int> version;
+	std::vector<bool> removed;
+
+	std::priority_queue<Collapse> heap;
+	double maxError;
+
+	const glm::vec3 & position(unsigned int p) const { return (*positions)[representative[p]]; }
+	const glm::vec2 & uv(unsigned int w) const { return (*uvs)[w]; }
+	unsigned int cornerPosition(unsigned int t, int c) const { return positionOf[triangles[3*t+c]]; }
+	int cornerOf(unsigned int t, unsigned int p) const {
+		for (int c = 0; c < 3; c++){
+			if (cornerPosition(t, c) == p) return c;
+		}
+		return -1;
+	}
+};
+
+static glm::dvec3 triangleNormal(const glm::vec3 & a, const glm::vec3 & b, const glm::vec3 & c){
+	return glm::cross(glm::dvec3(b - a), glm::dvec3(c - a));
+}
+
+// Live triangles that use both positions p and q. Returns how many there are, keeps the first two.
+static int sharedTriangles(const Simplifier & s, unsigned int p, unsigned int q, unsigned int out_shared[2]){
+	int count = 0;
+	const std::vector<unsigned int> & tris = s.trianglesOf[p];
+	for (size_t i = 0; i < tris.size(); i++){
+		unsigned int t = tris[i];
+		if (!s.triangleAlive[t] || s.cornerOf(t, q) < 0) continue;
+		if (count < 2) out_shared[count] = t;
+		count++;
+	}
+	return count;
+}
+
+// An edge is on a UV seam when its two triangles don't agree on the UVs of its ends
+static bool isSeamEdge(const Simplifier & s, unsigned int p, unsigned int q){
+	unsigned int shared[2];
+	if (sharedTriangles(s, p, q, shared) != 2)
+		return false;
+	for (int e = 0; e < 2; e++){
+		unsigned int end = e ? q : p;
+		if (s.uv(s.triangles[3*shared[0] + s.cornerOf(shared[0], end)]) != s.uv(s.triangles[3*shared[1] + s.cornerOf(shared[1], end)]))
+			return true;
+	}
+	return false;
+}
+
+// For each attribute vertex of `from`, the attribute vertex of `to` it merges into : the one across
+// a triangle edge, or else one across an edge with the same UVs (normals may differ from corner to corner).
+// Returns false if one of them has no counterpart, which would tear the UVs.
+static bool mapWedges(const Simplifier & s, unsigned int from, unsigned int to, std::vector<std::pair<unsigned int, unsigned int> > & out_map){
+	out_map.clear();
+	const std::vector<unsigned int> & tris = s.trianglesOf[from];
+	for (size_t i = 0; i < tris.size(); i++){
+		unsigned int t = tris[i];
+		if (!s.triangleAlive[t]) continue;
+		unsigned int wedge = s.triangles[3*t + s.cornerOf(t, from)];
+		bool known = false;
+		for (size_t m = 0; m < out_map.size() && !known; m++)
+			known = out_map[m].first == wedge;
+		if (known) continue;
+
+		int target = -1;
+		for (int pass = 0; pass < 2 && target < 0; pass++){
+			for (size_t j = 0; j < tris.size() && target < 0; j++){
+				unsigned int t2 = tris[j];
+				if (!s.triangleAlive[t2]) continue;
+				int toCorner = s.cornerOf(t2, to);
+				if (toCorner < 0) continue;
+				unsigned int fromWedge = s.triangles[3*t2 + s.cornerOf(t2, from)];
+				bool match = pass == 0 ? fromWedge == wedge : s.uv(fromWedge) == s.uv(wedge);
+				if (match) target = (int)s.triangles[3*t2 + toCorner];
+			}
+		}
+		if (target < 0)
+			return false;
+		out_map.push_back(std::make_pair(wedge, (unsigned int)target));
+	}
+	// Both sides of a seam must stay apart
+	for (size_t a = 0; a < out_map.size(); a++){
+		for (size_t b = a + 1; b < out_map.size(); b++){
+			if (s.uv(out_map[a].first) != s.uv(out_map[b].first) && s.uv(out_map[a].second) == s.uv(out_map[b].second))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool canCollapse(const Simplifier & s, unsigned int from, unsigned int to){
+	switch (s.kind[from]){
+	case KIND_MANIFOLD:
+		return true;
+	case KIND_BORDER: {
+		// Along a border edge only, so that the outline doesn't change
+		unsigned int shared[2];
+		return s.kind[to] == KIND_BORDER && sharedTriangles(s, from, to, shared) == 1;
+	}
+	case KIND_SEAM:
+		// Along the seam only, so that both sides of it keep matching
+		return s.kind[to] == KIND_SEAM && isSeamEdge(s, from, to);
+	default:
+		return false;
+	}
+}
+
+static void pushCollapses(Simplifier & s, unsigned int p){
+	const std::vector<unsigned int> & tris = s.trianglesOf[p];
+	for (size_t i = 0; i < tris.size(); i++){
+		unsigned int t = tris[i];
+		if (!s.triangleAlive[t]) continue;
+		for (int c = 0; c < 3; c++){
+			unsigned int q = s.cornerPosition(t, c);
+			if (q == p) continue;
+			// Both directions : p -> q and q -> p
+			for (int dir = 0; dir < 2; dir++){
+				unsigned int from = dir ? q : p;
+				unsigned int to = dir ? p : q;
+				if (!canCollapse(s, from, to)) continue;
+				Quadric q2 = s.quadrics[from];
+				addQuadric(q2, s.quadrics[to]);
+				Collapse collapse;
+				collapse.cost = evaluate(q2, s.position(to));
+				collapse.from = from;
+				collapse.to = to;
+				collapse.fromVersion = s.version[from];
+				collapse.toVersion = s.version[to];
+				s.heap.push(collapse);
+			}
+		}
+	}
+}
+
+// Would moving `from` onto `to` flip or squash one of the triangles around `from` ?
+static bool flipsTriangles(const Simplifier & s, unsigned int from, unsigned int to){
+	const glm::vec3 & target = s.position(to);
+	const std::vector<unsigned int> & tris = s.trianglesOf[from];
+	for (size_t i = 0; i < tris.size(); i++){
+		unsigned int t = tris[i];
+		if (!s.triangleAlive[t]) continue;
+		glm::vec3 corners[3];
+		bool hasTo = false;
+		for (int c = 0; c < 3; c++){
+			unsigned int p = s.cornerPosition(t, c);
+			if (p == to) hasTo = true;
+			corners[c] = s.position(p);
+		}
+		if (hasTo) continue; // this one disappears
+		glm::dvec3 before = triangleNormal(corners[0], corners[1], corners[2]);
+		for (int c = 0; c < 3; c++){
+			if (s.cornerPosition(t, c) == from) corners[c] = target;
+		}
+		glm::dvec3 after = triangleNormal(corners[0], corners[1], corners[2]);
+		double lengths = glm::length(before) * glm::length(after);
+		if (lengths <= 0.0 || glm::dot(before, after) < 0.25 * lengths)
+			return true;
+	}
+	return false;
+}
+
+// What is known about an edge, in position space
+struct EdgeInfo {
+	int triangles;
+	glm::vec2 uvA, uvB; // UVs of the ends, as seen by the first triangle
+	bool seam;
+};
+
+static void initSimplifier(Simplifier & s, const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec2> & uvs, const std::vector<unsigned short> & indices){
+	s.positions = &positions;
+	s.uvs = &uvs;
+	s.triangles.assign(indices.begin(), indices.end());
+	size_t triangleCount = indices.size() / 3;
+	s.triangleAlive.assign(triangleCount, true);
+	s.aliveTriangles = (unsigned int)triangleCount;
+	s.maxError = 0.0;
+
+	// Weld the vertices that share a position : they are the corners of the same point
+	std::map<std::pair<std::pair<float, float>, float>, unsigned int> positionIds;
+	s.positionOf.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++){
+		std::pair<std::pair<float, float>, float> key(std::make_pair(positions[i].x, positions[i].y), positions[i].z);
+		std::map<std::pair<std::pair<float, float>, float>, unsigned int>::iterator it = positionIds.find(key);
+		if (it == positionIds.end()){
+			unsigned int id = (unsigned int)s.representative.size();
+			positionIds[key] = id;
+			s.representative.push_back((unsigned int)i);
+			s.positionOf[i] = id;
+		}
+		else {
+			s.positionOf[i] = it->second;
+		}
+	}
+	size_t positionCount = s.representative.size();
+	s.trianglesOf.resize(positionCount);
+	s.quadrics.resize(positionCount);
+	s.version.assign(positionCount, 0);
+	s.removed.assign(positionCount, false);
+	s.kind.assign(positionCount, KIND_MANIFOLD);
+	for (size_t p = 0; p < positionCount; p++)
+		clearQuadric(s.quadrics[p]);
+
+	// Face planes, and the edges
+	std::map<std::pair<unsigned int, unsigned int>, EdgeInfo> edges;
+	std::vector<std::vector<glm::vec2> > uvClasses(positionCount); // distinct UVs at each position
+	for (size_t t = 0; t < triangleCount; t++){
+		unsigned int p[3], w[3];
+		for (int c = 0; c < 3; c++){
+			w[c] = s.triangles[3*t+c];
+			p[c] = s.positionOf[w[c]];
+		}
+		if (p[0] == p[1] || p[1] == p[2] || p[2] == p[0]){
+			s.triangleAlive[t] = false;
+			s.aliveTriangles--;
+			continue;
+		}
+		for (int c = 0; c < 3; c++){
+			s.trianglesOf[p[c]].push_back((unsigned int)t);
+			std::vector<glm::vec2> & classes = uvClasses[p[c]];
+			if (std::find(classes.begin(), classes.end(), uvs[w[c]]) == classes.end())
+				classes.push_back(uvs[w[c]]);
+		}
+		glm::dvec3 n = triangleNormal(positions[w[0]], positions[w[1]], positions[w[2]]);
+		double length = glm::length(n);
+		if (length > 0.0){
+			n /= length;
+			double d = -glm::dot(n, glm::dvec3(positions[w[0]]));
+			for (int c = 0; c < 3; c++)
+				addPlane(s.quadrics[p[c]], n, d, 1.0);
+		}
+		for (int c = 0; c < 3; c++){
+			unsigned int a = w[c], b = w[(c+1)%3];
+			if (p[c] > p[(c+1)%3]) std::swap(a, b);
+			std::pair<unsigned int, unsigned int> key(s.positionOf[a], s.positionOf[b]);
+			std::map<std::pair<unsigned int, unsigned int>, EdgeInfo>::iterator it = edges.find(key);
+			if (it == edges.end()){
+				EdgeInfo info;
+				info.triangles = 1;
+				info.uvA = uvs[a];
+				info.uvB = uvs[b];
+				info.seam = false;
+				edges[key] = info;
+			}
+			else {
+				it->second.triangles++;
+				if (it->second.uvA != uvs[a] || it->second.uvB != uvs[b])
+					it->second.seam = true;
+			}
+		}
+	}
+
+	// Classify the vertices from their edges, and keep the borders and seams in place with
+	// planes through the edge, perpendicular to the triangle
+	std::vector<int> borderEdges(positionCount, 0), seamEdges(positionCount, 0);
+	std::vector<bool> nonManifold(positionCount, false);
+	for (size_t t = 0; t < triangleCount; t++){
+		if (!s.triangleAlive[t]) continue;
+		for (int c = 0; c < 3; c++){
+			unsigned int wa = s.triangles[3*t+c], wb = s.triangles[3*t+(c+1)%3];
+			unsigned int a = s.positionOf[wa], b = s.positionOf[wb];
+			const EdgeInfo & info = edges[std::make_pair(std::min(a, b), std::max(a, b))];
+			bool border = info.triangles == 1;
+			bool seam = info.triangles == 2 && info.seam;
+			if (info.triangles > 2)
+				nonManifold[a] = nonManifold[b] = true;
+			if (!border && !seam)
+				continue;
+			// A seam edge is seen from its two triangles, a border edge from its only one
+			if (border){ borderEdges[a]++; borderEdges[b]++; }
+			else { seamEdges[a]++; seamEdges[b]++; }
+
+			const glm::vec3 & pa = positions[wa];
+			const glm::vec3 & pb = positions[wb];
+			const glm::vec3 & pc = positions[s.triangles[3*t+(c+2)%3]];
+			glm::dvec3 n = glm::cross(glm::dvec3(pb - pa), triangleNormal(pa, pb, pc));
+			double length = glm::length(n);
+			if (length > 0.0){
+				n /= length;
+				double d = -glm::dot(n, glm::dvec3(pa));
+				addPlane(s.quadrics[a], n, d, BorderWeight);
+				addPlane(s.quadrics[b], n, d, BorderWeight);
+			}
+		}
+	}
+	for (size_t p = 0; p < positionCount; p++){
+		size_t classes = uvClasses[p].size();
+		int seams = seamEdges[p] / 2;
+		if (nonManifold[p] || classes == 0 || classes > 2)
+			s.kind[p] = KIND_LOCKED;
+		else if (classes == 1 && borderEdges[p] == 0 && seams == 0)
+			s.kind[p] = KIND_MANIFOLD;
+		else if (classes == 1 && borderEdges[p] == 2 && seams == 0)
+			s.kind[p] = KIND_BORDER;
+		else if (classes == 2 && borderEdges[p] == 0 && seams == 2)
+			s.kind[p] = KIND_SEAM;
+		else
+			s.kind[p] = KIND_LOCKED;
+	}
+
+	for (size_t p = 0; p < positionCount; p++){
+		if (!s.trianglesOf[p].empty())
+			pushCollapses(s, (unsigned int)p);
+	}
+}
+
+static void collapse(Simplifier & s, unsigned int from, unsigned int to,
+	const std::vector<std::pair<unsigned int, unsigned int> > & wedgeMap){
+	std::vector<unsigned int> & tris = s.trianglesOf[from];
+	for (size_t i = 0; i < tris.size(); i++){
+		unsigned int t = tris[i];
+		if (!s.triangleAlive[t]) continue;
+		bool hasTo = false;
+		for (int c = 0; c < 3; c++){
+			if (s.cornerPosition(t, c) == to) hasTo = true;
+		}
+		if (hasTo){
+			// The triangles on the collapsed edge disappear
+			s.triangleAlive[t] = false;
+			s.aliveTriangles--;
+			continue;
+		}
+		for (int c = 0; c < 3; c++){
+			unsigned int & w = s.triangles[3*t+c];
+			for (size_t m = 0; m < wedgeMap.size(); m++){
+				if (w == wedgeMap[m].first){
+					w = wedgeMap[m].second;
+					break;
+				}
+			}
+		}
+		s.trianglesOf[to].push_back(t);
+	}
+	for (size_t m = 0; m < wedgeMap.size(); m++)
+		s.positionOf[wedgeMap[m].first] = to;
+	tris.clear();
+	s.removed[from] = true;
+	addQuadric(s.quadrics[to], s.quadrics[from]);
+	s.version[to]++;
+
+	// Drop the dead triangles from the list of `to`, so that it doesn't grow forever
+	std::vector<unsigned int> & toTris = s.trianglesOf[to];
+	size_t kept = 0;
+	for (size_t i = 0; i < toTris.size(); i++){
+		if (s.triangleAlive[toTris[i]]) toTris[kept++] = toTris[i];
+	}
+	toTris.resize(kept);
+	std::sort(toTris.begin(), toTris.end());
+	toTris.erase(std::unique(toTris.begin(), toTris.end()), toTris.end());
+
+	pushCollapses(s, to);
+}
+
+float simplifyMesh(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<unsigned short> & indices,
+	size_t targetIndexCount,
+	std::vector<unsigned short> & out_indices
+){
+	Simplifier s;
+	initSimplifier(s, positions, uvs, indices);
+
+	unsigned int targetTriangles = (unsigned int)(targetIndexCount / 3);
+	std::vector<std::pair<unsigned int, unsigned int> > wedgeMap;
+	while (s.aliveTriangles > targetTriangles && !s.heap.empty()){
+		Collapse c = s.heap.top();
+		s.heap.pop();
+		// Stale entries : one of the two ends changed since this was computed
+		if (s.removed[c.from] || s.removed[c.to]) continue;
+		if (c.fromVersion != s.version[c.from] || c.toVersion != s.version[c.to]) continue;
+		if (!canCollapse(s, c.from, c.to)) continue;
+		if (!mapWedges(s, c.from, c.to, wedgeMap)) continue;
+		if (flipsTriangles(s, c.from, c.to)) continue;
+		collapse(s, c.from, c.to, wedgeMap);
+		s.maxError = std::max(s.maxError, c.cost);
+	}
+
+	out_indices.clear();
+	for (size_t t = 0; t < s.triangleAlive.size(); t++){
+		if (!s.triangleAlive[t]) continue;
+		for (int c = 0; c < 3; c++)
+			out_indices.push_back((unsigned short)s.triangles[3*t+c]);
+	}
+	return (float)sqrt(s.maxError);
+}
+
+void buildLODChain(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<unsigned short> & indices,
+	unsigned int maxLevels,
+	std::vector<unsigned short> & out_indices,
+	std::vector<LODLevel> & out_levels
+){
+	out_indices = indices;
+	out_levels.clear();
+	LODLevel level0;
+	level0.firstIndex = 0;
+	level0.indexCount = (unsigned int)indices.size();
+	level0.error = 0.0f;
+	out_levels.push_back(level0);
+
+	std::vector<unsigned short> previous = indices;
+	std::vector<unsigned short> simplified;
+	float error = 0.0f;
+	while (out_levels.size() < maxLevels && previous.size() > 3 * 64){
+		// Each level starts from the previous one : errors add up
+		float levelError = simplifyMesh(positions, uvs, previous, previous.size() / 2, simplified);
+		// Stuck on borders and seams : more levels would be the same
+		if (simplified.size() > previous.size() * 9 / 10)
+			break;
+		error += levelError;
+		LODLevel level;
+		level.firstIndex = (unsigned int)out_indices.size();
+		level.indexCount = (unsigned int)simplified.size();
+		level.error = error;
+		out_levels.push_back(level);
+		out_indices.insert(out_indices.end(), simplified.begin(), simplified.end());
+		previous.swap(simplified);
+	}
+}
+
+int selectLOD(const std::vector<LODLevel> & levels, float distance, float projectionScale, float maxPixelError){
+	if (distance <= 0.0f)
+		return 0;
+	int selected = 0;
+	for (size_t i = 1; i < levels.size(); i++){
+		float pixels = levels[i].error * projectionScale / distance;
+		if (pixels > maxPixelError)
+			break;
+		selected = (int)i;
+	}
+	return selected;
+}
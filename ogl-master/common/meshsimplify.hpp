@@ -0,0 +1,42 @@
+#ifndef MESHSIMPLIFY_HPP
+#define MESHSIMPLIFY_HPP
+
+// Reduce an indexed triangle mesh to about targetIndexCount indices, by collapsing edges
+// in the order given by the quadric error metric (Garland & Heckbert).
+// Vertices are never moved or created : an edge collapses onto one of its two vertices, and
+// the result indexes the same vertex buffer, with all its attributes intact.
+// - Vertices on the border of the mesh only slide along the border.
+// - Vertices on a UV seam (same position, different UVs) only slide along the seam, on both sides at once.
+// Returns the error reached, roughly a distance in model space.
+float simplifyMesh(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<unsigned short> & indices,
+	size_t targetIndexCount,
+	std::vector<unsigned short> & out_indices
+);
+
+// One level of detail : a range of an index buffer
+struct LODLevel {
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	float error; // geometric error, in model space
+};
+
+// Build a chain of levels of detail, each one with about half the triangles of the previous one.
+// out_indices receives indices (level 0) followed by each simplified level.
+void buildLODChain(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<unsigned short> & indices,
+	unsigned int maxLevels,
+	std::vector<unsigned short> & out_indices,
+	std::vector<LODLevel> & out_levels
+);
+
+// Coarsest level whose error, projected on the screen, stays under maxPixelError.
+// distance is the distance from the camera to the object, projectionScale is
+// viewportHeight / (2 * tan(fovy / 2)), i.e. viewportHeight * P[1][1] / 2.
+int selectLOD(const std::vector<LODLevel> & levels, float distance, float projectionScale, float maxPixelError);
+
+#endif
@@ -0,0 +1,333 @@
+#include <stddef.h>
+#include <math.h>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MIPMAP_SSE
+#endif
+
+#include "mipmap.hpp"
+
+// Half width of the Kaiser filter, in texels of the new level, and its shape
+const float KaiserRadius = 3.0f;
+const float KaiserBeta = 4.0f;
+// Rows of a level buildMipChain gives downsampleRows at a time : the source rows they read are
+// converted to linear once for all of them
+const int MipStripRows = 32;
+
+// Samples of the Kaiser filter over [0, KaiserRadius]
+const int KaiserSamples = 4096;
+
+// 8-bit values to [0, 1], linear light for sRGB, and back from [0, 1] in 4096 steps (finer than a step
+// of 8-bit sRGB anywhere). Plus the Kaiser filter, which is slow to evaluate.
+struct ColorTables {
+	float fromSRGB[256];
+	float fromUnorm[256];
+	unsigned char toSRGB[4096];
+	unsigned char toUnorm[4096];
+	float kaiser[KaiserSamples + 1];
+};
+
+// Source texels of each texel of the new level along one axis, the same count for each, and their weights.
+// The indices are clamped to the image : the edge texels count again where the filter runs over.
+struct FilterTaps {
+	int count;
+	std::vector<int> index;       // targetSize * count
+	std::vector<float> weight;
+};
+
+// Modified Bessel function of the first kind, order 0
+static float besselI0(float x){
+	float sum = 1.0f, term = 1.0f;
+	for (int k = 1; k < 20; k++){
+		term *= (x / (2.0f * k)) * (x / (2.0f * k));
+		sum += term;
+	}
+	return sum;
+}
+
+// t in texels of the new level
+static float kaiser(float t){
+	if (fabsf(t) >= KaiserRadius)
+		return 0.0f;
+	float sinc = t == 0.0f ? 1.0f : sinf(3.14159265f * t) / (3.14159265f * t);
+	float r = t / KaiserRadius;
+	return sinc * besselI0(KaiserBeta * sqrtf(1.0f - r * r)) / besselI0(KaiserBeta);
+}
+
+static ColorTables makeColorTables(){
+	ColorTables tables;
+	for (int i = 0; i < 256; i++){
+		float c = i / 255.0f;
+		tables.fromSRGB[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		tables.fromUnorm[i] = c;
+	}
+	for (int i = 0; i < 4096; i++){
+		float l = i / 4095.0f;
+		float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+		tables.toSRGB[i] = (unsigned char)(c * 255.0f + 0.5f);
+		tables.toUnorm[i] = (unsigned char)(l * 255.0f + 0.5f);
+	}
+	for (int i = 0; i <= KaiserSamples; i++)
+		tables.kaiser[i] = kaiser(i * KaiserRadius / KaiserSamples);
+	return tables;
+}
+
+static const ColorTables & colorTables(){
+	// Made by the first thread to get here, the others wait for it
+	static const ColorTables tables = makeColorTables();
+	return tables;
+}
+
+// For the texels [0, end) of the target : the columns, or the rows up to the last one asked for
+static void makeTaps(int sourceSize, int targetSize, int end, MipFilter filter, const ColorTables & tables,
+	FilterTaps & taps){
+	if (sourceSize == targetSize){
+		// A side already 1 texel long
+		taps.count = 1;
+		taps.index.assign(end, 0);
+		taps.weight.assign(end, 1.0f);
+		for (int i = 0; i < end; i++)
+			taps.index[i] = i;
+		return;
+	}
+	// Texels of the source per texel of the target : 2, or a little more for an odd size
+	float scale = (float)sourceSize / targetSize;
+	float radius = filter == MIP_BOX ? scale * 0.5f : KaiserRadius * scale;
+	// The most texels any [center - radius, center + radius] overlaps
+	taps.count = 1;
+	for (int i = 0; i < end; i++){
+		float center = (i + 0.5f) * scale;
+		int span = (int)ceilf(center + radius) - (int)floorf(center - radius);
+		taps.count = span > taps.count ? span : taps.count;
+	}
+	taps.index.resize((size_t)end * taps.count);
+	taps.weight.resize((size_t)end * taps.count);
+	for (int i = 0; i < end; i++){
+		float center = (i + 0.5f) * scale;
+		int first = (int)floorf(center - radius);
+		float total = 0.0f;
+		for (int k = 0; k < taps.count; k++){
+			int j = first + k;
+			float w;
+			if (filter == MIP_BOX){
+				// How much of the texel is under the box
+				float low = j > center - radius ? j : center - radius;
+				float high = j + 1 < center + radius ? j + 1 : center + radius;
+				w = high > low ? high - low : 0.0f;
+			}
+			else {
+				float t = fabsf(j + 0.5f - center) / scale;
+				w = t < KaiserRadius ? tables.kaiser[(int)(t * (KaiserSamples / KaiserRadius) + 0.5f)] : 0.0f;
+			}
+			taps.index[(size_t)i * taps.count + k] = j < 0 ? 0 : (j >= sourceSize ? sourceSize - 1 : j);
+			taps.weight[(size_t)i * taps.count + k] = w;
+			total += w;
+		}
+		for (int k = 0; k < taps.count; k++)
+			taps.weight[(size_t)i * taps.count + k] /= total;
+	}
+}
+
+int mipLevelCount(int width, int height){
+	int levels = 1;
+	for (int size = width > height ? width : height; size > 1; size /= 2)
+		levels++;
+	return levels;
+}
+
+void mipLevelSize(int width, int height, int level, int & out_width, int & out_height){
+	out_width = width >> level > 0 ? width >> level : 1;
+	out_height = height >> level > 0 ? height >> level : 1;
+}
+
+size_t mipChainBytes(int width, int height, int channels){
+	size_t bytes = 0;
+	while (true){
+		bytes += (size_t)width * height * channels;
+		if (width == 1 && height == 1)
+			break;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return bytes;
+}
+
+// A row into 4 floats per texel, through the table of each channel. The channels past the last stay 0.
+static void rowToLinear(const unsigned char * row, int width, int channels, const float * const tables[4], float * out){
+	switch (channels){
+	case 1:
+		for (int x = 0; x < width; x++){
+			out[x * 4 + 0] = tables[0][row[x]];
+			out[x * 4 + 1] = out[x * 4 + 2] = out[x * 4 + 3] = 0.0f;
+		}
+		break;
+	case 2:
+		for (int x = 0; x < width; x++){
+			out[x * 4 + 0] = tables[0][row[x * 2 + 0]];
+			out[x * 4 + 1] = tables[1][row[x * 2 + 1]];
+			out[x * 4 + 2] = out[x * 4 + 3] = 0.0f;
+		}
+		break;
+	case 3:
+		for (int x = 0; x < width; x++){
+			out[x * 4 + 0] = tables[0][row[x * 3 + 0]];
+			out[x * 4 + 1] = tables[1][row[x * 3 + 1]];
+			out[x * 4 + 2] = tables[2][row[x * 3 + 2]];
+			out[x * 4 + 3] = 0.0f;
+		}
+		break;
+	default:
+		for (int x = 0; x < width; x++){
+			out[x * 4 + 0] = tables[0][row[x * 4 + 0]];
+			out[x * 4 + 1] = tables[1][row[x * 4 + 1]];
+			out[x * 4 + 2] = tables[2][row[x * 4 + 2]];
+			out[x * 4 + 3] = tables[3][row[x * 4 + 3]];
+		}
+	}
+}
+
+void downsampleRows(const unsigned char * source, int sourceWidth, int sourceHeight, int channels,
+	unsigned char * target, int targetWidth, int targetHeight, const MipSettings & settings,
+	int firstRow, int endRow){
+	if (firstRow >= endRow)
+		return;
+	const ColorTables & tables = colorTables();
+	FilterTaps columns, rows;
+	makeTaps(sourceWidth, targetWidth, targetWidth, settings.filter, tables, columns);
+	makeTaps(sourceHeight, targetHeight, endRow, settings.filter, tables, rows);
+	// sRGB for the colors, never for alpha
+	bool hasAlpha = channels == 2 || channels == 4;
+	const float * decode[4];
+	const unsigned char * encode[4];
+	for (int c = 0; c < 4; c++){
+		bool color = settings.srgb && !(hasAlpha && c == channels - 1);
+		decode[c] = color ? tables.fromSRGB : tables.fromUnorm;
+		encode[c] = color ? tables.toSRGB : tables.toUnorm;
+	}
+
+	// Every source row the range reads, converted once
+	int lowRow = sourceHeight, highRow = -1;
+	for (int y = firstRow; y < endRow; y++){
+		for (int k = 0; k < rows.count; k++){
+			int row = rows.index[(size_t)y * rows.count + k];
+			lowRow = row < lowRow ? row : lowRow;
+			highRow = row > highRow ? row : highRow;
+		}
+	}
+	size_t rowFloats = (size_t)sourceWidth * 4;
+	std::vector<float> linear((highRow - lowRow + 1) * rowFloats);
+	for (int row = lowRow; row <= highRow; row++)
+		rowToLinear(source + (size_t)row * sourceWidth * channels, sourceWidth, channels, decode,
+			&linear[(row - lowRow) * rowFloats]);
+
+	std::vector<float> column(rowFloats);
+	for (int y = firstRow; y < endRow; y++){
+		// The rows of the source into one, then its texels into the new ones
+		const int * rowIndex = &rows.index[(size_t)y * rows.count];
+		const float * rowWeight = &rows.weight[(size_t)y * rows.count];
+		unsigned char * out = target + (size_t)y * targetWidth * channels;
+#ifdef MIPMAP_SSE
+		for (size_t i = 0; i < rowFloats; i += 4)
+			_mm_storeu_ps(&column[i], _mm_setzero_ps());
+		for (int k = 0; k < rows.count; k++){
+			if (rowWeight[k] == 0.0f)
+				continue;
+			__m128 w = _mm_set1_ps(rowWeight[k]);
+			const float * in = &linear[(rowIndex[k] - lowRow) * rowFloats];
+			for (size_t i = 0; i < rowFloats; i += 4)
+				_mm_storeu_ps(&column[i], _mm_add_ps(_mm_loadu_ps(&column[i]), _mm_mul_ps(w, _mm_loadu_ps(&in[i]))));
+		}
+		for (int x = 0; x < targetWidth; x++){
+			const int * columnIndex = &columns.index[(size_t)x * columns.count];
+			const float * columnWeight = &columns.weight[(size_t)x * columns.count];
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < columns.count; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(columnWeight[k]), _mm_loadu_ps(&column[columnIndex[k] * 4])));
+			// The Kaiser filter's negative lobes can overshoot
+			sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+			float texel[4];
+			_mm_storeu_ps(texel, sum);
+#else
+		for (size_t i = 0; i < rowFloats; i++)
+			column[i] = 0.0f;
+		for (int k = 0; k < rows.count; k++){
+			float w = rowWeight[k];
+			const float * in = &linear[(rowIndex[k] - lowRow) * rowFloats];
+			for (size_t i = 0; i < rowFloats; i++)
+				column[i] += w * in[i];
+		}
+		for (int x = 0; x < targetWidth; x++){
+			const int * columnIndex = &columns.index[(size_t)x * columns.count];
+			const float * columnWeight = &columns.weight[(size_t)x * columns.count];
+			float texel[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < columns.count; k++){
+				for (int c = 0; c < 4; c++)
+					texel[c] += columnWeight[k] * column[columnIndex[k] * 4 + c];
+			}
+			for (int c = 0; c < 4; c++)
+				texel[c] = texel[c] < 0.0f ? 0.0f : (texel[c] > 1.0f ? 1.0f : texel[c]);
+#endif
+			for (int c = 0; c < channels; c++)
+				out[x * channels + c] = encode[c][(int)(texel[c] * 4095.0f + 0.5f)];
+		}
+	}
+}
+
+float alphaCoverage(const unsigned char * pixels, int width, int height, int channels, float cutoff){
+	size_t texels = (size_t)width * height;
+	size_t passing = 0;
+	for (size_t i = 0; i < texels; i++)
+		passing += pixels[i * channels + channels - 1] >= cutoff * 255.0f;
+	return (float)passing / texels;
+}
+
+void keepAlphaCoverage(unsigned char * pixels, int width, int height, int channels, float cutoff, float coverage){
+	size_t texels = (size_t)width * height;
+	size_t histogram[256] = {};
+	for (size_t i = 0; i < texels; i++)
+		histogram[pixels[i * channels + channels - 1]]++;
+	// The smallest scale which lets enough texels through : coverage only grows with it
+	float low = 0.0f, high = 4.0f;
+	for (int step = 0; step < 16; step++){
+		float scale = (low + high) * 0.5f;
+		size_t passing = 0;
+		for (int a = 0; a < 256; a++){
+			if (a * scale >= cutoff * 255.0f)
+				passing += histogram[a];
+		}
+		if ((float)passing / texels < coverage)
+			low = scale;
+		else
+			high = scale;
+	}
+	unsigned char scaled[256];
+	for (int a = 0; a < 256; a++){
+		float value = a * high + 0.5f;
+		scaled[a] = (unsigned char)(value > 255.0f ? 255.0f : value);
+	}
+	for (size_t i = 0; i < texels; i++)
+		pixels[i * channels + channels - 1] = scaled[pixels[i * channels + channels - 1]];
+}
+
+void buildMipChain(unsigned char * pixels, int width, int height, int channels, const MipSettings & settings){
+	bool alphaTested = settings.alphaCutoff > 0.0f && (channels == 2 || channels == 4);
+	float coverage = alphaTested ? alphaCoverage(pixels, width, height, channels, settings.alphaCutoff) : 0.0f;
+	unsigned char * source = pixels;
+	int sourceWidth = width, sourceHeight = height;
+	int levels = mipLevelCount(width, height);
+	for (int level = 1; level < levels; level++){
+		int levelWidth, levelHeight;
+		mipLevelSize(width, height, level, levelWidth, levelHeight);
+		unsigned char * target = source + (size_t)sourceWidth * sourceHeight * channels;
+		for (int row = 0; row < levelHeight; row += MipStripRows)
+			downsampleRows(source, sourceWidth, sourceHeight, channels, target, levelWidth, levelHeight, settings,
+				row, row + MipStripRows < levelHeight ? row + MipStripRows : levelHeight);
+		if (alphaTested)
+			keepAlphaCoverage(target, levelWidth, levelHeight, channels, settings.alphaCutoff, coverage);
+		source = target;
+		sourceWidth = levelWidth;
+		sourceHeight = levelHeight;
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef MIPMAP_HPP
+#define MIPMAP_HPP
+
+// Mip chains made on the CPU, instead of glGenerateMipmap : the same result on every driver, and nothing
+// to do on the GL thread. Each level is filtered from the one above in two passes (columns, then rows),
+// 4 channels at a time with SSE. sRGB colors are filtered in linear light, so that the small levels
+// don't darken. For alpha tested textures, the alpha of each level can be scaled so that as many texels
+// pass the test as in level 0 (foliage and fences otherwise fade out in the distance).
+// 1 to 4 channels of 8 bits, rows packed. The alpha is the last channel of 2 or 4.
+
+enum MipFilter {
+	MIP_BOX,      // the average of the texels under each new one
+	MIP_KAISER    // windowed sinc over 3 texels of the new level each side : sharper, may ring a little
+};
+
+struct MipSettings {
+	MipFilter filter;
+	bool srgb;           // the color channels are sRGB encoded. Alpha never is.
+	float alphaCutoff;   // > 0 : the alpha test the texture is drawn with, in [0, 1]
+};
+
+// Same as OpenGL : halved, rounded down, down to 1x1
+int mipLevelCount(int width, int height);
+void mipLevelSize(int width, int height, int level, int & out_width, int & out_height);
+// Of the whole chain, one level after the other
+size_t mipChainBytes(int width, int height, int channels);
+
+// Rows [firstRow, endRow) of a level from the level above it. Rows don't depend on each other :
+// a level can be split between threads.
+void downsampleRows(const unsigned char * source, int sourceWidth, int sourceHeight, int channels,
+	unsigned char * target, int targetWidth, int targetHeight, const MipSettings & settings,
+	int firstRow, int endRow);
+
+// Fraction of the texels whose alpha passes the cutoff
+float alphaCoverage(const unsigned char * pixels, int width, int height, int channels, float cutoff);
+// Once a level is done : scales its alpha to get back to `coverage`
+void keepAlphaCoverage(unsigned char * pixels, int width, int height, int channels, float cutoff, float coverage);
+
+// Every level after level 0, which starts `pixels` (mipChainBytes big), on the calling thread
+void buildMipChain(unsigned char * pixels, int width, int height, int channels, const MipSettings & settings);
+
+#endif
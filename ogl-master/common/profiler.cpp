@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2 // GetProcessMemoryInfo from kernel32, no psapi.lib
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <GL/glew.h>
+
+#include "arena.hpp"
+#include "profiler.hpp"
+
+// Events kept per thread between two collections. Old events are overwritten when a thread
+// records more than this during one frame.
+const unsigned int ProfileRingSize = 1 << 16;
+// Frames whose GPU queries can be in flight at the same time
+const unsigned int ProfileGPUFrames = 4;
+// Frames kept for the percentiles
+const unsigned int ProfileHistorySize = 4096;
+// Captured events, beyond which the capture stops by itself
+const size_t MaxCapturedEvents = 1 << 22;
+
+struct ProfileEvent {
+	const char * name;
+	unsigned long long begin, end;
+};
+
+// Written by its thread only. The collector reads the events between its tail and head.
+struct ProfileThreadBuffer {
+	std::string name;
+	unsigned int id;
+	std::atomic<unsigned long long> head;
+	unsigned long long tail;
+	ProfileEvent events[ProfileRingSize];
+};
+
+struct CapturedEvent {
+	const char * name;
+	unsigned long long begin, end;
+	unsigned int thread;   // ProfileThreadBuffer::id, or GPUThreadID
+};
+const unsigned int GPUThreadID = 0;
+
+struct GPUScope {
+	const char * name;
+	GLuint beginQuery, endQuery;
+};
+
+// The GPU queries of one frame
+struct GPUFrame {
+	bool pending;
+	unsigned int history;              // index of the frame in ProfileHistory
+	GLuint frameQuery;                 // GL_TIME_ELAPSED over the whole frame
+	std::vector<GLuint> queries;       // GL_TIMESTAMP pool, reused from frame to frame
+	unsigned int usedQueries;
+	std::vector<GPUScope> scopes;
+};
+
+struct FrameRecord {
+	unsigned long long begin, end;     // CPU
+	unsigned long long interval;       // since the previous frame began
+	long long gpu;                     // -1 until the queries are back
+	unsigned long long number;
+};
+
+std::mutex ProfileThreadsMutex;
+std::vector<ProfileThreadBuffer *> ProfileThreads;
+thread_local ProfileThreadBuffer * ProfileThisThread = NULL;
+
+GPUFrame ProfileGPU[ProfileGPUFrames];
+std::vector<unsigned int> ProfileGPUStack;
+long long ProfileGPUOffset = 0;        // CPU time minus GPU time, to put both on the same timeline
+bool ProfilerReady = false;
+
+FrameRecord ProfileHistory[ProfileHistorySize];
+unsigned long long ProfileFrameNumber = 0;  // frames begun so far
+unsigned long long ProfileFrameBegin = 0;
+unsigned int ProfileDroppedGPUFrames = 0;
+
+bool ProfileCapturing = false;
+std::vector<CapturedEvent> ProfileCaptured;
+
+unsigned long long profilerNow(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ProfileThreadBuffer * threadBuffer(){
+	if (ProfileThisThread == NULL){
+		// Once per thread : the only lock
+		ProfileThreadBuffer * buffer = new ProfileThreadBuffer;
+		buffer->head = 0;
+		buffer->tail = 0;
+		std::lock_guard<std::mutex> lock(ProfileThreadsMutex);
+		buffer->id = ProfileThreads.size() + 1;
+		char name[32];
+		snprintf(name, sizeof(name), "Thread %u", buffer->id);
+		buffer->name = name;
+		ProfileThreads.push_back(buffer);
+		ProfileThisThread = buffer;
+	}
+	return ProfileThisThread;
+}
+
+static void recordEvent(const char * name, unsigned long long begin, unsigned long long end){
+	ProfileThreadBuffer * buffer = threadBuffer();
+	unsigned long long head = buffer->head.load(std::memory_order_relaxed);
+	ProfileEvent & event = buffer->events[head % ProfileRingSize];
+	event.name = name;
+	event.begin = begin;
+	event.end = end;
+	// Publish the event to the collector
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+ProfileScope::ProfileScope(const char * scopeName){
+	name = scopeName;
+	begin = profilerNow();
+}
+
+ProfileScope::~ProfileScope(){
+	recordEvent(name, begin, profilerNow());
+}
+
+void setProfilerThreadName(const char * name){
+	ProfileThreadBuffer * buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(ProfileThreadsMutex);
+	buffer->name = name;
+}
+
+void initProfiler(){
+	setProfilerThreadName("Main");
+	for (unsigned int i = 0; i < ProfileGPUFrames; i++){
+		glGenQueries(1, &ProfileGPU[i].frameQuery);
+		ProfileGPU[i].pending = false;
+		ProfileGPU[i].usedQueries = 0;
+	}
+	// GL_TIMESTAMP counts from an arbitrary origin : measure where it is now
+	GLint64 gpuNow;
+	glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+	ProfileGPUOffset = (long long)profilerNow() - (long long)gpuNow;
+	memset(ProfileHistory, 0, sizeof(ProfileHistory));
+	ProfileFrameNumber = 0;
+	ProfilerReady = true;
+}
+
+// Move the new events of every thread to the capture, or just drop them
+static void collectEvents(){
+	std::lock_guard<std::mutex> lock(ProfileThreadsMutex);
+	for (size_t t = 0; t < ProfileThreads.size(); t++){
+		ProfileThreadBuffer * buffer = ProfileThreads[t];
+		unsigned long long head = buffer->head.load(std::memory_order_acquire);
+		if (head - buffer->tail > ProfileRingSize)
+			buffer->tail = head - ProfileRingSize;  // overwritten before we got to them
+		if (ProfileCapturing){
+			size_t start = ProfileCaptured.size();
+			for (unsigned long long i = buffer->tail; i < head; i++){
+				const ProfileEvent & event = buffer->events[i % ProfileRingSize];
+				CapturedEvent captured = { event.name, event.begin, event.end, buffer->id };
+				ProfileCaptured.push_back(captured);
+			}
+			// The thread may have wrapped around while we were copying : drop what it overwrote
+			unsigned long long newHead = buffer->head.load(std::memory_order_acquire);
+			if (newHead > ProfileRingSize && newHead - ProfileRingSize > buffer->tail){
+				size_t overwritten = std::min(newHead - ProfileRingSize, head) - buffer->tail;
+				ProfileCaptured.erase(ProfileCaptured.begin() + start, ProfileCaptured.begin() + start + overwritten);
+			}
+		}
+		buffer->tail = head;
+	}
+	if (ProfileCaptured.size() > MaxCapturedEvents){
+		printf("Profile capture full, stopped\n");
+		ProfileCapturing = false;
+	}
+}
+
+// Read the queries of a frame if they are all back. With wait, block until they are.
+static bool resolveGPUFrame(GPUFrame & frame, bool wait){
+	if (!frame.pending)
+		return true;
+	if (!wait){
+		// The queries complete in order : the last one is enough
+		GLuint available = 0;
+		GLuint last = frame.usedQueries > 0 ? frame.queries[frame.usedQueries - 1] : frame.frameQuery;
+		glGetQueryObjectuiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+			glGetQueryObjectuiv(frame.frameQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return false;
+	}
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(frame.frameQuery, GL_QUERY_RESULT, &elapsed);
+	FrameRecord & record = ProfileHistory[frame.history];
+	record.gpu = (long long)elapsed;
+	if (ProfileCapturing){
+		for (size_t i = 0; i < frame.scopes.size(); i++){
+			if (frame.scopes[i].endQuery == 0)
+				continue; // never ended
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(frame.scopes[i].beginQuery, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(frame.scopes[i].endQuery, GL_QUERY_RESULT, &end);
+			CapturedEvent captured = { frame.scopes[i].name, (unsigned long long)((long long)begin + ProfileGPUOffset),
+				(unsigned long long)((long long)end + ProfileGPUOffset), GPUThreadID };
+			ProfileCaptured.push_back(captured);
+		}
+	}
+	frame.pending = false;
+	return true;
+}
+
+void profilerBeginFrame(){
+	if (!ProfilerReady)
+		return;
+	unsigned long long now = profilerNow();
+	GPUFrame & gpu = ProfileGPU[ProfileFrameNumber % ProfileGPUFrames];
+	// Still not back after ProfileGPUFrames frames : give up on that frame rather than wait
+	if (!resolveGPUFrame(gpu, false)){
+		ProfileDroppedGPUFrames++;
+		gpu.pending = false;
+	}
+	gpu.usedQueries = 0;
+	gpu.scopes.clear();
+	gpu.history = ProfileFrameNumber % ProfileHistorySize;
+	ProfileGPUStack.clear();
+
+	FrameRecord & record = ProfileHistory[gpu.history];
+	record.number = ProfileFrameNumber;
+	record.begin = now;
+	record.end = now;
+	record.interval = ProfileFrameNumber > 0 ? now - ProfileFrameBegin : 0;
+	record.gpu = -1;
+	ProfileFrameBegin = now;
+	ProfileFrameNumber++;
+
+	glBeginQuery(GL_TIME_ELAPSED, gpu.frameQuery);
+}
+
+void profilerEndFrame(){
+	if (!ProfilerReady || ProfileFrameNumber == 0)
+		return;
+	GPUFrame & gpu = ProfileGPU[(ProfileFrameNumber - 1) % ProfileGPUFrames];
+	glEndQuery(GL_TIME_ELAPSED);
+	gpu.pending = true;
+
+	unsigned long long now = profilerNow();
+	ProfileHistory[gpu.history].end = now;
+	recordEvent("Frame", ProfileFrameBegin, now);
+	collectEvents();
+
+	// Pick up the results of the previous frames that came back meanwhile
+	for (unsigned int i = 0; i < ProfileGPUFrames; i++){
+		if (&ProfileGPU[i] != &gpu)
+			resolveGPUFrame(ProfileGPU[i], false);
+	}
+}
+
+static GLuint nextQuery(GPUFrame & frame){
+	if (frame.usedQueries == frame.queries.size()){
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+	return frame.queries[frame.usedQueries++];
+}
+
+void beginGPUScope(const char * name){
+	if (!ProfilerReady || ProfileFrameNumber == 0)
+		return;
+	GPUFrame & frame = ProfileGPU[(ProfileFrameNumber - 1) % ProfileGPUFrames];
+	GPUScope scope;
+	scope.name = name;
+	scope.beginQuery = nextQuery(frame);
+	scope.endQuery = 0;
+	// Timestamps rather than GL_TIME_ELAPSED, which can't be nested
+	glQueryCounter(scope.beginQuery, GL_TIMESTAMP);
+	ProfileGPUStack.push_back(frame.scopes.size());
+	frame.scopes.push_back(scope);
+}
+
+void endGPUScope(){
+	if (!ProfilerReady || ProfileGPUStack.empty())
+		return;
+	GPUFrame & frame = ProfileGPU[(ProfileFrameNumber - 1) % ProfileGPUFrames];
+	GPUScope & scope = frame.scopes[ProfileGPUStack.back()];
+	ProfileGPUStack.pop_back();
+	scope.endQuery = nextQuery(frame);
+	glQueryCounter(scope.endQuery, GL_TIMESTAMP);
+}
+
+void startProfileCapture(){
+	ProfileCaptured.clear();
+	// Start from now : forget what the threads recorded before
+	ProfileCapturing = false;
+	collectEvents();
+	ProfileCapturing = true;
+}
+
+bool isProfileCapturing(){
+	return ProfileCapturing;
+}
+
+static void writeJSONString(FILE * file, const char * text){
+	fputc('"', file);
+	for (const char * c = text; *c != '\0'; c++){
+		if (*c == '"' || *c == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*c >= 0x20)
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+bool writeProfileTrace(const char * path){
+	// The GPU results of the last frames, even if we have to wait for them
+	for (unsigned int i = 0; i < ProfileGPUFrames; i++)
+		resolveGPUFrame(ProfileGPU[i], true);
+	collectEvents();
+	ProfileCapturing = false;
+
+	FILE * file = fopen(path, "w");
+	if (file == NULL){
+		printf("Can't write %s\n", path);
+		return false;
+	}
+	unsigned long long origin = ~0ull;
+	for (size_t i = 0; i < ProfileCaptured.size(); i++)
+		origin = std::min(origin, ProfileCaptured[i].begin);
+	if (ProfileCaptured.empty())
+		origin = 0;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	// Names of the threads, the GPU first
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", GPUThreadID);
+	{
+		std::lock_guard<std::mutex> lock(ProfileThreadsMutex);
+		for (size_t t = 0; t < ProfileThreads.size(); t++){
+			fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", ProfileThreads[t]->id);
+			writeJSONString(file, ProfileThreads[t]->name.c_str());
+			fprintf(file, "}}");
+		}
+	}
+	// Complete events, in microseconds
+	for (size_t i = 0; i < ProfileCaptured.size(); i++){
+		const CapturedEvent & event = ProfileCaptured[i];
+		fprintf(file, ",\n{\"name\":");
+		writeJSONString(file, event.name);
+		fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.thread,
+			(event.begin - origin) / 1000.0, (event.end - event.begin) / 1000.0);
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("Wrote %u events to %s\n", (unsigned int)ProfileCaptured.size(), path);
+	ProfileCaptured.clear();
+	return true;
+}
+
+static ProfilePercentiles percentiles(ArenaVector<double> & values){
+	ProfilePercentiles result = { 0.0, 0.0, 0.0, 0.0 };
+	if (values.empty())
+		return result;
+	std::sort(values.begin(), values.end());
+	// Nearest rank
+	size_t n = values.size();
+	result.p50 = values[std::min(n - 1, (n * 50) / 100)];
+	result.p95 = values[std::min(n - 1, (n * 95) / 100)];
+	result.p99 = values[std::min(n - 1, (n * 99) / 100)];
+	result.max = values[n - 1];
+	return result;
+}
+
+ProfileSummary getProfileSummary(unsigned int lastFrames){
+	ProfileSummary summary;
+	memset(&summary, 0, sizeof(summary));
+	// The frame being recorded is not finished : start from the one before
+	unsigned long long available = ProfileFrameNumber > 0 ? ProfileFrameNumber - 1 : 0;
+	unsigned int count = (unsigned int)std::min<unsigned long long>(std::min(lastFrames, ProfileHistorySize), available);
+	// Asked for every second by the frame stats : sorted in the thread's arena
+	ArenaScope scope(threadArena());
+	ArenaVector<double> frame, cpu, gpu;
+	frame.reserve(count);
+	cpu.reserve(count);
+	gpu.reserve(count);
+	for (unsigned int i = 0; i < count; i++){
+		const FrameRecord & record = ProfileHistory[(available - 1 - i) % ProfileHistorySize];
+		if (record.interval > 0)
+			frame.push_back(record.interval / 1e6);
+		cpu.push_back((record.end - record.begin) / 1e6);
+		if (record.gpu >= 0)
+			gpu.push_back(record.gpu / 1e6);
+	}
+	summary.frames = count;
+	summary.gpuFrames = gpu.size();
+	summary.frame = percentiles(frame);
+	summary.cpu = percentiles(cpu);
+	summary.gpu = percentiles(gpu);
+	return summary;
+}
+
+void printProfileSummary(const ProfileSummary & summary){
+	printf("%u frames (ms)      p50      p95      p99      max\n", summary.frames);
+	printf("  frame      %9.3f%9.3f%9.3f%9.3f\n", summary.frame.p50, summary.frame.p95, summary.frame.p99, summary.frame.max);
+	printf("  cpu        %9.3f%9.3f%9.3f%9.3f\n", summary.cpu.p50, summary.cpu.p95, summary.cpu.p99, summary.cpu.max);
+	if (summary.gpuFrames > 0)
+		printf("  gpu        %9.3f%9.3f%9.3f%9.3f\n", summary.gpu.p50, summary.gpu.p95, summary.gpu.p99, summary.gpu.max);
+}
+
+unsigned long long getPeakMemoryKB(){
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void cleanupProfiler(){
+	if (!ProfilerReady)
+		return;
+	for (unsigned int i = 0; i < ProfileGPUFrames; i++){
+		glDeleteQueries(1, &ProfileGPU[i].frameQuery);
+		if (!ProfileGPU[i].queries.empty())
+			glDeleteQueries(ProfileGPU[i].queries.size(), &ProfileGPU[i].queries[0]);
+		ProfileGPU[i].queries.clear();
+		ProfileGPU[i].pending = false;
+	}
+	if (ProfileDroppedGPUFrames > 0)
+		printf("Profiler : %u frames without GPU times\n", ProfileDroppedGPUFrames);
+	ProfilerReady = false;
+}
@@ -0,0 +1,66 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+// Frame profiler.
+// CPU scopes are timed in nanoseconds and written to a ring buffer owned by the thread that
+// ran them : recording takes no lock. GPU scopes are pairs of GL timestamp queries, read a few
+// frames later, once the results are there, so that nothing waits for the GPU.
+// Everything can be written as a Chrome trace (chrome://tracing, or ui.perfetto.dev).
+
+// Time a CPU scope : PROFILE_SCOPE("culling");
+// The name must stay valid until the trace is written (a string literal).
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_CONCAT2(a, b) a##b
+
+struct ProfileScope {
+	const char * name;
+	unsigned long long begin;
+	ProfileScope(const char * scopeName);
+	~ProfileScope();
+};
+
+// Nanoseconds, on a monotonic clock
+unsigned long long profilerNow();
+
+// The name of the calling thread in the traces. Threads which don't call it are numbered.
+void setProfilerThreadName(const char * name);
+
+// Call once the GL context is current
+void initProfiler();
+
+// A frame goes from profilerBeginFrame to profilerEndFrame, on the main thread.
+// End the frame before swapping buffers, so that waiting for the vsync is not counted as CPU time.
+void profilerBeginFrame();
+void profilerEndFrame();
+
+// GPU scopes, on the thread of the GL context. They can be nested.
+void beginGPUScope(const char * name);
+void endGPUScope();
+
+// Keep the events of the next frames, until writeProfileTrace
+void startProfileCapture();
+bool isProfileCapturing();
+// Write the captured events as Chrome trace-event JSON, and stop capturing
+bool writeProfileTrace(const char * path);
+
+// Percentiles of the last frames, in milliseconds.
+// frame : from one profilerBeginFrame to the next ; cpu : begin to end of the frame ; gpu : the
+// GPU work between them. The GPU numbers only cover the frames whose queries are back.
+struct ProfilePercentiles {
+	double p50, p95, p99, max;
+};
+struct ProfileSummary {
+	unsigned int frames;
+	unsigned int gpuFrames;
+	ProfilePercentiles frame, cpu, gpu;
+};
+ProfileSummary getProfileSummary(unsigned int lastFrames);
+void printProfileSummary(const ProfileSummary & summary);
+
+// Largest resident memory of the process so far, in kilobytes (0 if the platform can't tell)
+unsigned long long getPeakMemoryKB();
+
+void cleanupProfiler();
+
+#endif
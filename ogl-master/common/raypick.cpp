@@ -0,0 +1,366 @@
+#include <vector>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+#include "raypick.hpp"
+
+Ray screenRay(double x, double y, int width, int height, const glm::mat4 & ProjectionMatrix, const glm::mat4 & ViewMatrix){
+	// Back from normalized device coordinates, at the near and far planes
+	glm::mat4 inverse = glm::inverse(ProjectionMatrix * ViewMatrix);
+	float ndcX = 2.0f * (float)x / width - 1.0f;
+	float ndcY = 1.0f - 2.0f * (float)y / height;
+	glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	nearPoint /= nearPoint.w;
+	farPoint /= farPoint.w;
+	Ray ray;
+	ray.origin = glm::vec3(nearPoint);
+	ray.direction = glm::normalize(glm::vec3(farPoint - nearPoint));
+	return ray;
+}
+
+// Buckets of centroids along the split axis, where the splits are evaluated
+static const int SAHBins = 16;
+static const int MaxTrianglesPerLeaf = 4;
+// Past this, a leaf is made whatever the cost : the traversal stack has room for the deepest path
+static const int MaxBVHDepth = 60;
+// Cost of visiting a node, relative to testing one triangle
+static const float TraversalCost = 1.0f;
+
+static AABB emptyAABB(){
+	AABB box;
+	box.min = glm::vec3(FLT_MAX);
+	box.max = glm::vec3(-FLT_MAX);
+	return box;
+}
+
+static void growAABB(AABB & box, const AABB & other){
+	box.min = glm::min(box.min, other.min);
+	box.max = glm::max(box.max, other.max);
+}
+
+static float surfaceArea(const AABB & box){
+	glm::vec3 d = box.max - box.min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static AABB triangleBounds(const TriangleBVH & bvh, unsigned int triangle){
+	const glm::vec3 & a = bvh.positions[bvh.indices[3 * triangle]];
+	const glm::vec3 & b = bvh.positions[bvh.indices[3 * triangle + 1]];
+	const glm::vec3 & c = bvh.positions[bvh.indices[3 * triangle + 2]];
+	AABB box;
+	box.min = glm::min(a, glm::min(b, c));
+	box.max = glm::max(a, glm::max(b, c));
+	return box;
+}
+
+// Bin of a centroid along an axis
+struct BinOf {
+	const std::vector<glm::vec3> * centroids;
+	int axis;
+	float start, scale;
+	int operator()(unsigned int triangle) const {
+		int bin = (int)(((*centroids)[triangle][axis] - start) * scale);
+		return std::min(std::max(bin, 0), SAHBins - 1);
+	}
+};
+
+struct SplitBefore {
+	BinOf binOf;
+	int split;
+	bool operator()(unsigned int triangle) const { return binOf(triangle) < split; }
+};
+
+struct CentroidAxisLess {
+	const std::vector<glm::vec3> * centroids;
+	int axis;
+	bool operator()(unsigned int a, unsigned int b) const { return (*centroids)[a][axis] < (*centroids)[b][axis]; }
+};
+
+// Builds the subtree of triangles[first, first + count), returns the index of its root
+static int buildTriangleNode(TriangleBVH & bvh, const std::vector<AABB> & bounds, const std::vector<glm::vec3> & centroids,
+	int first, int count, int depth){
+	int nodeIndex = (int)bvh.nodes.size();
+	bvh.nodes.push_back(TriangleBVHNode());
+
+	AABB box = emptyAABB();
+	AABB centroidBox = emptyAABB();
+	for (int i = first; i < first + count; i++){
+		growAABB(box, bounds[bvh.triangles[i]]);
+		const glm::vec3 & c = centroids[bvh.triangles[i]];
+		centroidBox.min = glm::min(centroidBox.min, c);
+		centroidBox.max = glm::max(centroidBox.max, c);
+	}
+
+	int left = -1, right = -1;
+	if (count > MaxTrianglesPerLeaf && depth < MaxBVHDepth){
+		glm::vec3 extent = centroidBox.max - centroidBox.min;
+		int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+		int middle = first + count / 2;
+		bool split = true;
+		if (extent[axis] > 0.0f){
+			// Cost of every split between two bins : the area of each side times its triangles
+			BinOf binOf;
+			binOf.centroids = &centroids;
+			binOf.axis = axis;
+			binOf.start = centroidBox.min[axis];
+			binOf.scale = SAHBins / extent[axis];
+			AABB binBounds[SAHBins];
+			int binCounts[SAHBins];
+			for (int b = 0; b < SAHBins; b++){
+				binBounds[b] = emptyAABB();
+				binCounts[b] = 0;
+			}
+			for (int i = first; i < first + count; i++){
+				int b = binOf(bvh.triangles[i]);
+				growAABB(binBounds[b], bounds[bvh.triangles[i]]);
+				binCounts[b]++;
+			}
+			float rightCosts[SAHBins];
+			AABB side = emptyAABB();
+			int sideCount = 0;
+			for (int b = SAHBins - 1; b > 0; b--){
+				growAABB(side, binBounds[b]);
+				sideCount += binCounts[b];
+				rightCosts[b] = sideCount > 0 ? surfaceArea(side) * sideCount : 0.0f;
+			}
+			float bestCost = FLT_MAX;
+			int bestSplit = 1;
+			side = emptyAABB();
+			sideCount = 0;
+			for (int b = 1; b < SAHBins; b++){
+				growAABB(side, binBounds[b - 1]);
+				sideCount += binCounts[b - 1];
+				float cost = (sideCount > 0 ? surfaceArea(side) * sideCount : 0.0f) + rightCosts[b];
+				if (cost < bestCost){
+					bestCost = cost;
+					bestSplit = b;
+				}
+			}
+			bestCost = TraversalCost + bestCost / surfaceArea(box);
+			// A leaf is kept when testing all its triangles is cheaper, as long as it stays small
+			if (bestCost >= (float)count && count <= 4 * MaxTrianglesPerLeaf){
+				split = false;
+			}
+			else {
+				SplitBefore before;
+				before.binOf = binOf;
+				before.split = bestSplit;
+				middle = (int)(std::partition(bvh.triangles.begin() + first, bvh.triangles.begin() + first + count, before)
+					- bvh.triangles.begin());
+			}
+		}
+		if (split && (middle == first || middle == first + count)){
+			// All in the same bin : median split
+			CentroidAxisLess less;
+			less.centroids = &centroids;
+			less.axis = axis;
+			middle = first + count / 2;
+			std::nth_element(bvh.triangles.begin() + first, bvh.triangles.begin() + middle,
+				bvh.triangles.begin() + first + count, less);
+		}
+		if (split){
+			left = buildTriangleNode(bvh, bounds, centroids, first, middle - first, depth + 1);
+			right = buildTriangleNode(bvh, bounds, centroids, middle, first + count - middle, depth + 1);
+		}
+	}
+
+	TriangleBVHNode & node = bvh.nodes[nodeIndex]; // after the recursion : nodes may have been reallocated
+	node.bounds = box;
+	node.left = left;
+	node.right = right;
+	node.first = first;
+	node.count = count;
+	return nodeIndex;
+}
+
+void buildTriangleBVH(TriangleBVH & bvh, const std::vector<glm::vec3> & positions,
+	const unsigned short * indices, unsigned int indexCount){
+	bvh.positions = positions;
+	bvh.indices.assign(indices, indices + indexCount);
+	bvh.nodes.clear();
+	unsigned int triangleCount = indexCount / 3;
+	bvh.triangles.resize(triangleCount);
+	if (triangleCount == 0)
+		return;
+	std::vector<AABB> bounds(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (unsigned int t = 0; t < triangleCount; t++){
+		bvh.triangles[t] = t;
+		bounds[t] = triangleBounds(bvh, t);
+		centroids[t] = (bounds[t].min + bounds[t].max) * 0.5f;
+	}
+	bvh.nodes.reserve(2 * triangleCount / MaxTrianglesPerLeaf + 1);
+	buildTriangleNode(bvh, bounds, centroids, 0, (int)triangleCount, 0);
+}
+
+void refitTriangleBVH(TriangleBVH & bvh){
+	// Children come after their parent : going backwards, they are always refitted first
+	for (size_t n = bvh.nodes.size(); n-- > 0;){
+		TriangleBVHNode & node = bvh.nodes[n];
+		if (node.left < 0){
+			node.bounds = emptyAABB();
+			for (int i = node.first; i < node.first + node.count; i++)
+				growAABB(node.bounds, triangleBounds(bvh, bvh.triangles[i]));
+		}
+		else {
+			node.bounds = bvh.nodes[node.left].bounds;
+			growAABB(node.bounds, bvh.nodes[node.right].bounds);
+		}
+	}
+}
+
+// Slab test, with the inverse of the direction computed once per ray
+static float enterAABB(const AABB & box, const glm::vec3 & origin, const glm::vec3 & inverseDirection, float maxDistance){
+	glm::vec3 t0 = (box.min - origin) * inverseDirection;
+	glm::vec3 t1 = (box.max - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float leave = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return enter <= leave ? enter : -1.0f;
+}
+
+float raycastAABB(const AABB & box, const Ray & ray, float maxDistance){
+	return enterAABB(box, ray.origin, 1.0f / ray.direction, maxDistance);
+}
+
+// Möller-Trumbore. Both sides count : the inside of the head is visible in wireframe.
+static bool intersectTriangle(const Ray & ray, const glm::vec3 & a, const glm::vec3 & b, const glm::vec3 & c,
+	float & out_t, float & out_u, float & out_v){
+	glm::vec3 edge1 = b - a;
+	glm::vec3 edge2 = c - a;
+	glm::vec3 p = glm::cross(ray.direction, edge2);
+	float determinant = glm::dot(edge1, p);
+	if (determinant == 0.0f)
+		return false; // parallel to the triangle
+	float inverse = 1.0f / determinant;
+	glm::vec3 s = ray.origin - a;
+	float u = glm::dot(s, p) * inverse;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(ray.direction, q) * inverse;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	out_t = glm::dot(edge2, q) * inverse;
+	out_u = u;
+	out_v = v;
+	return out_t >= 0.0f;
+}
+
+bool raycastTriangleBVH(const TriangleBVH & bvh, const Ray & ray, float maxDistance, RayHit & out_hit){
+	if (bvh.nodes.empty())
+		return false;
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	float closest = maxDistance;
+	bool found = false;
+	unsigned int hitTriangle = 0;
+	float hitU = 0.0f, hitV = 0.0f;
+
+	// Nodes to visit, with the distance at which the ray enters them
+	int stack[MaxBVHDepth + 2];
+	float stackEnter[MaxBVHDepth + 2];
+	int stackSize = 0;
+	float enterRoot = enterAABB(bvh.nodes[0].bounds, ray.origin, inverseDirection, closest);
+	if (enterRoot >= 0.0f){
+		stack[stackSize] = 0;
+		stackEnter[stackSize++] = enterRoot;
+	}
+	while (stackSize > 0){
+		stackSize--;
+		// A hit found since it was pushed may be closer than the whole node
+		if (stackEnter[stackSize] > closest)
+			continue;
+		const TriangleBVHNode & node = bvh.nodes[stack[stackSize]];
+		if (node.left < 0){
+			for (int i = node.first; i < node.first + node.count; i++){
+				unsigned int triangle = bvh.triangles[i];
+				float t, u, v;
+				if (intersectTriangle(ray, bvh.positions[bvh.indices[3 * triangle]], bvh.positions[bvh.indices[3 * triangle + 1]],
+					bvh.positions[bvh.indices[3 * triangle + 2]], t, u, v) && t < closest){
+					closest = t;
+					found = true;
+					hitTriangle = triangle;
+					hitU = u;
+					hitV = v;
+				}
+			}
+			continue;
+		}
+		// The closest child is visited first : once a hit is found, the farther one is often skipped
+		float enterLeft = enterAABB(bvh.nodes[node.left].bounds, ray.origin, inverseDirection, closest);
+		float enterRight = enterAABB(bvh.nodes[node.right].bounds, ray.origin, inverseDirection, closest);
+		bool leftFirst = enterLeft >= 0.0f && (enterRight < 0.0f || enterLeft <= enterRight);
+		int nearChild = leftFirst ? node.left : node.right;
+		int farChild = leftFirst ? node.right : node.left;
+		float enterNear = leftFirst ? enterLeft : enterRight;
+		float enterFar = leftFirst ? enterRight : enterLeft;
+		if (enterFar >= 0.0f){
+			stack[stackSize] = farChild;
+			stackEnter[stackSize++] = enterFar;
+		}
+		if (enterNear >= 0.0f){
+			stack[stackSize] = nearChild;
+			stackEnter[stackSize++] = enterNear;
+		}
+	}
+	if (!found)
+		return false;
+
+	out_hit.distance = closest;
+	out_hit.triangle = hitTriangle;
+	out_hit.barycentrics = glm::vec3(1.0f - hitU - hitV, hitU, hitV);
+	const unsigned int * corners = &bvh.indices[3 * hitTriangle];
+	out_hit.position = out_hit.barycentrics.x * bvh.positions[corners[0]] + out_hit.barycentrics.y * bvh.positions[corners[1]]
+		+ out_hit.barycentrics.z * bvh.positions[corners[2]];
+	out_hit.vertex = corners[0];
+	float nearest = FLT_MAX;
+	for (int i = 0; i < 3; i++){
+		glm::vec3 d = bvh.positions[corners[i]] - out_hit.position;
+		if (glm::dot(d, d) < nearest){
+			nearest = glm::dot(d, d);
+			out_hit.vertex = corners[i];
+		}
+	}
+	return true;
+}
+
+struct EntryLess {
+	bool operator()(const std::pair<float, int> & a, const std::pair<float, int> & b) const { return a.first < b.first; }
+};
+
+void raycastSceneBVH(const SceneBVH & bvh, const std::vector<AABB> & objectBounds, const Ray & ray,
+	float maxDistance, std::vector<int> & out_objects){
+	out_objects.clear();
+	if (bvh.nodes.empty())
+		return;
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	std::vector< std::pair<float, int> > entries;
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0){
+		const SceneBVHNode & node = bvh.nodes[stack[--stackSize]];
+		if (enterAABB(node.bounds, ray.origin, inverseDirection, maxDistance) < 0.0f)
+			continue;
+		if (node.left < 0){
+			for (int i = node.first; i < node.first + node.count; i++){
+				int object = bvh.objects[i];
+				float enter = enterAABB(objectBounds[object], ray.origin, inverseDirection, maxDistance);
+				if (enter >= 0.0f)
+					entries.push_back(std::make_pair(enter, object));
+			}
+			continue;
+		}
+		stack[stackSize++] = node.left;
+		stack[stackSize++] = node.right;
+	}
+	std::sort(entries.begin(), entries.end(), EntryLess());
+	for (size_t i = 0; i < entries.size(); i++)
+		out_objects.push_back(entries[i].second);
+}
@@ -0,0 +1,57 @@
+#ifndef RAYPICK_HPP
+#define RAYPICK_HPP
+
+// Picking on the CPU : a ray from the cursor, cast through a bounding volume hierarchy over the
+// triangles of each mesh. No GPU round trip, so a click doesn't stall the frames in flight.
+// Needs culling.hpp (AABB, SceneBVH) included before.
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction;   // normalized, in world space : the hit distances are in world units
+};
+
+// Ray through a cursor position in window coordinates ((0, 0) is the top left corner, as GLFW reports it)
+Ray screenRay(double x, double y, int width, int height, const glm::mat4 & ProjectionMatrix, const glm::mat4 & ViewMatrix);
+
+struct TriangleBVHNode {
+	AABB bounds;
+	int left, right;     // children, -1 for a leaf
+	int first, count;    // range in TriangleBVH::triangles, for a leaf
+};
+
+// The triangles of a mesh, with their hierarchy. Keeps its own copy of the positions, so that
+// the mesh can be edited and the copy updated then refitted without rebuilding the tree.
+struct TriangleBVH {
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> indices;      // 3 per triangle
+	std::vector<TriangleBVHNode> nodes;     // nodes[0] is the root, children always after their parent
+	std::vector<unsigned int> triangles;    // triangle numbers, in the order of the leaves
+};
+
+// Top-down build, split by the surface area heuristic over binned centroids
+void buildTriangleBVH(TriangleBVH & bvh, const std::vector<glm::vec3> & positions,
+	const unsigned short * indices, unsigned int indexCount);
+// After bvh.positions moved : recomputes the bounds, keeps the tree. Fine for small edits ;
+// after large ones the tree gets loose and should be built again.
+void refitTriangleBVH(TriangleBVH & bvh);
+
+struct RayHit {
+	float distance;        // along the ray
+	unsigned int triangle;
+	glm::vec3 barycentrics; // weights of the 3 corners of the triangle
+	unsigned int vertex;   // corner the closest to the hit point
+	glm::vec3 position;    // hit point, in the space of the mesh
+};
+
+// Closest hit closer than maxDistance. The ray may be in any space, as long as the mesh is in the same one :
+// the distance is measured in units of ray.direction.
+bool raycastTriangleBVH(const TriangleBVH & bvh, const Ray & ray, float maxDistance, RayHit & out_hit);
+
+// Objects of a SceneBVH whose box the ray enters before maxDistance, the closest entry first
+void raycastSceneBVH(const SceneBVH & bvh, const std::vector<AABB> & objectBounds, const Ray & ray,
+	float maxDistance, std::vector<int> & out_objects);
+
+// Distance at which the ray enters the box, or a negative value if it misses it
+float raycastAABB(const AABB & box, const Ray & ray, float maxDistance);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include <GLFW/glfw3.h>
+
+#include "redraw.hpp"
+
+typedef std::chrono::steady_clock RedrawClock;
+
+bool RedrawOnDemand = true;
+std::thread::id RedrawMainThread;
+std::atomic<bool> RedrawRequested(true);   // the first frame
+std::atomic<bool> RedrawWaiting(false);    // the main thread is in glfwWaitEvents
+std::atomic<int> RedrawContinuous(0);
+bool RedrawHasDeadline = false;
+RedrawClock::time_point RedrawDeadline;
+RedrawStats RedrawCounters;
+
+#if GLFW_VERSION_MAJOR * 100 + GLFW_VERSION_MINOR < 302
+
+// No glfwWaitEventsTimeout before GLFW 3.2 : a thread posts an empty event when the time is up,
+// which makes glfwWaitEvents return
+std::thread RedrawTimer;
+std::mutex RedrawTimerMutex;
+std::condition_variable RedrawTimerCondition;
+bool RedrawTimerArmed = false;
+bool RedrawTimerQuit = false;
+RedrawClock::time_point RedrawTimerDeadline;
+
+static void timerThread(){
+	std::unique_lock<std::mutex> lock(RedrawTimerMutex);
+	while (!RedrawTimerQuit){
+		if (!RedrawTimerArmed){
+			RedrawTimerCondition.wait(lock);
+			continue;
+		}
+		RedrawTimerCondition.wait_until(lock, RedrawTimerDeadline);
+		// Woken up early, or re-armed meanwhile : look again
+		if (RedrawTimerArmed && RedrawClock::now() >= RedrawTimerDeadline){
+			RedrawTimerArmed = false;
+			glfwPostEmptyEvent();
+		}
+	}
+}
+
+static void waitEventsUntil(RedrawClock::time_point deadline){
+	{
+		std::lock_guard<std::mutex> lock(RedrawTimerMutex);
+		if (!RedrawTimer.joinable())
+			RedrawTimer = std::thread(timerThread);
+		RedrawTimerDeadline = deadline;
+		RedrawTimerArmed = true;
+	}
+	RedrawTimerCondition.notify_one();
+	glfwWaitEvents();
+	std::lock_guard<std::mutex> lock(RedrawTimerMutex);
+	RedrawTimerArmed = false;
+}
+
+static void stopTimer(){
+	{
+		std::lock_guard<std::mutex> lock(RedrawTimerMutex);
+		RedrawTimerQuit = true;
+	}
+	RedrawTimerCondition.notify_one();
+	if (RedrawTimer.joinable())
+		RedrawTimer.join();
+	RedrawTimerQuit = false;
+}
+
+#else
+
+static void waitEventsUntil(RedrawClock::time_point deadline){
+	double seconds = std::chrono::duration<double>(deadline - RedrawClock::now()).count();
+	if (seconds > 0.0)
+		glfwWaitEventsTimeout(seconds);
+	else
+		glfwPollEvents();
+}
+
+static void stopTimer(){
+}
+
+#endif
+
+void initRedraw(bool onDemand){
+	RedrawOnDemand = onDemand;
+	RedrawMainThread = std::this_thread::get_id();
+	RedrawRequested = true;
+	RedrawHasDeadline = false;
+	RedrawCounters.frames = 0;
+	RedrawCounters.wakeups = 0;
+}
+
+void requestRedraw(){
+	RedrawRequested = true;
+	// The main thread is either drawing, or in waitForRedraw where it will see the request.
+	// Another thread may find it asleep : wake it up.
+	if (std::this_thread::get_id() != RedrawMainThread && RedrawWaiting)
+		glfwPostEmptyEvent();
+}
+
+void requestRedrawIn(double seconds){
+	RedrawClock::time_point deadline = RedrawClock::now() +
+		std::chrono::duration_cast<RedrawClock::duration>(std::chrono::duration<double>(seconds));
+	if (!RedrawHasDeadline || deadline < RedrawDeadline){
+		RedrawDeadline = deadline;
+		RedrawHasDeadline = true;
+	}
+}
+
+void acquireContinuousFrames(){
+	RedrawContinuous++;
+}
+
+void releaseContinuousFrames(){
+	if (RedrawContinuous > 0)
+		RedrawContinuous--;
+}
+
+bool waitForRedraw(){
+	if (!RedrawOnDemand || RedrawContinuous > 0){
+		glfwPollEvents();
+		RedrawRequested = false;
+		RedrawCounters.frames++;
+		return true;
+	}
+	if (!RedrawRequested){
+		RedrawWaiting = true;
+		// Checked again once RedrawWaiting is set, for a request made from another thread in between
+		if (RedrawRequested)
+			glfwPollEvents();
+		else if (RedrawHasDeadline)
+			waitEventsUntil(RedrawDeadline);
+		else
+			glfwWaitEvents();
+		RedrawWaiting = false;
+	}
+	else {
+		glfwPollEvents();
+	}
+	if (RedrawHasDeadline && RedrawClock::now() >= RedrawDeadline){
+		RedrawHasDeadline = false;
+		RedrawRequested = true;
+	}
+	// The event callbacks may have asked for a frame
+	if (RedrawRequested.exchange(false) || RedrawContinuous > 0){
+		RedrawCounters.frames++;
+		return true;
+	}
+	RedrawCounters.wakeups++;
+	return false;
+}
+
+RedrawStats getRedrawStats(){
+	return RedrawCounters;
+}
+
+void cleanupRedraw(){
+	stopTimer();
+	RedrawContinuous = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef REDRAW_HPP
+#define REDRAW_HPP
+
+// Rendering on demand : the main loop only draws a frame when something asked for one,
+// and sleeps in glfwWaitEvents the rest of the time.
+// Whatever changes what is on the screen (input, camera, mesh edits, results of jobs running on
+// other threads) calls requestRedraw. Animations hold continuous frames while they run.
+
+// onDemand false : a frame every time, as a plain render loop
+void initRedraw(bool onDemand);
+
+// The next frame must be drawn. Can be called from any thread : it wakes the main loop up.
+void requestRedraw();
+// Draw a frame after this many seconds, even if nothing else happens. The earliest request wins.
+void requestRedrawIn(double seconds);
+
+// While at least one is held, frames are drawn continuously
+void acquireContinuousFrames();
+void releaseContinuousFrames();
+
+// Processes the window events. When no frame is needed, waits for an event, a request or
+// the time given to requestRedrawIn. Returns true when a frame must be drawn, and clears the request.
+// Returns false when woken up by an event which changed nothing (the mouse moved, ...).
+bool waitForRedraw();
+
+struct RedrawStats {
+	unsigned int frames;   // waitForRedraw returned true
+	unsigned int wakeups;  // waitForRedraw returned false
+};
+RedrawStats getRedrawStats();
+
+void cleanupRedraw();
+
+#endif
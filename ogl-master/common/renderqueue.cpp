@@ -0,0 +1,147 @@
+#include <vector>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "glstate.hpp"
+#include "renderqueue.hpp"
+
+static const int PassBits    = 4;
+static const int ProgramBits = 10;
+static const int TextureBits = 14;
+static const int VAOBits     = 14;
+static const int DepthBits   = 22;
+
+RenderKey makeRenderKey(unsigned int pass, GLuint program, GLuint texture, GLuint vao, float depth01){
+	if (depth01 < 0.0f) depth01 = 0.0f;
+	if (depth01 > 1.0f) depth01 = 1.0f;
+	// Transparent surfaces must be blended back to front : invert the depth
+	if (pass == RENDER_PASS_TRANSPARENT)
+		depth01 = 1.0f - depth01;
+	RenderKey depth = (RenderKey)(depth01 * ((1 << DepthBits) - 1));
+
+	RenderKey key = pass & ((1 << PassBits) - 1);
+	key = (key << ProgramBits) | (program & ((1 << ProgramBits) - 1));
+	key = (key << TextureBits) | (texture & ((1 << TextureBits) - 1));
+	key = (key << VAOBits)     | (vao & ((1 << VAOBits) - 1));
+	key = (key << DepthBits)   | depth;
+	return key;
+}
+
+void clearRenderQueue(RenderQueue & queue){
+	// clear() keeps the capacity : no allocation once the queue has grown to the scene size
+	queue.items.clear();
+}
+
+void submitDraw(RenderQueue & queue, const DrawItem & item){
+	queue.items.push_back(item);
+}
+
+// LSD radix sort of the keys, 8 bits at a time. Sorts queue.order, so that
+// items[order[0]], items[order[1]], ... are in increasing key order.
+// The sort is stable, so draws with equal keys stay in submission order.
+static void radixSortKeys(RenderQueue & queue){
+	size_t n = queue.items.size();
+	queue.keys.resize(n);
+	queue.keysTmp.resize(n);
+	queue.order.resize(n);
+	queue.orderTmp.resize(n);
+	for (size_t i = 0; i < n; i++){
+		queue.keys[i] = queue.items[i].key;
+		queue.order[i] = (unsigned int)i;
+	}
+
+	for (int shift = 0; shift < 64; shift += 8){
+		unsigned int histogram[256];
+		memset(histogram, 0, sizeof(histogram));
+		for (size_t i = 0; i < n; i++)
+			histogram[(queue.keys[i] >> shift) & 0xFF]++;
+
+		// All the keys have the same digit : nothing to do for this pass.
+		// Most passes are skipped, since only a handful of programs, textures and VAOs are used.
+		if (histogram[(queue.keys[0] >> shift) & 0xFF] == n)
+			continue;
+
+		unsigned int offset = 0;
+		for (int d = 0; d < 256; d++){
+			unsigned int c = histogram[d];
+			histogram[d] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < n; i++){
+			unsigned int dst = histogram[(queue.keys[i] >> shift) & 0xFF]++;
+			queue.keysTmp[dst] = queue.keys[i];
+			queue.orderTmp[dst] = queue.order[i];
+		}
+		queue.keys.swap(queue.keysTmp);
+		queue.order.swap(queue.orderTmp);
+	}
+}
+
+void flushRenderQueue(
+	RenderQueue & queue,
+	void (*setupProgram)(GLuint program),
+	void (*setupDraw)(GLuint program, const DrawItem & item)
+){
+	memset(&queue.stats, 0, sizeof(queue.stats));
+	if (queue.items.empty())
+		return;
+
+	radixSortKeys(queue);
+
+	// The binds go through the state cache, which drops the redundant ones. The sort makes
+	// consecutive draws share their state, so most of them are dropped.
+	// Only the binds made here are counted : setupProgram and setupDraw do the same work either way.
+	unsigned int naiveChanges = 0;
+	unsigned int changes = 0;
+	GLuint currentProgram = 0;
+
+	for (size_t i = 0; i < queue.order.size(); i++){
+		const DrawItem & item = queue.items[queue.order[i]];
+
+		// A naive renderer binds the program, the VAO and the polygon mode for each draw,
+		// plus the texture unit and the texture of the textured ones
+		naiveChanges += (item.texture != 0) ? 5 : 3;
+
+		GLStateCounters before = glsGetCounters();
+		glsUseProgram(item.program);
+		changes += glsGetCounters().issued - before.issued;
+		if (i == 0 || item.program != currentProgram){
+			currentProgram = item.program;
+			setupProgram(item.program);
+		}
+		before = glsGetCounters();
+		if (item.texture != 0){
+			glsActiveTexture(GL_TEXTURE0);
+			glsBindTexture(GL_TEXTURE_2D, item.texture);
+		}
+		glsBindVertexArray(item.vao);
+		glsPolygonMode(item.polygonMode);
+		changes += glsGetCounters().issued - before.issued;
+
+		setupDraw(item.program, item);
+
+		if (item.indexType != 0){
+			size_t indexSize = (item.indexType == GL_UNSIGNED_BYTE) ? 1 : (item.indexType == GL_UNSIGNED_SHORT) ? 2 : 4;
+			const void * offset = (const void *)(item.first * indexSize);
+			if (item.instanceCount > 1)
+				glDrawElementsInstanced(item.mode, item.count, item.indexType, offset, item.instanceCount);
+			else
+				glDrawElements(item.mode, item.count, item.indexType, offset);
+		}
+		else {
+			if (item.instanceCount > 1)
+				glDrawArraysInstanced(item.mode, item.first, item.count, item.instanceCount);
+			else
+				glDrawArrays(item.mode, item.first, item.count);
+		}
+
+		queue.stats.draws++;
+	}
+
+	// The state is left as is : the next frame starts with what the cache already knows
+	queue.stats.stateChanges = changes;
+	queue.stats.stateChangesAvoided = naiveChanges > changes ? naiveChanges - changes : 0;
+}
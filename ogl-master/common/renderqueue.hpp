@@ -0,0 +1,77 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+
+// Passes, drawn in this order
+enum RenderPass {
+	RENDER_PASS_OPAQUE = 0,
+	RENDER_PASS_WIREFRAME = 1,
+	RENDER_PASS_TRANSPARENT = 2,
+	RENDER_PASS_OVERLAY = 3
+};
+
+// Flags of a DrawItem, passed as is to the per-draw callback
+enum DrawFlags {
+	DRAW_USE_LIGHTING = 1 << 0,
+	DRAW_USE_TEXTURE  = 1 << 1,
+	DRAW_SELECTED     = 1 << 2
+};
+
+// 64 bits sort key. From the most significant bits to the least :
+//   pass (4) | program (10) | texture (14) | VAO (14) | depth (22)
+// Sorting by key groups the draws by pass, then by program, texture and VAO, so that
+// consecutive draws share as much state as possible. Within the same state, opaque draws
+// go front to back (early depth rejection) and transparent ones back to front.
+// The GL names are truncated to fit : a collision only costs a state change, never a wrong draw.
+typedef unsigned long long RenderKey;
+
+RenderKey makeRenderKey(unsigned int pass, GLuint program, GLuint texture, GLuint vao, float depth01);
+
+// One draw call, with everything needed to issue it
+struct DrawItem {
+	RenderKey key;
+	GLuint program;
+	GLuint vao;
+	GLuint texture;          // 0 : no texture
+	GLenum mode;             // GL_TRIANGLES, GL_LINES, ...
+	GLuint first;            // first index (or first vertex for glDrawArrays)
+	GLsizei count;
+	GLenum indexType;        // GL_UNSIGNED_SHORT, ..., or 0 for glDrawArrays
+	GLsizei instanceCount;   // 1 for a regular draw
+	GLenum polygonMode;      // GL_FILL or GL_LINE
+	unsigned int flags;      // DrawFlags
+	unsigned int pickID;     // identifier written by the picking pass, 0 : not pickable
+	glm::mat4 ModelMatrix;
+	GLintptr constants;      // offset of the draw's DrawConstants in their uniform buffer (see drawlist.hpp), -1 : none
+};
+
+// Per-frame counters
+struct RenderQueueStats {
+	unsigned int draws;
+	unsigned int stateChanges;        // program, texture, VAO and polygon mode changes actually issued
+	unsigned int stateChangesAvoided; // the ones that a bind-everything-per-draw renderer would have issued on top
+};
+
+struct RenderQueue {
+	std::vector<DrawItem> items;
+	// Radix sort scratch space, kept from one frame to the next
+	std::vector<RenderKey> keys, keysTmp;
+	std::vector<unsigned int> order, orderTmp;
+	RenderQueueStats stats;
+};
+
+// Forget last frame's draws
+void clearRenderQueue(RenderQueue & queue);
+
+// Add a draw. Nothing is sent to OpenGL before flushRenderQueue().
+void submitDraw(RenderQueue & queue, const DrawItem & item);
+
+// Sort the draws by key and issue them, changing the state only when needed.
+// setupProgram is called each time a new program is bound (camera, lights, ...),
+// setupDraw before each draw (model matrix, flags, ...).
+void flushRenderQueue(
+	RenderQueue & queue,
+	void (*setupProgram)(GLuint program),
+	void (*setupDraw)(GLuint program, const DrawItem & item)
+);
+
+#endif
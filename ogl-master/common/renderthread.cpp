@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <GLFW/glfw3.h>
+
+#include "profiler.hpp"
+#include "renderthread.hpp"
+
+GLFWwindow * RenderWindow = NULL;
+std::thread RenderThread;
+bool RenderThreadStarted = false;
+
+// Commands recorded by the main thread since the last hand over. Only the main thread touches it.
+std::vector<RenderCommand> RenderRecording;
+
+// Lists handed over, not run yet, oldest first
+std::mutex RenderQueueMutex;
+std::condition_variable RenderQueueCondition;   // something to run, or quit
+std::condition_variable RenderDoneCondition;    // a list was run, or a slot freed
+std::vector< std::vector<RenderCommand> > RenderPending;
+// Lists run, given back empty with their capacity. A list goes around recording -> pending -> run -> spare,
+// so once there are enough of them handing a frame over doesn't allocate.
+std::vector< std::vector<RenderCommand> > RenderSpare;
+unsigned long long RenderSubmitted = 0;         // lists handed over
+unsigned long long RenderCompleted = 0;         // lists run
+bool RenderQuit = false;
+bool RenderSlotBusy[RenderSnapshotCount];
+unsigned int RenderNextSlot = 0;
+
+static void renderThreadMain(){
+	setProfilerThreadName("Render");
+	glfwMakeContextCurrent(RenderWindow);
+	std::vector<RenderCommand> commands;
+	while (true){
+		{
+			std::unique_lock<std::mutex> lock(RenderQueueMutex);
+			while (RenderPending.empty() && !RenderQuit)
+				RenderQueueCondition.wait(lock);
+			if (RenderPending.empty())
+				break; // quit, once everything ran
+			commands.swap(RenderPending.front());
+			RenderPending.erase(RenderPending.begin());
+		}
+		for (size_t i = 0; i < commands.size(); i++)
+			commands[i]();
+		commands.clear();
+		{
+			std::lock_guard<std::mutex> lock(RenderQueueMutex);
+			RenderSpare.push_back(std::vector<RenderCommand>());
+			RenderSpare.back().swap(commands);
+			RenderCompleted++;
+		}
+		RenderDoneCondition.notify_all();
+	}
+	glfwMakeContextCurrent(NULL);
+}
+
+void startRenderThread(GLFWwindow * window){
+	RenderWindow = window;
+	RenderQuit = false;
+	RenderSubmitted = 0;
+	RenderCompleted = 0;
+	RenderNextSlot = 0;
+	for (unsigned int i = 0; i < RenderSnapshotCount; i++)
+		RenderSlotBusy[i] = false;
+	// A context can only be current on one thread
+	glfwMakeContextCurrent(NULL);
+	RenderThread = std::thread(renderThreadMain);
+	RenderThreadStarted = true;
+}
+
+bool renderThreadRunning(){
+	return RenderThreadStarted;
+}
+
+void enqueueRenderCommand(const RenderCommand & command){
+	if (!RenderThreadStarted){
+		command();
+		return;
+	}
+	RenderRecording.push_back(command);
+}
+
+// Hand the recorded commands over to the render thread
+static void submitRecording(){
+	{
+		std::lock_guard<std::mutex> lock(RenderQueueMutex);
+		RenderPending.push_back(std::vector<RenderCommand>());
+		RenderPending.back().swap(RenderRecording);
+		// Record the next frame into a list already run
+		if (!RenderSpare.empty()){
+			RenderRecording.swap(RenderSpare.back());
+			RenderSpare.pop_back();
+		}
+		RenderSubmitted++;
+	}
+	RenderQueueCondition.notify_one();
+}
+
+unsigned int acquireSnapshot(){
+	unsigned int slot = RenderNextSlot;
+	RenderNextSlot = (RenderNextSlot + 1) % RenderSnapshotCount;
+	if (!RenderThreadStarted)
+		return slot;
+	PROFILE_SCOPE("acquireSnapshot");
+	// Only blocks when the render thread is RenderSnapshotCount - 1 frames behind
+	std::unique_lock<std::mutex> lock(RenderQueueMutex);
+	while (RenderSlotBusy[slot])
+		RenderDoneCondition.wait(lock);
+	RenderSlotBusy[slot] = true;
+	return slot;
+}
+
+void submitSnapshot(unsigned int slot, const RenderCommand & draw){
+	if (!RenderThreadStarted){
+		draw();
+		return;
+	}
+	// Two commands rather than one wrapping the other : both stay small enough for std::function
+	// to store them without allocating
+	RenderRecording.push_back(draw);
+	RenderRecording.push_back([slot](){
+		{
+			std::lock_guard<std::mutex> lock(RenderQueueMutex);
+			RenderSlotBusy[slot] = false;
+		}
+		RenderDoneCondition.notify_all();
+	});
+	submitRecording();
+}
+
+void finishRenderCommands(){
+	if (!RenderThreadStarted)
+		return;
+	if (!RenderRecording.empty())
+		submitRecording();
+	std::unique_lock<std::mutex> lock(RenderQueueMutex);
+	while (RenderCompleted < RenderSubmitted)
+		RenderDoneCondition.wait(lock);
+}
+
+void stopRenderThread(){
+	if (!RenderThreadStarted)
+		return;
+	finishRenderCommands();
+	{
+		std::lock_guard<std::mutex> lock(RenderQueueMutex);
+		RenderQuit = true;
+	}
+	RenderQueueCondition.notify_one();
+	RenderThread.join();
+	RenderThreadStarted = false;
+	glfwMakeContextCurrent(RenderWindow);
+}
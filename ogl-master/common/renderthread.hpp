@@ -0,0 +1,34 @@
+#ifndef RENDERTHREAD_HPP
+#define RENDERTHREAD_HPP
+
+// A thread which owns the OpenGL context and runs the commands the main thread gives it, in order.
+// The main thread records commands into its own list, without locking. submitSnapshot hands the
+// whole list over at once, and the main thread starts a new one while the render thread works
+// through the previous ones.
+// Frames are described by snapshots of the scene, kept by the caller in RenderSnapshotCount slots :
+// the main thread fills one while the render thread draws the others.
+// Without a render thread (before startRenderThread), commands run right away on the calling thread.
+
+typedef std::function<void()> RenderCommand;
+
+const unsigned int RenderSnapshotCount = 3;
+
+// Makes the context of `window` current on a new render thread : it must not be current anywhere else
+void startRenderThread(GLFWwindow * window);
+bool renderThreadRunning();
+
+// Any GL work, done before the next frame is drawn
+void enqueueRenderCommand(const RenderCommand & command);
+
+// Slot of the snapshot to fill. Waits while the render thread still uses it.
+unsigned int acquireSnapshot();
+// Hands the commands recorded so far over, followed by draw, after which the slot is free again
+void submitSnapshot(unsigned int slot, const RenderCommand & draw);
+
+// Waits until the render thread has run everything that was enqueued
+void finishRenderCommands();
+
+// Runs what is left, ends the thread and makes the context current on the calling thread again
+void stopRenderThread();
+
+#endif
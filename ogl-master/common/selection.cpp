@@ -0,0 +1,369 @@
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SELECTION_SSE
+#endif
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "glstate.hpp"
+#include "selection.hpp"
+
+void resizeSelection(SelectionBits & bits, unsigned int size){
+	unsigned int words = (size + 31) / 32;
+	bits.words.resize(words, 0u);
+	// Bits past the end of a word kept from a smaller size
+	if (size < bits.size && (size & 31) != 0)
+		bits.words[words - 1] &= (1u << (size & 31)) - 1;
+	bits.size = size;
+}
+
+void clearSelection(SelectionBits & bits){
+	std::fill(bits.words.begin(), bits.words.end(), 0u);
+}
+
+bool isVertexSelected(const SelectionBits & bits, unsigned int vertex){
+	return vertex < bits.size && (bits.words[vertex >> 5] & (1u << (vertex & 31))) != 0;
+}
+
+unsigned int countSelected(const SelectionBits & bits){
+	unsigned int count = 0;
+	for (size_t i = 0; i < bits.words.size(); i++){
+		unsigned int word = bits.words[i];
+		// Clears the lowest bit set each time
+		for (; word != 0; word &= word - 1)
+			count++;
+	}
+	return count;
+}
+
+void setSelectionVertices(SelectionGrid & grid, const glm::vec3 * positions, unsigned int count){
+	unsigned int padded = (count + 3) & ~3u;
+	grid.x.assign(padded, 0.0f);
+	grid.y.assign(padded, 0.0f);
+	grid.z.assign(padded, 0.0f);
+	for (unsigned int i = 0; i < count; i++){
+		grid.x[i] = positions[i].x;
+		grid.y[i] = positions[i].y;
+		grid.z[i] = positions[i].z;
+	}
+	grid.count = count;
+	grid.screenX.resize(padded);
+	grid.screenY.resize(padded);
+	grid.depth.resize(padded);
+	grid.vertexCell.resize(count);
+	grid.valid = false;
+}
+
+// Where the vertices behind the camera go : outside of any window
+const float OffScreen = -1e30f;
+
+static void projectVertices(SelectionGrid & grid, const glm::mat4 & M){
+	unsigned int padded = grid.x.size();
+	float halfWidth = 0.5f * grid.width, halfHeight = 0.5f * grid.height;
+#ifdef SELECTION_SSE
+	__m128 m[4][4];
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 4; row++)
+			m[column][row] = _mm_set1_ps(M[column][row]);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 minW = _mm_set1_ps(1e-6f);
+	const __m128 offScreen = _mm_set1_ps(OffScreen);
+	const __m128 sw = _mm_set1_ps(halfWidth), sh = _mm_set1_ps(halfHeight);
+	for (unsigned int i = 0; i < padded; i += 4){
+		__m128 x = _mm_loadu_ps(&grid.x[i]);
+		__m128 y = _mm_loadu_ps(&grid.y[i]);
+		__m128 z = _mm_loadu_ps(&grid.z[i]);
+		// clip = M * (x, y, z, 1), 4 vertices at a time
+		__m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][0], x), _mm_mul_ps(m[1][0], y)), _mm_add_ps(_mm_mul_ps(m[2][0], z), m[3][0]));
+		__m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][1], x), _mm_mul_ps(m[1][1], y)), _mm_add_ps(_mm_mul_ps(m[2][1], z), m[3][1]));
+		__m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][2], x), _mm_mul_ps(m[1][2], y)), _mm_add_ps(_mm_mul_ps(m[2][2], z), m[3][2]));
+		__m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][3], x), _mm_mul_ps(m[1][3], y)), _mm_add_ps(_mm_mul_ps(m[2][3], z), m[3][3]));
+		__m128 front = _mm_cmpgt_ps(cw, minW);
+		__m128 invW = _mm_div_ps(one, cw);
+		__m128 sx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cx, invW), one), sw);
+		__m128 sy = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(cy, invW)), sh);
+		__m128 d = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cz, invW), one), half);
+		// Behind the camera : off the screen, whatever the division gave
+		sx = _mm_or_ps(_mm_and_ps(front, sx), _mm_andnot_ps(front, offScreen));
+		_mm_storeu_ps(&grid.screenX[i], sx);
+		_mm_storeu_ps(&grid.screenY[i], sy);
+		_mm_storeu_ps(&grid.depth[i], d);
+	}
+#else
+	for (unsigned int i = 0; i < padded; i++){
+		glm::vec4 clip = M * glm::vec4(grid.x[i], grid.y[i], grid.z[i], 1.0f);
+		if (clip.w <= 1e-6f){
+			grid.screenX[i] = OffScreen;
+			continue;
+		}
+		grid.screenX[i] = (clip.x / clip.w + 1.0f) * halfWidth;
+		grid.screenY[i] = (1.0f - clip.y / clip.w) * halfHeight;
+		grid.depth[i] = (clip.z / clip.w + 1.0f) * 0.5f;
+	}
+#endif
+}
+
+// Counting sort of the vertices by cell
+static void binVertices(SelectionGrid & grid){
+	grid.columns = (grid.width + SelectionCellSize - 1) / SelectionCellSize;
+	grid.rows = (grid.height + SelectionCellSize - 1) / SelectionCellSize;
+	unsigned int cells = grid.columns * grid.rows;
+	grid.cellStart.assign(cells + 1, 0u);
+	for (unsigned int v = 0; v < grid.count; v++){
+		float sx = grid.screenX[v], sy = grid.screenY[v], d = grid.depth[v];
+		int cell = -1;
+		if (sx >= 0.0f && sx < grid.width && sy >= 0.0f && sy < grid.height && d >= 0.0f && d <= 1.0f){
+			cell = (int)sy / SelectionCellSize * grid.columns + (int)sx / SelectionCellSize;
+			grid.cellStart[cell]++;
+		}
+		grid.vertexCell[v] = cell;
+	}
+	// Counts to starts, then each vertex moves the start of its cell : it ends up on the start of the next cell
+	unsigned int total = 0;
+	for (unsigned int c = 0; c < cells; c++){
+		unsigned int count = grid.cellStart[c];
+		grid.cellStart[c] = total;
+		total += count;
+	}
+	grid.cellVertices.resize(total);
+	for (unsigned int v = 0; v < grid.count; v++){
+		if (grid.vertexCell[v] >= 0)
+			grid.cellVertices[grid.cellStart[grid.vertexCell[v]]++] = v;
+	}
+	for (unsigned int c = cells; c > 0; c--)
+		grid.cellStart[c] = grid.cellStart[c - 1];
+	grid.cellStart[0] = 0;
+}
+
+bool updateSelectionGrid(SelectionGrid & grid, const glm::mat4 & ViewProjection, int width, int height){
+	if (grid.valid && grid.width == width && grid.height == height && grid.ViewProjection == ViewProjection)
+		return false;
+	grid.width = width;
+	grid.height = height;
+	grid.ViewProjection = ViewProjection;
+	projectVertices(grid, ViewProjection);
+	binVertices(grid);
+	grid.valid = true;
+	return true;
+}
+
+static bool isVertexVisible(const SelectionGrid & grid, unsigned int v, const SelectionDepth * occlusion){
+	if (occlusion == NULL || occlusion->depth.empty())
+		return true;
+	int column = (int)(grid.screenX[v] * occlusion->width / grid.width);
+	int row = occlusion->height - 1 - (int)(grid.screenY[v] * occlusion->height / grid.height);
+	if (column < 0 || column >= occlusion->width || row < 0 || row >= occlusion->height)
+		return true;
+	return grid.depth[v] <= occlusion->depth[row * occlusion->width + column] + occlusion->bias;
+}
+
+static void applySelection(SelectionBits & bits, unsigned int v, SelectionMode mode){
+	if (mode == SELECT_REMOVE)
+		bits.words[v >> 5] &= ~(1u << (v & 31));
+	else
+		bits.words[v >> 5] |= 1u << (v & 31);
+}
+
+// Cells covered by a box of window coordinates, clamped to the grid. False if it misses the grid.
+static bool cellRange(const SelectionGrid & grid, float x0, float y0, float x1, float y1,
+	int & out_column0, int & out_row0, int & out_column1, int & out_row1){
+	if (x1 < 0.0f || y1 < 0.0f || x0 >= grid.width || y0 >= grid.height)
+		return false;
+	out_column0 = std::max((int)x0, 0) / SelectionCellSize;
+	out_row0 = std::max((int)y0, 0) / SelectionCellSize;
+	out_column1 = std::min((int)x1 / SelectionCellSize, grid.columns - 1);
+	out_row1 = std::min((int)y1 / SelectionCellSize, grid.rows - 1);
+	return true;
+}
+
+static void prepareSelection(const SelectionGrid & grid, SelectionMode mode, SelectionBits & bits){
+	resizeSelection(bits, grid.count);
+	if (mode == SELECT_REPLACE)
+		clearSelection(bits);
+}
+
+void selectRect(const SelectionGrid & grid, float x0, float y0, float x1, float y1,
+	const SelectionDepth * occlusion, SelectionMode mode, SelectionBits & bits){
+	prepareSelection(grid, mode, bits);
+	if (x0 > x1) std::swap(x0, x1);
+	if (y0 > y1) std::swap(y0, y1);
+	int column0, row0, column1, row1;
+	if (!grid.valid || !cellRange(grid, x0, y0, x1, y1, column0, row0, column1, row1))
+		return;
+	for (int row = row0; row <= row1; row++){
+		for (int column = column0; column <= column1; column++){
+			// The cells inside the rectangle need no test per vertex
+			bool inside = column * SelectionCellSize >= x0 && (column + 1) * SelectionCellSize <= x1 &&
+				row * SelectionCellSize >= y0 && (row + 1) * SelectionCellSize <= y1;
+			unsigned int cell = row * grid.columns + column;
+			for (unsigned int i = grid.cellStart[cell]; i < grid.cellStart[cell + 1]; i++){
+				unsigned int v = grid.cellVertices[i];
+				if (!inside && (grid.screenX[v] < x0 || grid.screenX[v] > x1 || grid.screenY[v] < y0 || grid.screenY[v] > y1))
+					continue;
+				if (isVertexVisible(grid, v, occlusion))
+					applySelection(bits, v, mode);
+			}
+		}
+	}
+}
+
+// Even-odd rule : the number of edges crossed by a ray going right
+static bool insidePolygon(const std::vector<glm::vec2> & polygon, float x, float y){
+	bool inside = false;
+	for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++){
+		const glm::vec2 & a = polygon[i];
+		const glm::vec2 & b = polygon[j];
+		if ((a.y > y) != (b.y > y) && x < a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y))
+			inside = !inside;
+	}
+	return inside;
+}
+
+void selectPolygon(const SelectionGrid & grid, const std::vector<glm::vec2> & polygon,
+	const SelectionDepth * occlusion, SelectionMode mode, SelectionBits & bits){
+	prepareSelection(grid, mode, bits);
+	if (!grid.valid || polygon.size() < 3)
+		return;
+	glm::vec2 low = polygon[0], high = polygon[0];
+	for (size_t i = 1; i < polygon.size(); i++){
+		low = glm::min(low, polygon[i]);
+		high = glm::max(high, polygon[i]);
+	}
+	int column0, row0, column1, row1;
+	if (!cellRange(grid, low.x, low.y, high.x, high.y, column0, row0, column1, row1))
+		return;
+	// Cells an edge goes through : the others are all inside or all outside, which their center tells
+	int columns = column1 - column0 + 1;
+	std::vector<unsigned char> boundary(columns * (row1 - row0 + 1), 0);
+	for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++){
+		glm::vec2 a = polygon[j], b = polygon[i];
+		if (a.y > b.y)
+			std::swap(a, b);
+		int first = std::max((int)floorf(a.y / SelectionCellSize), row0);
+		int last = std::min((int)floorf(b.y / SelectionCellSize), row1);
+		for (int row = first; row <= last; row++){
+			// The part of the edge within the band of the row
+			float top = std::max((float)(row * SelectionCellSize), a.y);
+			float bottom = std::min((float)((row + 1) * SelectionCellSize), b.y);
+			float xTop = a.x, xBottom = b.x;
+			if (b.y > a.y){
+				xTop = a.x + (top - a.y) * (b.x - a.x) / (b.y - a.y);
+				xBottom = a.x + (bottom - a.y) * (b.x - a.x) / (b.y - a.y);
+			}
+			int from = std::max((int)floorf(std::min(xTop, xBottom) / SelectionCellSize), column0);
+			int to = std::min((int)floorf(std::max(xTop, xBottom) / SelectionCellSize), column1);
+			for (int column = from; column <= to; column++)
+				boundary[(row - row0) * columns + column - column0] = 1;
+		}
+	}
+	for (int row = row0; row <= row1; row++){
+		for (int column = column0; column <= column1; column++){
+			bool crossed = boundary[(row - row0) * columns + column - column0] != 0;
+			if (!crossed && !insidePolygon(polygon, (column + 0.5f) * SelectionCellSize, (row + 0.5f) * SelectionCellSize))
+				continue;
+			unsigned int cell = row * grid.columns + column;
+			for (unsigned int i = grid.cellStart[cell]; i < grid.cellStart[cell + 1]; i++){
+				unsigned int v = grid.cellVertices[i];
+				if (crossed && !insidePolygon(polygon, grid.screenX[v], grid.screenY[v]))
+					continue;
+				if (isVertexVisible(grid, v, occlusion))
+					applySelection(bits, v, mode);
+			}
+		}
+	}
+}
+
+void uploadSelection(SelectionTexture & texture, const SelectionBits & bits){
+	if (texture.buffer == 0){
+		glGenBuffers(1, &texture.buffer);
+		glGenTextures(1, &texture.texture);
+	}
+	// Never empty : a buffer texture needs some storage
+	GLsizeiptr size = std::max(bits.words.size(), (size_t)1) * sizeof(unsigned int);
+	glsBindBuffer(GL_TEXTURE_BUFFER, texture.buffer);
+	if (size > texture.size){
+		glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+		if (texture.size == 0){
+			glsBindTexture(GL_TEXTURE_BUFFER, texture.texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, texture.buffer);
+		}
+		texture.size = size;
+	}
+	if (bits.words.empty()){
+		const unsigned int none = 0;
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(none), &none);
+	}
+	else {
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bits.words.size() * sizeof(unsigned int), &bits.words[0]);
+	}
+}
+
+void deleteSelectionTexture(SelectionTexture & texture){
+	if (texture.texture != 0)
+		glsDeleteTexture(texture.texture);
+	if (texture.buffer != 0)
+		glsDeleteBuffer(texture.buffer);
+	memset(&texture, 0, sizeof(texture));
+}
+
+void beginSelectionDepthRead(SelectionDepthRead & read, int width, int height){
+	GLsizeiptr size = (GLsizeiptr)width * height * sizeof(float);
+	if (read.pixelBuffer == 0)
+		glGenBuffers(1, &read.pixelBuffer);
+	glsBindBuffer(GL_PIXEL_PACK_BUFFER, read.pixelBuffer);
+	if (size != read.bufferSize){
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		read.bufferSize = size;
+	}
+	// A read still in flight is dropped
+	if (read.fence != 0)
+		glDeleteSync(read.fence);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	// Into the pack buffer : returns at once
+	glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, (void *)0);
+	glsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	read.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	read.width = width;
+	read.height = height;
+}
+
+bool finishSelectionDepthRead(SelectionDepthRead & read, SelectionDepth & out_depth){
+	if (read.fence == 0)
+		return false;
+	GLenum status = glClientWaitSync(read.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+	glDeleteSync(read.fence);
+	read.fence = 0;
+	out_depth.width = read.width;
+	out_depth.height = read.height;
+	out_depth.depth.resize((size_t)read.width * read.height);
+	glsBindBuffer(GL_PIXEL_PACK_BUFFER, read.pixelBuffer);
+	const void * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, read.bufferSize, GL_MAP_READ_BIT);
+	if (pixels != NULL){
+		memcpy(&out_depth.depth[0], pixels, read.bufferSize);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else {
+		// Nothing hides anything
+		std::fill(out_depth.depth.begin(), out_depth.depth.end(), 1.0f);
+	}
+	glsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return true;
+}
+
+void deleteSelectionDepthRead(SelectionDepthRead & read){
+	if (read.fence != 0)
+		glDeleteSync(read.fence);
+	if (read.pixelBuffer != 0)
+		glsDeleteBuffer(read.pixelBuffer);
+	memset(&read, 0, sizeof(read));
+}
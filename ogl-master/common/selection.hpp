@@ -0,0 +1,92 @@
+#ifndef SELECTION_HPP
+#define SELECTION_HPP
+
+// Box and lasso selection of the vertices of a mesh, on the CPU. The vertices are projected to the
+// window 4 at a time and binned into a grid of cells, which is kept until the camera or the mesh
+// changes : a query only looks at the vertices of the cells it covers. Vertices hidden behind the
+// surface can be left out by testing them against a copy of the depth buffer.
+// The result is a bitset, one bit per vertex, read by the IS_SELECTED shaders from a buffer texture.
+
+// One bit per vertex, 32 vertices per word
+struct SelectionBits {
+	std::vector<unsigned int> words;
+	unsigned int size;      // vertices
+};
+
+// Keeps the bits of the vertices which are still there, the new ones are not selected
+void resizeSelection(SelectionBits & bits, unsigned int size);
+void clearSelection(SelectionBits & bits);
+bool isVertexSelected(const SelectionBits & bits, unsigned int vertex);
+unsigned int countSelected(const SelectionBits & bits);
+
+enum SelectionMode {
+	SELECT_REPLACE,   // the vertices of the region only
+	SELECT_ADD,       // the region on top of what was selected
+	SELECT_REMOVE     // what was selected, minus the region
+};
+
+// Side of a cell of the grid, in pixels
+const int SelectionCellSize = 32;
+
+struct SelectionGrid {
+	// Positions in world space, one array per coordinate so that they load 4 at a time.
+	// Padded with zeros to a multiple of 4.
+	std::vector<float> x, y, z;
+	unsigned int count;
+	// Last projection : window coordinates ((0, 0) at the top left, as the cursor) and depth in [0, 1]
+	std::vector<float> screenX, screenY, depth;
+	// Vertices of cell c : cellVertices[cellStart[c] .. cellStart[c + 1]).
+	// The ones outside of the window or behind the camera are in none.
+	std::vector<unsigned int> cellStart, cellVertices;
+	std::vector<int> vertexCell;   // scratch, -1 : not binned
+	int columns, rows;
+	int width, height;
+	glm::mat4 ViewProjection;      // of the projection in the grid
+	bool valid;
+};
+
+// New vertices : the grid is built again by the next update
+void setSelectionVertices(SelectionGrid & grid, const glm::vec3 * positions, unsigned int count);
+// Projects and bins the vertices, unless the grid is already up to date for this camera and window.
+// Returns true when it had to.
+bool updateSelectionGrid(SelectionGrid & grid, const glm::mat4 & ViewProjection, int width, int height);
+
+// Copy of a depth buffer, rows from the bottom as glReadPixels gives them
+struct SelectionDepth {
+	std::vector<float> depth;
+	int width, height;
+	float bias;   // a vertex up to this far behind the surface (in depth buffer units) is still visible
+};
+
+// The vertices inside a rectangle (window coordinates, corners in any order) or a polygon (the lasso,
+// closed between its last and first points, even-odd rule). occlusion : NULL to select through the mesh.
+void selectRect(const SelectionGrid & grid, float x0, float y0, float x1, float y1,
+	const SelectionDepth * occlusion, SelectionMode mode, SelectionBits & bits);
+void selectPolygon(const SelectionGrid & grid, const std::vector<glm::vec2> & polygon,
+	const SelectionDepth * occlusion, SelectionMode mode, SelectionBits & bits);
+
+// The bitset as a GL_R32UI buffer texture
+struct SelectionTexture {
+	GLuint buffer;
+	GLuint texture;
+	GLsizeiptr size;
+};
+
+void uploadSelection(SelectionTexture & texture, const SelectionBits & bits);
+void deleteSelectionTexture(SelectionTexture & texture);
+
+// Copy of the depth buffer of the bound framebuffer, through a pixel buffer and a fence like the
+// ID buffer reads (see idpicking.hpp) : finished a frame or two later, without waiting
+struct SelectionDepthRead {
+	GLuint pixelBuffer;
+	GLsizeiptr bufferSize;
+	GLsync fence;
+	int width, height;
+};
+
+void beginSelectionDepthRead(SelectionDepthRead & read, int width, int height);
+// False while the GPU isn't done. Keeps out_depth.bias.
+bool finishSelectionDepthRead(SelectionDepthRead & read, SelectionDepth & out_depth);
+void deleteSelectionDepthRead(SelectionDepthRead & read);
+
+#endif
@@ -9,87 +9,283 @@ using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 
 #include <GL/glew.h>
 
 #include "shader.hpp"
 
+// GL_KHR_parallel_shader_compile is newer than our GLEW
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+struct PendingProgram {
+	GLuint ProgramID;
+	GLuint VertexShaderID;   // 0 when loaded from the binary cache
+	GLuint FragmentShaderID;
+	std::string VertexPath;
+	std::string FragmentPath;
+	// Kept to compile from source if the cached binary is rejected
+	std::string VertexShaderCode;
+	std::string FragmentShaderCode;
+	std::string CachePath;   // empty when the cache is disabled
+	bool FromBinary;
+};
+
+static std::string ProgramBinaryDirectory;
+
+// Insert the defines right after the #version line, which must stay first
+static std::string InsertDefines(const std::string & code, const char * defines){
+	if (defines == NULL || defines[0] == '\0')
+		return code;
+	size_t version = code.find("#version");
+	if (version == std::string::npos)
+		return std::string(defines) + code;
+	size_t lineEnd = code.find('\n', version);
+	if (lineEnd == std::string::npos)
+		return code + "\n" + defines;
+	// Keep the line numbers of the compile errors matching the file
+	std::string lineDirective = version == 0 ? "#line 2\n" : "";
+	return code.substr(0, lineEnd + 1) + defines + lineDirective + code.substr(lineEnd + 1);
+}
+
+static bool ReadFile(const char * path, std::string & out_code){
+	std::ifstream stream(path, std::ios::in);
+	if (!stream.is_open())
+		return false;
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	out_code = sstr.str();
+	return true;
+}
+
+static bool HasExtension(const char * name){
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++){
+		const char * extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+		if (extension != NULL && strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool ParallelCompileSupported(){
+	static int supported = -1;
+	if (supported < 0)
+		supported = HasExtension("GL_KHR_parallel_shader_compile") ? 1 : 0;
+	return supported == 1;
+}
+
+static bool ProgramBinarySupported(){
+	static int supported = -1;
+	if (supported < 0){
+		GLint formats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		supported = formats > 0 ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+// FNV-1a, 64 bits
+static void HashBytes(unsigned long long & hash, const void * data, size_t size){
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++){
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+static void HashString(unsigned long long & hash, const char * text){
+	if (text == NULL)
+		text = "";
+	HashBytes(hash, text, strlen(text) + 1); // with the terminator, so that "ab"+"c" != "a"+"bc"
+}
+
+// The binary only fits the exact same sources (defines included) on the exact same driver
+static std::string ProgramCachePath(const std::string & vertexCode, const std::string & fragmentCode){
+	unsigned long long hash = 14695981039346656037ULL;
+	HashString(hash, vertexCode.c_str());
+	HashString(hash, fragmentCode.c_str());
+	HashString(hash, (const char *)glGetString(GL_VENDOR));
+	HashString(hash, (const char *)glGetString(GL_RENDERER));
+	HashString(hash, (const char *)glGetString(GL_VERSION));
+	char name[32];
+	sprintf(name, "%016llx.bin", hash);
+	return ProgramBinaryDirectory + "/" + name;
+}
+
+// File layout : GLenum format, GLint length, then the binary itself
+static bool LoadProgramBinary(GLuint ProgramID, const std::string & path){
+	FILE * file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+		return false;
+	GLenum format = 0;
+	GLint length = 0;
+	std::vector<char> binary;
+	bool ok = fread(&format, sizeof(format), 1, file) == 1 && fread(&length, sizeof(length), 1, file) == 1 && length > 0;
+	if (ok){
+		binary.resize(length);
+		ok = fread(&binary[0], 1, length, file) == (size_t)length;
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+	glProgramBinary(ProgramID, format, &binary[0], length);
+	return true;
+}
+
+static void SaveProgramBinary(GLuint ProgramID, const std::string & path){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, &length, &format, &binary[0]);
+#ifdef _WIN32
+	_mkdir(ProgramBinaryDirectory.c_str());
+#else
+	mkdir(ProgramBinaryDirectory.c_str(), 0755);
+#endif
+	FILE * file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return;
+	fwrite(&format, sizeof(format), 1, file);
+	fwrite(&length, sizeof(length), 1, file);
+	fwrite(&binary[0], 1, length, file);
+	fclose(file);
+}
+
+// Issue the compiles and the link, without waiting for them
+static void CompileAndLink(PendingProgram * pending){
+	pending->VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	pending->FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
+	char const * VertexSourcePointer = pending->VertexShaderCode.c_str();
+	glShaderSource(pending->VertexShaderID, 1, &VertexSourcePointer , NULL);
+	glCompileShader(pending->VertexShaderID);
+
+	char const * FragmentSourcePointer = pending->FragmentShaderCode.c_str();
+	glShaderSource(pending->FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+	glCompileShader(pending->FragmentShaderID);
+
+	glAttachShader(pending->ProgramID, pending->VertexShaderID);
+	glAttachShader(pending->ProgramID, pending->FragmentShaderID);
+	if (!pending->CachePath.empty())
+		glProgramParameteri(pending->ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(pending->ProgramID);
+	pending->FromBinary = false;
+}
+
+void SetProgramBinaryCache(const char * directory){
+	ProgramBinaryDirectory = directory != NULL ? directory : "";
+}
+
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+	return LoadShadersWithDefines(vertex_file_path, fragment_file_path, "");
+}
+
+GLuint LoadShadersWithDefines(const char * vertex_file_path,const char * fragment_file_path,const char * defines){
+	return FinishLoadShaders(BeginLoadShaders(vertex_file_path, fragment_file_path, defines));
+}
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+PendingProgram * BeginLoadShaders(const char * vertex_file_path,const char * fragment_file_path,const char * defines){
+
+	PendingProgram * pending = new PendingProgram();
+	pending->ProgramID = 0;
+	pending->VertexShaderID = 0;
+	pending->FragmentShaderID = 0;
+	pending->VertexPath = vertex_file_path;
+	pending->FragmentPath = fragment_file_path;
+	pending->FromBinary = false;
 
 	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
+	if(!ReadFile(vertex_file_path, pending->VertexShaderCode)){
 		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
 		getchar();
-		return 0;
+		return pending;
 	}
 
 	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+	ReadFile(fragment_file_path, pending->FragmentShaderCode);
+
+	pending->VertexShaderCode = InsertDefines(pending->VertexShaderCode, defines);
+	pending->FragmentShaderCode = InsertDefines(pending->FragmentShaderCode, defines);
+
+	pending->ProgramID = glCreateProgram();
+
+	// Try the binary cache first
+	if (!ProgramBinaryDirectory.empty() && ProgramBinarySupported()){
+		pending->CachePath = ProgramCachePath(pending->VertexShaderCode, pending->FragmentShaderCode);
+		if (LoadProgramBinary(pending->ProgramID, pending->CachePath)){
+			pending->FromBinary = true;
+			return pending;
+		}
+	}
+
+	CompileAndLink(pending);
+	return pending;
+}
+
+bool IsProgramReady(const PendingProgram * pending){
+	if (pending->ProgramID == 0 || !ParallelCompileSupported())
+		return true;
+	GLint done = GL_TRUE;
+	glGetProgramiv(pending->ProgramID, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+GLuint FinishLoadShaders(PendingProgram * pending){
+
+	GLuint ProgramID = pending->ProgramID;
+	if (ProgramID == 0){
+		delete pending;
+		return 0;
 	}
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
-
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+	if (pending->FromBinary){
+		glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+		if (Result == GL_TRUE){
+			printf("Loaded program %s + %s from the binary cache\n", pending->VertexPath.c_str(), pending->FragmentPath.c_str());
+			delete pending;
+			return ProgramID;
+		}
+		// Driver update, different GPU... : back to the sources, and a new binary
+		printf("Cached binary of %s + %s rejected, compiling\n", pending->VertexPath.c_str(), pending->FragmentPath.c_str());
+		CompileAndLink(pending);
+	}
 
 	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	printf("Compiling shader : %s\n", pending->VertexPath.c_str());
+	glGetShaderiv(pending->VertexShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(pending->VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if ( InfoLogLength > 0 ){
 		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
+		glGetShaderInfoLog(pending->VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
 		printf("%s\n", &VertexShaderErrorMessage[0]);
 	}
 
-
-
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
 	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	printf("Compiling shader : %s\n", pending->FragmentPath.c_str());
+	glGetShaderiv(pending->FragmentShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(pending->FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if ( InfoLogLength > 0 ){
 		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
+		glGetShaderInfoLog(pending->FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
 		printf("%s\n", &FragmentShaderErrorMessage[0]);
 	}
 
-
-
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
-
 	// Check the program
+	printf("Linking program\n");
 	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
 	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if ( InfoLogLength > 0 ){
@@ -98,14 +294,15 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
 
-	
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-	
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	if (Result == GL_TRUE && !pending->CachePath.empty())
+		SaveProgramBinary(ProgramID, pending->CachePath);
 
-	return ProgramID;
-}
+	glDetachShader(ProgramID, pending->VertexShaderID);
+	glDetachShader(ProgramID, pending->FragmentShaderID);
 
+	glDeleteShader(pending->VertexShaderID);
+	glDeleteShader(pending->FragmentShaderID);
 
+	delete pending;
+	return ProgramID;
+}
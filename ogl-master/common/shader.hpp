@@ -3,4 +3,22 @@
 
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 
+// Same as LoadShaders, with defines (e.g. "#define USE_TEXTURE\n") inserted in both shaders,
+// right after their #version line
+GLuint LoadShadersWithDefines(const char * vertex_file_path,const char * fragment_file_path,const char * defines);
+
+// Keep the linked programs in this directory (glGetProgramBinary), and load them from there on the
+// next runs instead of compiling. The key is a hash of the sources with their defines, and of the
+// GL vendor, renderer and version strings. NULL disables the cache, which is the default.
+void SetProgramBinaryCache(const char * directory);
+
+// Loading in two steps : BeginLoadShaders issues the compiles and the link without checking them,
+// FinishLoadShaders waits for the result, prints the logs and deletes `pending`.
+// Beginning all the programs before finishing any lets the driver compile them in parallel.
+struct PendingProgram;
+PendingProgram * BeginLoadShaders(const char * vertex_file_path,const char * fragment_file_path,const char * defines);
+// False while the driver is still compiling (GL_KHR_parallel_shader_compile). Always true without the extension.
+bool IsProgramReady(const PendingProgram * pending);
+GLuint FinishLoadShaders(PendingProgram * pending);
+
 #endif
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "glstate.hpp"
+#include "shadervariants.hpp"
+
+// Names of the #defines, in the order of the ShaderFeature bits
+static const char * FeatureDefines[ShaderFeatureCount] = {
+	"USE_LIGHTING",
+	"USE_TEXTURE",
+	"IS_SELECTED",
+	"INSTANCED",
+	"DRAW_CONSTANTS"
+};
+
+void initShaderVariantCache(ShaderVariantCache & cache, const char * vertexPath, const char * fragmentPath){
+	cache.vertexPath = vertexPath;
+	cache.fragmentPath = fragmentPath;
+	cache.variants.clear();
+}
+
+static std::string featureDefines(unsigned int features){
+	std::string defines;
+	for (unsigned int i = 0; i < ShaderFeatureCount; i++){
+		if (features & (1u << i)){
+			defines += "#define ";
+			defines += FeatureDefines[i];
+			defines += "\n";
+		}
+	}
+	return defines;
+}
+
+static PendingProgram * beginVariant(ShaderVariantCache & cache, unsigned int features){
+	return BeginLoadShaders(cache.vertexPath.c_str(), cache.fragmentPath.c_str(), featureDefines(features).c_str());
+}
+
+static const ShaderVariant & finishVariant(ShaderVariantCache & cache, unsigned int features, PendingProgram * pending){
+	printf("Shader variant 0x%x\n", features);
+	ShaderVariant variant;
+	variant.features = features;
+	variant.program = FinishLoadShaders(pending);
+	variant.ModelMatrixID = glGetUniformLocation(variant.program, "M");
+	variant.NormalMatrixID = glGetUniformLocation(variant.program, "NormalMatrix");
+	variant.ViewMatrixID = glGetUniformLocation(variant.program, "V");
+	variant.ProjMatrixID = glGetUniformLocation(variant.program, "P");
+	variant.TextureID = glGetUniformLocation(variant.program, "texture1");
+	variant.SelectionID = glGetUniformLocation(variant.program, "selectionBits");
+	GLuint constantsBlock = glGetUniformBlockIndex(variant.program, "DrawConstants");
+	if (constantsBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(variant.program, constantsBlock, DrawConstantsBinding);
+	return cache.variants[features] = variant;
+}
+
+const ShaderVariant & getShaderVariant(ShaderVariantCache & cache, unsigned int features){
+	std::map<unsigned int, ShaderVariant>::iterator it = cache.variants.find(features);
+	if (it != cache.variants.end())
+		return it->second;
+	return finishVariant(cache, features, beginVariant(cache, features));
+}
+
+void prepareShaderVariants(ShaderVariantCache & cache, const unsigned int * featureSets, unsigned int count){
+	// Launch everything, then collect : the driver may compile them all at the same time
+	std::vector<PendingProgram *> pending(count, (PendingProgram *)NULL);
+	for (unsigned int i = 0; i < count; i++){
+		if (cache.variants.find(featureSets[i]) == cache.variants.end())
+			pending[i] = beginVariant(cache, featureSets[i]);
+	}
+	for (unsigned int i = 0; i < count; i++){
+		if (pending[i] == NULL)
+			continue;
+		// The same set twice in the list : keep the first one
+		if (cache.variants.find(featureSets[i]) == cache.variants.end())
+			finishVariant(cache, featureSets[i], pending[i]);
+		else
+			glsDeleteProgram(FinishLoadShaders(pending[i]));
+	}
+}
+
+const ShaderVariant * findShaderVariant(const ShaderVariantCache & cache, GLuint program){
+	// A handful of variants at most : a linear search is fine
+	for (std::map<unsigned int, ShaderVariant>::const_iterator it = cache.variants.begin(); it != cache.variants.end(); ++it){
+		if (it->second.program == program)
+			return &it->second;
+	}
+	return NULL;
+}
+
+void setShaderModelMatrix(const ShaderVariant & variant, const glm::mat4 & ModelMatrix){
+	if (variant.features & (SHADER_INSTANCED | SHADER_DRAW_CONSTANTS))
+		return;
+	glm::mat3 NormalMatrix = glm::transpose(glm::inverse(glm::mat3(ModelMatrix)));
+	glUniformMatrix4fv(variant.ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
+	glUniformMatrix3fv(variant.NormalMatrixID, 1, GL_FALSE, &NormalMatrix[0][0]);
+}
+
+void deleteShaderVariants(ShaderVariantCache & cache){
+	for (std::map<unsigned int, ShaderVariant>::iterator it = cache.variants.begin(); it != cache.variants.end(); ++it)
+		glsDeleteProgram(it->second.program);
+	cache.variants.clear();
+}
@@ -0,0 +1,54 @@
+#ifndef SHADERVARIANTS_HPP
+#define SHADERVARIANTS_HPP
+
+// Features of the standard shaders. Each one becomes a #define when compiling a variant,
+// so that the shaders don't branch on uniforms for them.
+enum ShaderFeature {
+	SHADER_LIGHTING  = 1 << 0, // USE_LIGHTING : two lights, else the vertex color
+	SHADER_TEXTURE   = 1 << 1, // USE_TEXTURE : texture1 modulates the color
+	SHADER_SELECTED  = 1 << 2, // IS_SELECTED : brighter material on the vertices set in the selectionBits buffer texture
+	SHADER_INSTANCED = 1 << 3, // INSTANCED : model matrix and tint from the instance attributes
+	SHADER_DRAW_CONSTANTS = 1 << 4 // DRAW_CONSTANTS : model and normal matrices from the DrawConstants uniform block
+};
+const unsigned int ShaderFeatureCount = 5;
+
+// Binding point of the DrawConstants uniform block (see drawlist.hpp)
+const GLuint DrawConstantsBinding = 0;
+
+// One compiled and linked permutation, and the locations of its uniforms
+struct ShaderVariant {
+	unsigned int features;
+	GLuint program;
+	GLint ModelMatrixID;   // -1 for INSTANCED and DRAW_CONSTANTS
+	GLint NormalMatrixID;  // -1 for INSTANCED and DRAW_CONSTANTS
+	GLint ViewMatrixID;
+	GLint ProjMatrixID;
+	GLint TextureID;       // -1 without USE_TEXTURE
+	GLint SelectionID;     // -1 without IS_SELECTED
+};
+
+// The permutations of a pair of shader files, keyed by their feature bits
+struct ShaderVariantCache {
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::map<unsigned int, ShaderVariant> variants;
+};
+
+void initShaderVariantCache(ShaderVariantCache & cache, const char * vertexPath, const char * fragmentPath);
+
+// The variant with these features. It is compiled and linked the first time it is asked for.
+const ShaderVariant & getShaderVariant(ShaderVariantCache & cache, unsigned int features);
+
+// Compile several variants at once : all the compiles are launched before the first one is waited for
+void prepareShaderVariants(ShaderVariantCache & cache, const unsigned int * featureSets, unsigned int count);
+
+// The variant which uses this program, or NULL
+const ShaderVariant * findShaderVariant(const ShaderVariantCache & cache, GLuint program);
+
+// Upload the model matrix, and the normal matrix computed from it, transpose(inverse(M)).
+// Does nothing for an INSTANCED or DRAW_CONSTANTS variant.
+void setShaderModelMatrix(const ShaderVariant & variant, const glm::mat4 & ModelMatrix);
+
+void deleteShaderVariants(ShaderVariantCache & cache);
+
+#endif
@@ -1,4 +1,5 @@
 #include <vector>
+#include <map>
 #include <cstring>
 
 #include <GL/glew.h>
@@ -9,6 +10,7 @@ using namespace glm;
 
 #include "shader.hpp"
 #include "texture.hpp"
+#include "arena.hpp"
 
 #include "text2D.hpp"
 
@@ -39,9 +41,12 @@ void printText2D(const char * text, int x, int y, int size){
 
 	unsigned int length = strlen(text);
 
-	// Fill buffers
-	std::vector<glm::vec2> vertices;
-	std::vector<glm::vec2> UVs;
+	// Fill buffers. They only live until the upload : taken from the thread's arena, not the heap.
+	ArenaScope scope(threadArena());
+	ArenaVector<glm::vec2> vertices;
+	ArenaVector<glm::vec2> UVs;
+	vertices.reserve(length * 6);
+	UVs.reserve(length * 6);
 	for ( unsigned int i=0 ; i<length ; i++ ){
 		
 		glm::vec2 vertex_up_left    = glm::vec2( x+i*size     , y+size );
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+#include "texture.hpp"
+#include "glstate.hpp"
+
+#include "textbatch.hpp"
+
+// Characters per frame. The buffer holds TextBatchFrames frames : the CPU writes one of them
+// while the GPU may still be reading the two previous ones.
+const unsigned int MaxGlyphsPerFrame = 16384;
+const unsigned int TextBatchFrames = 3;
+
+GLuint TextBatchTextureID;
+GLuint TextBatchShaderID;
+GLuint TextBatchSamplerID;
+GLuint TextBatchScreenSizeID;
+GLuint TextBatchVertexArrayID;
+GLuint TextBatchBufferID;
+
+bool TextBatchReady = false;
+bool TextBatchPersistent = false;
+GlyphInstance * TextBatchMapped = NULL;           // the whole ring, when persistently mapped
+std::vector<GlyphInstance> TextBatchStaging;      // one frame, for the orphaning path
+GLsync TextBatchFences[TextBatchFrames];
+unsigned int TextBatchFrame = 0;                  // region of the ring being written
+unsigned int TextBatchCount = 0;                  // characters in it
+unsigned int TextBatchDropped = 0;
+TextBatchStats TextBatchLastStats;
+
+// Where the characters of the current frame go
+static GlyphInstance * currentRegion(){
+	if (TextBatchPersistent)
+		return TextBatchMapped + TextBatchFrame * MaxGlyphsPerFrame;
+	return &TextBatchStaging[0];
+}
+
+// The instance attributes start at the region of the frame being drawn
+static void pointAttributes(size_t firstGlyph){
+	size_t base = firstGlyph * sizeof(GlyphInstance);
+	glsBindBuffer(GL_ARRAY_BUFFER, TextBatchBufferID);
+	glVertexAttribIPointer(0, 2, GL_SHORT, sizeof(GlyphInstance), (void*)(base));
+	glVertexAttribIPointer(1, 1, GL_UNSIGNED_SHORT, sizeof(GlyphInstance), (void*)(base + 2 * sizeof(GLshort)));
+	glVertexAttribIPointer(2, 1, GL_UNSIGNED_BYTE, sizeof(GlyphInstance), (void*)(base + 2 * sizeof(GLshort) + sizeof(GLushort)));
+}
+
+static void waitFence(GLsync & fence){
+	if (fence == 0)
+		return;
+	// Only blocks if the GPU is more than TextBatchFrames frames behind
+	GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+	while (result == GL_TIMEOUT_EXPIRED)
+		result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+bool initTextBatch(const char * fontPath, const char * vertexShaderPath, const char * fragmentShaderPath){
+
+	// loadDDS waits for a key press when the file is missing : check first
+	FILE * font = fopen(fontPath, "rb");
+	if (font == NULL){
+		printf("Font %s not found, no text\n", fontPath);
+		return false;
+	}
+	fclose(font);
+	TextBatchTextureID = loadDDS(fontPath);
+	if (TextBatchTextureID == 0)
+		return false;
+
+	TextBatchShaderID = LoadShaders(vertexShaderPath, fragmentShaderPath);
+	TextBatchSamplerID = glGetUniformLocation(TextBatchShaderID, "myTextureSampler");
+	TextBatchScreenSizeID = glGetUniformLocation(TextBatchShaderID, "screenSize");
+
+	glGenVertexArrays(1, &TextBatchVertexArrayID);
+	glsBindVertexArray(TextBatchVertexArrayID);
+	glGenBuffers(1, &TextBatchBufferID);
+	glsBindBuffer(GL_ARRAY_BUFFER, TextBatchBufferID);
+
+	// Persistently mapped ring when ARB_buffer_storage is there : addText writes straight
+	// into the memory the GPU reads, no copy and no map/unmap per frame
+	TextBatchPersistent = GLEW_ARB_buffer_storage != 0;
+	if (TextBatchPersistent){
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		GLsizeiptr size = TextBatchFrames * MaxGlyphsPerFrame * sizeof(GlyphInstance);
+		glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+		TextBatchMapped = (GlyphInstance *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+		TextBatchPersistent = TextBatchMapped != NULL;
+	}
+	if (!TextBatchPersistent){
+		// Orphaned stream buffer, refilled from a CPU copy at each flush
+		glBufferData(GL_ARRAY_BUFFER, MaxGlyphsPerFrame * sizeof(GlyphInstance), NULL, GL_STREAM_DRAW);
+		TextBatchStaging.resize(MaxGlyphsPerFrame);
+	}
+
+	for (GLuint location = 0; location < 3; location++){
+		glEnableVertexAttribArray(location);
+		// One character per instance
+		glVertexAttribDivisor(location, 1);
+	}
+	pointAttributes(0);
+	glsBindVertexArray(0);
+
+	for (unsigned int i = 0; i < TextBatchFrames; i++)
+		TextBatchFences[i] = 0;
+	TextBatchFrame = 0;
+	TextBatchCount = 0;
+	TextBatchDropped = 0;
+	memset(&TextBatchLastStats, 0, sizeof(TextBatchLastStats));
+	TextBatchLastStats.persistent = TextBatchPersistent;
+	TextBatchReady = true;
+	return true;
+}
+
+void addText(const char * text, int x, int y, int size){
+	if (!TextBatchReady)
+		return;
+	GlyphInstance * region = currentRegion();
+	for (unsigned int i = 0; text[i] != '\0'; i++){
+		if (text[i] == ' ')
+			continue; // nothing to draw
+		if (TextBatchCount == MaxGlyphsPerFrame){
+			TextBatchDropped++;
+			continue;
+		}
+		GlyphInstance & glyph = region[TextBatchCount++];
+		glyph.x = (GLshort)(x + i * size);
+		glyph.y = (GLshort)y;
+		glyph.size = (GLushort)size;
+		glyph.glyph = (GLubyte)text[i];
+		glyph.padding = 0;
+	}
+}
+
+void flushTextBatch(int screenWidth, int screenHeight){
+	if (!TextBatchReady)
+		return;
+
+	TextBatchLastStats.glyphs = TextBatchCount;
+	TextBatchLastStats.dropped = TextBatchDropped;
+	if (TextBatchCount > 0){
+		glsBindVertexArray(TextBatchVertexArrayID);
+		if (TextBatchPersistent){
+			pointAttributes(TextBatchFrame * MaxGlyphsPerFrame);
+		}
+		else {
+			glsBindBuffer(GL_ARRAY_BUFFER, TextBatchBufferID);
+			glBufferData(GL_ARRAY_BUFFER, MaxGlyphsPerFrame * sizeof(GlyphInstance), NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, TextBatchCount * sizeof(GlyphInstance), &TextBatchStaging[0]);
+		}
+
+		glsUseProgram(TextBatchShaderID);
+		glsActiveTexture(GL_TEXTURE0);
+		glsBindTexture(GL_TEXTURE_2D, TextBatchTextureID);
+		glUniform1i(TextBatchSamplerID, 0);
+		glUniform2f(TextBatchScreenSizeID, (float)screenWidth, (float)screenHeight);
+
+		glsPolygonMode(GL_FILL);
+		glsDisable(GL_DEPTH_TEST);
+		glsEnable(GL_BLEND);
+		glsBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		// 4 vertices per character : the vertex shader makes the quad from gl_VertexID
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, TextBatchCount);
+
+		glsDisable(GL_BLEND);
+		glsEnable(GL_DEPTH_TEST);
+	}
+
+	if (TextBatchPersistent){
+		// Move to the next region of the ring, once the GPU is done with it
+		if (TextBatchCount > 0)
+			TextBatchFences[TextBatchFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		TextBatchFrame = (TextBatchFrame + 1) % TextBatchFrames;
+		waitFence(TextBatchFences[TextBatchFrame]);
+	}
+	TextBatchCount = 0;
+	TextBatchDropped = 0;
+}
+
+TextBatchStats getTextBatchStats(){
+	return TextBatchLastStats;
+}
+
+void cleanupTextBatch(){
+	if (!TextBatchReady)
+		return;
+	for (unsigned int i = 0; i < TextBatchFrames; i++)
+		waitFence(TextBatchFences[i]);
+	if (TextBatchPersistent){
+		glsBindBuffer(GL_ARRAY_BUFFER, TextBatchBufferID);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		TextBatchMapped = NULL;
+	}
+	glsDeleteBuffer(TextBatchBufferID);
+	glsDeleteVertexArray(TextBatchVertexArrayID);
+	glsDeleteTexture(TextBatchTextureID);
+	glsDeleteProgram(TextBatchShaderID);
+	TextBatchReady = false;
+}
@@ -0,0 +1,35 @@
+#ifndef TEXTBATCH_HPP
+#define TEXTBATCH_HPP
+
+// Text for a whole frame in a single draw call.
+// addText only writes 8 bytes per character into a streaming buffer; flushTextBatch draws
+// everything, one instanced quad per character, expanded by the vertex shader.
+// The font is a 16x16 grid of characters, as for text2D.
+
+// One character on the screen
+struct GlyphInstance {
+	GLshort x, y;      // bottom left corner, in pixels from the bottom left of the screen
+	GLushort size;     // width and height, in pixels
+	GLubyte glyph;     // character code : cell of the font texture
+	GLubyte padding;
+};
+
+struct TextBatchStats {
+	unsigned int glyphs;   // drawn by the last flush
+	unsigned int dropped;  // did not fit in the buffer
+	bool persistent;       // persistently mapped ring buffer, or orphaned buffer
+};
+
+// False if the font can't be loaded : addText and flushTextBatch then do nothing
+bool initTextBatch(const char * fontPath, const char * vertexShaderPath, const char * fragmentShaderPath);
+
+void addText(const char * text, int x, int y, int size);
+
+// Draw all the text added since the last flush, over whatever is on the screen
+void flushTextBatch(int screenWidth, int screenHeight);
+
+TextBatchStats getTextBatchStats();
+
+void cleanupTextBatch();
+
+#endif
@@ -6,6 +6,10 @@
 
 #include <GLFW/glfw3.h>
 
+#include "mipmap.hpp"
+#include "mappedfile.hpp"
+#include "glstate.hpp"
+#include "texture.hpp"
 
 GLuint loadBMP_custom(const char * imagepath){
 
@@ -55,8 +59,10 @@ GLuint loadBMP_custom(const char * imagepath){
 	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
 	if (dataPos==0)      dataPos=54; // The BMP header is done that way
 
-	// Create a buffer
-	data = new unsigned char [imageSize];
+	// Create a buffer, with room for the padded rows even if the header says less
+	size_t bufferSize = (size_t)height * ((width * 3 + 3) & ~3u);
+	if (bufferSize < imageSize) bufferSize = imageSize;
+	data = new unsigned char [bufferSize]();
 
 	// Read the actual data from the file into the buffer
 	fread(data,1,imageSize,file);
@@ -69,11 +75,31 @@ GLuint loadBMP_custom(const char * imagepath){
 	glGenTextures(1, &textureID);
 	
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
+	glsBindTexture(GL_TEXTURE_2D, textureID);
 
 	// Give the image to OpenGL
 	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
 
+	// The other levels are made here rather than by glGenerateMipmap, which filters in gamma space
+	// (the small levels get darker) and differently from one driver to the next.
+	// BMP rows are padded to 4 bytes, the mip chain's aren't.
+	size_t rowBytes = (size_t)width * 3, paddedRowBytes = (rowBytes + 3) & ~(size_t)3;
+	unsigned char * chain = new unsigned char [mipChainBytes(width, height, 3)];
+	for (unsigned int y = 0; y < height; y++)
+		memcpy(chain + y * rowBytes, data + y * paddedRowBytes, rowBytes);
+	MipSettings mipSettings = { MIP_BOX, true, 0.0f };
+	buildMipChain(chain, width, height, 3, mipSettings);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	unsigned char * level = chain + (size_t)width * height * 3;
+	for (int i = 1; i < mipLevelCount(width, height); i++){
+		int levelWidth, levelHeight;
+		mipLevelSize(width, height, i, levelWidth, levelHeight);
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, levelWidth, levelHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, level);
+		level += (size_t)levelWidth * levelHeight * 3;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	delete [] chain;
+
 	// OpenGL has now copied the data. Free our own version
 	delete [] data;
 
@@ -86,8 +112,7 @@ GLuint loadBMP_custom(const char * imagepath){
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	// ... which requires mipmaps. Generate them automatically.
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// ... which requires mipmaps, made above.
 
 	// Return the ID of the texture we just created
 	return textureID;
@@ -120,66 +145,167 @@ GLuint loadBMP_custom(const char * imagepath){
 
 
 
-#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
-#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
-#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define DDS_FOURCC(a, b, c, d) ((unsigned int)(a) | ((unsigned int)(b) << 8) | ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+// DDS_HEADER fields, from the end of the "DDS " magic
+#define DDS_HEIGHT      8
+#define DDS_WIDTH       12
+#define DDS_MIPMAPCOUNT 24
+#define DDS_FOURCC_AT   80
+#define DDS_CAPS2       108
+#define DDSCAPS2_CUBEMAP          0x200
+#define DDSCAPS2_CUBEMAP_ALLFACES 0xFC00
+#define DDSCAPS2_VOLUME           0x200000
+// DDS_HEADER_DXT10, after DDS_HEADER when the FourCC is "DX10"
+#define DDS_RESOURCE_DIMENSION_TEXTURE2D 3
+#define DDS_RESOURCE_MISC_TEXTURECUBE    0x4
+
+// The block compressed formats, by DXGI_FORMAT
+struct DDSFormat {
+	unsigned int dxgiFormat;
+	GLenum format;
+	unsigned int blockBytes;
+};
+static const DDSFormat DDSFormats[] = {
+	{ 71, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,             8  },  // BC1_UNORM
+	{ 72, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,       8  },  // BC1_UNORM_SRGB
+	{ 74, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,             16 },  // BC2_UNORM
+	{ 75, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT,       16 },  // BC2_UNORM_SRGB
+	{ 77, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,             16 },  // BC3_UNORM
+	{ 78, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,       16 },  // BC3_UNORM_SRGB
+	{ 80, GL_COMPRESSED_RED_RGTC1,                      8  },  // BC4_UNORM
+	{ 81, GL_COMPRESSED_SIGNED_RED_RGTC1,               8  },  // BC4_SNORM
+	{ 83, GL_COMPRESSED_RG_RGTC2,                       16 },  // BC5_UNORM
+	{ 84, GL_COMPRESSED_SIGNED_RG_RGTC2,                16 },  // BC5_SNORM
+	{ 95, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,        16 },  // BC6H_UF16
+	{ 96, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT,          16 },  // BC6H_SF16
+	{ 98, GL_COMPRESSED_RGBA_BPTC_UNORM,                16 },  // BC7_UNORM
+	{ 99, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM,          16 },  // BC7_UNORM_SRGB
+};
+
+// The FourCCs of files without the DX10 header, and the DXGI_FORMAT they stand for
+static const unsigned int DDSFourCCs[][2] = {
+	{ DDS_FOURCC('D', 'X', 'T', '1'), 71 },
+	{ DDS_FOURCC('D', 'X', 'T', '2'), 74 },  // premultiplied alpha, the same blocks
+	{ DDS_FOURCC('D', 'X', 'T', '3'), 74 },
+	{ DDS_FOURCC('D', 'X', 'T', '4'), 77 },
+	{ DDS_FOURCC('D', 'X', 'T', '5'), 77 },
+	{ DDS_FOURCC('A', 'T', 'I', '1'), 80 },
+	{ DDS_FOURCC('B', 'C', '4', 'U'), 80 },
+	{ DDS_FOURCC('B', 'C', '4', 'S'), 81 },
+	{ DDS_FOURCC('A', 'T', 'I', '2'), 83 },
+	{ DDS_FOURCC('B', 'C', '5', 'U'), 83 },
+	{ DDS_FOURCC('B', 'C', '5', 'S'), 84 },
+};
+
+static unsigned int readUint(const unsigned char * data){
+	return (unsigned int)data[0] | ((unsigned int)data[1] << 8) | ((unsigned int)data[2] << 16) | ((unsigned int)data[3] << 24);
+}
 
-GLuint loadDDS(const char * imagepath){
+size_t ddsLevelBytes(const DDSInfo & info, unsigned int level){
+	unsigned int width = info.width >> level > 0 ? info.width >> level : 1;
+	unsigned int height = info.height >> level > 0 ? info.height >> level : 1;
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * info.blockBytes;
+}
 
-	unsigned char header[124];
+size_t ddsLevelOffset(const DDSInfo & info, unsigned int layer, unsigned int level){
+	size_t offset = info.dataOffset + (size_t)layer * info.layerBytes;
+	for (unsigned int i = 0; i < level; i++)
+		offset += ddsLevelBytes(info, i);
+	return offset;
+}
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
-		return 0;
+bool readDDSInfo(const unsigned char * data, size_t size, DDSInfo & out_info){
+	if (size < 4 + 124 || memcmp(data, "DDS ", 4) != 0)
+		return false;
+	const unsigned char * header = data + 4;
+	out_info.width = readUint(header + DDS_WIDTH);
+	out_info.height = readUint(header + DDS_HEIGHT);
+	// Sizes past what any GPU takes would only overflow the arithmetic below
+	if (out_info.width == 0 || out_info.height == 0 || out_info.width > 65536 || out_info.height > 65536)
+		return false;
+	unsigned int fullChain = 1;
+	for (unsigned int side = out_info.width > out_info.height ? out_info.width : out_info.height; side > 1; side /= 2)
+		fullChain++;
+	unsigned int levels = readUint(header + DDS_MIPMAPCOUNT);
+	levels = levels == 0 ? 1 : (levels > fullChain ? fullChain : levels);
+	unsigned int caps2 = readUint(header + DDS_CAPS2);
+	unsigned int fourCC = readUint(header + DDS_FOURCC_AT);
+	unsigned int dxgiFormat = 0;
+	unsigned int arraySize = 1;
+	bool cubemap = false;
+	out_info.dataOffset = 4 + 124;
+	if (fourCC == DDS_FOURCC('D', 'X', '1', '0')){
+		if (size < out_info.dataOffset + 20)
+			return false;
+		const unsigned char * dx10 = data + out_info.dataOffset;
+		dxgiFormat = readUint(dx10);
+		if (readUint(dx10 + 4) != DDS_RESOURCE_DIMENSION_TEXTURE2D)
+			return false;
+		cubemap = (readUint(dx10 + 8) & DDS_RESOURCE_MISC_TEXTURECUBE) != 0;
+		arraySize = readUint(dx10 + 12);
+		arraySize = arraySize == 0 ? 1 : arraySize;
+		out_info.dataOffset += 20;
 	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+	else {
+		for (size_t i = 0; i < sizeof(DDSFourCCs) / sizeof(DDSFourCCs[0]); i++){
+			if (DDSFourCCs[i][0] == fourCC)
+				dxgiFormat = DDSFourCCs[i][1];
+		}
+		if ((caps2 & DDSCAPS2_VOLUME) != 0)
+			return false;
+		if ((caps2 & DDSCAPS2_CUBEMAP) != 0){
+			// A cubemap missing faces can't be a GL texture
+			if ((caps2 & DDSCAPS2_CUBEMAP_ALLFACES) != DDSCAPS2_CUBEMAP_ALLFACES)
+				return false;
+			cubemap = true;
+		}
 	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
-	{ 
-	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
-		break; 
-	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
-		break; 
-	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
-		break; 
-	default: 
-		free(buffer); 
-		return 0; 
+	out_info.blockBytes = 0;
+	for (size_t i = 0; i < sizeof(DDSFormats) / sizeof(DDSFormats[0]); i++){
+		if (DDSFormats[i].dxgiFormat == dxgiFormat){
+			out_info.format = DDSFormats[i].format;
+			out_info.blockBytes = DDSFormats[i].blockBytes;
+		}
+	}
+	if (out_info.blockBytes == 0)
+		return false;
+	if (cubemap && out_info.width != out_info.height)
+		return false;
+	out_info.layers = arraySize * (cubemap ? 6 : 1);
+	if (cubemap)
+		out_info.target = arraySize > 1 ? GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_CUBE_MAP;
+	else
+		out_info.target = arraySize > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+
+	out_info.layerBytes = 0;
+	for (unsigned int level = 0; level < levels; level++)
+		out_info.layerBytes += ddsLevelBytes(out_info, level);
+	// A file cut short : the levels which are there in every layer, if level 0 is
+	size_t payload = size - out_info.dataOffset;
+	size_t lastLayer = (size_t)(out_info.layers - 1) * out_info.layerBytes;
+	if (lastLayer / out_info.layerBytes != out_info.layers - 1u || lastLayer > payload)
+		return false;
+	size_t available = 0;
+	out_info.levels = 0;
+	while (out_info.levels < levels){
+		available += ddsLevelBytes(out_info, out_info.levels);
+		if (lastLayer + available > payload)
+			break;
+		out_info.levels++;
+	}
+	return out_info.levels > 0;
+}
+
+GLuint loadDDSFromMemory(const unsigned char * data, size_t size, size_t * out_bytes, GLenum * out_target){
+
+	DDSInfo layout;
+	if (!readDDSInfo(data, size, layout))
+		return 0;
+	// Arrays of cubemaps are OpenGL 4.0 : the 3.3 contexts may not have them
+	if (layout.target == GL_TEXTURE_CUBE_MAP_ARRAY && !GLEW_VERSION_4_0 && !GLEW_ARB_texture_cube_map_array){
+		fprintf(stderr, "Cubemap arrays need OpenGL 4.0 or ARB_texture_cube_map_array\n");
+		return 0;
 	}
 
 	// Create one OpenGL texture
@@ -187,32 +313,67 @@ GLuint loadDDS(const char * imagepath){
 	glGenTextures(1, &textureID);
 
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
+	glsBindTexture(layout.target, textureID);
+
+	// Each level goes up straight from the file, as it is : the exact size of its blocks, no copy.
+	// A 2D texture or a cubemap is one call per level (and face). The layers of an array aren't next to
+	// each other in the file : the storage is made first, then each layer's levels are put in it.
+	GLenum format = layout.format;
+	size_t bytes = 0;
+	bool layered = layout.target == GL_TEXTURE_2D_ARRAY || layout.target == GL_TEXTURE_CUBE_MAP_ARRAY;
+	if (layered){
+		if (GLEW_ARB_texture_storage)
+			glTexStorage3D(layout.target, layout.levels, format, layout.width, layout.height, layout.layers);
+		else {
+			for (unsigned int level = 0; level < layout.levels; level++){
+				unsigned int width = layout.width >> level > 0 ? layout.width >> level : 1;
+				unsigned int height = layout.height >> level > 0 ? layout.height >> level : 1;
+				glCompressedTexImage3D(layout.target, level, format, width, height, layout.layers, 0,
+					(GLsizei)(ddsLevelBytes(layout, level) * layout.layers), NULL);
+			}
+		}
+	}
+	for (unsigned int layer = 0; layer < layout.layers; layer++){
+		const unsigned char * levelData = data + layout.dataOffset + (size_t)layer * layout.layerBytes;
+		for (unsigned int level = 0; level < layout.levels; level++){
+			unsigned int width = layout.width >> level > 0 ? layout.width >> level : 1;
+			unsigned int height = layout.height >> level > 0 ? layout.height >> level : 1;
+			GLsizei levelSize = (GLsizei)ddsLevelBytes(layout, level);
+			if (layered)
+				glCompressedTexSubImage3D(layout.target, level, 0, 0, layer, width, height, 1, format, levelSize, levelData);
+			else if (layout.target == GL_TEXTURE_CUBE_MAP)
+				glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer, level, format, width, height, 0, levelSize, levelData);
+			else
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, levelSize, levelData);
+			levelData += levelSize;
+			bytes += levelSize;
+		}
+	}
+	// Without all the levels down to 1x1, mipmapped filtering would find the texture incomplete
+	glTexParameteri(layout.target, GL_TEXTURE_MAX_LEVEL, layout.levels - 1);
 
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
+	if (out_bytes != NULL)
+		*out_bytes = bytes;
+	if (out_target != NULL)
+		*out_target = layout.target;
+	return textureID;
+}
 
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
+GLuint loadDDSTexture(const char * imagepath, GLenum * out_target, size_t * out_bytes){
 
-	} 
+	/* map the file, header and all the mipmaps : the levels are read from the mapping by the driver */ 
+	MappedFile file;
+	if (!mapFile(imagepath, file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
+		return 0;
+	}
 
-	free(buffer); 
+	GLuint textureID = loadDDSFromMemory(file.data, file.size, out_bytes, out_target);
+	unmapFile(file);
 
 	return textureID;
+}
 
-
-}
\ No newline at end of file
+GLuint loadDDS(const char * imagepath){
+	return loadDDSTexture(imagepath, NULL, NULL);
+}
@@ -9,8 +9,32 @@ GLuint loadBMP_custom(const char * imagepath);
 //// Load a .TGA file using GLFW's own loader
 //GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
+// Load a .DDS file : BC1 to BC7, with or without the DX10 header. The file is mapped rather than read,
+// and the levels go from the mapping to the driver without a copy of ours.
 GLuint loadDDS(const char * imagepath);
+// Same, for 2D textures, arrays and cubemaps. out_target : which of them it is (GL_TEXTURE_2D, _2D_ARRAY,
+// _CUBE_MAP, _CUBE_MAP_ARRAY), bound to it. out_bytes : size of all the levels. Either may be NULL.
+GLuint loadDDSTexture(const char * imagepath, GLenum * out_target, size_t * out_bytes);
+// Same, from the whole file already in memory (or mapped). No pixel unpack buffer may be bound.
+GLuint loadDDSFromMemory(const unsigned char * data, size_t size, size_t * out_bytes, GLenum * out_target);
+
+// Where everything is in a DDS file, from its headers, to upload the levels one at a time.
+// The layers (array elements, times 6 for cubemaps) are one after the other, each with its mip chain.
+struct DDSInfo {
+	GLenum target;            // GL_TEXTURE_2D, _2D_ARRAY, _CUBE_MAP or _CUBE_MAP_ARRAY
+	GLenum format;            // compressed internal format
+	unsigned int blockBytes;  // of a 4x4 block
+	unsigned int width, height;
+	unsigned int levels;      // in each layer : fewer than the header says if the file is cut short
+	unsigned int layers;
+	size_t dataOffset;
+	size_t layerBytes;        // of a whole mip chain, as the header says
+};
+// false for what isn't a block compressed 2D texture, array or cubemap, or doesn't fit in the file
+bool readDDSInfo(const unsigned char * data, size_t size, DDSInfo & out_info);
+size_t ddsLevelBytes(const DDSInfo & info, unsigned int level);
+// From the start of the file
+size_t ddsLevelOffset(const DDSInfo & info, unsigned int layer, unsigned int level);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1025 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+#include "texture.hpp"
+#include "redraw.hpp"
+#include "stb_image.hpp"
+#include "mappedfile.hpp"
+#include "mipmap.hpp"
+#include "texturemanager.hpp"
+
+enum TextureState {
+	TEXTURE_DECODING,    // queued for, or on, a decode thread
+	TEXTURE_UPLOADING,   // the GL texture exists, its rows go up a few at a time
+	TEXTURE_RESIDENT,
+	TEXTURE_EVICTED,
+	TEXTURE_FAILED       // drawn with the placeholder
+};
+
+// Memory from the staging pool
+struct StagingBlock {
+	unsigned char * memory;
+	size_t size;
+};
+
+struct ManagedTexture {
+	std::string path;                 // canonical path of the file it was loaded from
+	unsigned long long contentHash;   // known once the file was read
+	size_t fileSize;
+	TextureHandle sameAs;             // the first texture with the same content, found once the file was read. 0 : none
+	TextureState state;
+	GLuint texture;                   // 0 unless uploading or resident
+	size_t bytes;                     // of the mip chain, known once decoded
+	unsigned int references;
+	unsigned int lastUse;             // frame, 0 : not drawn yet
+	bool reload;                      // it was evicted before
+	bool pinned;                      // made by the caller (see addTexture) : no file to load it again from, never evicted
+	// While uploading : the decoded mip chain, one level after the other, rows from the bottom
+	StagingBlock pixels;
+	int width, height;                // of level 0
+	GLenum format;
+	size_t texelBytes;                // in pixels
+	int levels;
+	int uploadLevel;
+	size_t uploadOffset;              // of uploadLevel in pixels
+	int uploadedRows;                 // of uploadLevel
+	// Streamed DDS files : the file stays mapped, and levels firstLevel and coarser are on the GPU
+	bool streaming;
+	MappedFile file;
+	DDSInfo dds;
+	int firstLevel;                   // the finest one there, its GL_TEXTURE_BASE_LEVEL
+	int neededLevel;                  // the finest one the draws need, from their size on screen
+	float requestedPixels;            // largest size on screen asked for since the last frame, 0 : none
+	float fadeLOD;                    // GL_TEXTURE_MIN_LOD, from 1 down to 0 as a new level blends in
+};
+
+// TextureHandle - 1
+std::vector<ManagedTexture> ManagedTextures;
+// Every path a texture was asked by, and the content of the files
+std::map<std::string, TextureHandle> TexturesByPath;
+std::map<unsigned long long, TextureHandle> TexturesByContent;
+TextureManagerStats TextureStats;
+unsigned int TextureFrame = 1;
+// Drawn instead of the textures which aren't on the GPU yet
+GLuint PlaceholderTexture = 0;
+
+// Rows are copied into this buffer, which the texture uploads read from
+GLuint UploadBuffer = 0;
+size_t UploadBytesPerFrame = 8 * 1024 * 1024;
+// Textures with rows left to upload, first come first served
+std::deque<TextureHandle> UploadQueue;
+
+// DDS files go up starting with their levels of at most StreamTailSide texels, then one finer level at a time
+bool TextureStreaming = false;
+const unsigned int StreamTailSide = 128;
+// Of GL_TEXTURE_MIN_LOD per frame : a new level blends in over 4 frames instead of popping
+const float StreamFadeStep = 0.25f;
+
+// Blocks given back are kept for the next files while loads are under way, up to StagingKeepBytes
+std::mutex StagingMutex;
+std::vector<StagingBlock> StagingFree;
+size_t StagingFreeBytes = 0;
+const size_t StagingKeepBytes = 256 * 1024 * 1024;
+
+// How the decode threads make the mip chains, and whether they keep them in <image>.mips. Set before the first load.
+MipSettings TextureMipSettings = { MIP_BOX, true, 0.0f };
+bool TextureMipCache = true;
+
+// Start of an <image>.mips file, followed by the mip chain. Only valid for the same image file
+// (same size, same content hash) and the same settings.
+struct MipCacheHeader {
+	char magic[4];                    // "MIPS"
+	unsigned int version;
+	unsigned long long sourceHash;
+	unsigned long long sourceSize;
+	int width, height, channels;
+	int filter, srgb;
+	float alphaCutoff;
+};
+const unsigned int MipCacheVersion = 1;
+
+// What the decode threads are given, and what they give back
+struct DecodeRequest {
+	TextureHandle handle;
+	std::string path;
+};
+
+struct DecodeResult {
+	TextureHandle handle;
+	bool loaded;
+	bool dds;                 // file is mapped, for loadDDSFromMemory
+	unsigned long long contentHash;
+	size_t fileSize;
+	MappedFile file;
+	StagingBlock data;        // otherwise the pixels
+	int width, height;
+	GLenum format;
+	size_t texelBytes;
+	int levels;
+	bool fromCache;           // the mip chain was read from <image>.mips
+};
+
+std::vector<std::thread> DecodeThreads;
+std::mutex DecodeMutex;
+std::condition_variable DecodeCondition;      // a request, or quit
+std::condition_variable DecodeDoneCondition;  // a result
+std::deque<DecodeRequest> DecodeQueue;
+std::vector<DecodeResult> DecodeDone;
+unsigned int DecodeBusy = 0;                  // requests queued or being decoded
+bool DecodeQuit = false;
+
+// The smallest free block which is big enough, or a new one
+static StagingBlock takeStaging(size_t size){
+	{
+		std::lock_guard<std::mutex> lock(StagingMutex);
+		int best = -1;
+		for (size_t i = 0; i < StagingFree.size(); i++){
+			if (StagingFree[i].size >= size && (best < 0 || StagingFree[i].size < StagingFree[best].size))
+				best = i;
+		}
+		if (best >= 0){
+			StagingBlock block = StagingFree[best];
+			StagingFree.erase(StagingFree.begin() + best);
+			StagingFreeBytes -= block.size;
+			return block;
+		}
+	}
+	StagingBlock block;
+	block.memory = (unsigned char *)malloc(size > 0 ? size : 1);
+	block.size = size;
+	return block;
+}
+
+static void giveStaging(StagingBlock & block){
+	if (block.memory == NULL)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(StagingMutex);
+		if (StagingFreeBytes + block.size <= StagingKeepBytes){
+			StagingFree.push_back(block);
+			StagingFreeBytes += block.size;
+			block.memory = NULL;
+			return;
+		}
+	}
+	free(block.memory);
+	block.memory = NULL;
+}
+
+// Once nothing is loading anymore
+static void trimStaging(){
+	std::lock_guard<std::mutex> lock(StagingMutex);
+	for (size_t i = 0; i < StagingFree.size(); i++)
+		free(StagingFree[i].memory);
+	StagingFree.clear();
+	StagingFreeBytes = 0;
+}
+
+// Absolute, without . .. or links : "../common/a.jpg" and "common/a.jpg" from another directory are the same file.
+// False if there is no such file.
+static bool canonicalPath(const char * path, std::string & out_path){
+#ifdef _WIN32
+	char full[_MAX_PATH];
+	if (_fullpath(full, path, _MAX_PATH) == NULL)
+		return false;
+	FILE * file = fopen(full, "rb");
+	if (file == NULL)
+		return false;
+	fclose(file);
+#else
+	char full[PATH_MAX];
+	if (realpath(path, full) == NULL)
+		return false;
+#endif
+	out_path = full;
+	return true;
+}
+
+// FNV-1a, 64 bits
+static unsigned long long hashContent(const unsigned char * data, size_t size){
+	unsigned long long hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++){
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static GLenum formatOfChannels(int channels){
+	if (channels == 1)
+		return GL_RED;
+	if (channels == 2)
+		return GL_RG;
+	if (channels == 4)
+		return GL_RGBA;
+	return GL_RGB;
+}
+
+// Only the colors of RGB and RGBA images are taken as sRGB : one or two channels are usually data
+static MipSettings mipSettingsFor(int channels){
+	MipSettings settings = TextureMipSettings;
+	settings.srgb = settings.srgb && channels >= 3;
+	return settings;
+}
+
+static void fillMipCacheHeader(const DecodeResult & result, MipCacheHeader & header){
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "MIPS", 4);
+	header.version = MipCacheVersion;
+	header.sourceHash = result.contentHash;
+	header.sourceSize = result.fileSize;
+	header.width = result.width;
+	header.height = result.height;
+	header.channels = (int)result.texelBytes;
+	MipSettings settings = mipSettingsFor(header.channels);
+	header.filter = settings.filter;
+	header.srgb = settings.srgb;
+	header.alphaCutoff = settings.alphaCutoff;
+}
+
+// The mip chain of the image from <image>.mips, if it was made from this very file with these settings
+static bool readMipCache(const std::string & path, DecodeResult & result){
+	FILE * file = fopen((path + ".mips").c_str(), "rb");
+	if (file == NULL)
+		return false;
+	MipCacheHeader header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "MIPS", 4) == 0 &&
+		header.version == MipCacheVersion && header.sourceHash == result.contentHash &&
+		header.sourceSize == result.fileSize && header.width > 0 && header.height > 0 &&
+		header.channels >= 1 && header.channels <= 4;
+	if (valid){
+		// The settings it was made with, for this image
+		result.width = header.width;
+		result.height = header.height;
+		result.texelBytes = header.channels;
+		MipCacheHeader expected;
+		fillMipCacheHeader(result, expected);
+		valid = header.filter == expected.filter && header.srgb == expected.srgb && header.alphaCutoff == expected.alphaCutoff;
+	}
+	if (!valid){
+		fclose(file);
+		return false;
+	}
+	size_t chainBytes = mipChainBytes(header.width, header.height, header.channels);
+	result.data = takeStaging(chainBytes);
+	if (fread(result.data.memory, 1, chainBytes, file) != chainBytes){
+		fclose(file);
+		giveStaging(result.data);
+		return false;
+	}
+	fclose(file);
+	result.format = formatOfChannels(header.channels);
+	result.levels = mipLevelCount(header.width, header.height);
+	return true;
+}
+
+// Written under another name, then renamed : a load reading the file never sees half of it.
+// Where the image's directory can't be written, every load makes the mip chain again.
+static void writeMipCache(const std::string & path, const DecodeResult & result){
+	MipCacheHeader header;
+	fillMipCacheHeader(result, header);
+	std::string temporary = path + ".mips.tmp";
+	FILE * file = fopen(temporary.c_str(), "wb");
+	if (file == NULL)
+		return;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(result.data.memory, 1, result.data.size, file) == result.data.size;
+	fclose(file);
+	std::string cache = path + ".mips";
+	// rename doesn't replace a file everywhere
+	remove(cache.c_str());
+	if (!written || rename(temporary.c_str(), cache.c_str()) != 0)
+		remove(temporary.c_str());
+}
+
+// On a decode thread : reads the file, hashes it, and decodes it into staging memory
+static void decode(const DecodeRequest & request, DecodeResult & result){
+	result.handle = request.handle;
+	result.loaded = false;
+	result.dds = false;
+	result.fromCache = false;
+	result.data.memory = NULL;
+	result.file.data = NULL;
+	// Mapped, not copied : hashing it reads it in
+	MappedFile file;
+	if (!mapFile(request.path.c_str(), file))
+		return;
+	size_t fileSize = file.size;
+	result.contentHash = hashContent(file.data, fileSize);
+	result.fileSize = fileSize;
+	if (fileSize >= 4 && memcmp(file.data, "DDS ", 4) == 0){
+		// Already compressed : uploaded as it is, from the mapping
+		result.dds = true;
+		result.file = file;
+		result.loaded = true;
+		return;
+	}
+	int width, height, channels;
+	unsigned char * pixels = NULL;
+	if (!TextureMipCache || !readMipCache(request.path, result))
+		pixels = stbi_load_from_memory(file.data, (int)fileSize, &width, &height, &channels, 0);
+	else
+		result.fromCache = true;
+	unmapFile(file);
+	if (result.fromCache){
+		result.loaded = true;
+		return;
+	}
+	if (pixels == NULL)
+		return;
+	result.width = width;
+	result.height = height;
+	result.texelBytes = channels;
+	result.format = formatOfChannels(channels);
+	// The mip chain is made here too : glGenerateMipmap would be one long stall of the GL thread
+	result.levels = mipLevelCount(width, height);
+	size_t chainBytes = mipChainBytes(width, height, channels);
+	// stb_image allocates with malloc as the pool does (STBI_MALLOC isn't defined) : rather than being
+	// copied, its pixels become a block of the pool, grown to hold the other levels
+	unsigned char * chain = (unsigned char *)realloc(pixels, chainBytes);
+	if (chain == NULL){
+		stbi_image_free(pixels);
+		return;
+	}
+	buildMipChain(chain, width, height, channels, mipSettingsFor(channels));
+	result.data.memory = chain;
+	result.data.size = chainBytes;
+	result.loaded = true;
+	if (TextureMipCache)
+		writeMipCache(request.path, result);
+}
+
+static void decodeMain(){
+	while (true){
+		DecodeRequest request;
+		{
+			std::unique_lock<std::mutex> lock(DecodeMutex);
+			while (!DecodeQuit && DecodeQueue.empty())
+				DecodeCondition.wait(lock);
+			if (DecodeQuit)
+				return;
+			request = DecodeQueue.front();
+			DecodeQueue.pop_front();
+		}
+		DecodeResult result;
+		decode(request, result);
+		{
+			std::lock_guard<std::mutex> lock(DecodeMutex);
+			DecodeDone.push_back(result);
+			DecodeBusy--;
+		}
+		DecodeDoneCondition.notify_all();
+		// The GL thread takes it at the start of the next frame
+		requestRedraw();
+	}
+}
+
+static void queueDecode(TextureHandle handle){
+	ManagedTexture & texture = ManagedTextures[handle - 1];
+	texture.state = TEXTURE_DECODING;
+	DecodeRequest request;
+	request.handle = handle;
+	request.path = texture.path;
+	if (DecodeThreads.empty()){
+		DecodeResult result;
+		decode(request, result);
+		std::lock_guard<std::mutex> lock(DecodeMutex);
+		DecodeDone.push_back(result);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(DecodeMutex);
+		DecodeQueue.push_back(request);
+		DecodeBusy++;
+	}
+	DecodeCondition.notify_one();
+}
+
+void initTextureManager(size_t budgetBytes, unsigned int decodeThreads, size_t uploadBytesPerFrame){
+	memset(&TextureStats, 0, sizeof(TextureStats));
+	TextureStats.budget = budgetBytes;
+	UploadBytesPerFrame = uploadBytesPerFrame;
+	DecodeQuit = false;
+	for (unsigned int i = 0; i < decodeThreads; i++)
+		DecodeThreads.push_back(std::thread(decodeMain));
+	glGenBuffers(1, &UploadBuffer);
+	// Mid grey : the lighting still shows the shape
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	glGenTextures(1, &PlaceholderTexture);
+	glsBindTexture(GL_TEXTURE_2D, PlaceholderTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+// Makes a streamed texture anew with levels first and coarser, from the mapping : the levels are
+// added one at a time at the front, and dropped there, which storage made once can't do
+static void makeStreamedTexture(ManagedTexture & texture, int first){
+	GLuint previous = texture.texture;
+	// With the upload buffer bound, the file's address would be read as an offset in it
+	glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glGenTextures(1, &texture.texture);
+	glsBindTexture(GL_TEXTURE_2D, texture.texture);
+	size_t bytes = 0;
+	for (int level = first; level < texture.levels; level++){
+		int levelWidth, levelHeight;
+		mipLevelSize(texture.width, texture.height, level, levelWidth, levelHeight);
+		size_t size = ddsLevelBytes(texture.dds, level);
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.format, levelWidth, levelHeight, 0, (GLsizei)size,
+			texture.file.data + ddsLevelOffset(texture.dds, 0, level));
+		bytes += size;
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// The levels above first don't exist : sampling stops at first, and the texture is complete without them
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+	if (previous != 0)
+		glsDeleteTexture(previous);
+	TextureStats.residentBytes += bytes;
+	TextureStats.residentBytes -= texture.bytes;
+	texture.bytes = bytes;
+	texture.firstLevel = first;
+	texture.fadeLOD = 0.0f;
+}
+
+// A texture deleted, or evicted : nothing left to stream it from
+static void stopStreaming(ManagedTexture & texture){
+	unmapFile(texture.file);
+	texture.streaming = false;
+}
+
+// Least recently used first, the ones nobody holds before the others.
+// The textures of the current frame and keep stay : over the budget if they don't fit.
+// So do the ones still uploading.
+// Before any of that, streamed textures give back the levels finer than their draws need, the
+// largest first : far away objects lose their detail before anything is loaded again.
+static void evictTextures(TextureHandle keep){
+	while (TextureStats.residentBytes > TextureStats.budget){
+		int finest = -1;
+		size_t finestBytes = 0;
+		for (size_t i = 0; i < ManagedTextures.size(); i++){
+			const ManagedTexture & texture = ManagedTextures[i];
+			if (texture.state != TEXTURE_RESIDENT || !texture.streaming || texture.firstLevel >= texture.neededLevel)
+				continue;
+			size_t bytes = ddsLevelBytes(texture.dds, texture.firstLevel);
+			if (finest < 0 || bytes > finestBytes){
+				finest = i;
+				finestBytes = bytes;
+			}
+		}
+		if (finest >= 0){
+			// Safe for the current frame too : its draws ask for the texture again
+			makeStreamedTexture(ManagedTextures[finest], ManagedTextures[finest].firstLevel + 1);
+			TextureStats.levelDrops++;
+			continue;
+		}
+		int victim = -1;
+		for (size_t i = 0; i < ManagedTextures.size(); i++){
+			const ManagedTexture & texture = ManagedTextures[i];
+			if (texture.state != TEXTURE_RESIDENT || i + 1 == keep || texture.lastUse == TextureFrame || texture.pinned)
+				continue;
+			if (victim < 0)
+				victim = i;
+			else {
+				const ManagedTexture & best = ManagedTextures[victim];
+				bool held = texture.references > 0, bestHeld = best.references > 0;
+				if (held != bestHeld ? !held : texture.lastUse < best.lastUse)
+					victim = i;
+			}
+		}
+		if (victim < 0)
+			return;
+		ManagedTexture & texture = ManagedTextures[victim];
+		glsDeleteTexture(texture.texture);
+		texture.texture = 0;
+		stopStreaming(texture);
+		texture.state = TEXTURE_EVICTED;
+		TextureStats.residentBytes -= texture.bytes;
+		TextureStats.evictions++;
+	}
+}
+
+void setTextureMipmaps(const MipSettings & settings, bool cache){
+	TextureMipSettings = settings;
+	TextureMipCache = cache;
+}
+
+void setTextureBudget(size_t budgetBytes){
+	TextureStats.budget = budgetBytes;
+	evictTextures(0);
+}
+
+void setTextureStreaming(bool streaming){
+	TextureStreaming = streaming;
+}
+
+// The texture a handle stands for, once the duplicates are known
+static TextureHandle resolveHandle(TextureHandle handle){
+	while (ManagedTextures[handle - 1].sameAs != 0)
+		handle = ManagedTextures[handle - 1].sameAs;
+	return handle;
+}
+
+static void textureReady(ManagedTexture & texture){
+	texture.state = TEXTURE_RESIDENT;
+	if (texture.reload)
+		TextureStats.reloads++;
+	else
+		TextureStats.misses++;
+}
+
+// What a result holds : its pixels back to the pool, its file unmapped
+static void releaseResult(DecodeResult & result){
+	giveStaging(result.data);
+	unmapFile(result.file);
+}
+
+// On the GL thread : a file was decoded
+static void finishDecode(DecodeResult & result){
+	TextureHandle handle = result.handle;
+	ManagedTexture & texture = ManagedTextures[handle - 1];
+	if (!result.loaded){
+		fprintf(stderr, "%s is not an image we can read\n", texture.path.c_str());
+		texture.state = TEXTURE_FAILED;
+		releaseResult(result);
+		return;
+	}
+	if (result.fromCache)
+		TextureStats.mipCacheHits++;
+	if (!texture.reload){
+		texture.contentHash = result.contentHash;
+		texture.fileSize = result.fileSize;
+		std::map<unsigned long long, TextureHandle>::iterator byContent = TexturesByContent.find(result.contentHash);
+		if (byContent != TexturesByContent.end() && ManagedTextures[byContent->second - 1].fileSize == result.fileSize){
+			// The same image under another name : its holders move to the first one
+			ManagedTexture & first = ManagedTextures[byContent->second - 1];
+			first.references += texture.references;
+			if (texture.lastUse > first.lastUse)
+				first.lastUse = texture.lastUse;
+			texture.references = 0;
+			texture.sameAs = byContent->second;
+			texture.state = TEXTURE_EVICTED;
+			TextureStats.contentHits++;
+			releaseResult(result);
+			return;
+		}
+		TexturesByContent[result.contentHash] = handle;
+	}
+	DDSInfo dds;
+	if (result.dds && TextureStreaming && readDDSInfo(result.file.data, result.file.size, dds) &&
+		dds.target == GL_TEXTURE_2D && dds.levels > 1){
+		// The small levels at once, then the finer ones over the next frames. The texture keeps the mapping.
+		texture.streaming = true;
+		texture.file = result.file;
+		result.file.data = NULL;
+		texture.dds = dds;
+		texture.width = dds.width;
+		texture.height = dds.height;
+		texture.format = dds.format;
+		texture.levels = dds.levels;
+		int tail = texture.levels - 1;
+		while (tail > 0){
+			int levelWidth, levelHeight;
+			mipLevelSize(texture.width, texture.height, tail - 1, levelWidth, levelHeight);
+			if ((unsigned int)levelWidth > StreamTailSide || (unsigned int)levelHeight > StreamTailSide)
+				break;
+			tail--;
+		}
+		// All of it until a draw says how big it is on screen
+		texture.neededLevel = 0;
+		texture.requestedPixels = 0.0f;
+		texture.bytes = 0;
+		makeStreamedTexture(texture, tail);
+		releaseResult(result);
+		textureReady(texture);
+		evictTextures(handle);
+		return;
+	}
+	if (result.dds){
+		// Block compressed levels go up as they are in the file, in one go : a tenth of the
+		// bytes of the decoded image, and nothing to decode. With the upload buffer bound,
+		// the file's address would be read as an offset in it.
+		glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		GLenum target = GL_TEXTURE_2D;
+		texture.texture = loadDDSFromMemory(result.file.data, result.file.size, &texture.bytes, &target);
+		releaseResult(result);
+		if (texture.texture != 0 && target != GL_TEXTURE_2D){
+			// Drawn as 2D textures : arrays and cubemaps are for loadDDSTexture
+			fprintf(stderr, "%s is an array or a cubemap, not a 2D texture\n", texture.path.c_str());
+			glsDeleteTexture(texture.texture);
+			texture.texture = 0;
+		}
+		if (texture.texture == 0){
+			texture.state = TEXTURE_FAILED;
+			return;
+		}
+		// Still bound by loadDDSFromMemory
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		TextureStats.residentBytes += texture.bytes;
+		textureReady(texture);
+		evictTextures(handle);
+		return;
+	}
+	texture.pixels = result.data;
+	texture.width = result.width;
+	texture.height = result.height;
+	texture.format = result.format;
+	texture.texelBytes = result.texelBytes;
+	texture.levels = result.levels;
+	texture.uploadLevel = 0;
+	texture.uploadOffset = 0;
+	texture.uploadedRows = 0;
+	glGenTextures(1, &texture.texture);
+	glsBindTexture(GL_TEXTURE_2D, texture.texture);
+	// Storage only, all the levels at once when the driver can
+	if (GLEW_ARB_texture_storage){
+		GLenum sizedFormat = GL_RGB8;
+		if (texture.format == GL_RED)
+			sizedFormat = GL_R8;
+		else if (texture.format == GL_RG)
+			sizedFormat = GL_RG8;
+		else if (texture.format == GL_RGBA)
+			sizedFormat = GL_RGBA8;
+		glTexStorage2D(GL_TEXTURE_2D, texture.levels, sizedFormat, texture.width, texture.height);
+	}
+	else {
+		// With the upload buffer bound, NULL would be an offset in it
+		glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		for (int level = 0; level < texture.levels; level++){
+			int levelWidth, levelHeight;
+			mipLevelSize(texture.width, texture.height, level, levelWidth, levelHeight);
+			glTexImage2D(GL_TEXTURE_2D, level, texture.format, levelWidth, levelHeight, 0, texture.format, GL_UNSIGNED_BYTE, NULL);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// RGB is usually stored with 4 bytes per texel
+	texture.bytes = mipChainBytes(texture.width, texture.height, texture.texelBytes == 3 ? 4 : (int)texture.texelBytes);
+	texture.state = TEXTURE_UPLOADING;
+	TextureStats.residentBytes += texture.bytes;
+	UploadQueue.push_back(handle);
+	evictTextures(handle);
+}
+
+static void collectDecodes(){
+	std::vector<DecodeResult> done;
+	{
+		std::lock_guard<std::mutex> lock(DecodeMutex);
+		done.swap(DecodeDone);
+	}
+	for (size_t i = 0; i < done.size(); i++)
+		finishDecode(done[i]);
+}
+
+// Copies up to `bytes` of rows into the upload buffer, and from there into the levels of the textures.
+// At least one row goes up, so that a texture wider than the budget still gets there.
+static void uploadRows(size_t bytes){
+	while (!UploadQueue.empty()){
+		ManagedTexture & texture = ManagedTextures[UploadQueue.front() - 1];
+		int levelWidth, levelHeight;
+		mipLevelSize(texture.width, texture.height, texture.uploadLevel, levelWidth, levelHeight);
+		size_t rowBytes = (size_t)levelWidth * texture.texelBytes;
+		int rows = levelHeight - texture.uploadedRows;
+		if ((size_t)rows * rowBytes > bytes)
+			rows = bytes / rowBytes > 0 ? int(bytes / rowBytes) : 1;
+		size_t size = (size_t)rows * rowBytes;
+		glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, UploadBuffer);
+		// New storage every time : the GPU may still be reading the previous rows
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		void * mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped != NULL){
+			memcpy(mapped, texture.pixels.memory + texture.uploadOffset + (size_t)texture.uploadedRows * rowBytes, size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glsBindTexture(GL_TEXTURE_2D, texture.texture);
+			// Rows of RGB images aren't always a multiple of 4 bytes
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, texture.uploadLevel, 0, texture.uploadedRows, levelWidth, rows, texture.format, GL_UNSIGNED_BYTE, (void*)0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		}
+		glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		texture.uploadedRows += rows;
+		if (texture.uploadedRows == levelHeight){
+			texture.uploadOffset += (size_t)levelHeight * rowBytes;
+			texture.uploadedRows = 0;
+			texture.uploadLevel++;
+		}
+		if (texture.uploadLevel == texture.levels){
+			giveStaging(texture.pixels);
+			textureReady(texture);
+			UploadQueue.pop_front();
+			if (UploadQueue.empty()){
+				// Nothing to keep the buffer's memory for
+				glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, UploadBuffer);
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, 0, NULL, GL_STREAM_DRAW);
+				glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		}
+		if (size >= bytes)
+			return;
+		bytes -= size;
+	}
+}
+
+// Adds the next finer level of the streamed textures, up to `bytes` of them. The coarsest next level goes
+// first, whichever the texture : every object gets sharper before any of them is at full detail.
+// The first level always goes up, even if bigger, and none which doesn't fit in the budget once the
+// unneeded levels are dropped. True if levels are left for the next frame, false when they're all there or don't fit.
+static bool streamLevels(size_t bytes){
+	for (bool first = true; ; first = false){
+		int next = -1;
+		for (size_t i = 0; i < ManagedTextures.size(); i++){
+			const ManagedTexture & texture = ManagedTextures[i];
+			if (texture.state != TEXTURE_RESIDENT || !texture.streaming || texture.firstLevel <= texture.neededLevel)
+				continue;
+			if (next < 0 || texture.firstLevel > ManagedTextures[next].firstLevel)
+				next = i;
+		}
+		if (next < 0)
+			return false;
+		ManagedTexture & texture = ManagedTextures[next];
+		int level = texture.firstLevel - 1;
+		size_t size = ddsLevelBytes(texture.dds, level);
+		if (size > bytes && !first)
+			return true;
+		// Counted before it is there, so that making room for it doesn't take it out again
+		TextureStats.residentBytes += size;
+		evictTextures(next + 1);
+		if (TextureStats.residentBytes > TextureStats.budget || texture.state != TEXTURE_RESIDENT){
+			TextureStats.residentBytes -= size;
+			return false;
+		}
+		int levelWidth, levelHeight;
+		mipLevelSize(texture.width, texture.height, level, levelWidth, levelHeight);
+		glsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glsBindTexture(GL_TEXTURE_2D, texture.texture);
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.format, levelWidth, levelHeight, 0, (GLsizei)size,
+			texture.file.data + ddsLevelOffset(texture.dds, 0, level));
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+		// Still sampled as before, down from the level it had : see fadeLevels
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 1.0f);
+		texture.fadeLOD = 1.0f;
+		texture.bytes += size;
+		texture.firstLevel = level;
+		TextureStats.levelsStreamed++;
+		bytes = size < bytes ? bytes - size : 0;
+	}
+}
+
+// The levels the draws need, from the sizes they asked for since the last frame
+static void updateNeededLevels(){
+	for (size_t i = 0; i < ManagedTextures.size(); i++){
+		ManagedTexture & texture = ManagedTextures[i];
+		if (!texture.streaming || texture.requestedPixels <= 0.0f)
+			continue;
+		int side = texture.width > texture.height ? texture.width : texture.height;
+		int level = 0;
+		while (level < texture.levels - 1 && (float)(side >> (level + 1)) >= texture.requestedPixels)
+			level++;
+		texture.neededLevel = level;
+		texture.requestedPixels = 0.0f;
+	}
+}
+
+// Brings the new levels in a step further. True while one still is.
+static bool fadeLevels(float step){
+	bool fading = false;
+	for (size_t i = 0; i < ManagedTextures.size(); i++){
+		ManagedTexture & texture = ManagedTextures[i];
+		if (texture.state != TEXTURE_RESIDENT || !texture.streaming || texture.fadeLOD <= 0.0f)
+			continue;
+		texture.fadeLOD = texture.fadeLOD > step ? texture.fadeLOD - step : 0.0f;
+		glsBindTexture(GL_TEXTURE_2D, texture.texture);
+		// Back to the default once it's there, rather than 0 : nothing changes when magnified
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, texture.fadeLOD > 0.0f ? texture.fadeLOD : -1000.0f);
+		fading = fading || texture.fadeLOD > 0.0f;
+	}
+	return fading;
+}
+
+TextureHandle acquireTexture(const char * path){
+	std::string canonical;
+	if (!canonicalPath(path, canonical)){
+		fprintf(stderr, "%s could not be opened\n", path);
+		return 0;
+	}
+	std::map<std::string, TextureHandle>::iterator byPath = TexturesByPath.find(canonical);
+	if (byPath != TexturesByPath.end()){
+		TextureStats.hits++;
+		ManagedTextures[resolveHandle(byPath->second) - 1].references++;
+		return byPath->second;
+	}
+	ManagedTexture texture;
+	texture.path = canonical;
+	texture.contentHash = 0;
+	texture.fileSize = 0;
+	texture.sameAs = 0;
+	texture.texture = 0;
+	texture.bytes = 0;
+	texture.references = 1;
+	texture.lastUse = 0;
+	texture.reload = false;
+	texture.pinned = false;
+	texture.pixels.memory = NULL;
+	texture.streaming = false;
+	texture.file.data = NULL;
+	texture.firstLevel = 0;
+	texture.neededLevel = 0;
+	texture.requestedPixels = 0.0f;
+	texture.fadeLOD = 0.0f;
+	ManagedTextures.push_back(texture);
+	TextureHandle handle = ManagedTextures.size();
+	TexturesByPath[canonical] = handle;
+	// Read, hashed and decoded on a decode thread, then uploaded over the next frames
+	queueDecode(handle);
+	return handle;
+}
+
+TextureHandle addTexture(const char * name, GLuint glTexture, size_t bytes){
+	ManagedTexture texture;
+	// Not in TexturesByPath : acquireTexture only finds files
+	texture.path = name;
+	texture.contentHash = 0;
+	texture.fileSize = 0;
+	texture.sameAs = 0;
+	texture.state = TEXTURE_RESIDENT;
+	texture.texture = glTexture;
+	texture.bytes = bytes;
+	texture.references = 1;
+	texture.lastUse = 0;
+	texture.reload = false;
+	texture.pinned = true;
+	texture.pixels.memory = NULL;
+	texture.streaming = false;
+	texture.file.data = NULL;
+	texture.firstLevel = 0;
+	texture.neededLevel = 0;
+	texture.requestedPixels = 0.0f;
+	texture.fadeLOD = 0.0f;
+	ManagedTextures.push_back(texture);
+	TextureStats.residentBytes += bytes;
+	evictTextures(ManagedTextures.size());
+	return ManagedTextures.size();
+}
+
+void releaseTexture(TextureHandle handle){
+	if (handle == 0 || handle > ManagedTextures.size())
+		return;
+	ManagedTexture & texture = ManagedTextures[resolveHandle(handle) - 1];
+	if (texture.references > 0)
+		texture.references--;
+}
+
+GLuint useTexture(TextureHandle handle){
+	if (handle == 0 || handle > ManagedTextures.size())
+		return 0;
+	handle = resolveHandle(handle);
+	ManagedTexture & texture = ManagedTextures[handle - 1];
+	texture.lastUse = TextureFrame;
+	if (texture.state == TEXTURE_RESIDENT)
+		return texture.texture;
+	if (texture.state == TEXTURE_EVICTED){
+		texture.reload = true;
+		queueDecode(handle);
+	}
+	return PlaceholderTexture;
+}
+
+void requestTextureSize(TextureHandle handle, float pixels){
+	if (handle == 0 || handle > ManagedTextures.size())
+		return;
+	ManagedTexture & texture = ManagedTextures[resolveHandle(handle) - 1];
+	if (pixels > texture.requestedPixels)
+		texture.requestedPixels = pixels;
+}
+
+bool isTextureResident(TextureHandle handle){
+	if (handle == 0 || handle > ManagedTextures.size())
+		return false;
+	return ManagedTextures[resolveHandle(handle) - 1].state == TEXTURE_RESIDENT;
+}
+
+void beginTextureFrame(){
+	// Still counted as the previous frame : what it drew stays while the new textures make room
+	collectDecodes();
+	updateNeededLevels();
+	// The images which aren't on the GPU at all come before the finer levels of the others
+	bool streaming = false;
+	if (!UploadQueue.empty())
+		uploadRows(UploadBytesPerFrame);
+	else
+		streaming = streamLevels(UploadBytesPerFrame);
+	bool fading = fadeLevels(StreamFadeStep);
+	TextureFrame++;
+	// The next rows and levels go up with the next frame
+	if (!UploadQueue.empty() || streaming || fading)
+		requestRedraw();
+	else if (getTextureManagerStats().loading == 0)
+		trimStaging();
+}
+
+void finishTextureLoads(){
+	while (true){
+		{
+			std::unique_lock<std::mutex> lock(DecodeMutex);
+			while (DecodeBusy > 0 && DecodeDone.empty())
+				DecodeDoneCondition.wait(lock);
+		}
+		collectDecodes();
+		// Still in pieces, so that the upload buffer doesn't grow to the size of a whole image
+		while (!UploadQueue.empty())
+			uploadRows(UploadBytesPerFrame);
+		// Every level the draws need, without the fade : the screenshots must show them
+		updateNeededLevels();
+		streamLevels(SIZE_MAX);
+		fadeLevels(1.0f);
+		std::unique_lock<std::mutex> lock(DecodeMutex);
+		if (DecodeBusy == 0 && DecodeDone.empty()){
+			lock.unlock();
+			trimStaging();
+			return;
+		}
+	}
+}
+
+TextureManagerStats getTextureManagerStats(){
+	TextureManagerStats stats = TextureStats;
+	stats.textures = 0;
+	stats.resident = 0;
+	stats.loading = 0;
+	stats.streaming = 0;
+	for (size_t i = 0; i < ManagedTextures.size(); i++){
+		const ManagedTexture & texture = ManagedTextures[i];
+		// A copy under another name is the same texture
+		if (texture.sameAs != 0)
+			continue;
+		stats.textures++;
+		if (texture.state == TEXTURE_RESIDENT)
+			stats.resident++;
+		if (texture.state == TEXTURE_RESIDENT && texture.streaming && texture.firstLevel > texture.neededLevel)
+			stats.streaming++;
+		else if (texture.state == TEXTURE_DECODING || texture.state == TEXTURE_UPLOADING)
+			stats.loading++;
+	}
+	return stats;
+}
+
+void printTextureManagerStats(){
+	TextureManagerStats stats = getTextureManagerStats();
+	printf("textures: %u/%u on the GPU (%u loading, %u streaming), %.1f of %.1f MB, %u hits (%u by content), %u misses (%u mip chains cached), %u evictions, %u reloads, %u levels streamed, %u dropped\n",
+		stats.resident, stats.textures, stats.loading, stats.streaming, stats.residentBytes / (1024.0 * 1024.0), stats.budget / (1024.0 * 1024.0),
+		stats.hits + stats.contentHits, stats.contentHits, stats.misses, stats.mipCacheHits, stats.evictions, stats.reloads,
+		stats.levelsStreamed, stats.levelDrops);
+}
+
+void cleanupTextureManager(){
+	{
+		std::lock_guard<std::mutex> lock(DecodeMutex);
+		DecodeQuit = true;
+		DecodeQueue.clear();
+	}
+	DecodeCondition.notify_all();
+	for (size_t i = 0; i < DecodeThreads.size(); i++)
+		DecodeThreads[i].join();
+	DecodeThreads.clear();
+	for (size_t i = 0; i < DecodeDone.size(); i++)
+		releaseResult(DecodeDone[i]);
+	DecodeDone.clear();
+	DecodeBusy = 0;
+	for (size_t i = 0; i < ManagedTextures.size(); i++){
+		if (ManagedTextures[i].texture != 0)
+			glsDeleteTexture(ManagedTextures[i].texture);
+		giveStaging(ManagedTextures[i].pixels);
+		stopStreaming(ManagedTextures[i]);
+	}
+	ManagedTextures.clear();
+	UploadQueue.clear();
+	TexturesByPath.clear();
+	TexturesByContent.clear();
+	TextureStats.residentBytes = 0;
+	glsDeleteTexture(PlaceholderTexture);
+	PlaceholderTexture = 0;
+	glsDeleteBuffer(UploadBuffer);
+	UploadBuffer = 0;
+	trimStaging();
+}
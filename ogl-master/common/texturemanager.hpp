@@ -0,0 +1,78 @@
+#ifndef TEXTUREMANAGER_HPP
+#define TEXTUREMANAGER_HPP
+
+// Textures loaded from files, shared by everything which asks for the same image. A file is found again
+// by its canonical path, or by a hash of its content when it was copied under another name.
+// Each texture counts its users and the bytes of its mip chain. When the textures on the GPU go over
+// the budget, the least recently used ones are deleted : first the ones nobody holds anymore, then
+// the others, which are loaded again the next time they are drawn.
+// Loading never waits : the files are mapped, hashed and decoded on decode threads, into staging memory
+// which is kept for the next files. The pixels then go up through a pixel unpack buffer, a few rows
+// per frame, and the texture is drawn with a grey placeholder until the last of them is there.
+// DDS files go up from the mapping, in one go, or when streamed : their small levels first, so that
+// there is something to draw at once, then one finer level at a time, down to the finest one the draws
+// need for their size on screen. Under memory pressure, the levels they don't need go first.
+// GL thread only (the decode threads are internal).
+
+// 0 : no texture
+typedef unsigned int TextureHandle;
+
+struct TextureManagerStats {
+	size_t residentBytes;     // mip chains on the GPU
+	size_t budget;
+	unsigned int textures;    // known, on the GPU or not
+	unsigned int resident;
+	unsigned int loading;     // being decoded or uploaded
+	unsigned int streaming;   // on the GPU, with finer levels still to stream
+	unsigned int hits;        // same canonical path
+	unsigned int contentHits; // other path, same content
+	unsigned int misses;      // loaded from the file
+	unsigned int mipCacheHits; // of the misses, the ones whose mip chain was read from <image>.mips
+	unsigned int evictions;
+	unsigned int reloads;     // evicted, then drawn again
+	unsigned int levelsStreamed;
+	unsigned int levelDrops;  // levels finer than needed, given back under memory pressure
+};
+
+// decodeThreads 0 : the files are decoded by acquireTexture itself. The uploads take up to
+// uploadBytesPerFrame in each frame, or one row of a texture if it is wider.
+void initTextureManager(size_t budgetBytes, unsigned int decodeThreads, size_t uploadBytesPerFrame);
+// How the mip chains of the images are made (see common/mipmap.hpp; sRGB applies to RGB and RGBA images only),
+// and whether they are kept next to the images, as <image>.mips, for the next loads to only read them.
+// Box filtered, sRGB and cached unless this is called, before the first acquireTexture.
+void setTextureMipmaps(const MipSettings & settings, bool cache);
+// Changing the budget evicts at once if needed
+void setTextureBudget(size_t budgetBytes);
+// 2D DDS files with a mip chain are streamed, from the levels of 128x128 and smaller up. Off unless
+// this is called, before the first acquireTexture.
+void setTextureStreaming(bool streaming);
+
+// A texture for this image file (.dds, or anything stb_image reads), with one more reference. 0 if there is no such file.
+// Returns at once : the image is loaded in the background.
+TextureHandle acquireTexture(const char * path);
+// A texture made by the caller (an atlas, ...), with one reference, drawn through the manager like the others.
+// The manager owns it from now on : counted in the budget, never evicted, deleted by cleanupTextureManager.
+TextureHandle addTexture(const char * name, GLuint texture, size_t bytes);
+// One reference less. At 0 the texture stays cached, first in line for eviction.
+void releaseTexture(TextureHandle handle);
+
+// The GL texture, to draw with it now : marks it as used by the current frame, loads it again if it was evicted.
+// The placeholder while it isn't on the GPU.
+GLuint useTexture(TextureHandle handle);
+// How many pixels across the texture covers on screen this frame, at most : a streamed texture stops at
+// the level of about that size. The largest of the frame's requests counts. Until one comes, all the levels.
+void requestTextureSize(TextureHandle handle, float pixels);
+bool isTextureResident(TextureHandle handle);
+// Call once per frame, before the draws : takes the decoded images and uploads the next rows.
+// Textures used by the current frame are never evicted.
+void beginTextureFrame();
+// Waits for every load under way and uploads them in one go : for the benchmarks and screenshots
+void finishTextureLoads();
+
+TextureManagerStats getTextureManagerStats();
+void printTextureManagerStats();
+
+// Deletes every texture, held or not
+void cleanupTextureManager();
+
+#endif
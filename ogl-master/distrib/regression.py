@@ -0,0 +1,194 @@
+from __future__ import print_function
+import os
+import sys
+import json
+import subprocess
+from PIL import Image, ImageChops, ImageFilter
+
+# Golden-image and performance regression tests of misc05_picking.
+# Each scenario runs the program headless (--headless, see common/headless.hpp), which draws an
+# orbit of the camera, then one frame from a fixed point of view saved as a BMP (distrib/screenshot.h),
+# and writes a JSON report with its frame times, load time and peak memory.
+# The image is compared with a golden image, the numbers with stored baselines.
+
+RegressionDir = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'regression')
+BaselinesPath = os.path.join(RegressionDir, 'baselines.json')
+OutputDir = os.path.join(RegressionDir, 'out')
+ProgramDir = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'misc05_picking')
+ProgramPath = os.path.join(ProgramDir, 'misc05_picking_slow_easy')
+Frames = 120
+# Runs of each scenario : the performance numbers are the best of them, which is less noisy
+Runs = 3
+
+# name, command line options
+scenarios = [
+	('textured'   , ['--texture']              ),
+	('wireframe'  , ['--wireframe']            ),
+	('subdivided' , ['--subdivisions', '1']    ),
+]
+
+# Images : a pixel differs when its perceptual difference (0..255) is above PixelThreshold,
+# and the test fails when more than ImageTolerance of the pixels differ
+PixelThreshold = 24
+ImageTolerance = 0.005
+
+# Performance : (report entry, percentile or None, relative tolerance, absolute slack)
+metrics = [
+	('frame_ms'       , 'p95', 0.25, 0.5 ),
+	('cpu_ms'         , 'p95', 0.25, 0.25),
+	('load_ms'        , None , 0.25, 20.0),
+	('peak_memory_kb' , None , 0.10, 4096),
+]
+
+def SetProgramPath(path):
+	global ProgramPath
+	ProgramPath = os.path.abspath(path)
+
+def SetFrames(frames):
+	global Frames
+	Frames = frames
+
+def SetRuns(runs):
+	global Runs
+	Runs = max(1, runs)
+
+def GoldenPath(name):
+	return os.path.join(RegressionDir, name + '.png')
+
+def RunScenario(name, options, run=0):
+	if os.path.exists(OutputDir) == False:
+		os.makedirs(OutputDir)
+	screenshot = os.path.join(OutputDir, name + '.bmp')
+	report = os.path.join(OutputDir, name + '.json')
+	for path in [screenshot, report]:
+		if os.path.exists(path): os.remove(path)
+	path = ProgramPath
+	if os.name == 'nt':
+		path += '.exe'
+	command = [path, '--headless', '--frames', str(Frames), '--report', report, '--screenshot', screenshot] + options
+	print("Running %s (%d/%d)..." % (name, run + 1, Runs))
+	# The program finds its shaders and models relative to its own directory
+	with open(os.path.join(OutputDir, name + '.log'), 'w') as log:
+		result = subprocess.call(command, cwd=ProgramDir, stdout=log, stderr=log)
+	if result != 0 or os.path.exists(screenshot) == False or os.path.exists(report) == False:
+		print("  the program failed, see " + os.path.join(OutputDir, name + '.log'))
+		return None, None
+	with open(report) as file:
+		return Image.open(screenshot).convert('RGB'), json.load(file)
+
+def PerceptualDifference(generated, golden):
+	# A slight blur forgives one pixel shifts along the edges, then the difference is taken
+	# in YCbCr, with the luma counting twice as much as each chroma channel
+	a = generated.filter(ImageFilter.GaussianBlur(1)).convert('YCbCr').split()
+	b = golden.filter(ImageFilter.GaussianBlur(1)).convert('YCbCr').split()
+	channels = [ImageChops.difference(a[i], b[i]) for i in range(3)]
+	return Image.merge('RGB', channels).convert('L', (0.5, 0.25, 0.25, 0))
+
+def CompareImages(name, generated):
+	golden = GoldenPath(name)
+	if os.path.exists(golden) == False:
+		print("  no golden image, run with accept")
+		return False
+	reference = Image.open(golden).convert('RGB')
+	if generated.size != reference.size:
+		print("  size %s instead of %s" % (generated.size, reference.size))
+		return False
+	difference = PerceptualDifference(generated, reference)
+	histogram = difference.histogram()
+	pixels = generated.size[0] * generated.size[1]
+	different = sum(histogram[PixelThreshold + 1:])
+	mean = sum(i * histogram[i] for i in range(256)) / float(pixels)
+	print("  image : %.3f%% of the pixels differ, mean difference %.3f" % (100.0 * different / pixels, mean))
+	if different > ImageTolerance * pixels:
+		# Differences in white, amplified
+		path = os.path.join(OutputDir, name + '_diff.png')
+		difference.point(lambda v: min(255, v * 8)).save(path)
+		print("  this exceeds the tolerance ! see " + path)
+		return False
+	return True
+
+# Runs a scenario Runs times : the image of the first run, and the best value of each metric
+def RunScenarioBest(name, options):
+	image, report = RunScenario(name, options)
+	if image is None:
+		return None, None
+	best = dict((MetricName(metric), MetricValue(report, metric)) for metric in metrics)
+	best['renderer'] = report['renderer']
+	for run in range(1, Runs):
+		other, report = RunScenario(name, options, run)
+		if other is None:
+			return None, None
+		for metric in metrics:
+			best[MetricName(metric)] = min(best[MetricName(metric)], MetricValue(report, metric))
+	return image, best
+
+def MetricValue(report, metric):
+	value = report[metric[0]]
+	if metric[1] is not None:
+		value = value[metric[1]]
+	return value
+
+def MetricName(metric):
+	if metric[1] is None:
+		return metric[0]
+	return metric[0] + '.' + metric[1]
+
+def ComparePerformance(name, results, baselines):
+	if name not in baselines:
+		print("  no baseline, run with accept")
+		return False
+	if baselines[name].get('renderer') != results['renderer']:
+		# Timings from another GPU or driver mean nothing here
+		print("  baseline recorded on " + str(baselines[name].get('renderer')) + ", performance not compared")
+		return True
+	ok = True
+	for metric in metrics:
+		key = MetricName(metric)
+		if key not in baselines[name]:
+			continue
+		value = results[key]
+		baseline = baselines[name][key]
+		limit = baseline * (1.0 + metric[2]) + metric[3]
+		status = "ok"
+		if value > limit:
+			status = "REGRESSION"
+			ok = False
+		print("  %-20s %12.3f  baseline %12.3f  limit %12.3f  %s" % (key, value, baseline, limit, status))
+	return ok
+
+def LoadBaselines():
+	if os.path.exists(BaselinesPath) == False:
+		return {}
+	with open(BaselinesPath) as file:
+		return json.load(file)
+
+def RunAll():
+	baselines = LoadBaselines()
+	failed = []
+	for name, options in scenarios:
+		image, results = RunScenarioBest(name, options)
+		if image is None:
+			failed.append(name)
+			continue
+		imageOk = CompareImages(name, image)
+		performanceOk = ComparePerformance(name, results, baselines)
+		if not (imageOk and performanceOk):
+			failed.append(name)
+	if len(failed) > 0:
+		print("Failed : " + ', '.join(failed))
+		return False
+	print("All %d scenarios passed" % len(scenarios))
+	return True
+
+# Takes the current results as the new goldens and baselines
+def AcceptAll():
+	baselines = LoadBaselines()
+	for name, options in scenarios:
+		image, results = RunScenarioBest(name, options)
+		if image is None:
+			raise Exception(name + " failed")
+		image.save(GoldenPath(name))
+		baselines[name] = results
+		print("  accepted")
+	with open(BaselinesPath, 'w') as file:
+		json.dump(baselines, file, indent=1, sort_keys=True)
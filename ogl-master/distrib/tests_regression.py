@@ -0,0 +1,18 @@
+from regression import *
+
+# Usage : python tests_regression.py [accept] [path of misc05_picking_slow_easy] [frames=N] [runs=N]
+
+for arg in sys.argv[1:]:
+	if arg.startswith('frames='):
+		SetFrames(int(arg[len('frames='):]))
+	elif arg.startswith('runs='):
+		SetRuns(int(arg[len('runs='):]))
+	elif arg != 'accept':
+		SetProgramPath(arg)
+
+if "accept" in sys.argv:
+	AcceptAll()
+	exit()
+
+if not RunAll():
+	sys.exit(1)
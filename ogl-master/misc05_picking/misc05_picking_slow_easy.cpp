@@ -1,11 +1,16 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <array>
 #include <stack>
 #include <sstream>
 #include <map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <sys/stat.h>
 // Include GLEW
 #include <GL/glew.h>
 // Include GLFW
@@ -19,11 +24,39 @@ using namespace glm;
 // Include AntTweakBar
 // #include <AntTweakBar.h>
 #include <common/shader.hpp>
+#include <common/shadervariants.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/instancing.hpp>
+#include <common/glstate.hpp>
+#include <common/culling.hpp>
+#include <common/raypick.hpp>
+#include <common/idpicking.hpp>
+#include <common/selection.hpp>
+#include <common/mipmap.hpp>
+#include <common/texturemanager.hpp>
+#include <common/atlas.hpp>
+#include <common/renderqueue.hpp>
+#include <common/meshsimplify.hpp>
+#include <common/textbatch.hpp>
+#include <common/profiler.hpp>
+#include <common/headless.hpp>
+#include <common/redraw.hpp>
+#include <common/renderthread.hpp>
+#include <common/jobs.hpp>
+#include <common/drawlist.hpp>
+#include <common/arena.hpp>
+// Only for WriteScreenshot
+#define DISTRIB_SCREENSHOT_NO_HIJACK
+#include <distrib/screenshot.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "common/stb_image.h"
+// GL_KHR_parallel_shader_compile is newer than our GLEW
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+typedef void (APIENTRY * PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+#endif
 const int window_width = 1024, window_height = 768;
 struct HalfEdge;
 typedef struct Vertex {
@@ -137,19 +170,64 @@ void initOpenGL(void);
 void createVAOs(Vertex[], GLushort[], int);
 void loadObject(char*, glm::vec4, Vertex*&, GLushort*&, int);
 void createObjects(void);
-void pickObject(void);
+void loadRobotArm(void);
+void requestGPUPick(int, int);
+void applyGPUPick();
+struct SelectionRequest;
+void requestSelection(const SelectionRequest&);
+void setFaceSelectionMesh(const std::vector<Vertex>&);
+struct PickResult;
+bool rayPick(double, double, PickResult&);
+void createCrowdVAO(void);
+void updateCrowd(void);
+void computeObjectBounds(int, const std::vector<Vertex>&, std::vector<unsigned short>&);
+void buildObjectLODs(int, const std::vector<Vertex>&, std::vector<unsigned short>&);
+int selectObjectLOD(int, const glm::vec3&);
+void setSceneUniforms(GLuint, const glm::vec3&);
+void setupProgram(GLuint);
+void setupDraw(GLuint, const DrawItem&);
+GLuint standardProgram(unsigned int, bool);
+void resolvePacket(const DrawPacket&, DrawItem&);
+struct SceneSnapshot;
+void snapshotCamera(SceneSnapshot&);
+void submitFaceChunks(DrawList&, DrawPacket, const glm::mat4&, int, const Frustum&);
+void addCrowdLabels(SceneSnapshot&);
+void buildSnapshot(SceneSnapshot&);
+void drawSnapshot(const SceneSnapshot&);
+void drawPickingPass(const SceneSnapshot&);
+void updateSelection(const SceneSnapshot&);
+void drawHUD(const SceneSnapshot&);
+void updateFrameStats(const SceneSnapshot&);
+void renderFrame(const SceneSnapshot&);
 void renderScene(void);
+void subdivideFace(void);
+double appTime(void);
+void runHeadlessBenchmark(int, int, const char*, const char*);
+void runInstancingBenchmark(void);
 void cleanup(void);
 static void keyCallback(GLFWwindow*, int, int, int, int);
 static void mouseCallback(GLFWwindow*, int, int, int);
+static void cursorCallback(GLFWwindow*, double, double);
+static void windowRefreshCallback(GLFWwindow*);
 // GLOBAL VARIABLES
 GLFWwindow* window;
 glm::mat4 gProjectionMatrix;
 glm::mat4 gViewMatrix;
 GLuint gPickedIndex = -1;
 std::string gMessage;
-GLuint programID;
-GLuint pickingProgramID;
+// Permutations of StandardShading, one per set of features used by a draw
+ShaderVariantCache standardShaders;
+const unsigned int StartupShaderVariants[] = {
+	SHADER_LIGHTING | SHADER_DRAW_CONSTANTS,
+	SHADER_LIGHTING | SHADER_TEXTURE | SHADER_DRAW_CONSTANTS,
+	SHADER_LIGHTING | SHADER_INSTANCED
+};
+// ID pass of the GPU picking : one variant with the model matrix from the draw constants, one instanced
+ShaderVariantCache pickingShaders;
+const unsigned int PickingShaderVariants[] = {
+	SHADER_DRAW_CONSTANTS,
+	SHADER_INSTANCED
+};
 float horizAngle = 3.14f / 2.0f;
 float vertAngle = 0.0f;
 float radius = 20.0f;
@@ -183,22 +261,226 @@ size_t VertexBufferSize[NumObjects];
 size_t IndexBufferSize[NumObjects];
 size_t NumIdcs[NumObjects];
 size_t NumVerts[NumObjects];
-GLuint MatrixID;
-GLuint ModelMatrixID;
-GLuint ViewMatrixID;
-GLuint ProjMatrixID;
-GLuint PickingMatrixID;
-GLuint pickingColorID;
-GLuint LightID;
+// Bounds of each object in model space, and its chunks for finer culling
+AABB ObjectBounds[NumObjects];
+BoundingSphere ObjectSpheres[NumObjects];
+std::vector<MeshChunk> ObjectChunks[NumObjects];
+// Triangles of each object (full detail) for the picking rays, rebuilt when the mesh changes
+TriangleBVH ObjectPickBVH[NumObjects];
+const unsigned int TrianglesPerChunk = 256;
+// Levels of detail of each object, stored after the full mesh in its index buffer.
+// ObjectLODs[i][0] is the full mesh, NumIdcs[i] indices.
+const unsigned int MaxLODLevels = 6;
+std::vector<LODLevel> ObjectLODs[NumObjects];
+// Largest error allowed on the screen, in pixels (L cycles through them). 0 : always full detail.
+const float LODPixelErrors[] = { 1.0f, 4.0f, 0.0f };
+int lodPixelErrorIndex = 0;
 GLuint faceObjectID = 2;
 GLuint faceTextObjectID = 3;
-GLuint textureID = 4;
+// Texture of the textured face, from the texture manager
+TextureHandle textureID = 0;
 GLuint controlNetID = 5;
+// --robot-arm : the parts in models/, merged into one mesh drawn with one atlas, beside the face
+bool showRobotArm = false;
+GLuint robotArmObjectID = 6;
+TextureHandle robotArmTexture = 0;
+const glm::vec3 RobotArmPosition = glm::vec3(0.0f, 0.0f, -7.0f);
+const float RobotArmScale = 2.5f;
+// Crowd of heads, drawn with a single glDrawElementsInstanced
+const int MaxCrowdSize = 4096;
+const float CrowdSpacing = 10.0f;
+const int CrowdSizes[] = { 0, 16, 64, 256, 1024, 4096 };
+int crowdSizeIndex = 0;
+// One VAO and instance buffer per level of detail : all the heads at the same level go in one draw
+GLuint CrowdVertexArrayId[MaxLODLevels];
+GLuint InstanceBufferId[MaxLODLevels];
+std::vector<InstanceData> crowdInstances;
+// Draws of the frame, sorted by state before being issued
+RenderQueue renderQueue;
+// Bounding boxes of the heads of the crowd, and the hierarchy used to cull them
+std::vector<AABB> crowdBounds;
+SceneBVH crowdBVH;
+std::vector<int> visibleInstances;
+// What was culled during the last frame
+struct CullingStats {
+	unsigned int objects, visibleObjects;
+	unsigned int chunks, visibleChunks;
+} cullingStats;
+// Triangles of the visible objects, at the level of detail drawn and at full detail
+struct LODStats {
+	unsigned int triangles, fullTriangles;
+	unsigned int objectsPerLevel[MaxLODLevels];
+} lodStats;
+// On-screen text, all of it drawn in one call at the end of the frame.
+// The font is the 16x16 grid of characters used by text2D.
+bool hudEnabled = false;
+bool showLabels = false;
+const int HudLines = 3;
+char hudText[HudLines][160];
+// Where P writes the profile of the frames between two presses
+const char* ProfileTracePath = "profile_trace.json";
+bool profileRecording = false;
+// Meshes of the draw packets (see common/drawlist.hpp) : VertexArrayId[mesh] for the objects,
+// then CrowdVertexArrayId[mesh - CrowdMeshBase] for the instanced crowd
+const unsigned int CrowdMeshBase = NumObjects;
+// I : the crowd is drawn with one draw per head instead of one instanced draw per level of detail.
+// The draws are then recorded by the worker threads, HeadsPerDrawList heads in each list.
+bool crowdInstancing = true;
+const unsigned int HeadsPerDrawList = 128;
+// A click picks by casting a ray through the triangles on the CPU. --gpu-picking draws the frame
+// again into an integer ID buffer and reads the pixels around the cursor back instead, without
+// waiting for them : the answer comes a frame or two later (see common/idpicking.hpp).
+bool gpuPicking = false;
+// Identifiers written by the ID pass : 0 for the background, ObjectId + 1 for an object,
+// CrowdPickBase + n for the n-th head of SceneSnapshot::pickInstances
+const unsigned int CrowdPickBase = NumObjects + 1;
+// Pixels read on each side of the cursor : the closest one which isn't background is picked,
+// so that a click next to a line still gets it
+const int PickRadius = 3;
+// A click on its way through the GPU. Only touched by the render thread.
+struct GPUPick {
+	unsigned int request;
+	int x, y;                  // in the ID buffer, (0, 0) at the bottom left
+	unsigned int frame;        // when its ID pass was drawn
+	std::vector<int> heads;    // pickInstances of that frame
+};
+bool gpuPickWaiting = false;   // the next frame draws an ID pass for gpuPickNext
+GPUPick gpuPickNext;
+std::vector<GPUPick> gpuPicksInFlight;
+unsigned int gpuPickRequests = 0;
+// What the last GPU pick found, until the main thread takes it into gPickedIndex and gMessage
+struct GPUPickResult {
+	bool pending;
+	GLuint index;
+	std::string message;
+};
+GPUPickResult gpuPickResult = { false, GLuint(-1), std::string() };
+std::mutex gpuPickResultMutex;
+unsigned int renderedFrames = 0;
+IDPickBuffer idPickBuffer;
+IDReadbackQueue idReadbacks;
+IDReadbackResult idReadbackResult;
+// Draws of the frame, with the programs of the ID pass
+RenderQueue pickQueue;
+GLint PickIDLocation = -1;
+GLint PickPrimitiveBaseLocation = -1;
+// Box and lasso selection of the vertices of the face (see common/selection.hpp) : Shift + drag for a box,
+// Ctrl + drag for a lasso, with Alt to remove from the selection instead. O toggles the test against the
+// depth buffer, X clears the selection. The face is then drawn with the IS_SELECTED variants.
+struct SelectionRequest {
+	bool lasso;
+	std::vector<glm::vec2> points;   // the corners of the box, or the points of the lasso
+	SelectionMode mode;
+	bool occlusion;
+	glm::mat4 ViewProjection;        // of the frame the selection is made on
+};
+// Main thread : the drag in progress
+bool selectionDragging = false;
+SelectionRequest selectionDrag;
+bool selectionOcclusion = true;
+bool showSelection = false;
+// Render thread : the vertices of the face, the selection, and the request being handled
+SelectionGrid selectionGrid;
+SelectionBits selectedVertices;
+SelectionTexture selectionTexture;
+SelectionDepthRead selectionDepthRead;
+SelectionDepth selectionDepth;
+bool selectionWaiting = false;   // the next frame handles selectionNext
+bool selectionReading = false;   // the depth buffer of that frame is on its way
+SelectionRequest selectionNext;
+// texture1 is on unit 0
+const GLuint SelectionTextureUnit = 1;
+// In depth buffer units : about a tenth of a unit of length at the distance of the face
+const float SelectionDepthBias = 5e-5f;
+// What a click hit : the object, the head for the crowd, and where on the mesh
+struct PickResult {
+	int object;
+	int instance;    // in crowdInstances, -1 for the single face
+	RayHit hit;
+};
+// Heads whose box is on the ray of the last click
+std::vector<int> pickCandidates;
+// --jobs N : worker threads helping the main thread to build the frames (default : one per core, minus one)
+int jobWorkers = -1;
+// Per-draw constants of the frame being drawn, uploaded from the draw lists
+DrawConstantsBuffer drawConstantsBuffer;
+// Level of detail of each visible head, and the triangles counted by each draw list
+std::vector<int> visibleLevels;
+// Visible heads, by level of detail, in the order of their instances
+std::vector<int> levelInstances[MaxLODLevels];
+std::vector<LODStats> drawListLODStats;
+// A frame as the main thread hands it to the render thread (see common/renderthread.hpp) : the camera,
+// and the draws left after culling and the choice of the levels of detail.
+// The draws only name their mesh : the VAOs and programs belong to the render thread.
+struct ScreenLabel {
+	int x, y;
+	char text[16];
+};
+struct SceneSnapshot {
+	glm::mat4 ProjectionMatrix;
+	glm::mat4 ViewMatrix;
+	glm::vec3 cameraPosition;
+	// List 0 is recorded by the main thread, the others by the jobs, and they are replayed in order.
+	// Only the first drawListCount are used : the others keep their memory for later frames.
+	std::vector<DrawList> drawLists;
+	unsigned int drawListCount;
+	std::vector<InstanceData> crowdInstances[MaxLODLevels]; // visible heads, by level of detail
+	std::vector<int> pickInstances;   // heads of the crowd, in crowdInstances, by pick identifier - CrowdPickBase
+	std::vector<ScreenLabel> labels;
+	CullingStats culling;
+	LODStats lod;
+	unsigned int lodLevels;
+	// Pixels across the face on screen, for the levels of its texture to stream. 0 : not drawn textured.
+	float faceTexturePixels;
+};
+// The main thread fills one while the render thread draws the others
+SceneSnapshot sceneSnapshots[RenderSnapshotCount];
+// The snapshot being drawn, for the callbacks of the render queue
+const SceneSnapshot* drawnSnapshot = NULL;
+// --single-thread : build and draw the frames on the main thread, one after the other
+bool singleThread = false;
+// When the frame statistics were last printed, on the render thread
+double frameStatsTime = -1.0;
+int frameStatsCount = 0;
+// --headless : no window, the frames go to a framebuffer object (see common/headless.hpp)
+bool headless = false;
+// From the start of main to the end of initOpenGL, in seconds
+double loadTime = 0.0;
+// --continuous : draw frames all the time, instead of only when something changed
+bool continuousRendering = false;
+// --texture-budget MB : memory the textures may take on the GPU before the least recently used go
+size_t textureBudget = 256 * 1024 * 1024;
+// --decode-threads N : threads decoding the image files, 0 to decode them when they are asked for
+unsigned int decodeThreads = 2;
+// --upload-budget MB : texture rows uploaded in a frame
+size_t uploadBudget = 8 * 1024 * 1024;
+// --no-compressed-textures : decode the images even when texcompress has made a DDS of them
+bool compressedTextures = true;
+// --mip-filter box|kaiser : how the mip chains of the decoded images are made
+MipFilter mipFilter = MIP_BOX;
+// --no-mip-cache : make the mip chains on each load, instead of keeping them next to the images
+bool mipCache = true;
+// --stream-textures : DDS textures go up small levels first, then the finer ones the face needs for its size on screen
+bool streamTextures = false;
 // Declare global objects
 // TL
 const size_t CoordVertsCount = 6;
 Vertex CoordVerts[CoordVertsCount];
 int initWindow(void) {
+	if (headless) {
+		if (!createHeadlessContext(window_width, window_height)) {
+			return -1;
+		}
+		glewExperimental = true;
+		if (glewInit() != GLEW_OK) {
+			fprintf(stderr, "Failed to initialize GLEW\n");
+			return -1;
+		}
+		// glewInit may leave a GL_INVALID_ENUM behind in a core context
+		glGetError();
+		printf("Headless: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+		return 0;
+	}
 	// Initialise GLFW
 	if (!glfwInit()) {
 		fprintf(stderr, "Failed to initialize GLFW\n");
@@ -236,15 +518,28 @@ int initWindow(void) {
 	glfwSetCursorPos(window, window_width / 2, window_height / 2);
 	glfwSetKeyCallback(window, keyCallback);
 	glfwSetMouseButtonCallback(window, mouseCallback);
+	glfwSetCursorPosCallback(window, cursorCallback);
+	glfwSetWindowRefreshCallback(window, windowRefreshCallback);
 	return 0;
 }
+// glfwExtensionSupported needs a GLFW window : ask GL directly
+bool hasGLExtension(const char* name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
 void initOpenGL(void) {
 	// Enable depth test
-	glEnable(GL_DEPTH_TEST);
+	glsEnable(GL_DEPTH_TEST);
 	// Accept fragment if it closer to the camera than the former one
-	glDepthFunc(GL_LESS);
+	glsDepthFunc(GL_LESS);
 	// Cull triangles which normal is not towards the camera
-	glEnable(GL_CULL_FACE);
+	glsEnable(GL_CULL_FACE);
 	// Projection matrix : 45 Field of View, 4:3 ratio, display range : 0.1 unit < -> 100 units
 	gProjectionMatrix = glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, 100.0f);
 	// Or, for an ortho camera :
@@ -253,23 +548,38 @@ void initOpenGL(void) {
 	gViewMatrix = glm::lookAt(glm::vec3(10.0, 10.0, 10.0f), // eye
 		glm::vec3(0.0, 0.0, 0.0), // center
 		glm::vec3(0.0, 1.0, 0.0)); // up
-	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders("StandardShading.vertexshader",
+	// Create and compile our GLSL program from the shaders.
+	// Linked programs are cached on disk, so that the next runs skip the compiles.
+	double shaderStart = appTime();
+	SetProgramBinaryCache("shadercache");
+	// Let the driver compile on as many threads as it likes
+	if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+		PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR = headless ?
+			(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)getHeadlessProcAddress("glMaxShaderCompilerThreadsKHR") :
+			(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (glMaxShaderCompilerThreadsKHR != NULL) {
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		}
+	}
+	// All the programs needed at startup are launched before waiting for any of them.
+	// The other variants are compiled on first use.
+	initShaderVariantCache(standardShaders, "StandardShading.vertexshader",
 		"StandardShading.fragmentshader");
-	pickingProgramID = LoadShaders("Picking.vertexshader",
-		"Picking.fragmentshader");
-	// Get a handle for our "MVP" uniform
-	MatrixID = glGetUniformLocation(programID, "MVP");
-	ModelMatrixID = glGetUniformLocation(programID, "M");
-	ViewMatrixID = glGetUniformLocation(programID, "V");
-	ProjMatrixID = glGetUniformLocation(programID, "P");
-	PickingMatrixID = glGetUniformLocation(pickingProgramID, "MVP");
-	// Get a handle for our "pickingColorID" uniform
-	pickingColorID = glGetUniformLocation(pickingProgramID,
-		"PickingColor");
-	// Get a handle for our "LightPosition" uniform
-	LightID = glGetUniformLocation(programID,
-		"LightPosition_worldspace");
+	prepareShaderVariants(standardShaders, StartupShaderVariants,
+		sizeof(StartupShaderVariants) / sizeof(StartupShaderVariants[0]));
+	initShaderVariantCache(pickingShaders, "Picking.vertexshader", "Picking.fragmentshader");
+	if (gpuPicking) {
+		prepareShaderVariants(pickingShaders, PickingShaderVariants,
+			sizeof(PickingShaderVariants) / sizeof(PickingShaderVariants[0]));
+	}
+	printf("Shaders ready in %.1f ms\n", 1000.0 * (appTime() - shaderStart));
+	initProfiler();
+	initTextureManager(textureBudget, decodeThreads, uploadBudget);
+	MipSettings mipSettings = { mipFilter, true, 0.0f };
+	setTextureMipmaps(mipSettings, mipCache);
+	setTextureStreaming(streamTextures);
+	initDrawLists();
+	hudEnabled = initTextBatch("Holstein.DDS", "TextBatch.vertexshader", "TextBatch.fragmentshader");
 	// TL
 	// Define objects
 	createObjects();
@@ -282,14 +592,14 @@ void createVAOs(Vertex Vertices[], GLushort Indices[], int ObjectId) {
 	GLenum ErrorCheckValue = glGetError();
 	const size_t VertexSize = sizeof(Vertices[0]);
 	glGenVertexArrays(1, &VertexArrayId[ObjectId]);
-	glBindVertexArray(VertexArrayId[ObjectId]);
+	glsBindVertexArray(VertexArrayId[ObjectId]);
 	glGenBuffers(1, &VertexBufferId[ObjectId]);
-	glBindBuffer(GL_ARRAY_BUFFER, VertexBufferId[ObjectId]);
+	glsBindBuffer(GL_ARRAY_BUFFER, VertexBufferId[ObjectId]);
 	glBufferData(GL_ARRAY_BUFFER, VertexBufferSize[ObjectId], Vertices,
 		GL_STATIC_DRAW);
 	if (Indices != NULL) {
 		glGenBuffers(1, &IndexBufferId[ObjectId]);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+		glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
 			IndexBufferId[ObjectId]);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
 			IndexBufferSize[ObjectId], Indices, GL_STATIC_DRAW);
@@ -306,7 +616,7 @@ void createVAOs(Vertex Vertices[], GLushort Indices[], int ObjectId) {
 	glEnableVertexAttribArray(1); // Color
 	glEnableVertexAttribArray(2); // Normal
 	glEnableVertexAttribArray(3); // TexCoord
-	glBindVertexArray(0);
+	glsBindVertexArray(0);
 	ErrorCheckValue = glGetError();
 	if (ErrorCheckValue != GL_NO_ERROR) {
 		fprintf(stderr, "ERROR: Could not create a VBO: %s\n",
@@ -356,6 +666,10 @@ void loadObject(char* file, glm::vec4 color, Vertex*& out_Vertices,
 	std::vector<Vertex> indexedVertices;
 	indexVBO(tempVertices, tempNormals, tempUVs, indices, indexedVertices);
 	printf("Indexed data: %zu vertices, %zu indices\n", indexedVertices.size(), indices.size());
+	// Bounds, chunks and picking hierarchy. The triangles get reordered chunk by chunk.
+	computeObjectBounds(ObjectId, indexedVertices, indices);
+	// The simplified levels go after the full mesh
+	buildObjectLODs(ObjectId, indexedVertices, indices);
 	// Allocate and transfer data to output pointers
 	size_t vertCount = indexedVertices.size();
 	size_t idxCount = indices.size();
@@ -370,7 +684,38 @@ void loadObject(char* file, glm::vec4 color, Vertex*& out_Vertices,
 	// Store buffer sizes
 	VertexBufferSize[ObjectId] = sizeof(Vertex) * vertCount;
 	IndexBufferSize[ObjectId] = sizeof(GLushort) * idxCount;
-	NumIdcs[ObjectId] = idxCount;
+	NumIdcs[ObjectId] = ObjectLODs[ObjectId][0].indexCount;
+}
+void computeObjectBounds(int ObjectId, const std::vector<Vertex>& meshVertices,
+	std::vector<unsigned short>& indices) {
+	std::vector<glm::vec3> positions(meshVertices.size());
+	for (size_t i = 0; i < meshVertices.size(); i++) {
+		positions[i] = glm::vec3(meshVertices[i].Position[0], meshVertices[i].Position[1],
+			meshVertices[i].Position[2]);
+	}
+	computeBounds(positions, ObjectBounds[ObjectId], ObjectSpheres[ObjectId]);
+	buildMeshChunks(positions, indices, TrianglesPerChunk, ObjectChunks[ObjectId]);
+	buildTriangleBVH(ObjectPickBVH[ObjectId], positions, indices.data(), indices.size());
+}
+// Simplify the object with the quadric error metric, and append each level to its indices.
+// All the levels share the vertex buffer : a level is just a range of the index buffer.
+void buildObjectLODs(int ObjectId, const std::vector<Vertex>& meshVertices,
+	std::vector<unsigned short>& indices) {
+	std::vector<glm::vec3> positions(meshVertices.size());
+	std::vector<glm::vec2> texCoords(meshVertices.size());
+	for (size_t i = 0; i < meshVertices.size(); i++) {
+		positions[i] = glm::vec3(meshVertices[i].Position[0], meshVertices[i].Position[1],
+			meshVertices[i].Position[2]);
+		texCoords[i] = glm::vec2(meshVertices[i].TexCoord[0], meshVertices[i].TexCoord[1]);
+	}
+	std::vector<unsigned short> allLevels;
+	buildLODChain(positions, texCoords, indices, MaxLODLevels, allLevels, ObjectLODs[ObjectId]);
+	indices.swap(allLevels);
+	printf("LOD chain:");
+	for (size_t i = 0; i < ObjectLODs[ObjectId].size(); i++) {
+		printf(" %u triangles (error %.3f)", ObjectLODs[ObjectId][i].indexCount / 3, ObjectLODs[ObjectId][i].error);
+	}
+	printf("\n");
 }
 void addEdge(int v1, int v2) {
 	if (v1 > v2) std::swap(v1, v2);
@@ -379,35 +724,6 @@ void addEdge(int v1, int v2) {
 		edges[edgeKey] = -1;
 	}
 }
-GLuint loadTexture(const char* filepath) {
-	int width, height, nrChannels;
-	unsigned char* data = stbi_load(filepath, &width, &height,
-		&nrChannels, 0);
-	GLenum format = GL_RGB;
-	if (nrChannels == 1) {
-		format = GL_RED;
-	}
-	else if (nrChannels == 3) {
-		format = GL_RGB;
-	}
-	else if (nrChannels == 4) {
-		format = GL_RGBA;
-	}
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-		GL_UNSIGNED_BYTE, data);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-		GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
-		GL_LINEAR);
-	stbi_image_free(data);
-	return textureID;
-}
 void createObjects(void) {
 	//-- COORDINATE AXES --//
 	/*CoordVerts[0] = { { 0.0, 0.0, 0.0, 1.0 }, { 1.0, 0.0, 0.0, 1.0 }, { 0.0,
@@ -430,8 +746,8 @@ void createObjects(void) {
 		// GLushort* Idcs;
 		// loadObject("models/base.obj", glm::vec4(1.0, 0.0, 0.0, 1.0), Verts, Idcs, ObjectID);
 		// createVAOs(Verts, Idcs, ObjectID);
-	Vertex* faceVerts;
-	GLushort* faceIndices;
+	Vertex* faceVerts = NULL;
+	GLushort* faceIndices = NULL;
 	loadObject("../common/newHead3.obj", glm::vec4(1.0, 0.0, 0.0, 1.0), faceVerts, faceIndices, faceObjectID);
 	vertices.assign(faceVerts, faceVerts + (VertexBufferSize[faceObjectID] / sizeof(Vertex)));
 
@@ -440,13 +756,23 @@ void createObjects(void) {
 		+ 2] });
 	}
 	createVAOs(faceVerts, faceIndices, faceObjectID);
-	Vertex* faceTextVerts;
-	GLushort* faceTextIndices;
+	setFaceSelectionMesh(vertices);
+	Vertex* faceTextVerts = NULL;
+	GLushort* faceTextIndices = NULL;
 	loadObject("../common/headWithTexture.obj", glm::vec4(1.0, 0.0, 0.0, 1.0), faceTextVerts, faceTextIndices, faceTextObjectID);
 	createVAOs(faceTextVerts, faceTextIndices, faceTextObjectID);
+	delete[] faceTextVerts;
+	delete[] faceTextIndices;
 	printf("num verts: %zu\n", NumVerts[faceObjectID]);
 	stbi_set_flip_vertically_on_load(true);
-	textureID = loadTexture("../common/faceImage.jpg");
+	// Drawn with a placeholder until it is decoded and uploaded. The DDS the compressed_textures
+	// target makes from the image goes up as it is, unless the image was changed after it.
+	const char* faceImagePath = "../common/faceImage.jpg";
+	struct stat imageStat, compressedStat;
+	if (compressedTextures && stat("../common/faceImage.dds", &compressedStat) == 0 &&
+		(stat(faceImagePath, &imageStat) != 0 || compressedStat.st_mtime >= imageStat.st_mtime))
+		faceImagePath = "../common/faceImage.dds";
+	textureID = acquireTexture(faceImagePath);
 	std::vector<GLushort> controlNetIndices;
 	for (const auto& face : faces) {
 		controlNetIndices.push_back(face.v1);
@@ -459,17 +785,151 @@ void createObjects(void) {
 	VertexBufferSize[controlNetID] = sizeof(Vertex) * vertices.size();
 	IndexBufferSize[controlNetID] = sizeof(GLushort) * controlNetIndices.size();
 	NumIdcs[controlNetID] = controlNetIndices.size();
-	createVAOs(faceVerts, faceIndices, controlNetID);
+	// The control net draws the edges of the face : its own indices, over the face's vertices
+	createVAOs(faceVerts, controlNetIndices.data(), controlNetID);
+	delete[] faceVerts;
+	delete[] faceIndices;
+	if (showRobotArm) {
+		loadRobotArm();
+	}
+	for (unsigned int level = 0; level < MaxLODLevels; level++) {
+		InstanceBufferId[level] = createInstanceBuffer(MaxCrowdSize);
+	}
+	createCrowdVAO();
 }
-bool isBoundaryEdge(const Edge& edge, const std::map<Edge,
-	std::vector<int>>&adjacentTriangles) {
+// Each part of the robot arm gets a small texture of its own, as if it came with the model : a checker
+// in its color, over the UVs it uses. The textures are packed into one atlas and the parts into one
+// mesh, their UVs moved to their image in it, so that the whole arm is one draw with one texture.
+void loadRobotArm(void) {
+	const char* const parts[] = { "models/Base.obj", "models/Top.obj", "models/Arm1.obj", "models/Joint.obj",
+		"models/Arm2.obj", "models/Pen.obj", "models/Object.obj" };
+	const glm::vec3 colors[] = { glm::vec3(0.85f, 0.3f, 0.2f), glm::vec3(0.9f, 0.7f, 0.2f), glm::vec3(0.3f, 0.75f, 0.3f),
+		glm::vec3(0.2f, 0.6f, 0.85f), glm::vec3(0.45f, 0.35f, 0.85f), glm::vec3(0.85f, 0.35f, 0.7f), glm::vec3(0.9f, 0.9f, 0.9f) };
+	const int partCount = sizeof(parts) / sizeof(parts[0]);
+	// Texels, and checker squares, per unit of UV
+	const float TexelsPerUV = 128.0f;
+	const float SquaresPerUV = 8.0f;
+	std::vector<Vertex> partVertices[partCount];
+	std::vector<unsigned short> partIndices[partCount];
+	std::vector<unsigned char> images[partCount];
+	std::vector<AtlasImage> atlasImages(partCount);
+	glm::vec2 uvMin[partCount], uvMax[partCount];
+	for (int part = 0; part < partCount; part++) {
+		std::vector<glm::vec3> tempVertices, tempNormals;
+		std::vector<glm::vec2> tempUVs;
+		if (!loadOBJ(parts[part], tempVertices, tempNormals, tempUVs)) {
+			printf("Failed to load OBJ file: %s\n", parts[part]);
+			return;
+		}
+		indexVBO(tempVertices, tempNormals, tempUVs, partIndices[part], partVertices[part]);
+		// Some caps go past 1 : the repeats are baked into the image, which covers all the UVs of the part
+		uvMin[part] = glm::vec2(1e9f);
+		uvMax[part] = glm::vec2(-1e9f);
+		for (size_t i = 0; i < tempUVs.size(); i++) {
+			uvMin[part] = glm::min(uvMin[part], tempUVs[i]);
+			uvMax[part] = glm::max(uvMax[part], tempUVs[i]);
+		}
+		uvMax[part] = glm::max(uvMax[part], uvMin[part] + glm::vec2(1.0f / TexelsPerUV));
+		glm::vec2 extent = uvMax[part] - uvMin[part];
+		int width = glm::max(8, int(extent.x * TexelsPerUV + 0.5f));
+		int height = glm::max(8, int(extent.y * TexelsPerUV + 0.5f));
+		images[part].resize((size_t)width * height * 4);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				glm::vec2 uv = uvMin[part] + extent * glm::vec2((x + 0.5f) / width, (y + 0.5f) / height);
+				bool dark = (int(floor(uv.x * SquaresPerUV)) + int(floor(uv.y * SquaresPerUV))) & 1;
+				glm::vec3 color = colors[part] * (dark ? 0.6f : 1.0f);
+				unsigned char* texel = &images[part][((size_t)y * width + x) * 4];
+				texel[0] = (unsigned char)(color.r * 255.0f);
+				texel[1] = (unsigned char)(color.g * 255.0f);
+				texel[2] = (unsigned char)(color.b * 255.0f);
+				texel[3] = 255;
+			}
+		}
+		atlasImages[part].pixels = &images[part][0];
+		atlasImages[part].width = width;
+		atlasImages[part].height = height;
+	}
+	Atlas atlas;
+	if (!buildAtlas(&atlasImages[0], partCount, 2048, 8, atlas)) {
+		return;
+	}
+	size_t atlasBytes = 0;
+	robotArmTexture = addTexture("robot arm atlas", uploadAtlas(atlas, &atlasBytes), atlasBytes);
+	// One mesh : the parts one after the other, each one's UVs in its rectangle of the atlas
+	std::vector<Vertex> vertices;
+	std::vector<unsigned short> indices;
+	for (int part = 0; part < partCount; part++) {
+		unsigned short base = (unsigned short)vertices.size();
+		for (size_t i = 0; i < partVertices[part].size(); i++) {
+			Vertex vertex = partVertices[part][i];
+			glm::vec2 uv = (glm::vec2(vertex.TexCoord[0], vertex.TexCoord[1]) - uvMin[part]) / (uvMax[part] - uvMin[part]);
+			glm::vec2 atlasCoord = atlasUV(atlas.rects[part], uv);
+			vertex.SetTexCoord(&atlasCoord.x);
+			vertices.push_back(vertex);
+		}
+		for (size_t i = 0; i < partIndices[part].size(); i++) {
+			indices.push_back(base + partIndices[part][i]);
+		}
+	}
+	computeObjectBounds(robotArmObjectID, vertices, indices);
+	buildObjectLODs(robotArmObjectID, vertices, indices);
+	VertexBufferSize[robotArmObjectID] = sizeof(Vertex) * vertices.size();
+	IndexBufferSize[robotArmObjectID] = sizeof(GLushort) * indices.size();
+	NumIdcs[robotArmObjectID] = ObjectLODs[robotArmObjectID][0].indexCount;
+	createVAOs(&vertices[0], &indices[0], robotArmObjectID);
+	printf("Robot arm: %d parts in one mesh, their textures in a %dx%d atlas (%.0f%% used, %d mip levels)\n",
+		partCount, atlas.width, atlas.height, 100.0f * atlas.used, atlas.levels);
+}
+// Lay out the crowd, and rebuild the hierarchy used to cull it.
+// The instance buffer itself is filled each frame with the visible heads only.
+void updateCrowd(void) {
+	buildInstanceGrid(crowdInstances, CrowdSizes[crowdSizeIndex], CrowdSpacing);
+	crowdBounds.resize(crowdInstances.size());
+	for (size_t i = 0; i < crowdInstances.size(); i++) {
+		crowdBounds[i] = transformAABB(ObjectBounds[faceObjectID], crowdInstances[i].ModelMatrix);
+	}
+	buildSceneBVH(crowdBVH, crowdBounds);
+}
+// The crowd shares the vertex and index buffers of the face, and adds the
+// per-instance attributes on top. Must be called again whenever the face buffers are recreated.
+void createCrowdVAO(void) {
+	for (unsigned int level = 0; level < MaxLODLevels; level++) {
+		if (CrowdVertexArrayId[level] != 0) {
+			glsDeleteVertexArray(CrowdVertexArrayId[level]);
+		}
+		glGenVertexArrays(1, &CrowdVertexArrayId[level]);
+		glsBindVertexArray(CrowdVertexArrayId[level]);
+		glsBindBuffer(GL_ARRAY_BUFFER, VertexBufferId[faceObjectID]);
+		glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IndexBufferId[faceObjectID]);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+			(GLvoid*)0); // Position
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+			(GLvoid*)sizeof(Vertex::Position)); // Color
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)
+			(sizeof(Vertex::Position) + sizeof(Vertex::Color))); // Normal
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)
+			(sizeof(Vertex::Position) + sizeof(Vertex::Color) + sizeof(Vertex::Normal))); // TexCoord
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glEnableVertexAttribArray(3);
+		setupInstanceAttributes(InstanceBufferId[level], 4); // ModelMatrix + Tint
+	}
+	glsBindVertexArray(0);
+}
+// The containers of a subdivision step only live until its result is copied to the mesh :
+// they are taken from the thread's arena, rewound once the step is done
+typedef ArenaMap<Edge, ArenaVector<int>> AdjacentTriangles;
+typedef ArenaMap<Edge, glm::vec3> EdgePoints;
+typedef ArenaMap<Edge, int> EdgeIndices;
+bool isBoundaryEdge(const Edge& edge, const AdjacentTriangles& adjacentTriangles) {
 	return adjacentTriangles.at(edge).size() == 1;
 }
-bool isBoundaryVertex(int vertexIndex, const std::map<Edge,
-	std::vector<int>>&adjacentTriangles) {
+bool isBoundaryVertex(int vertexIndex, const AdjacentTriangles& adjacentTriangles) {
 	for (auto it = adjacentTriangles.begin(); it != adjacentTriangles.end(); ++it) {
 		const Edge& edge = it->first;
-		const std::vector<int>& triangles = it->second;
+		const ArenaVector<int>& triangles = it->second;
 		if ((edge.v1 == vertexIndex || edge.v2 == vertexIndex) &&
 			triangles.size() == 1) {
 			return true;
@@ -479,8 +939,8 @@ bool isBoundaryVertex(int vertexIndex, const std::map<Edge,
 }
 glm::vec3 updateBoundaryVertex(
 	const Vertex& vertex,
-	const std::map<Edge, glm::vec3>& edgePoints,
-	const std::map<Edge, std::vector<int>>& adjacentTriangles
+	const EdgePoints& edgePoints,
+	const AdjacentTriangles& adjacentTriangles
 ) {
 	glm::vec3 updatedPosition = glm::vec3(vertex.Position[0],
 		vertex.Position[1], vertex.Position[2]);
@@ -503,9 +963,9 @@ glm::vec3 updateBoundaryVertex(
 	}
 	return updatedPosition;
 }
-std::map<Edge, std::vector<int>> buildAdjacentTriangles(const
+AdjacentTriangles buildAdjacentTriangles(const
 	std::vector<Face>& faces) {
-	std::map<Edge, std::vector<int>> adjacentTriangles;
+	AdjacentTriangles adjacentTriangles;
 	for (size_t i = 0; i < faces.size(); ++i) {
 		const Face& face = faces[i];
 		adjacentTriangles[Edge(face.v1, face.v2)].push_back(i);
@@ -519,7 +979,7 @@ void subdivideTriangle(
 	int depth,
 	const std::vector<Vertex>& vertices,
 	std::vector<Vertex>& newVertices,
-	std::map<Edge, int>& edgeCache,
+	EdgeIndices& edgeCache,
 	std::vector<Face>& newFaces
 ) {
 	if (depth == 0) {
@@ -619,15 +1079,15 @@ std::vector<glm::vec3> computeFacePoints(const std::vector<Vertex>&
 	}
 	return facePoints;
 }
-std::map<Edge, glm::vec3> computeEdgePoints(
+EdgePoints computeEdgePoints(
 	const std::vector<Vertex>& vertices,
 	const std::vector<Face>& faces,
-	const std::map<Edge, std::vector<int>>& adjacentTriangles
+	const AdjacentTriangles& adjacentTriangles
 ) {
-	std::map<Edge, glm::vec3> edgePoints;
+	EdgePoints edgePoints;
 	for (auto it = adjacentTriangles.begin(); it != adjacentTriangles.end(); ++it) {
 		const Edge& edge = it->first;
-		const std::vector<int>& triangles = it->second;
+		const ArenaVector<int>& triangles = it->second;
 		glm::vec3 v1 = glm::vec3(vertices[edge.v1].Position[0],
 			vertices[edge.v1].Position[1], vertices[edge.v1].Position[2]);
 		glm::vec3 v2 = glm::vec3(vertices[edge.v2].Position[0],
@@ -647,14 +1107,14 @@ std::map<Edge, glm::vec3> computeEdgePoints(
 	}
 	return edgePoints;
 }
-std::vector<glm::vec3> computeVertexPoints(
+ArenaVector<glm::vec3> computeVertexPoints(
 	const std::vector<Vertex>& vertices,
-	const std::map<Edge, glm::vec3>& edgePoints,
-	const std::map<Edge, std::vector<int>>& adjacentTriangles
+	const EdgePoints& edgePoints,
+	const AdjacentTriangles& adjacentTriangles
 ) {
-	std::vector<glm::vec3> updatedVertices(vertices.size(),
+	ArenaVector<glm::vec3> updatedVertices(vertices.size(),
 		glm::vec3(0.0f));
-	std::vector<int> valence(vertices.size(), 0);
+	ArenaVector<int> valence(vertices.size(), 0);
 	for (auto it = edgePoints.begin(); it != edgePoints.end(); ++it) {
 		const Edge& edge = it->first;
 		const glm::vec3& edgePoint = it->second;
@@ -680,17 +1140,17 @@ std::vector<glm::vec3> computeVertexPoints(
 	return updatedVertices;
 }
 void addEdgePointsToVertices(
-	const std::map<Edge, glm::vec3>& edgePoints,
-	std::vector<Vertex>& newVertices,
-	std::map<Edge, int>& edgePointIndices,
+	const EdgePoints& edgePoints,
+	ArenaVector<Vertex>& newVertices,
+	EdgeIndices& edgePointIndices,
 	int& index
 ) {
 	for (auto it = edgePoints.begin(); it != edgePoints.end(); ++it) {
 		const Edge& edge = it->first;
 		const glm::vec3& edgePoint = it->second;
 		Vertex edgeVertex = {};
-		edgeVertex.SetPosition(new float[3] { edgePoint.x, edgePoint.y,
-			edgePoint.z });
+		float position[3] = { edgePoint.x, edgePoint.y, edgePoint.z };
+		edgeVertex.SetPosition(position);
 		newVertices.push_back(edgeVertex);
 		edgePointIndices[edge] = index++;
 	}
@@ -702,56 +1162,63 @@ void recursiveSubdivideMesh(
 	std::vector<Vertex>& newVertices,
 	std::vector<Face>& newFaces
 ) {
-	std::map<Edge, int> edgeCache;
+	EdgeIndices edgeCache;
 	newVertices = vertices;
 	for (const auto& face : faces) {
 		subdivideTriangle(face, depth, vertices, newVertices, edgeCache,
 			newFaces);
 	}
 }
-void pickObject(void) {
-	// Clear the screen in white
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glUseProgram(pickingProgramID);
-	{
-		glm::mat4 ModelMatrix = glm::mat4(1.0); // TranslationMatrix * RotationMatrix;
-		glm::mat4 MVP = gProjectionMatrix * gViewMatrix * ModelMatrix;
-		// Send our transformation to the currently bound shader, in the "MVP" uniform
-		glUniformMatrix4fv(PickingMatrixID, 1, GL_FALSE, &MVP[0][0]);
-		// ATTN: DRAW YOUR PICKING SCENE HERE. REMEMBER TO SEND IN A DIFFERENT PICKING COLOR FOR EACH OBJECT BEFOREHAND
-		glBindVertexArray(0);
-	}
-	glUseProgram(0);
-	// Wait until all the pending drawing commands are really done.
-	// Ultra-mega-over slow !
-	// There are usually a long time between glDrawElements() and
-	// all the fragments completely rasterized.
-	glFlush();
-	glFinish();
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	// Read the pixel at the center of the screen.
-	// You can also use glfwGetMousePos().
-	// Ultra-mega-over slow too, even for 1 pixel,
-	// because the framebuffer is on the GPU.
-	double xpos, ypos;
-	glfwGetCursorPos(window, &xpos, &ypos);
-	unsigned char data[4];
-	glReadPixels(xpos, window_height - ypos, 1, 1, GL_RGBA,
-		GL_UNSIGNED_BYTE, data); // OpenGL renders with (0,0) on bottom, mouse reports with(0, 0) on top
-	// Convert the color back to an integer ID
-	gPickedIndex = int(data[0]);
-	if (gPickedIndex == 255) { // Full white, must be the background !
-		gMessage = "background";
+// Runs on the render thread : the ID pass is drawn with the next frame, from its camera and draws.
+// (x, y) is the pixel under the cursor, from the bottom of the window.
+void requestGPUPick(int x, int y) {
+	gpuPickWaiting = true;
+	gpuPickNext.request = ++gpuPickRequests;
+	gpuPickNext.x = x;
+	gpuPickNext.y = y;
+}
+// Casts the ray under the cursor through the objects drawn, on the main thread : the meshes and the
+// crowd are the ones the next frame is built from, and the GPU is left alone.
+// The full detail meshes are hit, whatever level of detail is on the screen.
+bool rayPick(double xpos, double ypos, PickResult& out_pick) {
+	PROFILE_SCOPE("rayPick");
+	Ray ray = screenRay(xpos, ypos, window_width, window_height, gProjectionMatrix, gViewMatrix);
+	float closest = 100.0f; // far plane
+	bool found = false;
+	int crowdSize = CrowdSizes[crowdSizeIndex];
+	if (crowdSize > 0) {
+		// Heads in the order the ray enters their boxes : the search stops at the first box beyond the closest hit
+		raycastSceneBVH(crowdBVH, crowdBounds, ray, closest, pickCandidates);
+		for (size_t i = 0; i < pickCandidates.size(); i++) {
+			int instance = pickCandidates[i];
+			if (raycastAABB(crowdBounds[instance], ray, closest) < 0.0f) {
+				break;
+			}
+			// In the space of the mesh, with a direction which isn't normalized anymore : the distances stay in world units
+			glm::mat4 inverse = glm::inverse(crowdInstances[instance].ModelMatrix);
+			Ray local;
+			local.origin = glm::vec3(inverse * glm::vec4(ray.origin, 1.0f));
+			local.direction = glm::vec3(inverse * glm::vec4(ray.direction, 0.0f));
+			RayHit hit;
+			if (raycastTriangleBVH(ObjectPickBVH[faceObjectID], local, closest, hit)) {
+				closest = hit.distance;
+				found = true;
+				out_pick.object = faceObjectID;
+				out_pick.instance = instance;
+				out_pick.hit = hit;
+			}
+		}
+		return found;
 	}
-	else {
-		std::ostringstream oss;
-		oss << "point " << gPickedIndex;
-		gMessage = oss.str();
+	int ObjectId = showTexture ? faceTextObjectID : faceObjectID;
+	RayHit hit;
+	if (raycastTriangleBVH(ObjectPickBVH[ObjectId], ray, closest, hit)) {
+		found = true;
+		out_pick.object = ObjectId;
+		out_pick.instance = -1;
+		out_pick.hit = hit;
 	}
-	// Uncomment these lines to see the picking shader in effect
-	//glfwSwapBuffers(window);
-	//continue; // skips the normal rendering
+	return found;
 }
 void updateCamera() {
 	cameraPosition = glm::vec3(
@@ -764,95 +1231,658 @@ void updateCamera() {
 		glm::vec3(0.0f, 0.0f, 0.0f),
 		upVector
 	);
+	requestRedraw();
 }
-void renderScene(void) {
+// Lights, material and camera: everything that is shared by all the draws of a frame
+void setSceneUniforms(GLuint program, const glm::vec3& viewPosition) {
+	// light 1
+	glUniform3f(glGetUniformLocation(program, "lightPos1"), lightPos1.x, lightPos1.y, lightPos1.z);
+	glUniform3f(glGetUniformLocation(program, "lightDiffuse1"), lightDiffuseColor1.x, lightDiffuseColor1.y, lightDiffuseColor1.z);
+	glUniform3f(glGetUniformLocation(program, "lightAmbient1"), lightAmbientColor1.x, lightAmbientColor1.y, lightAmbientColor1.z);
+	glUniform3f(glGetUniformLocation(program, "lightSpecular1"), lightSpecularColor1.x, lightSpecularColor1.y, lightSpecularColor1.z);
+	// light 2
+	glUniform3f(glGetUniformLocation(program, "lightPos2"), lightPos2.x, lightPos2.y, lightPos2.z);
+	glUniform3f(glGetUniformLocation(program, "lightDiffuse2"), lightDiffuseColor2.x, lightDiffuseColor2.y, lightDiffuseColor2.z);
+	glUniform3f(glGetUniformLocation(program, "lightAmbient2"), lightAmbientColor2.x, lightAmbientColor2.y, lightAmbientColor2.z);
+	glUniform3f(glGetUniformLocation(program, "lightSpecular2"), lightSpecularColor2.x, lightSpecularColor2.y, lightSpecularColor2.z);
+	// material
+	glUniform3f(glGetUniformLocation(program, "materialDiffuse"), materialDiffuse.x, materialDiffuse.y, materialDiffuse.z);
+	glUniform3f(glGetUniformLocation(program, "materialAmbient"), materialAmbient.x, materialAmbient.y, materialAmbient.z);
+	glUniform3f(glGetUniformLocation(program, "materialSpecular"), materialSpecular.x, materialSpecular.y, materialSpecular.z);
+	glUniform1f(glGetUniformLocation(program, "materialShininess"), materialShininess);
+	glUniform3f(glGetUniformLocation(program, "viewPosition"), viewPosition.x, viewPosition.y, viewPosition.z);
+}
+// The permutation of the standard shaders for a draw with these DrawFlags.
+// The model matrix comes from the instance attributes, or else from the DrawConstants of the draw.
+GLuint standardProgram(unsigned int flags, bool instanced) {
+	unsigned int features = 0;
+	if (flags & DRAW_USE_LIGHTING) features |= SHADER_LIGHTING;
+	if (flags & DRAW_USE_TEXTURE) features |= SHADER_TEXTURE;
+	if (flags & DRAW_SELECTED) features |= SHADER_SELECTED;
+	features |= instanced ? SHADER_INSTANCED : SHADER_DRAW_CONSTANTS;
+	return getShaderVariant(standardShaders, features).program;
+}
+// Called while replaying the draw lists, on the render thread
+void resolvePacket(const DrawPacket& packet, DrawItem& item) {
+	bool instanced = packet.mesh >= CrowdMeshBase;
+	item.vao = instanced ? CrowdVertexArrayId[packet.mesh - CrowdMeshBase] : VertexArrayId[packet.mesh];
+	item.program = standardProgram(item.flags, instanced);
+	// The packets name their texture by its handle in the texture manager
+	item.texture = useTexture(packet.texture);
+}
+// Called by the render queue each time it switches to another program.
+// The camera is the one of the snapshot being drawn : the main thread may have moved on already.
+void setupProgram(GLuint program) {
+	const ShaderVariant* variant = findShaderVariant(standardShaders, program);
+	if (variant == NULL) {
+		return;
+	}
+	glUniformMatrix4fv(variant->ViewMatrixID, 1, GL_FALSE, &drawnSnapshot->ViewMatrix[0][0]);
+	glUniformMatrix4fv(variant->ProjMatrixID, 1, GL_FALSE, &drawnSnapshot->ProjectionMatrix[0][0]);
+	if (variant->features & SHADER_TEXTURE) {
+		glUniform1i(variant->TextureID, 0);
+	}
+	if (variant->features & SHADER_SELECTED) {
+		glUniform1i(variant->SelectionID, SelectionTextureUnit);
+		glsActiveTexture(GL_TEXTURE0 + SelectionTextureUnit);
+		glsBindTexture(GL_TEXTURE_BUFFER, selectionTexture.texture);
+		glsActiveTexture(GL_TEXTURE0);
+	}
+	setSceneUniforms(program, drawnSnapshot->cameraPosition);
+}
+// Called by the render queue before each draw. The features are baked in the program,
+// only the model and normal matrices change from one draw to the next.
+void setupDraw(GLuint program, const DrawItem& item) {
+	const ShaderVariant* variant = findShaderVariant(standardShaders, program);
+	if (variant == NULL) {
+		return;
+	}
+	if (variant->features & SHADER_DRAW_CONSTANTS) {
+		bindDrawConstants(drawConstantsBuffer, item.constants);
+	}
+	else {
+		setShaderModelMatrix(*variant, item.ModelMatrix);
+	}
+}
+// Coarsest level of detail of an object whose error, once projected, stays under the allowed
+// number of pixels. center is the center of the object in world space.
+int selectObjectLOD(int ObjectId, const glm::vec3& center) {
+	float maxPixelError = LODPixelErrors[lodPixelErrorIndex];
+	if (maxPixelError <= 0.0f || ObjectLODs[ObjectId].empty()) {
+		return 0;
+	}
+	float distance = glm::length(center - cameraPosition) - ObjectSpheres[ObjectId].radius;
+	// Pixels per unit of length, one unit away from the camera
+	float projectionScale = window_height * gProjectionMatrix[1][1] * 0.5f;
+	return selectLOD(ObjectLODs[ObjectId], distance, projectionScale, maxPixelError);
+}
+void countLODTriangles(LODStats& stats, int ObjectId, int level, unsigned int instances) {
+	stats.triangles += instances * (ObjectLODs[ObjectId][level].indexCount / 3);
+	stats.fullTriangles += instances * (NumIdcs[ObjectId] / 3);
+	stats.objectsPerLevel[level] += instances;
+}
+// Record the chunks of an object that are in the frustum. Consecutive visible chunks are
+// contiguous in the index buffer, so they are merged into a single draw.
+// The chunks only cover the full mesh : the simplified levels are drawn whole.
+void submitFaceChunks(DrawList& list, DrawPacket packet, const glm::mat4& ModelMatrix, int level, const Frustum& frustum) {
+	int ObjectId = packet.mesh;
+	CullResult whole = cullAABB(frustum, transformAABB(ObjectBounds[ObjectId], ModelMatrix));
+	const std::vector<MeshChunk>& chunks = ObjectChunks[ObjectId];
+	cullingStats.objects++;
+	cullingStats.chunks += chunks.size();
+	if (whole == CULL_OUTSIDE) {
+		return;
+	}
+	cullingStats.visibleObjects++;
+	countLODTriangles(lodStats, ObjectId, level, 1);
+	DrawConstants constants = makeDrawConstants(ModelMatrix);
+	if (level > 0) {
+		packet.first = ObjectLODs[ObjectId][level].firstIndex;
+		packet.count = ObjectLODs[ObjectId][level].indexCount;
+		recordDraw(list, packet, &constants);
+		return;
+	}
+	if (whole == CULL_INSIDE || chunks.empty()) {
+		cullingStats.visibleChunks += chunks.size();
+		packet.first = 0;
+		packet.count = NumIdcs[ObjectId];
+		recordDraw(list, packet, &constants);
+		return;
+	}
+	packet.count = 0;
+	for (size_t c = 0; c < chunks.size(); c++) {
+		bool visible = cullAABB(frustum, transformAABB(chunks[c].bounds, ModelMatrix)) != CULL_OUTSIDE;
+		if (visible) {
+			cullingStats.visibleChunks++;
+			if (packet.count == 0) {
+				packet.first = chunks[c].firstIndex;
+			}
+			packet.count += chunks[c].indexCount;
+		}
+		if (!visible || c + 1 == chunks.size()) {
+			if (packet.count > 0) {
+				recordDraw(list, packet, &constants);
+			}
+			packet.count = 0;
+		}
+	}
+}
+// Depth of a point, between 0 (near) and 1 (far), for the sort keys
+float viewDepth01(const glm::vec3& position) {
+	float distance = glm::length(position - cameraPosition);
+	return distance / 100.0f; // far plane
+}
+void snapshotCamera(SceneSnapshot& snapshot) {
+	snapshot.ProjectionMatrix = gProjectionMatrix;
+	snapshot.ViewMatrix = gViewMatrix;
+	snapshot.cameraPosition = cameraPosition;
+}
+// Center of a head of the crowd, in world space
+glm::vec3 headCenter(const InstanceData& instance) {
+	return glm::vec3(instance.ModelMatrix * glm::vec4(ObjectSpheres[faceObjectID].center, 1.0f));
+}
+// Records the heads [begin, end) of visibleInstances, one draw each, into their own draw list.
+// Runs on the job threads : it only writes the list and the counters of its batch.
+void recordCrowdDraws(SceneSnapshot& snapshot, unsigned int begin, unsigned int end, DrawPacket packet) {
+	PROFILE_SCOPE("recordCrowdDraws");
+	unsigned int batch = begin / HeadsPerDrawList;
+	DrawList& list = snapshot.drawLists[1 + batch];
+	LODStats& stats = drawListLODStats[batch];
+	clearDrawList(list);
+	memset(&stats, 0, sizeof(stats));
+	for (unsigned int i = begin; i < end; i++) {
+		const InstanceData& instance = crowdInstances[visibleInstances[i]];
+		glm::vec3 center = headCenter(instance);
+		int level = selectObjectLOD(faceObjectID, center);
+		countLODTriangles(stats, faceObjectID, level, 1);
+		packet.first = ObjectLODs[faceObjectID][level].firstIndex;
+		packet.count = ObjectLODs[faceObjectID][level].indexCount;
+		packet.depth = viewDepth01(center);
+		packet.pickID = CrowdPickBase + i;
+		DrawConstants constants = makeDrawConstants(instance.ModelMatrix);
+		recordDraw(list, packet, &constants);
+	}
+}
+// Main thread side of a frame : culling and levels of detail from the current camera, no GL calls.
+// The per-head work of the crowd is shared with the job threads.
+void buildSnapshot(SceneSnapshot& snapshot) {
 	//ATTN: DRAW YOUR SCENE HERE. MODIFY/ADAPT WHERE NECESSARY!
+	// Nothing taken from the arena outlives a frame
+	resetArena(threadArena());
+	snapshotCamera(snapshot);
+	if (snapshot.drawLists.empty()) {
+		snapshot.drawLists.resize(1);
+	}
+	snapshot.drawListCount = 1;
+	DrawList& mainList = snapshot.drawLists[0];
+	clearDrawList(mainList);
+	snapshot.labels.clear();
+	snapshot.pickInstances.clear();
+	snapshot.faceTexturePixels = 0.0f;
+	for (unsigned int level = 0; level < MaxLODLevels; level++) {
+		snapshot.crowdInstances[level].clear();
+		levelInstances[level].clear();
+	}
+	GLenum polygonMode = isWireframe ? GL_LINE : GL_FILL;
+	unsigned int pass = isWireframe ? RENDER_PASS_WIREFRAME : RENDER_PASS_OPAQUE;
+	Frustum frustum = extractFrustum(gProjectionMatrix * gViewMatrix);
+	memset(&cullingStats, 0, sizeof(cullingStats));
+	memset(&lodStats, 0, sizeof(lodStats));
+	int crowdSize = CrowdSizes[crowdSizeIndex];
+	if (crowdSize > 0) {
+		PROFILE_SCOPE("crowd");
+		// Only the heads in the frustum are drawn
+		visibleInstances.clear();
+		cullSceneBVH(crowdBVH, crowdBounds, frustum, visibleInstances);
+		unsigned int visible = visibleInstances.size();
+		cullingStats.objects = crowdSize;
+		cullingStats.visibleObjects = visible;
+		DrawPacket packet = {};
+		packet.pass = pass;
+		packet.mode = GL_TRIANGLES;
+		packet.indexType = GL_UNSIGNED_SHORT;
+		packet.instanceCount = 1;
+		packet.polygonMode = polygonMode;
+		packet.flags = DRAW_USE_LIGHTING;
+		if (crowdInstancing) {
+			// The instance buffers get the visible heads sorted by level of detail
+			visibleLevels.resize(visible);
+			parallelFor(visible, HeadsPerDrawList, [](unsigned int begin, unsigned int end, unsigned int) {
+				for (unsigned int i = begin; i < end; i++) {
+					visibleLevels[i] = selectObjectLOD(faceObjectID, headCenter(crowdInstances[visibleInstances[i]]));
+				}
+			});
+			for (unsigned int i = 0; i < visible; i++) {
+				snapshot.crowdInstances[visibleLevels[i]].push_back(crowdInstances[visibleInstances[i]]);
+				levelInstances[visibleLevels[i]].push_back(visibleInstances[i]);
+			}
+			// One draw call per level : the model matrices come from the instance buffer
+			for (unsigned int level = 0; level < ObjectLODs[faceObjectID].size(); level++) {
+				if (snapshot.crowdInstances[level].empty()) {
+					continue;
+				}
+				countLODTriangles(lodStats, faceObjectID, level, snapshot.crowdInstances[level].size());
+				packet.mesh = CrowdMeshBase + level;
+				packet.first = ObjectLODs[faceObjectID][level].firstIndex;
+				packet.count = ObjectLODs[faceObjectID][level].indexCount;
+				packet.instanceCount = snapshot.crowdInstances[level].size();
+				// The instances of the draw take the identifiers after this one
+				packet.pickID = CrowdPickBase + snapshot.pickInstances.size();
+				snapshot.pickInstances.insert(snapshot.pickInstances.end(), levelInstances[level].begin(), levelInstances[level].end());
+				recordDraw(mainList, packet, NULL);
+			}
+		}
+		else {
+			// One draw per head, each batch of heads recorded into its own list by whichever thread takes it
+			unsigned int batches = (visible + HeadsPerDrawList - 1) / HeadsPerDrawList;
+			snapshot.drawListCount = 1 + batches;
+			if (snapshot.drawLists.size() < snapshot.drawListCount) {
+				snapshot.drawLists.resize(snapshot.drawListCount);
+			}
+			drawListLODStats.resize(batches);
+			packet.mesh = faceObjectID;
+			parallelFor(visible, HeadsPerDrawList, [&snapshot, &packet](unsigned int begin, unsigned int end, unsigned int) {
+				recordCrowdDraws(snapshot, begin, end, packet);
+			});
+			snapshot.pickInstances = visibleInstances;
+			for (unsigned int batch = 0; batch < batches; batch++) {
+				const LODStats& stats = drawListLODStats[batch];
+				lodStats.triangles += stats.triangles;
+				lodStats.fullTriangles += stats.fullTriangles;
+				for (unsigned int level = 0; level < MaxLODLevels; level++) {
+					lodStats.objectsPerLevel[level] += stats.objectsPerLevel[level];
+				}
+			}
+		}
+		if (hudEnabled && showLabels) {
+			addCrowdLabels(snapshot);
+		}
+	}
+	else {
+		// axes
+		DrawPacket axes = {};
+		axes.mesh = 0;
+		axes.pass = pass;
+		axes.depth = viewDepth01(glm::vec3(0.0f));
+		axes.mode = GL_LINES;
+		axes.count = NumVerts[0];
+		axes.instanceCount = 1;
+		axes.polygonMode = polygonMode;
+		axes.flags = DRAW_USE_LIGHTING;
+		axes.pickID = axes.mesh + 1;
+		DrawConstants axesConstants = makeDrawConstants(glm::mat4(1.0));
+		recordDraw(mainList, axes, &axesConstants);
+		// draw face
+		DrawPacket face = {};
+		face.mesh = faceObjectID;
+		face.pass = pass;
+		face.mode = GL_TRIANGLES;
+		face.indexType = GL_UNSIGNED_SHORT;
+		face.instanceCount = 1;
+		face.polygonMode = polygonMode;
+		face.flags = DRAW_USE_LIGHTING;
+		if (showTexture) {
+			face.mesh = faceTextObjectID;
+			face.texture = textureID;
+			face.flags |= DRAW_USE_TEXTURE;
+			// The image is stretched over the whole face : as many texels as pixels across it
+			const BoundingSphere& sphere = ObjectSpheres[face.mesh];
+			float distance = glm::max(glm::length(sphere.center - cameraPosition), sphere.radius);
+			snapshot.faceTexturePixels = 2.0f * sphere.radius * window_height * gProjectionMatrix[1][1] * 0.5f / distance;
+		}
+		face.depth = viewDepth01(ObjectSpheres[face.mesh].center);
+		face.pickID = face.mesh + 1;
+		// The selection is made of vertices of the untextured face
+		if (showSelection && face.mesh == faceObjectID) {
+			face.flags |= DRAW_SELECTED;
+		}
+		submitFaceChunks(mainList, face, glm::mat4(1.0), selectObjectLOD(face.mesh, ObjectSpheres[face.mesh].center), frustum);
+		if (robotArmTexture != 0) {
+			// All the parts with the one atlas : a single draw, whatever the number of parts
+			glm::mat4 armMatrix = glm::scale(glm::translate(glm::mat4(1.0), RobotArmPosition), glm::vec3(RobotArmScale));
+			glm::vec3 armCenter = glm::vec3(armMatrix * glm::vec4(ObjectSpheres[robotArmObjectID].center, 1.0f));
+			DrawPacket arm = face;
+			arm.mesh = robotArmObjectID;
+			arm.texture = robotArmTexture;
+			arm.flags = DRAW_USE_LIGHTING | DRAW_USE_TEXTURE;
+			arm.depth = viewDepth01(armCenter);
+			// Only the face is picked
+			arm.pickID = 0;
+			submitFaceChunks(mainList, arm, armMatrix, selectObjectLOD(arm.mesh, armCenter), frustum);
+		}
+	}
+	snapshot.culling = cullingStats;
+	snapshot.lod = lodStats;
+	snapshot.lodLevels = ObjectLODs[faceObjectID].size();
+}
+// Render thread side : uploads the visible heads and the per-draw constants, then the draw lists
+// go through the render queue
+void drawSnapshot(const SceneSnapshot& snapshot) {
 	// Dark blue background
 	glClearColor(0.0f, 0.0f, 0.2f, 0.0f);
 	// Re-clear the screen for real rendering
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glUseProgram(programID);
-	{
-		glm::vec3 lightPos = glm::vec3(4, 4, 4);
-		glm::mat4x4 ModelMatrix = glm::mat4(1.0);
-		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
-		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &gViewMatrix[0]
-			[0]);
-		glUniformMatrix4fv(ProjMatrixID, 1, GL_FALSE,
-			&gProjectionMatrix[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0]
-			[0]);
-		// light 1
-		glUniform3f(glGetUniformLocation(programID, "lightPos1"), lightPos1.x, lightPos1.y, lightPos1.z);
-		glUniform3f(glGetUniformLocation(programID, "lightDiffuse1"), lightDiffuseColor1.x, lightDiffuseColor1.y, lightDiffuseColor1.z);
-		glUniform3f(glGetUniformLocation(programID, "lightAmbient1"), lightAmbientColor1.x, lightAmbientColor1.y, lightAmbientColor1.z);
-		glUniform3f(glGetUniformLocation(programID, "lightSpecular1"), lightSpecularColor1.x, lightSpecularColor1.y, lightSpecularColor1.z);
-		// light 2
-		glUniform3f(glGetUniformLocation(programID, "lightPos2"), lightPos2.x, lightPos2.y, lightPos2.z);
-		glUniform3f(glGetUniformLocation(programID, "lightDiffuse2"), lightDiffuseColor2.x, lightDiffuseColor2.y, lightDiffuseColor2.z);
-		glUniform3f(glGetUniformLocation(programID, "lightAmbient2"), lightAmbientColor2.x, lightAmbientColor2.y, lightAmbientColor2.z);
-		glUniform3f(glGetUniformLocation(programID, "lightSpecular2"), lightSpecularColor2.x, lightSpecularColor2.y, lightSpecularColor2.z);
-		// material
-		glUniform3f(glGetUniformLocation(programID, "materialDiffuse"), materialDiffuse.x, materialDiffuse.y, materialDiffuse.z);
-		glUniform3f(glGetUniformLocation(programID, "materialAmbient"), materialAmbient.x, materialAmbient.y, materialAmbient.z);
-		glUniform3f(glGetUniformLocation(programID, "materialSpecular"), materialSpecular.x, materialSpecular.y, materialSpecular.z);
-		glUniform1f(glGetUniformLocation(programID, "materialShininess"), materialShininess);
-		glUniform3f(glGetUniformLocation(programID, "viewPosition"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
-		glBindVertexArray(VertexArrayId[0]);
-		glUniform1i(glGetUniformLocation(programID, "useLighting"), true);
-		glDrawArrays(GL_LINES, 0, NumVerts[0]);
-		glBindVertexArray(0);
-		glDrawArrays(GL_LINES, 0, NumVerts[0]);
-		glBindVertexArray(0);
-		// draw face
-		if (showTexture) {
-			glUniform1i(glGetUniformLocation(programID, "useTexture"), 1);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, textureID);
-			glUniform1i(glGetUniformLocation(programID, "texture1"), 0);
-			glBindVertexArray(VertexArrayId[faceTextObjectID]);
-			glDrawElements(GL_TRIANGLES, NumIdcs[faceTextObjectID], GL_UNSIGNED_SHORT, 0);
-			glBindVertexArray(0);
-		}
-		//if (showSubdivided) {
-		// glUniform1i(glGetUniformLocation(programID, "useLighting"), true);
-		// glUniform1i(glGetUniformLocation(programID, "useTexture"), 0);
-		// glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		// glBindVertexArray(VertexArrayId[faceObjectID]);
-		// glDrawElements(GL_TRIANGLES, NumIdcs[faceObjectID], GL_UNSIGNED_SHORT, 0);
-		// glBindVertexArray(0);
-		// // Render original control net as wireframe
-		// //glUniform1i(glGetUniformLocation(programID, "useLighting"), true);
-		// //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // Wireframe mode
-			// //glUniform3f(glGetUniformLocation(programID, "materialDiffuse"), 1.0f, 0.0f, 0.0f); // Set wireframe color
-			// //glBindVertexArray(VertexArrayId[controlNetID]);
-			// //glDrawElements(GL_TRIANGLES, NumIdcs[controlNetID], GL_UNSIGNED_SHORT, 0);
-			// //glBindVertexArray(0);
-			//}
+	clearRenderQueue(renderQueue);
+	drawnSnapshot = &snapshot;
+	if (snapshot.faceTexturePixels > 0.0f) {
+		requestTextureSize(textureID, snapshot.faceTexturePixels);
+	}
+	for (unsigned int level = 0; level < MaxLODLevels; level++) {
+		if (!snapshot.crowdInstances[level].empty()) {
+			uploadInstances(InstanceBufferId[level], MaxCrowdSize, snapshot.crowdInstances[level]);
+		}
+	}
+	replayDrawLists(&snapshot.drawLists[0], snapshot.drawListCount, drawConstantsBuffer, renderQueue, resolvePacket);
+	PROFILE_SCOPE("flushRenderQueue");
+	beginGPUScope("scene");
+	flushRenderQueue(renderQueue, setupProgram, setupDraw);
+	endGPUScope();
+}
+// Called by the picking queue each time it switches to another program
+void setupPickingProgram(GLuint program) {
+	const ShaderVariant* variant = findShaderVariant(pickingShaders, program);
+	if (variant == NULL) {
+		return;
+	}
+	glUniformMatrix4fv(variant->ViewMatrixID, 1, GL_FALSE, &drawnSnapshot->ViewMatrix[0][0]);
+	glUniformMatrix4fv(variant->ProjMatrixID, 1, GL_FALSE, &drawnSnapshot->ProjectionMatrix[0][0]);
+	PickIDLocation = glGetUniformLocation(program, "PickID");
+	PickPrimitiveBaseLocation = glGetUniformLocation(program, "PickPrimitiveBase");
+}
+// Called by the picking queue before each draw : its identifier, and where its triangles start in the
+// index buffer, so that the primitive read back is a triangle of the mesh and not of the chunk drawn
+void setupPickingDraw(GLuint program, const DrawItem& item) {
+	const ShaderVariant* variant = findShaderVariant(pickingShaders, program);
+	if (variant == NULL) {
+		return;
+	}
+	glUniform1ui(PickIDLocation, item.pickID);
+	bool indexedTriangles = item.mode == GL_TRIANGLES && item.indexType != 0;
+	glUniform1ui(PickPrimitiveBaseLocation, indexedTriangles ? item.first / 3 : 0);
+	if (variant->features & SHADER_DRAW_CONSTANTS) {
+		bindDrawConstants(drawConstantsBuffer, item.constants);
+	}
+}
+// What the ID buffer had under a click, printed once it is back. Render thread : the result
+// waits in gpuPickResult, gPickedIndex and gMessage belong to the main thread.
+void reportGPUPick(const GPUPick& pick, const IDReadbackResult& result) {
+	unsigned int frames = renderedFrames - pick.frame;
+	const PickID* id = closestPickID(result, pick.x, pick.y);
+	GLuint index = -1;
+	std::string message = "background";
+	if (id == NULL) {
+		printf("Picked the background (GPU, %u frames later)\n", frames);
+	}
+	else {
+		std::ostringstream oss;
+		if (id->object < CrowdPickBase) {
+			index = id->object - 1;
+			oss << "object " << index;
+		}
 		else {
-			glUniform1i(glGetUniformLocation(programID, "useLighting"), true);
-			glUniform1i(glGetUniformLocation(programID, "useTexture"), 0);
-			glBindVertexArray(VertexArrayId[faceObjectID]);
-			glDrawElements(GL_TRIANGLES, NumIdcs[faceObjectID], GL_UNSIGNED_SHORT, 0);
-			glBindVertexArray(0);
+			unsigned int head = id->object - CrowdPickBase;
+			index = faceObjectID;
+			oss << "object " << faceObjectID << ", head " << (head < pick.heads.size() ? pick.heads[head] : -1);
+		}
+		oss << ", triangle " << id->primitive;
+		message = oss.str();
+		printf("Picked %s (GPU, %u frames later)\n", message.c_str(), frames);
+	}
+	std::lock_guard<std::mutex> lock(gpuPickResultMutex);
+	gpuPickResult.pending = true;
+	gpuPickResult.index = index;
+	gpuPickResult.message.swap(message);
+}
+// Main thread : the last GPU pick which came back, if any
+void applyGPUPick() {
+	std::lock_guard<std::mutex> lock(gpuPickResultMutex);
+	if (!gpuPickResult.pending) {
+		return;
+	}
+	gPickedIndex = gpuPickResult.index;
+	gMessage.swap(gpuPickResult.message);
+	gpuPickResult.pending = false;
+}
+// Render thread, after the scene : the ID pass of a click waiting for it, and the reads which came back.
+// Nothing here waits for the GPU.
+void drawPickingPass(const SceneSnapshot& snapshot) {
+	PROFILE_SCOPE("picking");
+	if (gpuPickWaiting && (idPickBuffer.framebuffer != 0 || createIDPickBuffer(idPickBuffer, window_width, window_height))) {
+		// The draws of the frame again, with the programs of the ID pass. Nothing to bind but the mesh.
+		clearRenderQueue(pickQueue);
+		for (size_t i = 0; i < renderQueue.items.size(); i++) {
+			DrawItem item = renderQueue.items[i];
+			if (item.pickID == 0) {
+				continue;
+			}
+			const ShaderVariant* variant = findShaderVariant(standardShaders, item.program);
+			bool instanced = variant != NULL && (variant->features & SHADER_INSTANCED);
+			item.program = getShaderVariant(pickingShaders, instanced ? SHADER_INSTANCED : SHADER_DRAW_CONSTANTS).program;
+			item.texture = 0;
+			item.polygonMode = GL_FILL;
+			submitDraw(pickQueue, item);
 		}
+		beginGPUScope("picking");
+		beginIDPickPass(idPickBuffer);
+		flushRenderQueue(pickQueue, setupPickingProgram, setupPickingDraw);
+		beginIDReadback(idReadbacks, idPickBuffer, gpuPickNext.x - PickRadius, gpuPickNext.y - PickRadius,
+			2 * PickRadius + 1, 2 * PickRadius + 1, gpuPickNext.request);
+		endIDPickPass(idPickBuffer);
+		endGPUScope();
+		gpuPickNext.frame = renderedFrames;
+		gpuPickNext.heads = snapshot.pickInstances;
+		gpuPicksInFlight.push_back(gpuPickNext);
+	}
+	gpuPickWaiting = false;
+	while (finishIDReadback(idReadbacks, idReadbackResult)) {
+		for (size_t i = 0; i < gpuPicksInFlight.size(); i++) {
+			if (gpuPicksInFlight[i].request == idReadbackResult.request) {
+				reportGPUPick(gpuPicksInFlight[i], idReadbackResult);
+				gpuPicksInFlight.erase(gpuPicksInFlight.begin() + i);
+				break;
+			}
+		}
+	}
+	// Frames keep coming until the last read is back
+	if (idReadbacksPending(idReadbacks)) {
+		requestRedraw();
 	}
-	glUseProgram(0);
+}
+// Render thread : the vertices of the face changed. Called before the render thread starts, then by the
+// command which uploads the subdivided mesh.
+void setFaceSelectionMesh(const std::vector<Vertex>& meshVertices) {
+	std::vector<glm::vec3> positions(meshVertices.size());
+	for (size_t i = 0; i < meshVertices.size(); i++) {
+		positions[i] = glm::vec3(meshVertices[i].Position[0], meshVertices[i].Position[1], meshVertices[i].Position[2]);
+	}
+	setSelectionVertices(selectionGrid, positions.data(), positions.size());
+	resizeSelection(selectedVertices, positions.size());
+	uploadSelection(selectionTexture, selectedVertices);
+}
+// Runs on the render thread : the selection is made on the next frame, from its camera
+void requestSelection(const SelectionRequest& request) {
+	selectionNext = request;
+	selectionWaiting = true;
+}
+void runSelection(const SelectionRequest& request, SelectionDepth* occlusion) {
+	PROFILE_SCOPE("selection");
+	double start = appTime();
+	// Projected again only when the camera moved since the last selection
+	bool projected = updateSelectionGrid(selectionGrid, request.ViewProjection, window_width, window_height);
+	if (occlusion != NULL) {
+		occlusion->bias = SelectionDepthBias;
+	}
+	if (request.lasso) {
+		selectPolygon(selectionGrid, request.points, occlusion, request.mode, selectedVertices);
+	}
+	else {
+		selectRect(selectionGrid, request.points[0].x, request.points[0].y, request.points[1].x, request.points[1].y,
+			occlusion, request.mode, selectedVertices);
+	}
+	uploadSelection(selectionTexture, selectedVertices);
+	printf("Selected %u of %u vertices (%.2f ms%s)\n", countSelected(selectedVertices), selectionGrid.count,
+		1000.0 * (appTime() - start), projected ? ", projected" : "");
+	requestRedraw();
+}
+// Render thread, after the scene : starts the selection waiting, once its depth buffer is read if it needs one
+void updateSelection(const SceneSnapshot& snapshot) {
+	if (selectionWaiting && !selectionReading) {
+		selectionWaiting = false;
+		selectionNext.ViewProjection = snapshot.ProjectionMatrix * snapshot.ViewMatrix;
+		if (selectionNext.occlusion) {
+			beginSelectionDepthRead(selectionDepthRead, window_width, window_height);
+			selectionReading = true;
+		}
+		else {
+			runSelection(selectionNext, NULL);
+		}
+	}
+	if (selectionReading && finishSelectionDepthRead(selectionDepthRead, selectionDepth)) {
+		selectionReading = false;
+		runSelection(selectionNext, &selectionDepth);
+	}
+	if (selectionWaiting || selectionReading) {
+		requestRedraw();
+	}
+}
+// A label above each visible head of the crowd, to show that many strings are still one draw
+void addCrowdLabels(SceneSnapshot& snapshot) {
+	glm::mat4 VP = gProjectionMatrix * gViewMatrix;
+	for (size_t i = 0; i < visibleInstances.size(); i++) {
+		const InstanceData& instance = crowdInstances[visibleInstances[i]];
+		glm::vec4 clip = VP * instance.ModelMatrix * glm::vec4(ObjectSpheres[faceObjectID].center, 1.0f);
+		if (clip.w <= 0.0f) {
+			continue;
+		}
+		ScreenLabel label;
+		label.x = int((clip.x / clip.w * 0.5f + 0.5f) * window_width) - 4 * 8;
+		label.y = int((clip.y / clip.w * 0.5f + 0.5f) * window_height);
+		snprintf(label.text, sizeof(label.text), "head %d", visibleInstances[i]);
+		snapshot.labels.push_back(label);
+	}
+}
+void drawHUD(const SceneSnapshot& snapshot) {
+	if (!hudEnabled) {
+		return;
+	}
+	PROFILE_SCOPE("drawHUD");
+	for (int line = 0; line < HudLines; line++) {
+		addText(hudText[line], 10, window_height - 20 * (line + 1), 14);
+	}
+	for (size_t i = 0; i < snapshot.labels.size(); i++) {
+		addText(snapshot.labels[i].text, snapshot.labels[i].x, snapshot.labels[i].y, 8);
+	}
+	beginGPUScope("text");
+	flushTextBatch(window_width, window_height);
+	endGPUScope();
+}
+// Printed and shown on the HUD once per second, from the render thread
+void updateFrameStats(const SceneSnapshot& snapshot) {
+	// Measure speed
+	double currentTime = appTime();
+	if (frameStatsTime < 0.0) {
+		frameStatsTime = currentTime;
+	}
+	frameStatsCount++;
+	if (currentTime - frameStatsTime < 1.0) { // If last prinf() was less than 1sec ago
+		return;
+	}
+	ProfileSummary profile = getProfileSummary(frameStatsCount);
+	printProfileSummary(profile);
+	GLStateCounters glCalls = glsGetCounters();
+	printf("%u draws, %u state changes (%u avoided), GL state calls: %u issued, %u filtered\n",
+		renderQueue.stats.draws, renderQueue.stats.stateChanges,
+		renderQueue.stats.stateChangesAvoided, glCalls.issued, glCalls.filtered);
+	glsResetCounters();
+	const CullingStats& culling = snapshot.culling;
+	const LODStats& lod = snapshot.lod;
+	printf("culling: %u/%u objects visible, %u/%u chunks visible\n", culling.visibleObjects,
+		culling.objects, culling.visibleChunks, culling.chunks);
+	if (lod.fullTriangles > 0) {
+		printf("LOD: %u triangles instead of %u at full detail (%.1f%% saved), objects per level:", lod.triangles,
+			lod.fullTriangles, 100.0 * (1.0 - double(lod.triangles) / double(lod.fullTriangles)));
+		for (unsigned int level = 0; level < snapshot.lodLevels; level++) {
+			printf(" %u", lod.objectsPerLevel[level]);
+		}
+		printf("\n");
+	}
+	// Same numbers on the screen
+	TextBatchStats textStats = getTextBatchStats();
+	snprintf(hudText[0], sizeof(hudText[0]), "frame %.2f/%.2f ms  cpu %.2f  gpu %.2f  %u draws",
+		profile.frame.p50, profile.frame.p99, profile.cpu.p50, profile.gpu.p50, renderQueue.stats.draws);
+	snprintf(hudText[1], sizeof(hudText[1]), "%u/%u objects  %u triangles", culling.visibleObjects,
+		culling.objects, lod.triangles);
+	TextureManagerStats textureStats = getTextureManagerStats();
+	snprintf(hudText[2], sizeof(hudText[2]), "%u characters%s  textures %.1f MB, %u loading", textStats.glyphs,
+		textStats.persistent ? " (persistent)" : "", textureStats.residentBytes / (1024.0 * 1024.0), textureStats.loading);
+	frameStatsCount = 0;
+	// Not += 1.0 : there may have been no frame for a long time
+	frameStatsTime = currentTime;
+}
+// Render thread side of a frame, up to the swap
+void renderFrame(const SceneSnapshot& snapshot) {
+	profilerBeginFrame();
+	resetArena(threadArena());
+	beginTextureFrame();
+	renderedFrames++;
+	if (!headless) {
+		updateFrameStats(snapshot);
+	}
+	{
+		PROFILE_SCOPE("drawScene");
+		drawSnapshot(snapshot);
+	}
+	updateSelection(snapshot);
+	if (gpuPicking) {
+		drawPickingPass(snapshot);
+	}
+	drawHUD(snapshot);
+	// Before the swap, which may wait for the vsync
+	profilerEndFrame();
 	// Draw GUI
 	//TwDraw();
 	// Swap buffers
-	glfwSwapBuffers(window);
-	glfwPollEvents();
+	if (!headless) {
+		glfwSwapBuffers(window);
+	}
+}
+// Both sides of a frame on the calling thread, for the benchmarks
+void renderScene(void) {
+	SceneSnapshot& snapshot = sceneSnapshots[0];
+	{
+		PROFILE_SCOPE("buildSnapshot");
+		buildSnapshot(snapshot);
+	}
+	renderFrame(snapshot);
 }
 void cleanup(void) {
 	// Cleanup VBO and shader
 	for (int i = 0; i < NumObjects; i++) {
-		glDeleteBuffers(1, &VertexBufferId[i]);
-		glDeleteBuffers(1, &IndexBufferId[i]);
-		glDeleteVertexArrays(1, &VertexArrayId[i]);
+		glsDeleteBuffer(VertexBufferId[i]);
+		glsDeleteBuffer(IndexBufferId[i]);
+		glsDeleteVertexArray(VertexArrayId[i]);
+	}
+	for (unsigned int level = 0; level < MaxLODLevels; level++) {
+		glsDeleteBuffer(InstanceBufferId[level]);
+		glsDeleteVertexArray(CrowdVertexArrayId[level]);
+	}
+	deleteDrawConstantsBuffer(drawConstantsBuffer);
+	deleteShaderVariants(standardShaders);
+	deleteShaderVariants(pickingShaders);
+	deleteIDReadbacks(idReadbacks);
+	deleteIDPickBuffer(idPickBuffer);
+	deleteSelectionTexture(selectionTexture);
+	deleteSelectionDepthRead(selectionDepthRead);
+	cleanupTextBatch();
+	printTextureManagerStats();
+	cleanupTextureManager();
+	cleanupProfiler();
+	cleanupRedraw();
+	cleanupJobs();
+	if (headless) {
+		destroyHeadlessContext();
+		return;
 	}
-	glDeleteProgram(programID);
-	glDeleteProgram(pickingProgramID);
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 }
@@ -893,131 +1923,191 @@ void recomputeNormals(std::vector<Vertex>& vertices, const
 	}
 }
 // Alternative way of triggering functions on keyboard events
+// One level of subdivision of the face : replaces its buffers, bounds and levels of detail
+void subdivideFace(void) {
+	PROFILE_SCOPE("subdivide");
+	ArenaScope scope(threadArena());
+	AdjacentTriangles adjacentTriangles;
+	for (size_t i = 0; i < faces.size(); ++i) {
+		const auto& face = faces[i];
+		adjacentTriangles[Edge(face.v1,
+			face.v2)].push_back(static_cast<int>(i));
+		adjacentTriangles[Edge(face.v2,
+			face.v3)].push_back(static_cast<int>(i));
+		adjacentTriangles[Edge(face.v3,
+			face.v1)].push_back(static_cast<int>(i));
+	}
+	EdgePoints edgePoints =
+		computeEdgePoints(vertices, faces, adjacentTriangles);
+	auto updatedVertices = computeVertexPoints(vertices,
+		edgePoints, adjacentTriangles);
+	ArenaVector<Vertex> newVertices;
+	ArenaVector<Face> newFaces;
+	newVertices.reserve(updatedVertices.size() + edgePoints.size());
+	newFaces.reserve(faces.size() * 4);
+	for (const auto& vertex : updatedVertices) {
+		Vertex updatedVertex = {};
+		float position[3] = { vertex.x, vertex.y, vertex.z };
+		updatedVertex.SetPosition(position);
+		newVertices.push_back(updatedVertex);
+	}
+	EdgeIndices edgePointIndices;
+	int index = vertices.size();
+	addEdgePointsToVertices(edgePoints, newVertices,
+		edgePointIndices, index);
+	for (const auto& face : faces) {
+		int e1 = edgePointIndices[Edge(face.v1, face.v2)];
+		int e2 = edgePointIndices[Edge(face.v2, face.v3)];
+		int e3 = edgePointIndices[Edge(face.v3, face.v1)];
+		assert(e1 != e2 && e2 != e3 && e3 != e1);
+		newFaces.push_back({ face.v1, e1, e3 });
+		newFaces.push_back({ e1, face.v2, e2 });
+		newFaces.push_back({ e3, e2, face.v3 });
+		newFaces.push_back({ e1, e2, e3 });
+	}
+	vertices.assign(newVertices.begin(), newVertices.end());
+	faces.assign(newFaces.begin(), newFaces.end());
+	for (auto& face : faces) {
+		glm::vec3 v0(vertices[face.v1].Position[0],
+			vertices[face.v1].Position[1], vertices[face.v1].Position[2]);
+		glm::vec3 v1(vertices[face.v2].Position[0],
+			vertices[face.v2].Position[1], vertices[face.v2].Position[2]);
+		glm::vec3 v2(vertices[face.v3].Position[0],
+			vertices[face.v3].Position[1], vertices[face.v3].Position[2]);
+		glm::vec3 normal = glm::normalize(glm::cross(v1 -
+			v0, v2 - v0));
+		vertices[face.v1].Normal[0] += normal.x;
+		vertices[face.v1].Normal[1] += normal.y;
+		vertices[face.v1].Normal[2] += normal.z;
+		vertices[face.v2].Normal[0] += normal.x;
+		vertices[face.v2].Normal[1] += normal.y;
+		vertices[face.v2].Normal[2] += normal.z;
+		vertices[face.v3].Normal[0] += normal.x;
+		vertices[face.v3].Normal[1] += normal.y;
+		vertices[face.v3].Normal[2] += normal.z;
+	}
+	for (auto& vertex : vertices) {
+		glm::vec3 normal(vertex.Normal[0],
+			vertex.Normal[1], vertex.Normal[2]);
+		normal = glm::normalize(normal);
+		vertex.Normal[0] = normal.x;
+		vertex.Normal[1] = normal.y;
+		vertex.Normal[2] = normal.z;
+	}
+	std::vector<GLushort> indices;
+	for (const auto& face : faces) {
+		indices.push_back(face.v1);
+		indices.push_back(face.v2);
+		indices.push_back(face.v3);
+	}
+	computeObjectBounds(faceObjectID, vertices, indices);
+	buildObjectLODs(faceObjectID, vertices, indices);
+	VertexBufferSize[faceObjectID] = sizeof(Vertex) *
+		vertices.size();
+	IndexBufferSize[faceObjectID] = sizeof(GLushort) *
+		indices.size();
+	NumIdcs[faceObjectID] = ObjectLODs[faceObjectID][0].indexCount;
+	// The buffers are replaced on the render thread, between the frames drawn with the old mesh and
+	// the ones drawn with the new one. The command keeps its own copy of the data.
+	std::vector<Vertex> vertexData = vertices;
+	enqueueRenderCommand([vertexData, indices]() {
+		glsDeleteBuffer(VertexBufferId[faceObjectID]);
+		glsDeleteBuffer(IndexBufferId[faceObjectID]);
+		glsDeleteVertexArray(VertexArrayId[faceObjectID]);
+		glGenVertexArrays(1, &VertexArrayId[faceObjectID]);
+		glsBindVertexArray(VertexArrayId[faceObjectID]);
+		glGenBuffers(1, &VertexBufferId[faceObjectID]);
+		glsBindBuffer(GL_ARRAY_BUFFER,
+			VertexBufferId[faceObjectID]);
+		glBufferData(GL_ARRAY_BUFFER,
+			sizeof(Vertex) * vertexData.size(), vertexData.data(), GL_STATIC_DRAW);
+		glGenBuffers(1, &IndexBufferId[faceObjectID]);
+		glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+			IndexBufferId[faceObjectID]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			sizeof(GLushort) * indices.size(), indices.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE,
+			sizeof(Vertex), (void*)0); // Position
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE,
+			sizeof(Vertex), (void*)sizeof(Vertex::Position)); // Color
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE,
+			sizeof(Vertex),
+			(void*)(sizeof(Vertex::Position) +
+				sizeof(Vertex::Color))); // Normal
+		glEnableVertexAttribArray(2);
+		glsBindVertexArray(0);
+		createCrowdVAO();
+		// The old vertices keep their numbers : so does their selection
+		setFaceSelectionMesh(vertexData);
+	});
+	updateCrowd();
+	showSubdivided = true;
+	requestRedraw();
+}
 static void keyCallback(GLFWwindow* window, int key, int scancode, int
 	action, int mods) {
 	// ATTN: MODIFY AS APPROPRIATE
 	if (action == GLFW_PRESS || action == GLFW_REPEAT) {
 		switch (key)
 		{
-		case GLFW_KEY_F: // toggle wireframe mode
+		case GLFW_KEY_F: // toggle wireframe mode (applied per draw by the render queue)
 			isWireframe = !isWireframe;
-			if (isWireframe) {
-				glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			}
-			else {
-				glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-			}
 			break;
-		case GLFW_KEY_S: {
-			std::map<Edge, std::vector<int>> adjacentTriangles;
-			for (size_t i = 0; i < faces.size(); ++i) {
-				const auto& face = faces[i];
-				adjacentTriangles[Edge(face.v1,
-					face.v2)].push_back(static_cast<int>(i));
-				adjacentTriangles[Edge(face.v2,
-					face.v3)].push_back(static_cast<int>(i));
-				adjacentTriangles[Edge(face.v3,
-					face.v1)].push_back(static_cast<int>(i));
-			}
-			std::map<Edge, glm::vec3> edgePoints =
-				computeEdgePoints(vertices, faces, adjacentTriangles);
-			auto updatedVertices = computeVertexPoints(vertices,
-				edgePoints, adjacentTriangles);
-			std::vector<Vertex> newVertices;
-			std::vector<Face> newFaces;
-			for (const auto& vertex : updatedVertices) {
-				Vertex updatedVertex = {};
-				updatedVertex.SetPosition(new float[3] { vertex.x,
-					vertex.y, vertex.z });
-				newVertices.push_back(updatedVertex);
-			}
-			std::map<Edge, int> edgePointIndices;
-			int index = vertices.size();
-			addEdgePointsToVertices(edgePoints, newVertices,
-				edgePointIndices, index);
-			for (const auto& face : faces) {
-				int e1 = edgePointIndices[Edge(face.v1, face.v2)];
-				int e2 = edgePointIndices[Edge(face.v2, face.v3)];
-				int e3 = edgePointIndices[Edge(face.v3, face.v1)];
-				assert(e1 != e2 && e2 != e3 && e3 != e1);
-				newFaces.push_back({ face.v1, e1, e3 });
-				newFaces.push_back({ e1, face.v2, e2 });
-				newFaces.push_back({ e3, e2, face.v3 });
-				newFaces.push_back({ e1, e2, e3 });
-			}
-			vertices = newVertices;
-			faces = newFaces;
-			for (auto& face : faces) {
-				glm::vec3 v0(vertices[face.v1].Position[0],
-					vertices[face.v1].Position[1], vertices[face.v1].Position[2]);
-				glm::vec3 v1(vertices[face.v2].Position[0],
-					vertices[face.v2].Position[1], vertices[face.v2].Position[2]);
-				glm::vec3 v2(vertices[face.v3].Position[0],
-					vertices[face.v3].Position[1], vertices[face.v3].Position[2]);
-				glm::vec3 normal = glm::normalize(glm::cross(v1 -
-					v0, v2 - v0));
-				vertices[face.v1].Normal[0] += normal.x;
-				vertices[face.v1].Normal[1] += normal.y;
-				vertices[face.v1].Normal[2] += normal.z;
-				vertices[face.v2].Normal[0] += normal.x;
-				vertices[face.v2].Normal[1] += normal.y;
-				vertices[face.v2].Normal[2] += normal.z;
-				vertices[face.v3].Normal[0] += normal.x;
-				vertices[face.v3].Normal[1] += normal.y;
-				vertices[face.v3].Normal[2] += normal.z;
-			}
-			for (auto& vertex : vertices) {
-				glm::vec3 normal(vertex.Normal[0],
-					vertex.Normal[1], vertex.Normal[2]);
-				normal = glm::normalize(normal);
-				vertex.Normal[0] = normal.x;
-				vertex.Normal[1] = normal.y;
-				vertex.Normal[2] = normal.z;
-			}
-			glDeleteBuffers(1, &VertexBufferId[faceObjectID]);
-			glDeleteBuffers(1, &IndexBufferId[faceObjectID]);
-			glDeleteVertexArrays(1, &VertexArrayId[faceObjectID]);
-			std::vector<GLushort> indices;
-			for (const auto& face : faces) {
-				indices.push_back(face.v1);
-				indices.push_back(face.v2);
-				indices.push_back(face.v3);
-			}
-			VertexBufferSize[faceObjectID] = sizeof(Vertex) *
-				vertices.size();
-			IndexBufferSize[faceObjectID] = sizeof(GLushort) *
-				indices.size();
-			NumIdcs[faceObjectID] = indices.size();
-			glGenVertexArrays(1, &VertexArrayId[faceObjectID]);
-			glBindVertexArray(VertexArrayId[faceObjectID]);
-			glGenBuffers(1, &VertexBufferId[faceObjectID]);
-			glBindBuffer(GL_ARRAY_BUFFER,
-				VertexBufferId[faceObjectID]);
-			glBufferData(GL_ARRAY_BUFFER,
-				VertexBufferSize[faceObjectID], vertices.data(), GL_STATIC_DRAW);
-			glGenBuffers(1, &IndexBufferId[faceObjectID]);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-				IndexBufferId[faceObjectID]);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-				IndexBufferSize[faceObjectID], indices.data(), GL_STATIC_DRAW);
-			glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE,
-				sizeof(Vertex), (void*)0); // Position
-			glEnableVertexAttribArray(0);
-			glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE,
-				sizeof(Vertex), (void*)sizeof(Vertex::Position)); // Color
-			glEnableVertexAttribArray(1);
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE,
-				sizeof(Vertex),
-				(void*)(sizeof(Vertex::Position) +
-					sizeof(Vertex::Color))); // Normal
-			glEnableVertexAttribArray(2);
-			glBindVertexArray(0);
-			showSubdivided = true;
+		case GLFW_KEY_S:
+			subdivideFace();
 			break;
-		}
 		case GLFW_KEY_T: // toggle texture
 			showTexture = !showTexture;
 			break;
+		case GLFW_KEY_C: // cycle through the crowd sizes
+			crowdSizeIndex = (crowdSizeIndex + 1) % (sizeof(CrowdSizes) / sizeof(CrowdSizes[0]));
+			updateCrowd();
+			printf("crowd: %d heads\n", CrowdSizes[crowdSizeIndex]);
+			break;
+		case GLFW_KEY_L: // cycle through the screen-space error allowed for the levels of detail
+			lodPixelErrorIndex = (lodPixelErrorIndex + 1) % (sizeof(LODPixelErrors) / sizeof(LODPixelErrors[0]));
+			if (LODPixelErrors[lodPixelErrorIndex] > 0.0f)
+				printf("LOD: up to %.0f pixel(s) of error\n", LODPixelErrors[lodPixelErrorIndex]);
+			else
+				printf("LOD: off, full detail\n");
+			break;
+		case GLFW_KEY_I: // toggle between one instanced draw per level of detail and one draw per head
+			crowdInstancing = !crowdInstancing;
+			if (crowdInstancing)
+				printf("crowd: instanced\n");
+			else
+				printf("crowd: one draw per head, recorded on %u threads\n", jobThreadCount());
+			break;
+		case GLFW_KEY_O: // toggle the depth test of the box and lasso selections
+			selectionOcclusion = !selectionOcclusion;
+			printf("selection: %s\n", selectionOcclusion ? "visible vertices only" : "through the mesh");
+			break;
+		case GLFW_KEY_X: // clear the selection
+			showSelection = false;
+			enqueueRenderCommand([]() {
+				clearSelection(selectedVertices);
+				uploadSelection(selectionTexture, selectedVertices);
+			});
+			break;
+		case GLFW_KEY_H: // toggle the labels of the crowd
+			showLabels = !showLabels;
+			break;
+		case GLFW_KEY_P: // start recording a trace, or write it
+			// Frames are drawn all the time while recording, else the trace would be mostly empty.
+			// The capture belongs to the render thread, which draws the frames.
+			if (profileRecording) {
+				enqueueRenderCommand([]() { writeProfileTrace(ProfileTracePath); });
+				releaseContinuousFrames();
+			}
+			else {
+				enqueueRenderCommand([]() { startProfileCapture(); });
+				acquireContinuousFrames();
+				printf("Recording a profile, press P again to write %s\n", ProfileTracePath);
+			}
+			profileRecording = !profileRecording;
+			break;
 		case GLFW_KEY_LEFT:
 			horizAngle -= cameraSpeed;
 			break;
@@ -1035,6 +2125,7 @@ static void keyCallback(GLFWwindow* window, int key, int scancode, int
 		default:
 			break;
 		}
+		// Also asks for a new frame : all the keys change something on the screen
 		updateCamera();
 	}
 }
@@ -1043,38 +2134,372 @@ static void mouseCallback(GLFWwindow* window, int button, int action, int
 	mods) {
 	if (button == GLFW_MOUSE_BUTTON_LEFT && action ==
 		GLFW_PRESS) {
-		pickObject();
+		// Events are handled on the main thread, where the cursor and the camera are current
+		double xpos, ypos;
+		glfwGetCursorPos(window, &xpos, &ypos);
+		if (mods & (GLFW_MOD_SHIFT | GLFW_MOD_CONTROL)) {
+			// Selections are made on the face alone : the crowd only shares its mesh
+			if (CrowdSizes[crowdSizeIndex] > 0 || showTexture) {
+				printf("selection: only on the untextured face, without the crowd\n");
+				return;
+			}
+			selectionDragging = true;
+			selectionDrag.lasso = (mods & GLFW_MOD_CONTROL) != 0;
+			selectionDrag.mode = (mods & GLFW_MOD_ALT) ? SELECT_REMOVE : SELECT_REPLACE;
+			selectionDrag.occlusion = selectionOcclusion;
+			selectionDrag.points.assign(1, glm::vec2(xpos, ypos));
+			return;
+		}
+		if (gpuPicking) {
+			// OpenGL has (0, 0) at the bottom, the cursor at the top
+			int x = int(xpos), y = window_height - 1 - int(ypos);
+			enqueueRenderCommand([x, y]() { requestGPUPick(x, y); });
+			// The ID pass goes with the next frame
+			requestRedraw();
+			return;
+		}
+		double start = appTime();
+		PickResult pick;
+		bool hit = rayPick(xpos, ypos, pick);
+		double elapsed = (appTime() - start) * 1e6;
+		if (!hit) {
+			gPickedIndex = -1;
+			gMessage = "background";
+			printf("Picked the background (%.1f us)\n", elapsed);
+			return;
+		}
+		gPickedIndex = pick.object;
+		std::ostringstream oss;
+		oss << "object " << pick.object;
+		if (pick.instance >= 0) {
+			oss << ", head " << pick.instance;
+		}
+		oss << ", triangle " << pick.hit.triangle << ", vertex " << pick.hit.vertex;
+		gMessage = oss.str();
+		printf("Picked %s, barycentrics (%.3f, %.3f, %.3f), at %.3f (%.1f us)\n", gMessage.c_str(),
+			pick.hit.barycentrics.x, pick.hit.barycentrics.y, pick.hit.barycentrics.z, pick.hit.distance, elapsed);
+	}
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE && selectionDragging) {
+		selectionDragging = false;
+		double xpos, ypos;
+		glfwGetCursorPos(window, &xpos, &ypos);
+		if (selectionDrag.lasso) {
+			selectionDrag.points.push_back(glm::vec2(xpos, ypos));
+		}
+		else {
+			selectionDrag.points.resize(1);
+			selectionDrag.points.push_back(glm::vec2(xpos, ypos));
+		}
+		showSelection = true;
+		SelectionRequest request = selectionDrag;
+		enqueueRenderCommand([request]() { requestSelection(request); });
+		requestRedraw();
+	}
+}
+// The lasso follows the cursor while the button is down
+static void cursorCallback(GLFWwindow*, double xpos, double ypos) {
+	if (!selectionDragging || !selectionDrag.lasso) {
+		return;
+	}
+	// A point every few pixels is enough
+	glm::vec2 point(xpos, ypos);
+	if (glm::length(point - selectionDrag.points.back()) >= 3.0f) {
+		selectionDrag.points.push_back(point);
+	}
+}
+// The window was uncovered or resized : its content must be drawn again
+static void windowRefreshCallback(GLFWwindow*) {
+	requestRedraw();
+}
+// Frame time of the crowd, drawn either one glDrawElements per head or with a single
+// glDrawElementsInstanced, for an increasing number of heads.
+// Run with --bench-instancing. VSync is disabled so that the numbers are not capped.
+void runInstancingBenchmark(void) {
+	const int warmupFrames = 10;
+	const int measuredFrames = 100;
+	if (!headless) {
+		glfwSwapInterval(0);
+	}
+	// setupProgram takes the camera from a snapshot
+	SceneSnapshot camera;
+	drawnSnapshot = &camera;
+	printf("%10s %20s %20s\n", "instances", "ms/frame (loop)", "ms/frame (instanced)");
+	for (int count = 1; count <= MaxCrowdSize; count *= 4) {
+		buildInstanceGrid(crowdInstances, count, CrowdSpacing);
+		uploadInstances(InstanceBufferId[0], MaxCrowdSize, crowdInstances);
+		// Back off far enough to see the whole grid
+		float extent = CrowdSpacing * ceil(sqrt((float)count));
+		radius = 20.0f + extent;
+		gProjectionMatrix = glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, radius * 3.0f);
+		updateCamera();
+		snapshotCamera(camera);
+		double msPerFrame[2];
+		for (int instanced = 0; instanced < 2; instanced++) {
+			double start = 0.0;
+			for (int frame = 0; frame < warmupFrames + measuredFrames; frame++) {
+				if (frame == warmupFrames) {
+					glFinish();
+					start = appTime();
+				}
+				glClearColor(0.0f, 0.0f, 0.2f, 0.0f);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				if (instanced) {
+					GLuint program = standardProgram(DRAW_USE_LIGHTING, true);
+					glsUseProgram(program);
+					setupProgram(program);
+					glsBindVertexArray(CrowdVertexArrayId[0]);
+					glDrawElementsInstanced(GL_TRIANGLES, NumIdcs[faceObjectID], GL_UNSIGNED_SHORT, 0, count);
+				}
+				else {
+					const ShaderVariant& variant = getShaderVariant(standardShaders, SHADER_LIGHTING);
+					glsUseProgram(variant.program);
+					setupProgram(variant.program);
+					glsBindVertexArray(VertexArrayId[faceObjectID]);
+					for (int i = 0; i < count; i++) {
+						setShaderModelMatrix(variant, crowdInstances[i].ModelMatrix);
+						glDrawElements(GL_TRIANGLES, NumIdcs[faceObjectID], GL_UNSIGNED_SHORT, 0);
+					}
+				}
+				glsBindVertexArray(0);
+				glsUseProgram(0);
+				if (!headless) {
+					glfwSwapBuffers(window);
+					glfwPollEvents();
+				}
+			}
+			glFinish();
+			msPerFrame[instanced] = 1000.0 * (appTime() - start) / measuredFrames;
+		}
+		printf("%10d %20.3f %20.3f\n", count, msPerFrame[0], msPerFrame[1]);
+	}
+}
+// Seconds since an arbitrary origin. Same clock as the profiler : works without GLFW.
+double appTime(void) {
+	return profilerNow() * 1e-9;
+}
+// Headless benchmark : an orbit of the camera around the head in `frames` frames, after
+// `subdivisions` levels of subdivision, reported as JSON (to `reportPath`, or stdout).
+// Each frame ends with glFinish, which stands in for the swap.
+// With a `screenshotPath`, one more frame is drawn from the starting point of the orbit, and saved as a BMP.
+void runHeadlessBenchmark(int frames, int subdivisions, const char* reportPath, const char* screenshotPath) {
+	const int warmupFrames = 10;
+	if (frames < 1) {
+		frames = 1;
+	}
+	double subdivideStart = appTime();
+	int applied = 0;
+	for (; applied < subdivisions; applied++) {
+		// Each level adds one vertex per edge : stop before the 16-bit indices overflow
+		if (vertices.size() + faces.size() * 3 / 2 > 65535) {
+			fprintf(stderr, "Stopped after %d subdivisions, the next one needs 32-bit indices\n", applied);
+			break;
+		}
+		subdivideFace();
+	}
+	double subdivideTime = appTime() - subdivideStart;
+	updateCrowd();
+	// Back off far enough to see the whole crowd
+	int crowdSize = CrowdSizes[crowdSizeIndex];
+	radius = 20.0f + CrowdSpacing * ceil(sqrt((float)crowdSize));
+	gProjectionMatrix = glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, radius * 3.0f);
+	float startAngle = horizAngle;
+	double trianglesDrawn = 0.0;
+	double start = 0.0;
+	for (int frame = 0; frame < warmupFrames + frames; frame++) {
+		if (frame == warmupFrames) {
+			trianglesDrawn = 0.0;
+			start = appTime();
+		}
+		horizAngle = startAngle + 2.0f * 3.14159265f * float(frame % frames) / float(frames);
+		updateCamera();
+		renderScene();
+		glFinish();
+		trianglesDrawn += lodStats.triangles;
+	}
+	double elapsed = appTime() - start;
+	ProfileSummary profile = getProfileSummary(frames);
+	printProfileSummary(profile);
+	if (screenshotPath != NULL) {
+		horizAngle = startAngle;
+		updateCamera();
+		// The HUD shows timings, which change from one run to the next
+		hudEnabled = false;
+		renderScene();
+		WriteScreenshot(screenshotPath, window_width, window_height);
+		printf("Wrote %s\n", screenshotPath);
+	}
+
+	FILE* report = reportPath != NULL ? fopen(reportPath, "w") : stdout;
+	if (report == NULL) {
+		fprintf(stderr, "Can't write %s\n", reportPath);
+		return;
+	}
+	fprintf(report, "{\n");
+	fprintf(report, "  \"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+	fprintf(report, "  \"width\": %d, \"height\": %d,\n", window_width, window_height);
+	fprintf(report, "  \"frames\": %d,\n", frames);
+	fprintf(report, "  \"subdivisions\": %d,\n", applied);
+	fprintf(report, "  \"crowd\": %d,\n", crowdSize);
+	fprintf(report, "  \"instancing\": %s,\n", crowdInstancing ? "true" : "false");
+	fprintf(report, "  \"threads\": %u,\n", jobThreadCount());
+	fprintf(report, "  \"load_ms\": %.3f,\n", loadTime * 1000.0);
+	fprintf(report, "  \"subdivide_ms\": %.3f,\n", subdivideTime * 1000.0);
+	fprintf(report, "  \"peak_memory_kb\": %llu,\n", getPeakMemoryKB());
+	const char* names[3] = { "frame_ms", "cpu_ms", "gpu_ms" };
+	const ProfilePercentiles* times[3] = { &profile.frame, &profile.cpu, &profile.gpu };
+	for (int i = 0; i < 3; i++) {
+		fprintf(report, "  \"%s\": { \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n", names[i],
+			times[i]->p50, times[i]->p95, times[i]->p99, times[i]->max);
+	}
+	fprintf(report, "  \"triangles_per_frame\": %.0f,\n", trianglesDrawn / frames);
+	fprintf(report, "  \"triangles_per_second\": %.0f\n", elapsed > 0.0 ? trianglesDrawn / elapsed : 0.0);
+	fprintf(report, "}\n");
+	if (report != stdout) {
+		fclose(report);
+		printf("Wrote %s\n", reportPath);
 	}
 }
-int main(void) {
+int main(int argc, char* argv[]) {
 	// TL
 	// ATTN: Refer to https://learnopengl.com/Getting-started/Transformations, https://learnopengl.com/Getting-started/Coordinate-Systems,
 	// and https://learnopengl.com/Getting-started/Camera to familiarize yourself with implementing the camera movement
 	// ATTN (Project 3 only): Refer to https://learnopengl.com/Gettingstarted/ Textures to familiarize yourself with mapping a texture
 	// to a given mesh
+	double startTime = appTime();
+	bool benchInstancing = false;
+	int benchFrames = 300;
+	int benchSubdivisions = 0;
+	const char* reportPath = NULL;
+	const char* screenshotPath = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench-instancing") == 0) {
+			benchInstancing = true;
+		}
+		else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		}
+		else if (strcmp(argv[i], "--continuous") == 0) {
+			continuousRendering = true;
+		}
+		else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+			textureBudget = (size_t)atoi(argv[++i]) * 1024 * 1024;
+		}
+		else if (strcmp(argv[i], "--decode-threads") == 0 && i + 1 < argc) {
+			decodeThreads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc) {
+			uploadBudget = (size_t)atoi(argv[++i]) * 1024 * 1024;
+		}
+		else if (strcmp(argv[i], "--no-compressed-textures") == 0) {
+			compressedTextures = false;
+		}
+		else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc) {
+			mipFilter = strcmp(argv[++i], "kaiser") == 0 ? MIP_KAISER : MIP_BOX;
+		}
+		else if (strcmp(argv[i], "--no-mip-cache") == 0) {
+			mipCache = false;
+		}
+		else if (strcmp(argv[i], "--stream-textures") == 0) {
+			streamTextures = true;
+		}
+		else if (strcmp(argv[i], "--robot-arm") == 0) {
+			showRobotArm = true;
+		}
+		else if (strcmp(argv[i], "--single-thread") == 0) {
+			singleThread = true;
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			jobWorkers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--gpu-picking") == 0) {
+			gpuPicking = true;
+		}
+		else if (strcmp(argv[i], "--no-instancing") == 0) {
+			crowdInstancing = false;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			benchFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--subdivisions") == 0 && i + 1 < argc) {
+			benchSubdivisions = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--crowd") == 0 && i + 1 < argc) {
+			// One of the sizes C cycles through
+			int size = atoi(argv[++i]);
+			for (int c = 0; c < int(sizeof(CrowdSizes) / sizeof(CrowdSizes[0])); c++) {
+				if (CrowdSizes[c] <= size) {
+					crowdSizeIndex = c;
+				}
+			}
+		}
+		else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+			reportPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc) {
+			screenshotPath = argv[++i];
+		}
+		// Start in the same mode as after pressing T or F
+		else if (strcmp(argv[i], "--texture") == 0) {
+			showTexture = true;
+		}
+		else if (strcmp(argv[i], "--wireframe") == 0) {
+			isWireframe = true;
+		}
+	}
+	if (jobWorkers < 0) {
+		unsigned int cores = std::thread::hardware_concurrency();
+		jobWorkers = cores > 1 ? cores - 1 : 0;
+	}
+	initJobs(jobWorkers);
 	// Initialize window
 	int errorCode = initWindow();
 	if (errorCode != 0)
 		return errorCode;
 	// Initialize OpenGL pipeline
 	initOpenGL();
-	// For speed computation
-	double lastTime = glfwGetTime();
-	int nbFrames = 0;
+	if (benchInstancing) {
+		runInstancingBenchmark();
+		cleanup();
+		return 0;
+	}
+	if (headless) {
+		// The textures too are part of the load time, and of every frame measured
+		finishTextureLoads();
+		loadTime = appTime() - startTime;
+		runHeadlessBenchmark(benchFrames, benchSubdivisions, reportPath, screenshotPath);
+		cleanup();
+		return 0;
+	}
+	// Frames are only drawn when something changed, unless --continuous
+	initRedraw(!continuousRendering);
+	// The render thread takes the context over. The main thread keeps the events and the scene :
+	// it builds the next frame while the render thread submits the previous one.
+	if (!singleThread) {
+		startRenderThread(window);
+	}
 	do {
-		// Measure speed
-		double currentTime = glfwGetTime();
-		nbFrames++;
-		if (currentTime - lastTime >= 1.0) { // If last prinf() was more than 1sec ago
-			printf("%f ms/frame\n", 1000.0 / double(nbFrames));
-			nbFrames = 0;
-			lastTime += 1.0;
+		// Sleeps while there is nothing new to draw
+		bool redraw = waitForRedraw();
+		applyGPUPick();
+		if (!redraw) {
+			continue;
+		}
+		// Only waits when the render thread is two frames behind
+		unsigned int slot = acquireSnapshot();
+		SceneSnapshot* snapshot = &sceneSnapshots[slot];
+		{
+			PROFILE_SCOPE("buildSnapshot");
+			buildSnapshot(*snapshot);
 		}
 		// DRAWING POINTS
-		renderScene();
+		submitSnapshot(slot, [snapshot]() { renderFrame(*snapshot); });
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
 		glfwWindowShouldClose(window) == 0);
+	// Back to the main thread, for the cleanup
+	stopRenderThread();
+	// Whole run, or at least its last frames
+	printProfileSummary(getProfileSummary(~0u));
 	cleanup();
 	return 0;
 }
\ No newline at end of file
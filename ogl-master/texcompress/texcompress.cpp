@@ -0,0 +1,272 @@
+// texcompress : block compresses an image into a DDS file with its whole mip chain, which loadDDS and
+// the texture manager upload as it is, without decoding anything.
+//
+//	texcompress [--format bc1|bc3|bc7] [--quality fast|normal|best] [--mip-filter box|kaiser] [--linear]
+//		[--alpha-cutoff A] [--top-down] [--jobs N] image output.dds
+//
+// Without --format : BC1 for opaque images, BC3 when some texels aren't. BC7 keeps more detail than BC1
+// in twice the space, and needs OpenGL 4.2 (or ARB_texture_compression_bptc) to be drawn.
+// The rows are written bottom first, as stb_image gives them to the texture manager (flipped), so that
+// the DDS replaces the image without touching the UVs. --top-down keeps the file's order, for the
+// tutorials which flip V themselves.
+// The mip levels are Kaiser filtered in linear light unless asked otherwise (--linear for normal maps and
+// other data). --alpha-cutoff keeps the coverage of alpha tested textures in the small levels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <math.h>
+
+#include <common/jobs.hpp>
+#include <common/mipmap.hpp>
+#include <common/blockcompress.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <common/stb_image.hpp>
+
+#define DDS_FOURCC(a, b, c, d) ((unsigned int)(a) | ((unsigned int)(b) << 8) | ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+// DXGI_FORMAT_BC7_UNORM, in the DX10 header
+const unsigned int DXGIFormatBC7 = 98;
+
+struct MipLevel {
+	std::vector<unsigned char> rgba;
+	int width, height;
+};
+
+static double seconds(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Each level filtered from the one before, down to 1x1, rows of each level on every thread
+static void buildMipChain(std::vector<MipLevel> & levels, const MipSettings & settings){
+	bool alphaTested = settings.alphaCutoff > 0.0f;
+	float coverage = alphaTested ? alphaCoverage(&levels[0].rgba[0], levels[0].width, levels[0].height, 4, settings.alphaCutoff) : 0.0f;
+	while (levels.back().width > 1 || levels.back().height > 1){
+		MipLevel level;
+		level.width = levels.back().width > 1 ? levels.back().width / 2 : 1;
+		level.height = levels.back().height > 1 ? levels.back().height / 2 : 1;
+		level.rgba.resize((size_t)level.width * level.height * 4);
+		const MipLevel & source = levels.back();
+		parallelFor(level.height, 16, [&](unsigned int begin, unsigned int end, unsigned int){
+			downsampleRows(&source.rgba[0], source.width, source.height, 4, &level.rgba[0], level.width, level.height,
+				settings, begin, end);
+		});
+		if (alphaTested)
+			keepAlphaCoverage(&level.rgba[0], level.width, level.height, 4, settings.alphaCutoff, coverage);
+		levels.push_back(level);
+	}
+}
+
+// Peak signal to noise ratio of a compressed level against its source, over RGB (and alpha unless BC1)
+static double measurePSNR(BlockFormat format, const MipLevel & level, const std::vector<unsigned char> & blocks){
+	int blocksWide = (level.width + 3) / 4, blocksHigh = (level.height + 3) / 4;
+	int channels = format == BLOCK_BC1 ? 3 : 4;
+	double squared = 0.0;
+	size_t samples = 0;
+	unsigned char texels[64];
+	for (int row = 0; row < blocksHigh; row++){
+		for (int column = 0; column < blocksWide; column++){
+			decompressBlock(format, &blocks[((size_t)row * blocksWide + column) * blockBytes(format)], texels);
+			for (int y = 0; y < 4 && row * 4 + y < level.height; y++){
+				for (int x = 0; x < 4 && column * 4 + x < level.width; x++){
+					const unsigned char * source = &level.rgba[((size_t)(row * 4 + y) * level.width + column * 4 + x) * 4];
+					for (int c = 0; c < channels; c++){
+						double d = (double)texels[(y * 4 + x) * 4 + c] - source[c];
+						squared += d * d;
+					}
+					samples += channels;
+				}
+			}
+		}
+	}
+	if (squared == 0.0)
+		return 99.0;
+	return 10.0 * log10(255.0 * 255.0 * samples / squared);
+}
+
+static void putUint(unsigned char * out, size_t offset, unsigned int value){
+	out[offset + 0] = value & 0xff;
+	out[offset + 1] = (value >> 8) & 0xff;
+	out[offset + 2] = (value >> 16) & 0xff;
+	out[offset + 3] = (value >> 24) & 0xff;
+}
+
+static bool writeDDS(const char * path, BlockFormat format, int width, int height,
+	const std::vector<std::vector<unsigned char> > & levels){
+	// "DDS ", the 124 bytes of DDS_HEADER, and DDS_HEADER_DXT10 for BC7
+	unsigned char header[4 + 124 + 20];
+	memset(header, 0, sizeof(header));
+	memcpy(header, "DDS ", 4);
+	unsigned char * surface = header + 4;
+	putUint(surface, 0, 124);
+	// CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT | LINEARSIZE
+	putUint(surface, 4, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);
+	putUint(surface, 8, height);
+	putUint(surface, 12, width);
+	putUint(surface, 16, (unsigned int)levels[0].size());
+	putUint(surface, 24, (unsigned int)levels.size());
+	// DDS_PIXELFORMAT : its size, DDPF_FOURCC and the FourCC
+	putUint(surface, 72, 32);
+	putUint(surface, 76, 0x4);
+	unsigned int fourCC = DDS_FOURCC('D', 'X', 'T', '1');
+	if (format == BLOCK_BC3)
+		fourCC = DDS_FOURCC('D', 'X', 'T', '5');
+	else if (format == BLOCK_BC7)
+		fourCC = DDS_FOURCC('D', 'X', '1', '0');
+	putUint(surface, 80, fourCC);
+	// TEXTURE | COMPLEX | MIPMAP
+	putUint(surface, 104, 0x1000 | 0x8 | 0x400000);
+	size_t headerSize = 4 + 124;
+	if (format == BLOCK_BC7){
+		unsigned char * dx10 = header + headerSize;
+		putUint(dx10, 0, DXGIFormatBC7);
+		putUint(dx10, 4, 3);   // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+		putUint(dx10, 12, 1);  // array size
+		headerSize += 20;
+	}
+	FILE * file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+	bool written = fwrite(header, 1, headerSize, file) == headerSize;
+	for (size_t i = 0; i < levels.size() && written; i++)
+		written = fwrite(&levels[i][0], 1, levels[i].size(), file) == levels[i].size();
+	fclose(file);
+	return written;
+}
+
+static void usage(){
+	fprintf(stderr, "Usage : texcompress [--format bc1|bc3|bc7] [--quality fast|normal|best] [--mip-filter box|kaiser] [--linear]\n"
+		"	[--alpha-cutoff A] [--top-down] [--jobs N] image output.dds\n");
+}
+
+int main(int argc, char ** argv){
+	const char * inputPath = NULL;
+	const char * outputPath = NULL;
+	int format = -1;
+	BlockQuality quality = BLOCK_NORMAL;
+	MipSettings mipSettings = { MIP_KAISER, true, 0.0f };
+	bool topDown = false;
+	int jobWorkers = -1;
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--format") == 0 && i + 1 < argc){
+			i++;
+			if (strcmp(argv[i], "bc1") == 0)
+				format = BLOCK_BC1;
+			else if (strcmp(argv[i], "bc3") == 0)
+				format = BLOCK_BC3;
+			else if (strcmp(argv[i], "bc7") == 0)
+				format = BLOCK_BC7;
+			else {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--quality") == 0 && i + 1 < argc){
+			i++;
+			if (strcmp(argv[i], "fast") == 0)
+				quality = BLOCK_FAST;
+			else if (strcmp(argv[i], "normal") == 0)
+				quality = BLOCK_NORMAL;
+			else if (strcmp(argv[i], "best") == 0)
+				quality = BLOCK_BEST;
+			else {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc){
+			i++;
+			if (strcmp(argv[i], "box") == 0)
+				mipSettings.filter = MIP_BOX;
+			else if (strcmp(argv[i], "kaiser") == 0)
+				mipSettings.filter = MIP_KAISER;
+			else {
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--linear") == 0)
+			mipSettings.srgb = false;
+		else if (strcmp(argv[i], "--alpha-cutoff") == 0 && i + 1 < argc)
+			mipSettings.alphaCutoff = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--top-down") == 0)
+			topDown = true;
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+			jobWorkers = atoi(argv[++i]);
+		else if (inputPath == NULL)
+			inputPath = argv[i];
+		else if (outputPath == NULL)
+			outputPath = argv[i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (inputPath == NULL || outputPath == NULL){
+		usage();
+		return 1;
+	}
+
+	double start = seconds();
+	std::vector<MipLevel> levels(1);
+	int channels;
+	stbi_set_flip_vertically_on_load(!topDown);
+	unsigned char * pixels = stbi_load(inputPath, &levels[0].width, &levels[0].height, &channels, 4);
+	if (pixels == NULL){
+		fprintf(stderr, "%s : %s\n", inputPath, stbi_failure_reason());
+		return 1;
+	}
+	levels[0].rgba.assign(pixels, pixels + (size_t)levels[0].width * levels[0].height * 4);
+	stbi_image_free(pixels);
+	bool opaque = true;
+	for (size_t i = 3; i < levels[0].rgba.size() && opaque; i += 4)
+		opaque = levels[0].rgba[i] == 255;
+	if (format < 0)
+		format = opaque ? BLOCK_BC1 : BLOCK_BC3;
+	else if (format == BLOCK_BC1 && !opaque)
+		fprintf(stderr, "%s has transparent texels : BC1 keeps the colors only\n", inputPath);
+	if (jobWorkers < 0){
+		unsigned int cores = std::thread::hardware_concurrency();
+		jobWorkers = cores > 1 ? cores - 1 : 0;
+	}
+	initJobs(jobWorkers);
+	buildMipChain(levels, mipSettings);
+	double loaded = seconds();
+
+	static const char * FormatNames[] = { "BC1", "BC3", "BC7" };
+	static const char * QualityNames[] = { "fast", "normal", "best" };
+	printf("%s : %dx%d, %zu levels, %s %s, %u threads\n", inputPath, levels[0].width, levels[0].height, levels.size(),
+		FormatNames[format], QualityNames[quality], jobThreadCount());
+	std::vector<std::vector<unsigned char> > blocks(levels.size());
+	size_t uncompressedBytes = 0, compressedBytes = 0;
+	for (size_t i = 0; i < levels.size(); i++){
+		const MipLevel & level = levels[i];
+		blocks[i].resize(compressedSize((BlockFormat)format, level.width, level.height));
+		int blockRows = (level.height + 3) / 4;
+		unsigned char * out = &blocks[i][0];
+		parallelFor(blockRows, 4, [&](unsigned int begin, unsigned int end, unsigned int){
+			compressBlockRows((BlockFormat)format, quality, &level.rgba[0], level.width, level.height, begin, end, out);
+		});
+		// RGB textures take 4 bytes per texel on the GPU too
+		uncompressedBytes += (size_t)level.width * level.height * 4;
+		compressedBytes += blocks[i].size();
+	}
+	double compressed = seconds();
+	double psnr = measurePSNR((BlockFormat)format, levels[0], blocks[0]);
+	if (!writeDDS(outputPath, (BlockFormat)format, levels[0].width, levels[0].height, blocks)){
+		fprintf(stderr, "%s could not be written\n", outputPath);
+		cleanupJobs();
+		return 1;
+	}
+	printf("%s : %.1f MB -> %.1f MB on the GPU (%.1fx), level 0 PSNR %.2f dB\n", outputPath,
+		uncompressedBytes / (1024.0 * 1024.0), compressedBytes / (1024.0 * 1024.0),
+		(double)uncompressedBytes / compressedBytes, psnr);
+	printf("load and mipmaps %.0f ms, compression %.0f ms (%.1f Mtexels/s)\n", (loaded - start) * 1000.0,
+		(compressed - loaded) * 1000.0, uncompressedBytes / 4 / (compressed - loaded) / 1e6);
+	cleanupJobs();
+	return 0;
+}